@@ -28,6 +28,11 @@
 #include "bus-message.h"
 #include "bus-xml-policy.h"
 #include "sd-login.h"
+#include "siphash24.h"
+
+/* The policy is immutable once loaded, hence verdicts may be cached
+ * until it is reloaded. Flushed entirely when full. */
+#define POLICY_CACHE_MAX 4096U
 
 static void policy_item_free(PolicyItem *i) {
         assert(i);
@@ -758,36 +763,184 @@ static int check_policy_items(PolicyItem *items, const struct policy_check_filte
         return verdict;
 }
 
-static int policy_check(Policy *p, const struct policy_check_filter *filter) {
+struct policy_verdicts {
+        int verdict;
+        int on_console;
+        int no_console;
+        int mandatory;
+};
 
-        PolicyItem *items;
-        int verdict, v;
+struct PolicyCache {
+        pthread_mutex_t lock;
+        Hashmap *entries;
+};
+
+typedef struct PolicyCacheEntry {
+        struct policy_check_filter filter;
+        struct policy_verdicts verdicts;
+} PolicyCacheEntry;
+
+static unsigned long policy_check_filter_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        const struct policy_check_filter *f = p;
+        uint8_t hash_key2[HASH_KEY_SIZE];
+        const char *s[4];
+        unsigned long h;
+        uint64_t u;
+        unsigned i;
+        struct {
+                uint32_t class;
+                uint32_t uid;
+                uint32_t gid;
+                int32_t message_type;
+        } ids = {
+                .class = f->class,
+                .uid = f->uid,
+                .gid = f->gid,
+                .message_type = f->message_type,
+        };
+
+        siphash24((uint8_t*) &u, &ids, sizeof(ids), hash_key);
+        h = (unsigned long) u;
+
+        s[0] = f->name;
+        s[1] = f->interface;
+        s[2] = f->path;
+        s[3] = f->member;
+
+        memcpy(hash_key2, hash_key, HASH_KEY_SIZE);
+        for (i = 0; i < ELEMENTSOF(s); i++) {
+                hash_key2[0]++;
+                if (s[i])
+                        h ^= string_hash_func(s[i], hash_key2);
+        }
+
+        return h;
+}
+
+static int compare_strings(const char *a, const char *b) {
+        if (a && b)
+                return strcmp(a, b);
+
+        return a ? 1 : (b ? -1 : 0);
+}
+
+static int policy_check_filter_compare_func(const void *a, const void *b) {
+        const struct policy_check_filter *x = a, *y = b;
+        int r;
+
+        if (x->class != y->class)
+                return x->class < y->class ? -1 : 1;
+        if (x->uid != y->uid)
+                return x->uid < y->uid ? -1 : 1;
+        if (x->gid != y->gid)
+                return x->gid < y->gid ? -1 : 1;
+        if (x->message_type != y->message_type)
+                return x->message_type < y->message_type ? -1 : 1;
+
+        r = compare_strings(x->name, y->name);
+        if (r != 0)
+                return r;
+
+        r = compare_strings(x->interface, y->interface);
+        if (r != 0)
+                return r;
+
+        r = compare_strings(x->path, y->path);
+        if (r != 0)
+                return r;
+
+        return compare_strings(x->member, y->member);
+}
+
+static const struct hash_ops policy_check_filter_hash_ops = {
+        .hash = policy_check_filter_hash_func,
+        .compare = policy_check_filter_compare_func
+};
+
+static char *append_string(char *p, const char **dst, const char *src) {
+        if (!src) {
+                *dst = NULL;
+                return p;
+        }
+
+        *dst = p;
+        return stpcpy(p, src) + 1;
+}
+
+static PolicyCacheEntry *policy_cache_entry_new(const struct policy_check_filter *filter, const struct policy_verdicts *verdicts) {
+        PolicyCacheEntry *e;
+        char *p;
 
-        assert(p);
         assert(filter);
+        assert(verdicts);
+
+        /* The strings of the filter are stored right after the entry */
+        e = malloc(sizeof(PolicyCacheEntry) +
+                   (filter->name ? strlen(filter->name) + 1 : 0) +
+                   (filter->interface ? strlen(filter->interface) + 1 : 0) +
+                   (filter->path ? strlen(filter->path) + 1 : 0) +
+                   (filter->member ? strlen(filter->member) + 1 : 0));
+        if (!e)
+                return NULL;
 
-        assert(IN_SET(filter->class, POLICY_ITEM_SEND, POLICY_ITEM_RECV, POLICY_ITEM_OWN, POLICY_ITEM_USER, POLICY_ITEM_GROUP));
+        e->filter = *filter;
+        e->verdicts = *verdicts;
 
-        /*
-         * The policy check is implemented by the following logic:
-         *
-         *  1. Check default items
-         *  2. Check group items
-         *  3. Check user items
-         *  4. Check on/no_console items
-         *  5. Check mandatory items
-         *
-         *  Later rules override earlier rules.
-         */
+        p = (char*) (e + 1);
+        p = append_string(p, &e->filter.name, filter->name);
+        p = append_string(p, &e->filter.interface, filter->interface);
+        p = append_string(p, &e->filter.path, filter->path);
+        append_string(p, &e->filter.member, filter->member);
+
+        return e;
+}
+
+static void policy_cache_free(PolicyCache *c) {
+        if (!c)
+                return;
+
+        hashmap_free_free(c->entries);
+        pthread_mutex_destroy(&c->lock);
+        free(c);
+}
+
+static int policy_cache_new(PolicyCache **ret) {
+        PolicyCache *c;
+        int r;
+
+        assert(ret);
+
+        c = new0(PolicyCache, 1);
+        if (!c)
+                return -ENOMEM;
+
+        r = pthread_mutex_init(&c->lock, NULL);
+        if (r != 0) {
+                free(c);
+                return -r;
+        }
+
+        *ret = c;
+        return 0;
+}
+
+static void policy_check_uncached(Policy *p, const struct policy_check_filter *filter, struct policy_verdicts *verdicts) {
+
+        PolicyItem *items;
+        int v;
+
+        assert(p);
+        assert(filter);
+        assert(verdicts);
 
-        verdict = check_policy_items(p->default_items, filter);
+        verdicts->verdict = check_policy_items(p->default_items, filter);
 
         if (filter->gid != GID_INVALID) {
                 items = hashmap_get(p->group_items, UINT32_TO_PTR(filter->gid));
                 if (items) {
                         v = check_policy_items(items, filter);
                         if (v != DUNNO)
-                                verdict = v;
+                                verdicts->verdict = v;
                 }
         }
 
@@ -796,20 +949,101 @@ static int policy_check(Policy *p, const struct policy_check_filter *filter) {
                 if (items) {
                         v = check_policy_items(items, filter);
                         if (v != DUNNO)
-                                verdict = v;
+                                verdicts->verdict = v;
                 }
         }
 
-        if (filter->uid != UID_INVALID && sd_uid_get_seats(filter->uid, -1, NULL) > 0)
-                v = check_policy_items(p->on_console_items, filter);
-        else
-                v = check_policy_items(p->no_console_items, filter);
-        if (v != DUNNO)
-                verdict = v;
+        /* Whether the user is on a console may change any time,
+         * hence evaluate both lists and pick one later */
+        verdicts->on_console = check_policy_items(p->on_console_items, filter);
+        verdicts->no_console = check_policy_items(p->no_console_items, filter);
+
+        verdicts->mandatory = check_policy_items(p->mandatory_items, filter);
+}
+
+static void policy_check_cached(Policy *p, const struct policy_check_filter *filter, struct policy_verdicts *verdicts) {
+        PolicyCacheEntry *e;
+
+        assert(p);
+        assert(filter);
+        assert(verdicts);
+
+        if (!p->cache) {
+                policy_check_uncached(p, filter, verdicts);
+                return;
+        }
+
+        pthread_mutex_lock(&p->cache->lock);
+
+        e = hashmap_get(p->cache->entries, filter);
+        if (e) {
+                *verdicts = e->verdicts;
+                pthread_mutex_unlock(&p->cache->lock);
+                return;
+        }
+
+        /* The policy itself is not modified while we hold a
+         * reference to it, hence evaluating it under the cache lock
+         * is only about keeping other threads from racing us. */
+        policy_check_uncached(p, filter, verdicts);
 
-        v = check_policy_items(p->mandatory_items, filter);
-        if (v != DUNNO)
-                verdict = v;
+        if (hashmap_size(p->cache->entries) >= POLICY_CACHE_MAX) {
+                hashmap_clear_free(p->cache->entries);
+                log_debug("Policy cache full, flushed.");
+        }
+
+        /* Failing to cache the verdict is not fatal, we just have
+         * to evaluate the policy again next time */
+        if (hashmap_ensure_allocated(&p->cache->entries, &policy_check_filter_hash_ops) >= 0) {
+                e = policy_cache_entry_new(filter, verdicts);
+                if (e && hashmap_put(p->cache->entries, &e->filter, e) < 0)
+                        free(e);
+        }
+
+        pthread_mutex_unlock(&p->cache->lock);
+}
+
+static int policy_check(Policy *p, const struct policy_check_filter *filter) {
+
+        struct policy_verdicts verdicts;
+        int verdict;
+
+        assert(p);
+        assert(filter);
+
+        assert(IN_SET(filter->class, POLICY_ITEM_SEND, POLICY_ITEM_RECV, POLICY_ITEM_OWN, POLICY_ITEM_USER, POLICY_ITEM_GROUP));
+
+        /*
+         * The policy check is implemented by the following logic:
+         *
+         *  1. Check default items
+         *  2. Check group items
+         *  3. Check user items
+         *  4. Check on/no_console items
+         *  5. Check mandatory items
+         *
+         *  Later rules override earlier rules.
+         */
+
+        policy_check_cached(p, filter, &verdicts);
+
+        if (verdicts.mandatory != DUNNO)
+                return verdicts.mandatory;
+
+        verdict = verdicts.verdict;
+
+        /* Only ask logind if it makes a difference */
+        if (verdicts.on_console != verdicts.no_console) {
+                int v;
+
+                if (filter->uid != UID_INVALID && sd_uid_get_seats(filter->uid, -1, NULL) > 0)
+                        v = verdicts.on_console;
+                else
+                        v = verdicts.no_console;
+                if (v != DUNNO)
+                        verdict = v;
+        } else if (verdicts.on_console != DUNNO)
+                verdict = verdicts.on_console;
 
         return verdict;
 }
@@ -1014,6 +1248,12 @@ int policy_load(Policy *p, char **files) {
 
         assert(p);
 
+        if (!p->cache) {
+                r = policy_cache_new(&p->cache);
+                if (r < 0)
+                        return log_oom();
+        }
+
         STRV_FOREACH(i, files) {
 
                 r = file_load(p, *i);
@@ -1081,6 +1321,9 @@ void policy_free(Policy *p) {
         hashmap_free(p->group_items);
 
         p->user_items = p->group_items = NULL;
+
+        policy_cache_free(p->cache);
+        p->cache = NULL;
 }
 
 static void dump_items(PolicyItem *items, const char *prefix) {
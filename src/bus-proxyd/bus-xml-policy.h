@@ -68,6 +68,8 @@ struct PolicyItem {
         LIST_FIELDS(PolicyItem, items);
 };
 
+typedef struct PolicyCache PolicyCache;
+
 typedef struct Policy {
         LIST_HEAD(PolicyItem, default_items);
         LIST_HEAD(PolicyItem, mandatory_items);
@@ -75,6 +77,9 @@ typedef struct Policy {
         LIST_HEAD(PolicyItem, no_console_items);
         Hashmap *user_items;
         Hashmap *group_items;
+
+        /* Verdicts of previous checks, shared by all threads */
+        PolicyCache *cache;
 } Policy;
 
 typedef struct SharedPolicy {
@@ -53,6 +53,11 @@
 #include "proxy.h"
 #include "synthesize.h"
 
+/* Stop reading from one side while the write queue it feeds is this
+ * long, so that a peer that does not keep up with reading cannot make
+ * us queue messages without bounds */
+#define PROXY_WQUEUE_MAX 64U
+
 static int proxy_create_destination(Proxy *p, const char *destination, const char *local_sec, bool negotiate_fds) {
         _cleanup_bus_close_unref_ sd_bus *b = NULL;
         int r;
@@ -328,6 +333,21 @@ int proxy_hello_policy(Proxy *p, uid_t original_uid) {
         return r;
 }
 
+static bool proxy_local_throttled(Proxy *p) {
+        assert(p);
+
+        /* Note that we keep reading from our client even if it
+         * doesn't read our replies, as it might only do so after
+         * having written all its requests */
+        return p->destination_bus->wqueue_size >= PROXY_WQUEUE_MAX;
+}
+
+static bool proxy_destination_throttled(Proxy *p) {
+        assert(p);
+
+        return p->local_bus->wqueue_size >= PROXY_WQUEUE_MAX;
+}
+
 static int proxy_wait(Proxy *p) {
         uint64_t timeout_destination, timeout_local, t;
         int events_destination, events_local, fd;
@@ -357,6 +377,19 @@ static int proxy_wait(Proxy *p) {
         if (r < 0)
                 return log_error_errno(r, "Failed to get timeout: %m");
 
+        /* While we don't read from a side, only wait for it to
+         * become writable. Its timeout is ignored too, since it is
+         * zero as long as there are unprocessed messages. */
+        if (p->got_hello && proxy_destination_throttled(p)) {
+                events_destination &= ~POLLIN;
+                timeout_destination = (uint64_t) -1;
+        }
+
+        if (proxy_local_throttled(p)) {
+                events_local &= ~POLLIN;
+                timeout_local = (uint64_t) -1;
+        }
+
         t = timeout_destination;
         if (t == (uint64_t) -1 || (timeout_local != (uint64_t) -1 && timeout_local < timeout_destination))
                 t = timeout_local;
@@ -824,8 +857,12 @@ int proxy_run(Proxy *p) {
                 bool busy = false;
 
                 if (p->got_hello) {
-                        /* Read messages from bus, to pass them on to our client */
-                        r = proxy_process_destination_to_local(p);
+                        /* Read messages from bus, to pass them on to our
+                         * client, unless it doesn't keep up with them. */
+                        if (proxy_destination_throttled(p))
+                                r = bus_dispatch_wqueue(p->destination_bus);
+                        else
+                                r = proxy_process_destination_to_local(p);
                         if (r == -ECONNRESET || r == -ENOTCONN)
                                 return 0;
                         if (r < 0)
@@ -835,7 +872,10 @@ int proxy_run(Proxy *p) {
                 }
 
                 /* Read messages from our client, to pass them on to the bus */
-                r = proxy_process_local_to_destination(p);
+                if (proxy_local_throttled(p))
+                        r = bus_dispatch_wqueue(p->local_bus);
+                else
+                        r = proxy_process_local_to_destination(p);
                 if (r == -ECONNRESET || r == -ENOTCONN)
                         return 0;
                 if (r < 0)
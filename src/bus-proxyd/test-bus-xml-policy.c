@@ -76,6 +76,7 @@ static int show_policy(const char *fn) {
 int main(int argc, char *argv[]) {
 
         Policy p = {};
+        unsigned i;
 
         printf("Showing session policy BEGIN\n");
         show_policy("/etc/dbus-1/session.conf");
@@ -176,6 +177,17 @@ int main(int argc, char *argv[]) {
         assert_se(policy_check_one_recv(&p, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.foo.FooService", "/an/object/path", "org.foo.FooBroadcastInterface2", "Member") == false);
         assert_se(policy_check_one_recv(&p, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.foo.FooService2", "/an/object/path", "org.foo.FooBroadcastInterface", "Member") == false);
 
+        /* Verdicts are cached, make sure more of them than fit into
+         * the cache are not mixed up */
+        for (i = 0; i < 5000; i++) {
+                char member[sizeof("Member") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(member, "Member%u", i);
+                assert_se(policy_check_one_send(&p, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.test.test1", "/an/object/path", "org.foo.FooBroadcastInterface", member) == true);
+                assert_se(policy_check_one_send(&p, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.test.test1", "/an/object/path", "org.foo.FooBroadcastInterface", member) == false);
+                assert_se(policy_check_one_send(&p, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.test.test1", "/an/object/path", "org.test.int2", member) == false);
+        }
+
         policy_free(&p);
 
         return EXIT_SUCCESS;
@@ -25,6 +25,7 @@
 #include "job.h"
 #include "dbus-job.h"
 #include "dbus.h"
+#include "bus-objects.h"
 
 static BUS_DEFINE_PROPERTY_GET_ENUM(property_get_type, job_type, JobType);
 static BUS_DEFINE_PROPERTY_GET_ENUM(property_get_state, job_state, JobState);
@@ -172,6 +173,10 @@ static int send_removed_signal(sd_bus *bus, void *userdata) {
         if (!p)
                 return -ENOMEM;
 
+        /* Let the job's last changes go out first, while it still
+         * exists */
+        bus_properties_changed_flush_path(bus, p);
+
         r = sd_bus_message_new_signal(
                         bus,
                         &m,
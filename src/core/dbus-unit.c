@@ -27,6 +27,7 @@
 #include "path-util.h"
 #include "fileio.h"
 #include "bus-common-errors.h"
+#include "bus-objects.h"
 #include "dbus.h"
 #include "dbus-manager.h"
 #include "dbus-unit.h"
@@ -768,9 +769,13 @@ static int send_removed_signal(sd_bus *bus, void *userdata) {
         assert(u);
 
         p = unit_dbus_path(u);
-        if (!u)
+        if (!p)
                 return -ENOMEM;
 
+        /* Let the unit's last changes go out first, while it still
+         * exists */
+        bus_properties_changed_flush_path(bus, p);
+
         r = sd_bus_message_new_signal(
                         bus,
                         &m,
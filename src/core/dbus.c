@@ -42,10 +42,17 @@
 #include "bus-common-errors.h"
 #include "strxcpyx.h"
 #include "bus-internal.h"
+#include "bus-objects.h"
+#include "bus-control.h"
 #include "selinux-access.h"
 
 #define CONNECTIONS_MAX 512
 
+/* How long to hold back PropertiesChanged signals of units and jobs,
+ * so that multiple state changes in quick succession, as they are
+ * common during boot, result in a single signal per object */
+#define PROPERTIES_CHANGED_LATENCY_USEC (10*USEC_PER_MSEC)
+
 static void destroy_bus(Manager *m, sd_bus **bus);
 
 int bus_send_queued_message(Manager *m) {
@@ -481,6 +488,13 @@ static int bus_job_enumerate(sd_bus *bus, const char *path, void *userdata, char
         Iterator i;
         Job *j;
 
+        /* Jobs have no children, hence only enumerate them when
+         * the job directory itself is introspected, not for each
+         * job below it, which would make introspecting all of them
+         * quadratic */
+        if (!streq(path, "/org/freedesktop/systemd1/job"))
+                return 0;
+
         l = new0(char*, hashmap_size(m->jobs)+1);
         if (!l)
                 return -ENOMEM;
@@ -508,6 +522,13 @@ static int bus_unit_enumerate(sd_bus *bus, const char *path, void *userdata, cha
         Iterator i;
         Unit *u;
 
+        /* Units have no children, hence only enumerate them when
+         * the unit directory itself is introspected, not for each
+         * unit below it, which would make introspecting all of them
+         * quadratic */
+        if (!streq(path, "/org/freedesktop/systemd1/unit"))
+                return 0;
+
         l = new0(char*, hashmap_size(m->units)+1);
         if (!l)
                 return -ENOMEM;
@@ -533,6 +554,10 @@ static int bus_setup_api_vtables(Manager *m, sd_bus *bus) {
         assert(m);
         assert(bus);
 
+        r = bus_set_properties_changed_latency(bus, PROPERTIES_CHANGED_LATENCY_USEC);
+        if (r < 0)
+                log_warning_errno(r, "Failed to enable coalescing of PropertiesChanged signals, ignoring: %m");
+
 #ifdef HAVE_SELINUX
         r = sd_bus_add_filter(bus, NULL, mac_selinux_filter, m);
         if (r < 0)
@@ -756,6 +781,12 @@ static int bus_setup_api(Manager *m, sd_bus *bus) {
         if (r < 0)
                 log_warning_errno(r, "Failed to enable credential passing, ignoring: %m");
 
+        /* We check the sender of most calls we get, hence remember
+         * what the bus driver tells us about our peers */
+        r = bus_creds_cache_enable(bus);
+        if (r < 0 && r != -EOPNOTSUPP)
+                log_warning_errno(r, "Failed to enable credentials cache, ignoring: %m");
+
         r = bus_setup_api_vtables(m, bus);
         if (r < 0)
                 return r;
@@ -227,19 +227,16 @@ static int have_ask_password(void) {
         }
 }
 
-static int manager_dispatch_ask_password_fd(sd_event_source *source,
-                                            int fd, uint32_t revents, void *userdata) {
+static int manager_dispatch_ask_password(sd_event_source *source,
+                                         const struct inotify_event *event, void *userdata) {
         Manager *m = userdata;
 
         assert(m);
 
-        flush_fd(fd);
-
-        m->have_ask_password = have_ask_password();
-        if (m->have_ask_password < 0)
-                /* Log error but continue. Negative have_ask_password
-                 * is treated as unknown status. */
-                log_error_errno(m->have_ask_password, "Failed to list /run/systemd/ask-password: %m");
+        /* Queries tend to come and go in bursts, hence don't rescan
+         * the directory for every event, but only once the status
+         * is needed next. */
+        m->have_ask_password = -EINVAL;
 
         return 0;
 }
@@ -247,7 +244,6 @@ static int manager_dispatch_ask_password_fd(sd_event_source *source,
 static void manager_close_ask_password(Manager *m) {
         assert(m);
 
-        m->ask_password_inotify_fd = safe_close(m->ask_password_inotify_fd);
         m->ask_password_event_source = sd_event_source_unref(m->ask_password_event_source);
         m->have_ask_password = -EINVAL;
 }
@@ -258,32 +254,26 @@ static int manager_check_ask_password(Manager *m) {
         assert(m);
 
         if (!m->ask_password_event_source) {
-                assert(m->ask_password_inotify_fd < 0);
-
                 mkdir_p_label("/run/systemd/ask-password", 0755);
 
-                m->ask_password_inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
-                if (m->ask_password_inotify_fd < 0)
-                        return log_error_errno(errno, "inotify_init1() failed: %m");
-
-                if (inotify_add_watch(m->ask_password_inotify_fd, "/run/systemd/ask-password", IN_CREATE|IN_DELETE|IN_MOVE) < 0) {
-                        log_error_errno(errno, "Failed to add watch on /run/systemd/ask-password: %m");
-                        manager_close_ask_password(m);
-                        return -errno;
-                }
-
-                r = sd_event_add_io(m->event, &m->ask_password_event_source,
-                                    m->ask_password_inotify_fd, EPOLLIN,
-                                    manager_dispatch_ask_password_fd, m);
+                r = sd_event_add_inotify(m->event, &m->ask_password_event_source,
+                                         "/run/systemd/ask-password", IN_CREATE|IN_DELETE|IN_MOVE,
+                                         manager_dispatch_ask_password, m);
                 if (r < 0) {
-                        log_error_errno(errno, "Failed to add event source for /run/systemd/ask-password: %m");
+                        log_error_errno(r, "Failed to add watch on /run/systemd/ask-password: %m");
                         manager_close_ask_password(m);
-                        return -errno;
+                        return r;
                 }
+        }
 
-                /* Queries might have been added meanwhile... */
-                manager_dispatch_ask_password_fd(m->ask_password_event_source,
-                                                 m->ask_password_inotify_fd, EPOLLIN, m);
+        /* Rescan if we never did or the directory changed since,
+         * queries might have been added meanwhile... */
+        if (m->have_ask_password == -EINVAL) {
+                m->have_ask_password = have_ask_password();
+                if (m->have_ask_password < 0)
+                        /* Log error but continue. Negative have_ask_password
+                         * is treated as unknown status. */
+                        log_error_errno(m->have_ask_password, "Failed to list /run/systemd/ask-password: %m");
         }
 
         return m->have_ask_password;
@@ -544,7 +534,6 @@ int manager_new(SystemdRunningAs running_as, bool test_run, Manager **_m) {
         m->pin_cgroupfs_fd = m->notify_fd = m->signal_fd = m->time_change_fd = m->dev_autofs_fd = m->private_listen_fd = m->kdbus_fd = m->utab_inotify_fd = -1;
         m->current_job_id = 1; /* start as id #1, so that we can leave #0 around as "null-like" value */
 
-        m->ask_password_inotify_fd = -1;
         m->have_ask_password = -EINVAL; /* we don't know */
 
         m->test_run = test_run;
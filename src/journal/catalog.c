@@ -63,6 +63,12 @@ typedef struct CatalogItem {
         le64_t offset;
 } CatalogItem;
 
+struct Catalog {
+        char *database;
+        struct stat st;
+        void *p;
+};
+
 static unsigned long catalog_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
         const CatalogItem *i = p;
         uint64_t u;
@@ -556,40 +562,106 @@ static const char *find_id(void *p, sd_id128_t id) {
                 le64toh(f->offset);
 }
 
-int catalog_get(const char* database, sd_id128_t id, char **_text) {
+int catalog_open(const char *database, Catalog **ret) {
+        Catalog *c;
+
+        assert(database);
+        assert(ret);
+
+        c = new0(Catalog, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->database = strdup(database);
+        if (!c->database) {
+                free(c);
+                return -ENOMEM;
+        }
+
+        *ret = c;
+        return 0;
+}
+
+static void catalog_unmap(Catalog *c) {
+        assert(c);
+
+        if (c->p) {
+                munmap(c->p, c->st.st_size);
+                c->p = NULL;
+        }
+}
+
+Catalog *catalog_close(Catalog *c) {
+        if (!c)
+                return NULL;
+
+        catalog_unmap(c);
+        free(c->database);
+        free(c);
+
+        return NULL;
+}
+
+static int catalog_refresh(Catalog *c) {
         _cleanup_close_ int fd = -1;
-        void *p = NULL;
         struct stat st;
-        char *text = NULL;
-        int r;
+
+        assert(c);
+
+        /* catalog_update() always writes a new file and renames it
+         * into place, hence it is sufficient to compare the inode to
+         * figure out whether our mapping is still current. */
+
+        if (stat(c->database, &st) < 0) {
+                catalog_unmap(c);
+                return -errno;
+        }
+
+        if (c->p &&
+            st.st_dev == c->st.st_dev &&
+            st.st_ino == c->st.st_ino)
+                return 0;
+
+        catalog_unmap(c);
+
+        return open_mmap(c->database, &fd, &c->st, &c->p);
+}
+
+int catalog_lookup(Catalog *c, sd_id128_t id, char **_text) {
         const char *s;
+        char *text;
+        int r;
 
+        assert(c);
         assert(_text);
 
-        r = open_mmap(database, &fd, &st, &p);
+        r = catalog_refresh(c);
         if (r < 0)
                 return r;
 
-        s = find_id(p, id);
-        if (!s) {
-                r = -ENOENT;
-                goto finish;
-        }
+        s = find_id(c->p, id);
+        if (!s)
+                return -ENOENT;
 
         text = strdup(s);
-        if (!text) {
-                r = -ENOMEM;
-                goto finish;
-        }
+        if (!text)
+                return -ENOMEM;
 
         *_text = text;
-        r = 0;
+        return 0;
+}
 
-finish:
-        if (p)
-                munmap(p, st.st_size);
+int catalog_get(const char* database, sd_id128_t id, char **_text) {
+        _cleanup_(catalog_closep) Catalog *c = NULL;
+        int r;
 
-        return r;
+        assert(_text);
+
+        r = catalog_open(database, &c);
+        if (r < 0)
+                return r;
+
+        return catalog_lookup(c, id, _text);
 }
 
 static char *find_header(const char *s, const char *header) {
@@ -27,11 +27,18 @@
 #include "hashmap.h"
 #include "strbuf.h"
 
+typedef struct Catalog Catalog;
+
 int catalog_import_file(Hashmap *h, struct strbuf *sb, const char *path);
 int catalog_update(const char* database, const char* root, const char* const* dirs);
 int catalog_get(const char* database, sd_id128_t id, char **data);
+int catalog_open(const char *database, Catalog **ret);
+Catalog *catalog_close(Catalog *c);
+int catalog_lookup(Catalog *c, sd_id128_t id, char **data);
 int catalog_list(FILE *f, const char* database, bool oneline);
 int catalog_list_items(FILE *f, const char* database, bool oneline, char **items);
 int catalog_file_lang(const char *filename, char **lang);
 extern const char * const catalog_file_dirs[];
 extern const struct hash_ops catalog_hash_ops;
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(Catalog*, catalog_close);
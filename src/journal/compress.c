@@ -343,6 +343,10 @@ int decompress_startswith(int compression,
                 return -EBADMSG;
 }
 
+#define XZ_STREAM_BLOCK_SIZE (8U*1024U*1024U)
+#define XZ_STREAM_THREADS_MAX 16U
+#define XZ_STREAM_MEMORY_MAX (256U*1024U*1024U)
+
 int compress_stream_xz(int fdf, int fdt, off_t max_bytes) {
 #ifdef HAVE_XZ
         _cleanup_(lzma_end) lzma_stream s = LZMA_STREAM_INIT;
@@ -354,7 +358,40 @@ int compress_stream_xz(int fdf, int fdt, off_t max_bytes) {
         assert(fdf >= 0);
         assert(fdt >= 0);
 
-        ret = lzma_easy_encoder(&s, LZMA_PRESET_DEFAULT, LZMA_CHECK_CRC64);
+        ret = LZMA_PROG_ERROR;
+
+#if LZMA_VERSION >= UINT32_C(50020002)
+        {
+                /* Compress in independent blocks on all CPUs. This
+                 * results in a multi-block stream with an index, so
+                 * that the data may be located without decompressing
+                 * everything in front of it. Each thread needs a
+                 * few hundred MiB at the default preset, and we
+                 * might be called when memory is short already,
+                 * hence use only as many threads as fit into a
+                 * fixed budget. */
+                lzma_mt mt = {
+                        .block_size = XZ_STREAM_BLOCK_SIZE,
+                        .preset = LZMA_PRESET_DEFAULT,
+                        .check = LZMA_CHECK_CRC64,
+                };
+                uint64_t budget;
+
+                budget = MIN((uint64_t) XZ_STREAM_MEMORY_MAX, physical_memory() / 8);
+
+                mt.threads = CLAMP(lzma_cputhreads(), 1U, XZ_STREAM_THREADS_MAX);
+                while (mt.threads > 1 && lzma_stream_encoder_mt_memusage(&mt) > budget)
+                        mt.threads--;
+
+                if (mt.threads > 1) {
+                        ret = lzma_stream_encoder_mt(&s, &mt);
+                        if (ret != LZMA_OK)
+                                log_debug("Failed to initialize multi-threaded XZ encoder, falling back to single thread: code %u", ret);
+                }
+        }
+#endif
+        if (ret != LZMA_OK)
+                ret = lzma_easy_encoder(&s, LZMA_PRESET_DEFAULT, LZMA_CHECK_CRC64);
         if (ret != LZMA_OK) {
                 log_error("Failed to initialize XZ encoder: code %u", ret);
                 return -EINVAL;
@@ -312,7 +312,9 @@ static int save_external_coredump(
         if (fd < 0)
                 return log_error_errno(errno, "Failed to create coredump file %s: %m", tmp);
 
-        r = copy_bytes(STDIN_FILENO, fd, arg_process_size_max, false);
+        /* Coredumps of large processes tend to be mostly zero
+         * pages, hence keep them sparse on disk */
+        r = copy_bytes_sparse(STDIN_FILENO, fd, arg_process_size_max);
         if (r == -EFBIG) {
                 log_error("Coredump of %s (%s) is larger than configured processing limit, refusing.", info[INFO_PID], info[INFO_COMM]);
                 goto fail;
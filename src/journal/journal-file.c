@@ -597,7 +597,7 @@ int journal_file_append_object(JournalFile *f, ObjectType type, uint64_t size, O
         return 0;
 }
 
-static int journal_file_setup_data_hash_table(JournalFile *f) {
+static int journal_file_setup_data_hash_table(JournalFile *f, uint64_t n_data) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -607,11 +607,17 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         /* We estimate that we need 1 hash table entry per 768 of
            journal file and we want to make sure we never get beyond
            75% fill level. Calculate the hash table size for the
-           maximum file size based on these metrics. */
+           maximum file size based on these metrics. If the number of
+           data objects is known in advance, size it exactly for
+           that. */
 
-        s = (f->metrics.max_size * 4 / 768 / 3) * sizeof(HashItem);
-        if (s < DEFAULT_DATA_HASH_TABLE_SIZE)
-                s = DEFAULT_DATA_HASH_TABLE_SIZE;
+        if (n_data > 0)
+                s = (n_data * 4 / 3 + 1) * sizeof(HashItem);
+        else {
+                s = (f->metrics.max_size * 4 / 768 / 3) * sizeof(HashItem);
+                if (s < DEFAULT_DATA_HASH_TABLE_SIZE)
+                        s = DEFAULT_DATA_HASH_TABLE_SIZE;
+        }
 
         log_debug("Reserving %"PRIu64" entries in hash table.", s / sizeof(HashItem));
 
@@ -630,7 +636,7 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         return 0;
 }
 
-static int journal_file_setup_field_hash_table(JournalFile *f) {
+static int journal_file_setup_field_hash_table(JournalFile *f, uint64_t n_fields) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -640,7 +646,10 @@ static int journal_file_setup_field_hash_table(JournalFile *f) {
         /* We use a fixed size hash table for the fields as this
          * number should grow very slowly only */
 
-        s = DEFAULT_FIELD_HASH_TABLE_SIZE;
+        if (n_fields > 0)
+                s = (n_fields * 4 / 3 + 1) * sizeof(HashItem);
+        else
+                s = DEFAULT_FIELD_HASH_TABLE_SIZE;
         r = journal_file_append_object(f,
                                        OBJECT_FIELD_HASH_TABLE,
                                        offsetof(Object, hash_table.items) + s,
@@ -2523,7 +2532,7 @@ void journal_file_print_header(JournalFile *f) {
                 printf("Disk usage: %s\n", format_bytes(bytes, sizeof(bytes), (off_t) st.st_blocks * 512ULL));
 }
 
-int journal_file_open(
+static int journal_file_open_internal(
                 const char *fname,
                 int flags,
                 mode_t mode,
@@ -2532,6 +2541,8 @@ int journal_file_open(
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
                 JournalFile *template,
+                uint64_t n_data,
+                uint64_t n_fields,
                 JournalFile **ret) {
 
         bool newly_created = false;
@@ -2546,10 +2557,6 @@ int journal_file_open(
             (flags & O_ACCMODE) != O_RDWR)
                 return -EINVAL;
 
-        if (!endswith(fname, ".journal") &&
-            !endswith(fname, ".journal~"))
-                return -EINVAL;
-
         f = new0(JournalFile, 1);
         if (!f)
                 return -ENOMEM;
@@ -2693,11 +2700,11 @@ int journal_file_open(
 #endif
 
         if (newly_created) {
-                r = journal_file_setup_field_hash_table(f);
+                r = journal_file_setup_field_hash_table(f, n_fields);
                 if (r < 0)
                         goto fail;
 
-                r = journal_file_setup_data_hash_table(f);
+                r = journal_file_setup_data_hash_table(f, n_data);
                 if (r < 0)
                         goto fail;
 
@@ -2733,6 +2740,27 @@ fail:
         return r;
 }
 
+int journal_file_open(
+                const char *fname,
+                int flags,
+                mode_t mode,
+                bool compress,
+                bool seal,
+                JournalMetrics *metrics,
+                MMapCache *mmap_cache,
+                JournalFile *template,
+                JournalFile **ret) {
+
+        assert(fname);
+
+        if (!endswith(fname, ".journal") &&
+            !endswith(fname, ".journal~"))
+                return -EINVAL;
+
+        return journal_file_open_internal(fname, flags, mode, compress, seal,
+                                          metrics, mmap_cache, template, 0, 0, ret);
+}
+
 int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         _cleanup_free_ char *p = NULL;
         size_t l;
@@ -2841,9 +2869,53 @@ int journal_file_open_reliably(
                                  metrics, mmap_cache, template, ret);
 }
 
+static int journal_file_copy_data(JournalFile *from, JournalFile *to, uint64_t q, le64_t le_hash, Object **ret, uint64_t *offset) {
+        uint64_t l;
+        size_t t;
+        void *data;
+        Object *o;
+        int r;
+
+        assert(from);
+        assert(to);
+
+        r = journal_file_move_to_object(from, OBJECT_DATA, q, &o);
+        if (r < 0)
+                return r;
+
+        if (le_hash != o->data.hash)
+                return -EBADMSG;
+
+        l = le64toh(o->object.size) - offsetof(Object, data.payload);
+        t = (size_t) l;
+
+        /* We hit the limit on 32bit machines */
+        if ((uint64_t) t != l)
+                return -E2BIG;
+
+        if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+                size_t rsize;
+
+                r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                                    o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0);
+                if (r < 0)
+                        return r;
+
+                data = from->compress_buffer;
+                l = rsize;
+#else
+                return -EPROTONOSUPPORT;
+#endif
+        } else
+                data = o->data.payload;
+
+        return journal_file_append_data(to, data, l, ret, offset);
+}
+
 int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, uint64_t *seqnum, Object **ret, uint64_t *offset) {
         uint64_t i, n;
-        uint64_t q, xor_hash = 0;
+        uint64_t xor_hash = 0;
         int r;
         EntryItem *items;
         dual_timestamp ts;
@@ -2864,63 +2936,235 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         items = alloca(sizeof(EntryItem) * MAX(1u, n));
 
         for (i = 0; i < n; i++) {
-                uint64_t l, h;
-                le64_t le_hash;
-                size_t t;
-                void *data;
+                uint64_t h;
                 Object *u;
 
-                q = le64toh(o->entry.items[i].object_offset);
-                le_hash = o->entry.items[i].hash;
+                r = journal_file_copy_data(from, to,
+                                           le64toh(o->entry.items[i].object_offset),
+                                           o->entry.items[i].hash,
+                                           &u, &h);
+                if (r < 0)
+                        return r;
 
-                r = journal_file_move_to_object(from, OBJECT_DATA, q, &o);
+                xor_hash ^= le64toh(u->data.hash);
+                items[i].object_offset = htole64(h);
+                items[i].hash = u->data.hash;
+
+                r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
                 if (r < 0)
                         return r;
+        }
 
-                if (le_hash != o->data.hash)
-                        return -EBADMSG;
+        r = journal_file_append_entry_internal(to, &ts, xor_hash, items, n, seqnum, ret, offset);
 
-                l = le64toh(o->object.size) - offsetof(Object, data.payload);
-                t = (size_t) l;
+        if (mmap_cache_got_sigbus(to->mmap, to->fd))
+                return -EIO;
 
-                /* We hit the limit on 32bit machines */
-                if ((uint64_t) t != l)
-                        return -E2BIG;
+        return r;
+}
 
-                if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
-                        size_t rsize;
+static int journal_file_reserve_entry_array(JournalFile *f, uint64_t n, uint64_t *ret) {
+        Object *o;
+        uint64_t q;
+        int r;
 
-                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
-                                            o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0);
-                        if (r < 0)
-                                return r;
+        assert(f);
+        assert(n > 0);
+        assert(ret);
 
-                        data = from->compress_buffer;
-                        l = rsize;
-#else
-                        return -EPROTONOSUPPORT;
+        r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
+                                       offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
+                                       &o, &q);
+        if (r < 0)
+                return r;
+
+#ifdef HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY, o, q);
+        if (r < 0)
+                return r;
 #endif
-                } else
-                        data = o->data.payload;
 
-                r = journal_file_append_data(to, data, l, &u, &h);
+        if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
+                f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
+
+        *ret = q;
+        return 0;
+}
+
+typedef struct CompactData {
+        uint64_t offset;
+        uint64_t n_entries;
+} CompactData;
+
+int journal_file_compact(JournalFile *from, const char *fname, bool compress, MMapCache *mmap_cache, JournalFile **ret) {
+        _cleanup_free_ CompactData *data = NULL;
+        size_t n_data = 0, n_allocated = 0;
+        uint64_t n_entries, i, j, p, q;
+        JournalFile *to = NULL;
+        Object *o;
+        int r;
+
+        assert(from);
+        assert(fname);
+
+        /* Writes all entries of from into a new, archived file. In
+         * contrast to the files journald writes, the hash tables are
+         * sized exactly, every entry array is allocated in one piece
+         * instead of as a chain of growing arrays, and the objects
+         * are grouped by type: first all data and field objects in
+         * the order they are first referenced, then the entry arrays,
+         * then the entries. Sequence numbers and boot IDs are
+         * retained. fname does not need to look like a journal file
+         * name, so that the file can be written under a temporary
+         * name. If ret is non-NULL, the new file is returned
+         * instead of closed. */
+
+        n_entries = le64toh(from->header->n_entries);
+
+        r = journal_file_open_internal(fname, O_RDWR|O_CREAT|O_EXCL, 0640, compress, false, NULL, mmap_cache, NULL,
+                                       JOURNAL_HEADER_CONTAINS(from->header, n_data) ? le64toh(from->header->n_data) : 0,
+                                       JOURNAL_HEADER_CONTAINS(from->header, n_fields) ? le64toh(from->header->n_fields) : 0,
+                                       &to);
+        if (r < 0) {
+                /* Don't remove a file that isn't ours */
+                if (r != -EEXIST)
+                        unlink(fname);
+
+                return r;
+        }
+
+        to->header->seqnum_id = from->header->seqnum_id;
+        to->header->machine_id = from->header->machine_id;
+
+        for (i = 0; i < n_entries; i++) {
+                uint64_t k, m;
+
+                r = generic_array_get(from, le64toh(from->header->entry_array_offset), i, &o, &p);
+                if (r == 0)
+                        r = -EBADMSG;
                 if (r < 0)
-                        return r;
+                        goto fail;
 
-                xor_hash ^= le64toh(u->data.hash);
-                items[i].object_offset = htole64(h);
-                items[i].hash = u->data.hash;
+                m = journal_file_entry_n_items(o);
+                for (k = 0; k < m; k++) {
+                        uint64_t before, h;
+                        Object *d;
 
-                r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
+                        q = le64toh(o->entry.items[k].object_offset);
+                        before = le64toh(to->header->n_data);
+
+                        r = journal_file_copy_data(from, to, q, o->entry.items[k].hash, NULL, &h);
+                        if (r < 0)
+                                goto fail;
+
+                        if (le64toh(to->header->n_data) > before) {
+                                r = journal_file_move_to_object(from, OBJECT_DATA, q, &d);
+                                if (r < 0)
+                                        goto fail;
+
+                                if (!GREEDY_REALLOC(data, n_allocated, n_data + 1)) {
+                                        r = -ENOMEM;
+                                        goto fail;
+                                }
+
+                                data[n_data].offset = h;
+                                data[n_data].n_entries = le64toh(d->data.n_entries);
+                                n_data++;
+                        }
+
+                        r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
+                        if (r < 0)
+                                goto fail;
+                }
+        }
+
+        if (n_entries > 0) {
+                r = journal_file_reserve_entry_array(to, n_entries, &q);
                 if (r < 0)
-                        return r;
+                        goto fail;
+
+                to->header->entry_array_offset = htole64(q);
         }
 
-        r = journal_file_append_entry_internal(to, &ts, xor_hash, items, n, seqnum, ret, offset);
+        for (j = 0; j < n_data; j++) {
 
-        if (mmap_cache_got_sigbus(to->mmap, to->fd))
-                return -EIO;
+                /* The first entry is linked from the data object
+                 * itself */
+                if (data[j].n_entries <= 1)
+                        continue;
+
+                r = journal_file_reserve_entry_array(to, data[j].n_entries - 1, &q);
+                if (r < 0)
+                        goto fail;
+
+                r = journal_file_move_to_object(to, OBJECT_DATA, data[j].offset, &o);
+                if (r < 0)
+                        goto fail;
+
+                o->data.entry_array_offset = htole64(q);
+        }
+
+        for (i = 0; i < n_entries; i++) {
+                uint64_t seqnum;
+
+                r = generic_array_get(from, le64toh(from->header->entry_array_offset), i, &o, &p);
+                if (r == 0)
+                        r = -EBADMSG;
+                if (r < 0)
+                        goto fail;
+
+                seqnum = le64toh(o->entry.seqnum);
+                if (seqnum == 0) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
+                seqnum--;
+                to->header->boot_id = o->entry.boot_id;
+
+                r = journal_file_copy_entry(from, to, o, p, &seqnum, NULL, NULL);
+                if (r < 0)
+                        goto fail;
+        }
+
+        /* Drop the space that was preallocated beyond the last
+         * object */
+        q = le64toh(to->header->tail_object_offset);
+        r = journal_file_move_to_object(to, OBJECT_UNUSED, q, &o);
+        if (r < 0)
+                goto fail;
+
+        p = PAGE_ALIGN(q + ALIGN64(le64toh(o->object.size)));
+        if (p < le64toh(to->header->header_size) + le64toh(to->header->arena_size)) {
+                if (ftruncate(to->fd, p) < 0) {
+                        r = -errno;
+                        goto fail;
+                }
+
+                to->header->arena_size = htole64(p - le64toh(to->header->header_size));
+        }
+
+        r = journal_file_set_offline(to);
+        if (r < 0)
+                goto fail;
+
+        to->header->state = STATE_ARCHIVED;
+
+        if (fsync(to->fd) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        if (ret)
+                *ret = to;
+        else
+                journal_file_close(to);
+
+        return 0;
+
+fail:
+        journal_file_close(to);
+        unlink(fname);
 
         return r;
 }
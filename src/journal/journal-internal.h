@@ -32,6 +32,7 @@
 #include "hashmap.h"
 #include "set.h"
 #include "journal-file.h"
+#include "catalog.h"
 #include "sd-journal.h"
 
 typedef struct Match Match;
@@ -122,6 +123,8 @@ struct sd_journal {
         Hashmap *directories_by_wd;
 
         Set *errors;
+
+        Catalog *catalog;
 };
 
 char *journal_make_match_string(sd_journal *j);
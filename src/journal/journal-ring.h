@@ -0,0 +1,73 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include "macro.h"
+
+/* A journal ring is a memfd shared between a single producer (a
+ * client process) and journald. It is registered once by sending
+ * JOURNAL_RING_REGISTER over the native socket, together with the
+ * memfd and one end of an AF_UNIX stream socket pair. After that the
+ * client appends entries in the native protocol format to the ring
+ * without any syscalls, and only writes a byte to the socket if
+ * journald announced that it went idle. journald forgets about the
+ * ring when the socket hangs up, i.e. when the producer closed its
+ * end or exited.
+ *
+ * The ring is never shared across machines, hence all fields are in
+ * host byte order. head and tail are free running byte counters, the
+ * offset into the data area is derived from them by masking with
+ * size - 1. Each record consists of a 64bit length, followed by the
+ * entry itself, padded to 8 bytes. A length of JOURNAL_RING_WRAP
+ * means that the rest of the data area is unused and the next record
+ * starts at offset 0. */
+
+#define JOURNAL_RING_REGISTER "RING\n"
+
+#define JOURNAL_RING_SIGNATURE ((const uint8_t[]) { 'L', 'P', 'K', 'S', 'R', 'I', 'N', 'G' })
+
+#define JOURNAL_RING_SIZE_MIN (64U*1024U)
+#define JOURNAL_RING_SIZE_MAX (16U*1024U*1024U)
+#define JOURNAL_RING_SIZE_DEFAULT (256U*1024U)
+
+#define JOURNAL_RING_WRAP UINT64_MAX
+
+#define JOURNAL_RING_ALIGN(l) ALIGN_TO((l), sizeof(uint64_t))
+
+typedef struct JournalRingHeader {
+        uint8_t signature[8];
+        uint64_t size;                    /* size of the data area, a power of two */
+        uint8_t reserved0[48];
+
+        /* Written by the producer only, on a cache line of its own */
+        uint64_t head;
+        uint32_t closed;
+        uint8_t reserved1[52];
+
+        /* Written by the consumer only, except for wakeup, which the
+         * producer resets before it writes to the socket */
+        uint64_t tail;
+        uint32_t wakeup;
+        uint8_t reserved2[52];
+} JournalRingHeader;
+
+#define JOURNAL_RING_HEADER_SIZE ALIGN_TO(sizeof(JournalRingHeader), 256U)
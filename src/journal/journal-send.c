@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <printf.h>
+#include <sys/mman.h>
 
 #define SD_JOURNAL_SUPPRESS_LOCATION
 
@@ -33,6 +34,8 @@
 #include "util.h"
 #include "socket-util.h"
 #include "memfd-util.h"
+#include "missing.h"
+#include "journal-ring.h"
 
 #define SNDBUF_SIZE (8*1024*1024)
 
@@ -196,35 +199,18 @@ finish:
         return r;
 }
 
-_public_ int sd_journal_sendv(const struct iovec *iov, int n) {
-        PROTECT_ERRNO;
-        int fd, r;
-        _cleanup_close_ int buffer_fd = -1;
-        struct iovec *w;
-        uint64_t *l;
-        int i, j = 0;
-        struct sockaddr_un sa = {
-                .sun_family = AF_UNIX,
-                .sun_path = "/run/systemd/journal/socket",
-        };
-        struct msghdr mh = {
-                .msg_name = &sa,
-                .msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(sa.sun_path),
-        };
-        ssize_t k;
-        union {
-                struct cmsghdr cmsghdr;
-                uint8_t buf[CMSG_SPACE(sizeof(int))];
-        } control;
-        struct cmsghdr *cmsg;
+static int journal_iovec_build(const struct iovec *iov, int n, struct iovec *w, uint64_t *l) {
         bool have_syslog_identifier = false;
-        bool seal = true;
+        int i, j = 0;
 
-        assert_return(iov, -EINVAL);
-        assert_return(n > 0, -EINVAL);
+        assert(iov);
+        assert(n > 0);
+        assert(w);
+        assert(l);
 
-        w = alloca(sizeof(struct iovec) * n * 5 + 3);
-        l = alloca(sizeof(uint64_t) * n);
+        /* Converts the passed fields into the native protocol
+         * format. w needs room for n * 5 + 3 entries, l for n
+         * entries. Returns the number of entries used in w. */
 
         for (i = 0; i < n; i++) {
                 char *c, *nl;
@@ -287,6 +273,42 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
                 IOVEC_SET_STRING(w[j++], "\n");
         }
 
+        return j;
+}
+
+_public_ int sd_journal_sendv(const struct iovec *iov, int n) {
+        PROTECT_ERRNO;
+        int fd, r;
+        _cleanup_close_ int buffer_fd = -1;
+        struct iovec *w;
+        uint64_t *l;
+        int j;
+        struct sockaddr_un sa = {
+                .sun_family = AF_UNIX,
+                .sun_path = "/run/systemd/journal/socket",
+        };
+        struct msghdr mh = {
+                .msg_name = &sa,
+                .msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(sa.sun_path),
+        };
+        ssize_t k;
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct cmsghdr *cmsg;
+        bool seal = true;
+
+        assert_return(iov, -EINVAL);
+        assert_return(n > 0, -EINVAL);
+
+        w = alloca(sizeof(struct iovec) * n * 5 + 3);
+        l = alloca(sizeof(uint64_t) * n);
+
+        j = journal_iovec_build(iov, n, w, l);
+        if (j < 0)
+                return j;
+
         fd = journal_fd();
         if (_unlikely_(fd < 0))
                 return fd;
@@ -357,6 +379,236 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         return 0;
 }
 
+struct sd_journal_ring {
+        int memfd;
+        int wakeup_fd;
+
+        JournalRingHeader *header;
+        uint8_t *data;
+        uint64_t size;
+};
+
+static int journal_ring_register(sd_journal_ring *r, int pair[2]) {
+        struct sockaddr_un sa = {
+                .sun_family = AF_UNIX,
+                .sun_path = "/run/systemd/journal/socket",
+        };
+        struct iovec iovec = {
+                .iov_base = (char*) JOURNAL_RING_REGISTER,
+                .iov_len = strlen(JOURNAL_RING_REGISTER),
+        };
+        struct msghdr mh = {
+                .msg_name = &sa,
+                .msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(sa.sun_path),
+                .msg_iov = &iovec,
+                .msg_iovlen = 1,
+        };
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(int) * 2)];
+        } control = {};
+        struct cmsghdr *cmsg;
+        int fd, fds[2];
+
+        assert(r);
+
+        fd = journal_fd();
+        if (fd < 0)
+                return fd;
+
+        fds[0] = r->memfd;
+        fds[1] = pair[1];
+
+        mh.msg_control = &control;
+        mh.msg_controllen = sizeof(control);
+
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        mh.msg_controllen = cmsg->cmsg_len;
+
+        if (sendmsg(fd, &mh, MSG_NOSIGNAL) < 0)
+                return -errno;
+
+        return 0;
+}
+
+_public_ int sd_journal_ring_open(sd_journal_ring **ret, size_t size) {
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        sd_journal_ring *r;
+        void *p = NULL;
+        int k;
+
+        assert_return(ret, -EINVAL);
+
+        if (size == 0)
+                size = JOURNAL_RING_SIZE_DEFAULT;
+
+        assert_return(size >= JOURNAL_RING_SIZE_MIN, -EINVAL);
+        assert_return(size <= JOURNAL_RING_SIZE_MAX, -EINVAL);
+        assert_return((size & (size - 1)) == 0, -EINVAL);
+
+        r = new0(sd_journal_ring, 1);
+        if (!r)
+                return -ENOMEM;
+
+        r->wakeup_fd = -1;
+        r->size = size;
+
+        r->memfd = memfd_new("journal-ring");
+        if (r->memfd < 0) {
+                k = r->memfd;
+                goto fail;
+        }
+
+        k = memfd_set_size(r->memfd, JOURNAL_RING_HEADER_SIZE + size);
+        if (k < 0)
+                goto fail;
+
+        /* journald maps the ring, hence make sure we cannot cause
+         * SIGBUS on its side by truncating it later on */
+        if (fcntl(r->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+                k = -errno;
+                goto fail;
+        }
+
+        k = memfd_map(r->memfd, 0, JOURNAL_RING_HEADER_SIZE + size, &p);
+        if (k < 0)
+                goto fail;
+
+        r->header = p;
+        r->data = (uint8_t*) p + JOURNAL_RING_HEADER_SIZE;
+
+        memcpy(r->header->signature, JOURNAL_RING_SIGNATURE, sizeof(r->header->signature));
+        r->header->size = size;
+
+        /* journald keeps the other end, and drops the ring as soon
+         * as it sees it hang up */
+        if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, pair) < 0) {
+                k = -errno;
+                goto fail;
+        }
+
+        k = journal_ring_register(r, pair);
+        if (k < 0)
+                goto fail;
+
+        r->wakeup_fd = pair[0];
+        pair[0] = -1;
+
+        *ret = r;
+        return 0;
+
+fail:
+        sd_journal_ring_close(r);
+        return k;
+}
+
+static void journal_ring_wakeup_fd(int fd) {
+        static const char c = 0;
+
+        /* If the socket buffer is full journald has a wakeup pending
+         * anyway, hence don't care if this fails */
+        (void) send(fd, &c, 1, MSG_DONTWAIT|MSG_NOSIGNAL);
+}
+
+static void journal_ring_wakeup(sd_journal_ring *r) {
+
+        /* Only signal journald if it announced that it went idle,
+         * and make sure only one of us does so. */
+        if (__atomic_exchange_n(&r->header->wakeup, 0, __ATOMIC_SEQ_CST))
+                journal_ring_wakeup_fd(r->wakeup_fd);
+}
+
+_public_ sd_journal_ring* sd_journal_ring_close(sd_journal_ring *r) {
+        if (!r)
+                return NULL;
+
+        if (r->header) {
+                /* Tell journald to process what is left, and then
+                 * to forget about this ring */
+                __atomic_store_n(&r->header->closed, 1, __ATOMIC_SEQ_CST);
+
+                if (r->wakeup_fd >= 0)
+                        journal_ring_wakeup_fd(r->wakeup_fd);
+
+                munmap(r->header, JOURNAL_RING_HEADER_SIZE + r->size);
+        }
+
+        safe_close(r->memfd);
+        safe_close(r->wakeup_fd);
+        free(r);
+
+        return NULL;
+}
+
+_public_ int sd_journal_ring_sendv(sd_journal_ring *r, const struct iovec *iov, int n) {
+        uint64_t head, tail, offset, length, need, waste = 0;
+        struct iovec *w;
+        uint64_t *l;
+        int i, j;
+
+        assert_return(r, -EINVAL);
+        assert_return(iov, -EINVAL);
+        assert_return(n > 0, -EINVAL);
+
+        w = alloca(sizeof(struct iovec) * n * 5 + 3);
+        l = alloca(sizeof(uint64_t) * n);
+
+        j = journal_iovec_build(iov, n, w, l);
+        if (j < 0)
+                return j;
+
+        length = 0;
+        for (i = 0; i < j; i++)
+                length += w[i].iov_len;
+
+        /* Entries that take more than half of the ring might never
+         * fit, refuse them right-away */
+        need = sizeof(uint64_t) + JOURNAL_RING_ALIGN(length);
+        if (need > r->size / 2)
+                return -EMSGSIZE;
+
+        /* We are the only one writing head, but the consumer moves
+         * tail, hence read it with acquire semantics, so that we
+         * don't overwrite data it is still looking at. */
+        head = r->header->head;
+        tail = __atomic_load_n(&r->header->tail, __ATOMIC_ACQUIRE);
+
+        offset = head & (r->size - 1);
+        if (offset + need > r->size)
+                waste = r->size - offset;
+
+        if (head - tail + waste + need > r->size) {
+                journal_ring_wakeup(r);
+                return -ENOBUFS;
+        }
+
+        if (waste > 0) {
+                *(uint64_t*) (r->data + offset) = JOURNAL_RING_WRAP;
+                offset = 0;
+        }
+
+        *(uint64_t*) (r->data + offset) = length;
+        offset += sizeof(uint64_t);
+
+        for (i = 0; i < j; i++) {
+                memcpy(r->data + offset, w[i].iov_base, w[i].iov_len);
+                offset += w[i].iov_len;
+        }
+
+        /* Publish the entry. This has to be ordered before we look
+         * at the wakeup flag, hence the full barrier. */
+        __atomic_store_n(&r->header->head, head + waste + need, __ATOMIC_SEQ_CST);
+
+        journal_ring_wakeup(r);
+
+        return 0;
+}
+
 static int fill_iovec_perror_and_send(const char *message, int skip, struct iovec iov[]) {
         PROTECT_ERRNO;
         size_t n, k;
@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/inotify.h>
+#include <sys/wait.h>
 #include <linux/fs.h>
 
 #include "sd-journal.h"
@@ -125,6 +126,7 @@ static enum {
         ACTION_LIST_BOOTS,
         ACTION_FLUSH,
         ACTION_VACUUM,
+        ACTION_COMPACT,
 } arg_action = ACTION_SHOW;
 
 typedef struct boot_id_t {
@@ -237,6 +239,7 @@ static void help(void) {
                "     --disk-usage          Show total disk usage of all journal files\n"
                "     --vacuum-size=BYTES   Reduce disk usage below specified size\n"
                "     --vacuum-time=TIME    Remove journal files older than specified date\n"
+               "     --compact             Rewrite archived journal files compactly\n"
                "     --flush               Flush all journal data from /run into /var\n"
                "     --header              Show journal header information\n"
                "     --list-catalog        Show all message IDs in the catalog\n"
@@ -281,6 +284,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_FLUSH,
                 ARG_VACUUM_SIZE,
                 ARG_VACUUM_TIME,
+                ARG_COMPACT,
         };
 
         static const struct option options[] = {
@@ -334,6 +338,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "flush",          no_argument,       NULL, ARG_FLUSH          },
                 { "vacuum-size",    required_argument, NULL, ARG_VACUUM_SIZE    },
                 { "vacuum-time",    required_argument, NULL, ARG_VACUUM_TIME    },
+                { "compact",        no_argument,       NULL, ARG_COMPACT        },
                 {}
         };
 
@@ -550,6 +555,10 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_action = ACTION_VACUUM;
                         break;
 
+                case ARG_COMPACT:
+                        arg_action = ACTION_COMPACT;
+                        break;
+
 #ifdef HAVE_GCRYPT
                 case ARG_FORCE:
                         arg_force = true;
@@ -1531,6 +1540,223 @@ static int verify(sd_journal *j) {
         return r;
 }
 
+static int compact_copy_access(JournalFile *f, int fd) {
+#ifdef HAVE_ACL
+        _cleanup_(acl_freep) acl_t acl = NULL;
+#endif
+
+        assert(f);
+        assert(fd >= 0);
+
+        /* journald might have granted users access to the original
+         * file, see server_fix_perms(), hence carry over owner,
+         * access mode and ACL to its replacement. */
+
+        if (fchown(fd, f->last_stat.st_uid, f->last_stat.st_gid) < 0)
+                return -errno;
+
+        if (fchmod(fd, f->last_stat.st_mode & 07777) < 0)
+                return -errno;
+
+#ifdef HAVE_ACL
+        acl = acl_get_fd(f->fd);
+        if (!acl) {
+                if (errno == ENOTSUP)
+                        return 0;
+
+                return -errno;
+        }
+
+        if (acl_set_fd(fd, acl) < 0)
+                return -errno;
+#endif
+
+        return 0;
+}
+
+static int compact_file(JournalFile *f, MMapCache *m) {
+        _cleanup_free_ char *t = NULL;
+        char a[FORMAT_BYTES_MAX], b[FORMAT_BYTES_MAX];
+        JournalFile *c = NULL;
+        uint64_t p = 0, q = 0;
+        struct stat st;
+        int r;
+
+        assert(f);
+
+        /* Write to a hidden file that matches none of the patterns
+         * of journal files, so that readers and vacuuming don't pick
+         * it up, and so that leftovers of an interrupted run don't
+         * get in the way. */
+        r = tempfn_random(f->path, &t);
+        if (r < 0)
+                return log_error_errno(r, "Failed to determine temporary file name for %s: %m", f->path);
+
+        r = journal_file_compact(f, t, true, m, &c);
+        if (r < 0)
+                return log_error_errno(r, "Failed to compact %s: %m", f->path);
+
+        r = journal_file_verify(c, NULL, NULL, NULL, NULL, false);
+        if (r < 0) {
+                log_error_errno(r, "Compacted journal file %s failed verification: %m", t);
+                goto finish;
+        }
+
+        /* Make sure the new file contains exactly the same entries
+         * as the old one */
+        for (;;) {
+                uint64_t seqnum, realtime, monotonic, xor_hash, n;
+                sd_id128_t boot_id;
+                Object *o;
+                int k;
+
+                r = journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p);
+                if (r < 0)
+                        goto finish;
+                if (r > 0) {
+                        seqnum = le64toh(o->entry.seqnum);
+                        realtime = le64toh(o->entry.realtime);
+                        monotonic = le64toh(o->entry.monotonic);
+                        xor_hash = le64toh(o->entry.xor_hash);
+                        boot_id = o->entry.boot_id;
+                        n = journal_file_entry_n_items(o);
+                }
+
+                k = journal_file_next_entry(c, q, DIRECTION_DOWN, &o, &q);
+                if (k < 0) {
+                        r = k;
+                        goto finish;
+                }
+
+                if (r == 0 && k == 0)
+                        break;
+
+                if (r == 0 || k == 0 ||
+                    seqnum != le64toh(o->entry.seqnum) ||
+                    realtime != le64toh(o->entry.realtime) ||
+                    monotonic != le64toh(o->entry.monotonic) ||
+                    xor_hash != le64toh(o->entry.xor_hash) ||
+                    !sd_id128_equal(boot_id, o->entry.boot_id) ||
+                    n != journal_file_entry_n_items(o)) {
+                        r = -EBADMSG;
+                        log_error("Compacted journal file %s does not match %s.", t, f->path);
+                        goto finish;
+                }
+        }
+
+        if (fstat(c->fd, &st) < 0) {
+                r = log_error_errno(errno, "Failed to stat %s: %m", t);
+                goto finish;
+        }
+
+        if (st.st_blocks >= f->last_stat.st_blocks) {
+                log_info("%s is already compact.", f->path);
+                r = 0;
+                goto finish;
+        }
+
+        r = compact_copy_access(f, c->fd);
+        if (r < 0) {
+                log_error_errno(r, "Failed to copy access mode of %s: %m", f->path);
+                goto finish;
+        }
+
+        if (rename(t, f->path) < 0) {
+                r = log_error_errno(errno, "Failed to replace %s: %m", f->path);
+                goto finish;
+        }
+
+        log_info("Compacted %s: %s → %s.", f->path,
+                 format_bytes(a, sizeof(a), (uint64_t) f->last_stat.st_blocks * 512ULL),
+                 format_bytes(b, sizeof(b), (uint64_t) st.st_blocks * 512ULL));
+
+        free(t);
+        t = NULL;
+        r = 0;
+
+finish:
+        if (c)
+                journal_file_close(c);
+
+        if (t)
+                unlink(t);
+
+        return r;
+}
+
+static int compact_wait(void) {
+        siginfo_t si = {};
+
+        if (waitid(P_ALL, 0, &si, WEXITED) < 0)
+                return log_error_errno(errno, "Failed to wait for worker: %m");
+
+        if (si.si_code != CLD_EXITED)
+                log_error("Worker "PID_FMT" terminated abnormally.", si.si_pid);
+
+        return si.si_code == CLD_EXITED && si.si_status == EXIT_SUCCESS ? 0 : -EPROTO;
+}
+
+static int compact(sd_journal *j) {
+        unsigned n_running = 0, n_max;
+        JournalFile *f;
+        Iterator i;
+        int r = 0, k;
+
+        assert(j);
+
+        /* Each file is rewritten by a worker process of its own,
+         * with up to one worker per CPU running at a time */
+        n_max = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                pid_t pid;
+
+                if (f->header->state != STATE_ARCHIVED || !endswith(f->path, ".journal")) {
+                        log_debug("Skipping %s, not an archived journal file.", f->path);
+                        continue;
+                }
+
+                if (f->header->n_entries == 0) {
+                        log_debug("Skipping %s, no entries.", f->path);
+                        continue;
+                }
+
+                if (JOURNAL_HEADER_SEALED(f->header)) {
+                        log_notice("Skipping %s, sealed journal files cannot be compacted.", f->path);
+                        continue;
+                }
+
+                if (n_running >= n_max) {
+                        k = compact_wait();
+                        if (k < 0)
+                                r = k;
+
+                        n_running--;
+                }
+
+                pid = fork();
+                if (pid < 0) {
+                        r = log_error_errno(errno, "Failed to fork: %m");
+                        break;
+                }
+
+                if (pid == 0)
+                        _exit(compact_file(f, j->mmap) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
+                n_running++;
+        }
+
+        while (n_running > 0) {
+                k = compact_wait();
+                if (k < 0)
+                        r = k;
+
+                n_running--;
+        }
+
+        return r;
+}
+
 #ifdef HAVE_ACL
 static int access_check_var_log_journal(sd_journal *j) {
         _cleanup_strv_free_ char **g = NULL;
@@ -1830,6 +2056,11 @@ int main(int argc, char *argv[]) {
                 return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
         }
 
+        if (arg_action == ACTION_COMPACT) {
+                r = compact(j);
+                goto finish;
+        }
+
         if (arg_action == ACTION_LIST_BOOTS) {
                 r = list_boots(j);
                 goto finish;
@@ -103,9 +103,130 @@ static bool is_us(const char *pid) {
         return t == getpid();
 }
 
+/* How long we trust the udev data we looked up for a kernel device,
+ * and for how many devices we keep it around at most. During kernel
+ * message floods the same few devices tend to log over and over
+ * again, hence this saves us a lot of udev database lookups. */
+#define DEV_KMSG_UDEV_CACHE_USEC (5*USEC_PER_SEC)
+#define DEV_KMSG_UDEV_CACHE_MAX 256
+
+/* How many kernel messages to process at most per wakeup, so that a
+ * flood doesn't starve the other event sources */
+#define DEV_KMSG_READ_MAX 64
+
+typedef struct DevKmsgUdevEntry {
+        char *device;
+        usec_t timestamp;
+        unsigned n_fields;
+        char *fields[N_IOVEC_UDEV_FIELDS];
+} DevKmsgUdevEntry;
+
+static DevKmsgUdevEntry* dev_kmsg_udev_entry_free(DevKmsgUdevEntry *e) {
+        unsigned i;
+
+        if (!e)
+                return NULL;
+
+        for (i = 0; i < e->n_fields; i++)
+                free(e->fields[i]);
+
+        free(e->device);
+        free(e);
+
+        return NULL;
+}
+
+void server_flush_dev_kmsg_udev_cache(Server *s) {
+        DevKmsgUdevEntry *e;
+
+        assert(s);
+
+        while ((e = hashmap_steal_first(s->dev_kmsg_udev_cache)))
+                dev_kmsg_udev_entry_free(e);
+}
+
+static void dev_kmsg_udev_entry_add_field(DevKmsgUdevEntry *e, const char *field, const char *value) {
+        char *b;
+
+        assert(e);
+        assert(field);
+
+        if (!value)
+                return;
+
+        if (e->n_fields >= ELEMENTSOF(e->fields))
+                return;
+
+        b = strappend(field, value);
+        if (!b)
+                return;
+
+        e->fields[e->n_fields++] = b;
+}
+
+static DevKmsgUdevEntry* dev_kmsg_udev_lookup(Server *s, const char *device) {
+        DevKmsgUdevEntry *e;
+        struct udev_device *ud;
+        usec_t n;
+
+        assert(s);
+        assert(device);
+
+        n = now(CLOCK_MONOTONIC);
+
+        e = hashmap_get(s->dev_kmsg_udev_cache, device);
+        if (e) {
+                if (e->timestamp + DEV_KMSG_UDEV_CACHE_USEC > n)
+                        return e;
+
+                hashmap_remove(s->dev_kmsg_udev_cache, device);
+                dev_kmsg_udev_entry_free(e);
+        }
+
+        if (hashmap_size(s->dev_kmsg_udev_cache) >= DEV_KMSG_UDEV_CACHE_MAX)
+                server_flush_dev_kmsg_udev_cache(s);
+
+        if (hashmap_ensure_allocated(&s->dev_kmsg_udev_cache, &string_hash_ops) < 0)
+                return NULL;
+
+        e = new0(DevKmsgUdevEntry, 1);
+        if (!e)
+                return NULL;
+
+        e->device = strdup(device);
+        if (!e->device)
+                return dev_kmsg_udev_entry_free(e);
+
+        e->timestamp = n;
+
+        /* Devices udev doesn't know are remembered too, so that we
+         * don't look them up again and again */
+        ud = udev_device_new_from_device_id(s->udev, device);
+        if (ud) {
+                struct udev_list_entry *ll;
+
+                dev_kmsg_udev_entry_add_field(e, "_UDEV_DEVNODE=", udev_device_get_devnode(ud));
+                dev_kmsg_udev_entry_add_field(e, "_UDEV_SYSNAME=", udev_device_get_sysname(ud));
+
+                ll = udev_device_get_devlinks_list_entry(ud);
+                udev_list_entry_foreach(ll, ll)
+                        dev_kmsg_udev_entry_add_field(e, "_UDEV_DEVLINK=", udev_list_entry_get_name(ll));
+
+                udev_device_unref(ud);
+        }
+
+        if (hashmap_put(s->dev_kmsg_udev_cache, e->device, e) < 0)
+                return dev_kmsg_udev_entry_free(e);
+
+        return e;
+}
+
 static void dev_kmsg_record(Server *s, const char *p, size_t l) {
         struct iovec iovec[N_IOVEC_META_FIELDS + 7 + N_IOVEC_KERNEL_FIELDS + 2 + N_IOVEC_UDEV_FIELDS];
-        char *message = NULL, *syslog_priority = NULL, *syslog_pid = NULL, *syslog_facility = NULL, *syslog_identifier = NULL, *source_time = NULL;
+        char *message = NULL, *syslog_pid = NULL, *syslog_identifier = NULL;
+        char syslog_priority[sizeof("PRIORITY=") + DECIMAL_STR_MAX(int)],
+             syslog_facility[sizeof("SYSLOG_FACILITY=") + DECIMAL_STR_MAX(int)],
+             source_time[sizeof("_SOURCE_MONOTONIC_TIMESTAMP=") + DECIMAL_STR_MAX(unsigned long long)];
         int priority, r;
         unsigned n = 0, z = 0, j;
         unsigned long long usec;
@@ -216,65 +337,24 @@ static void dev_kmsg_record(Server *s, const char *p, size_t l) {
         }
 
         if (kernel_device) {
-                struct udev_device *ud;
-
-                ud = udev_device_new_from_device_id(s->udev, kernel_device);
-                if (ud) {
-                        const char *g;
-                        struct udev_list_entry *ll;
-                        char *b;
-
-                        g = udev_device_get_devnode(ud);
-                        if (g) {
-                                b = strappend("_UDEV_DEVNODE=", g);
-                                if (b) {
-                                        IOVEC_SET_STRING(iovec[n++], b);
-                                        z++;
-                                }
-                        }
-
-                        g = udev_device_get_sysname(ud);
-                        if (g) {
-                                b = strappend("_UDEV_SYSNAME=", g);
-                                if (b) {
-                                        IOVEC_SET_STRING(iovec[n++], b);
-                                        z++;
-                                }
-                        }
-
-                        j = 0;
-                        ll = udev_device_get_devlinks_list_entry(ud);
-                        udev_list_entry_foreach(ll, ll) {
-
-                                if (j > N_IOVEC_UDEV_FIELDS)
-                                        break;
-
-                                g = udev_list_entry_get_name(ll);
-                                if (g) {
-                                        b = strappend("_UDEV_DEVLINK=", g);
-                                        if (b) {
-                                                IOVEC_SET_STRING(iovec[n++], b);
-                                                z++;
-                                        }
-                                }
-
-                                j++;
-                        }
-
-                        udev_device_unref(ud);
-                }
+                DevKmsgUdevEntry *ue;
+
+                ue = dev_kmsg_udev_lookup(s, kernel_device);
+                if (ue)
+                        for (j = 0; j < ue->n_fields; j++)
+                                IOVEC_SET_STRING(iovec[n++], ue->fields[j]);
         }
 
-        if (asprintf(&source_time, "_SOURCE_MONOTONIC_TIMESTAMP=%llu", usec) >= 0)
-                IOVEC_SET_STRING(iovec[n++], source_time);
+        xsprintf(source_time, "_SOURCE_MONOTONIC_TIMESTAMP=%llu", usec);
+        IOVEC_SET_STRING(iovec[n++], source_time);
 
         IOVEC_SET_STRING(iovec[n++], "_TRANSPORT=kernel");
 
-        if (asprintf(&syslog_priority, "PRIORITY=%i", priority & LOG_PRIMASK) >= 0)
-                IOVEC_SET_STRING(iovec[n++], syslog_priority);
+        xsprintf(syslog_priority, "PRIORITY=%i", priority & LOG_PRIMASK);
+        IOVEC_SET_STRING(iovec[n++], syslog_priority);
 
-        if (asprintf(&syslog_facility, "SYSLOG_FACILITY=%i", LOG_FAC(priority)) >= 0)
-                IOVEC_SET_STRING(iovec[n++], syslog_facility);
+        xsprintf(syslog_facility, "SYSLOG_FACILITY=%i", LOG_FAC(priority));
+        IOVEC_SET_STRING(iovec[n++], syslog_facility);
 
         if ((priority & LOG_FACMASK) == LOG_KERN)
                 IOVEC_SET_STRING(iovec[n++], "SYSLOG_IDENTIFIER=kernel");
@@ -310,11 +390,8 @@ finish:
                 free(iovec[j].iov_base);
 
         free(message);
-        free(syslog_priority);
         free(syslog_identifier);
         free(syslog_pid);
-        free(syslog_facility);
-        free(source_time);
         free(identifier);
         free(pid);
 }
@@ -376,6 +453,8 @@ int server_flush_dev_kmsg(Server *s) {
 
 static int dispatch_dev_kmsg(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
         Server *s = userdata;
+        unsigned i;
+        int r;
 
         assert(es);
         assert(fd == s->dev_kmsg_fd);
@@ -387,7 +466,16 @@ static int dispatch_dev_kmsg(sd_event_source *es, int fd, uint32_t revents, void
         if (!(revents & EPOLLIN))
                 log_error("Got invalid event from epoll for /dev/kmsg: %"PRIx32, revents);
 
-        return server_read_dev_kmsg(s);
+        /* The kernel returns only a single record per read(), hence
+         * process a batch of them before going back to the event
+         * loop. */
+        for (i = 0; i < DEV_KMSG_READ_MAX; i++) {
+                r = server_read_dev_kmsg(s);
+                if (r <= 0)
+                        return r;
+        }
+
+        return 0;
 }
 
 int server_open_dev_kmsg(Server *s) {
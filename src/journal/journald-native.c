@@ -24,6 +24,7 @@
 #include <sys/epoll.h>
 #include <sys/mman.h>
 
+#include "sd-daemon.h"
 #include "socket-util.h"
 #include "path-util.h"
 #include "selinux-util.h"
@@ -33,7 +34,36 @@
 #include "journald-console.h"
 #include "journald-syslog.h"
 #include "journald-wall.h"
+#include "journal-ring.h"
 #include "memfd-util.h"
+#include "missing.h"
+
+/* Don't allow more than this many shared memory rings at a time, in
+ * total and per user, and don't process more than this many entries
+ * of a ring per event loop iteration */
+#define NATIVE_RINGS_MAX 128
+#define NATIVE_RINGS_PER_UID_MAX 8
+#define NATIVE_RING_ENTRIES_MAX 256
+
+struct NativeRing {
+        Server *server;
+
+        JournalRingHeader *header;
+        const uint8_t *data;
+        uint64_t size;
+        uint64_t tail;
+
+        int wakeup_fd;
+
+        struct ucred ucred;
+        char *label;
+        size_t label_len;
+
+        sd_event_source *event_source;
+        sd_event_source *defer_event_source;
+
+        LIST_FIELDS(NativeRing, native_ring);
+};
 
 bool valid_user_field(const char *p, size_t l, bool allow_protected) {
         const char *a;
@@ -411,6 +441,333 @@ void server_process_native_file(
         }
 }
 
+void native_ring_free(NativeRing *r) {
+        if (!r)
+                return;
+
+        if (r->server) {
+                assert(r->server->n_native_rings > 0);
+                r->server->n_native_rings --;
+                LIST_REMOVE(native_ring, r->server->native_rings, r);
+        }
+
+        sd_event_source_unref(r->event_source);
+        sd_event_source_unref(r->defer_event_source);
+
+        if (r->header)
+                munmap(r->header, JOURNAL_RING_HEADER_SIZE + r->size);
+
+        safe_close(r->wakeup_fd);
+        free(r->label);
+        free(r);
+}
+
+int native_ring_next(
+                const uint8_t *data,
+                uint64_t size,
+                uint64_t head,
+                uint64_t tail,
+                uint64_t *ret_length,
+                uint64_t *ret_need) {
+
+        uint64_t offset, length, need;
+
+        assert(data);
+        assert(size > 0 && (size & (size - 1)) == 0);
+        assert(ret_length);
+        assert(ret_need);
+
+        /* Looks at the record at tail, and validates it against the
+         * data published up to head. Returns 0 if there is none, > 0
+         * if there is one, -EBADMSG if the ring is corrupted. The
+         * length of a record might be changed by the producer any
+         * time, hence it is read exactly once. */
+
+        if (head == tail)
+                return 0;
+
+        if (head - tail > size)
+                return -EBADMSG;
+
+        offset = tail & (size - 1);
+        if (size - offset < sizeof(uint64_t))
+                return -EBADMSG;
+
+        length = *(volatile const uint64_t*) (data + offset);
+
+        if (length == JOURNAL_RING_WRAP)
+                need = size - offset;
+        else {
+                if (length > size)
+                        return -EBADMSG;
+
+                need = sizeof(uint64_t) + JOURNAL_RING_ALIGN(length);
+                if (offset + need > size)
+                        return -EBADMSG;
+        }
+
+        if (need > head - tail)
+                return -EBADMSG;
+
+        *ret_length = length;
+        *ret_need = need;
+        return 1;
+}
+
+static int native_ring_process(NativeRing *r) {
+        Server *s;
+        unsigned n;
+
+        assert(r);
+        assert(r->server);
+
+        s = r->server;
+
+        /* The ring is writable by the producer, hence we keep our own
+         * copy of tail, and validate everything we read from it. The
+         * entries are copied out before we parse them. Returns > 0 if
+         * there is more left to process. */
+
+        for (n = 0;; n++) {
+                uint64_t head, length, need;
+                int k;
+
+                head = __atomic_load_n(&r->header->head, __ATOMIC_ACQUIRE);
+
+                k = native_ring_next(r->data, r->size, head, r->tail, &length, &need);
+                if (k <= 0)
+                        return k;
+
+                if (n >= NATIVE_RING_ENTRIES_MAX)
+                        return 1;
+
+                if (length != JOURNAL_RING_WRAP && length > 0) {
+                        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, length + 1))
+                                return log_oom();
+
+                        memcpy(s->buffer, r->data + (r->tail & (r->size - 1)) + sizeof(uint64_t), length);
+                }
+
+                r->tail += need;
+                __atomic_store_n(&r->header->tail, r->tail, __ATOMIC_RELEASE);
+
+                if (length != JOURNAL_RING_WRAP && length > 0)
+                        server_process_native_message(s, s->buffer, length, &r->ucred, NULL, r->label, r->label_len);
+        }
+}
+
+static int native_ring_dispatch(NativeRing *r, bool closed) {
+        int k;
+
+        assert(r);
+
+        /* Check this first, so that we know that everything the
+         * producer wrote before closing is processed below */
+        if (__atomic_load_n(&r->header->closed, __ATOMIC_ACQUIRE))
+                closed = true;
+
+        k = native_ring_process(r);
+        if (k < 0) {
+                log_warning_errno(k, "Invalid data in journal ring of PID "PID_FMT", dropping ring: %m", r->ucred.pid);
+                native_ring_free(r);
+                return 0;
+        }
+        if (k == 0 && closed) {
+                native_ring_free(r);
+                return 0;
+        }
+
+        /* Announce that we go idle, so that the producer wakes us up
+         * for the next entry. Then check again, in case something was
+         * added before it could have seen that. If there's more to
+         * do, make sure we are dispatched again. */
+        if (k == 0)
+                __atomic_store_n(&r->header->wakeup, 1, __ATOMIC_SEQ_CST);
+
+        if (k > 0 || __atomic_load_n(&r->header->head, __ATOMIC_SEQ_CST) != r->tail)
+                return sd_event_source_set_enabled(r->defer_event_source, SD_EVENT_ONESHOT);
+
+        return 0;
+}
+
+static int dispatch_native_ring(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        NativeRing *r = userdata;
+        bool closed;
+
+        assert(r);
+        assert(fd == r->wakeup_fd);
+
+        /* Drain the wakeups. If the socket hung up, the producer
+         * closed the ring or exited, and won't add anything
+         * anymore. */
+        closed = revents & (EPOLLHUP|EPOLLERR);
+        for (;;) {
+                char buf[64];
+                ssize_t l;
+
+                l = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+                if (l > 0)
+                        continue;
+                if (l < 0 && errno == EINTR)
+                        continue;
+                if (l == 0 || errno != EAGAIN)
+                        closed = true;
+
+                break;
+        }
+
+        return native_ring_dispatch(r, closed);
+}
+
+static int dispatch_native_ring_defer(sd_event_source *es, void *userdata) {
+        NativeRing *r = userdata;
+
+        assert(r);
+
+        return native_ring_dispatch(r, false);
+}
+
+static unsigned native_rings_of_uid(Server *s, uid_t uid) {
+        NativeRing *r;
+        unsigned n = 0;
+
+        LIST_FOREACH(native_ring, r, s->native_rings)
+                if (r->ucred.uid == uid)
+                        n++;
+
+        return n;
+}
+
+void server_process_native_ring(
+                Server *s,
+                int fds[2],
+                const struct ucred *ucred,
+                const char *label, size_t label_len) {
+
+        NativeRing *r;
+        struct stat st;
+        uint64_t size;
+        void *p = NULL;
+        int k;
+
+        assert(s);
+        assert(fds);
+
+        /* A client registers a shared memory ring, see journal-ring.h
+         * for details. fds[0] is the memfd of the ring, fds[1] the
+         * socket to wait on. On success we take possession of the
+         * socket.
+         *
+         * The credentials are the ones the kernel attached to the
+         * registration, i.e. the effective ones of the producer at
+         * that time, and are used for all entries of the ring, the
+         * same way as for stream connections. */
+
+        if (!ucred) {
+                log_warning("Journal ring registered without credentials, ignoring.");
+                return;
+        }
+
+        if (s->n_native_rings >= NATIVE_RINGS_MAX) {
+                log_warning("Too many journal rings, refusing registration.");
+                return;
+        }
+
+        if (native_rings_of_uid(s, ucred->uid) >= NATIVE_RINGS_PER_UID_MAX) {
+                log_warning("Too many journal rings of UID "UID_FMT", refusing registration.", ucred->uid);
+                return;
+        }
+
+        if (sd_is_socket(fds[1], AF_UNIX, SOCK_STREAM, -1) <= 0) {
+                log_warning("Journal ring registered without wakeup socket, ignoring.");
+                return;
+        }
+
+        /* The ring must be sealed against shrinking, so that the
+         * producer cannot make us crash accessing it */
+        k = fcntl(fds[0], F_GET_SEALS);
+        if (k < 0 || (k & (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE)) != (F_SEAL_SHRINK|F_SEAL_GROW)) {
+                log_warning("Journal ring is not a properly sealed memfd, ignoring.");
+                return;
+        }
+
+        if (fstat(fds[0], &st) < 0) {
+                log_warning_errno(errno, "Failed to stat journal ring, ignoring: %m");
+                return;
+        }
+
+        if (st.st_size < (off_t) (JOURNAL_RING_HEADER_SIZE + JOURNAL_RING_SIZE_MIN) ||
+            st.st_size > (off_t) (JOURNAL_RING_HEADER_SIZE + JOURNAL_RING_SIZE_MAX)) {
+                log_warning("Journal ring has invalid size, ignoring.");
+                return;
+        }
+
+        k = memfd_map(fds[0], 0, st.st_size, &p);
+        if (k < 0) {
+                log_warning_errno(k, "Failed to map journal ring, ignoring: %m");
+                return;
+        }
+
+        size = ((JournalRingHeader*) p)->size;
+        if (memcmp(((JournalRingHeader*) p)->signature, JOURNAL_RING_SIGNATURE, 8) != 0 ||
+            (size & (size - 1)) != 0 ||
+            JOURNAL_RING_HEADER_SIZE + size != (uint64_t) st.st_size) {
+                log_warning("Journal ring has invalid header, ignoring.");
+                munmap(p, st.st_size);
+                return;
+        }
+
+        r = new0(NativeRing, 1);
+        if (!r) {
+                log_oom();
+                munmap(p, st.st_size);
+                return;
+        }
+
+        r->header = p;
+        r->data = (const uint8_t*) p + JOURNAL_RING_HEADER_SIZE;
+        r->size = size;
+        r->tail = r->header->tail;
+        r->wakeup_fd = -1;
+        r->ucred = *ucred;
+
+        if (label) {
+                r->label = strndup(label, label_len);
+                if (!r->label) {
+                        log_oom();
+                        goto fail;
+                }
+
+                r->label_len = label_len;
+        }
+
+        r->wakeup_fd = fds[1];
+        fds[1] = -1;
+
+        k = sd_event_add_io(s->event, &r->event_source, r->wakeup_fd, EPOLLIN, dispatch_native_ring, r);
+        if (k < 0) {
+                log_error_errno(k, "Failed to add journal ring to event loop: %m");
+                goto fail;
+        }
+
+        /* Process whatever was written before the registration
+         * reached us, and arm the wakeup */
+        k = sd_event_add_defer(s->event, &r->defer_event_source, dispatch_native_ring_defer, r);
+        if (k < 0) {
+                log_error_errno(k, "Failed to add journal ring to event loop: %m");
+                goto fail;
+        }
+
+        r->server = s;
+        LIST_PREPEND(native_ring, s->native_rings, r);
+        s->n_native_rings ++;
+
+        return;
+
+fail:
+        native_ring_free(r);
+}
+
 int server_open_native_socket(Server*s) {
         static const int one = 1;
         int r;
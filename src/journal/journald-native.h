@@ -34,4 +34,9 @@ void server_process_native_message(Server *s, const void *buffer, size_t buffer_
 
 void server_process_native_file(Server *s, int fd, const struct ucred *ucred, const struct timeval *tv, const char *label, size_t label_len);
 
+void server_process_native_ring(Server *s, int fds[2], const struct ucred *ucred, const char *label, size_t label_len);
+
+void native_ring_free(NativeRing *r);
+int native_ring_next(const uint8_t *data, uint64_t size, uint64_t head, uint64_t tail, uint64_t *ret_length, uint64_t *ret_need);
+
 int server_open_native_socket(Server*s);
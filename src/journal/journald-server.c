@@ -50,6 +50,7 @@
 #include "journald-stream.h"
 #include "journald-console.h"
 #include "journald-native.h"
+#include "journal-ring.h"
 #include "journald-audit.h"
 #include "journald-server.h"
 #include "acl-util.h"
@@ -1211,6 +1212,10 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
                                 server_process_native_message(s, s->buffer, n, ucred, tv, label, label_len);
                         else if (n == 0 && n_fds == 1)
                                 server_process_native_file(s, fds[0], ucred, tv, label, label_len);
+                        else if (n_fds == 2 &&
+                                 (size_t) n == strlen(JOURNAL_RING_REGISTER) &&
+                                 memcmp(s->buffer, JOURNAL_RING_REGISTER, n) == 0)
+                                server_process_native_ring(s, fds, ucred, label, label_len);
                         else if (n_fds > 0)
                                 log_warning("Got too many file descriptors via native socket. Ignoring.");
 
@@ -1648,6 +1653,9 @@ void server_done(Server *s) {
         while (s->stdout_streams)
                 stdout_stream_free(s->stdout_streams);
 
+        while (s->native_rings)
+                native_ring_free(s->native_rings);
+
         if (s->system_journal)
                 journal_file_close(s->system_journal);
 
@@ -1693,6 +1701,9 @@ void server_done(Server *s) {
         if (s->mmap)
                 mmap_cache_unref(s->mmap);
 
+        server_flush_dev_kmsg_udev_cache(s);
+        hashmap_free(s->dev_kmsg_udev_cache);
+
         if (s->udev)
                 udev_unref(s->udev);
 }
@@ -53,6 +53,7 @@ typedef enum SplitMode {
 } SplitMode;
 
 typedef struct StdoutStream StdoutStream;
+typedef struct NativeRing NativeRing;
 
 typedef struct Server {
         int syslog_fd;
@@ -116,6 +117,9 @@ typedef struct Server {
         LIST_HEAD(StdoutStream, stdout_streams);
         unsigned n_stdout_streams;
 
+        LIST_HEAD(NativeRing, native_rings);
+        unsigned n_native_rings;
+
         char *tty_path;
 
         int max_level_store;
@@ -134,6 +138,7 @@ typedef struct Server {
         uint64_t *kernel_seqnum;
 
         struct udev *udev;
+        Hashmap *dev_kmsg_udev_cache;
 
         bool sync_scheduled;
 
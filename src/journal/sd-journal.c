@@ -1766,6 +1766,7 @@ _public_ void sd_journal_close(sd_journal *j) {
         free(j->prefix);
         free(j->unique_field);
         set_free(j->errors);
+        catalog_close(j->catalog);
         free(j);
 }
 
@@ -2576,7 +2577,15 @@ _public_ int sd_journal_get_catalog(sd_journal *j, char **ret) {
         if (r < 0)
                 return r;
 
-        r = catalog_get(CATALOG_DATABASE, id, &text);
+        /* Keep the catalog database mapped for subsequent calls,
+         * since this is usually called for every single entry */
+        if (!j->catalog) {
+                r = catalog_open(CATALOG_DATABASE, &j->catalog);
+                if (r < 0)
+                        return r;
+        }
+
+        r = catalog_lookup(j->catalog, id, &text);
         if (r < 0)
                 return r;
 
@@ -123,6 +123,23 @@ static void test_catalog_update(void) {
         assert_se(r >= 0);
 }
 
+static void test_catalog_lookup(void) {
+        _cleanup_(catalog_closep) Catalog *c = NULL;
+        _cleanup_free_ char *text = NULL, *text2 = NULL, *text3 = NULL;
+
+        assert_se(catalog_open(database, &c) >= 0);
+
+        assert_se(catalog_lookup(c, SD_MESSAGE_COREDUMP, &text) >= 0);
+        assert_se(catalog_lookup(c, SD_MESSAGE_COREDUMP, &text2) >= 0);
+        assert_se(streq(text, text2));
+
+        /* Replacing the database must be picked up by the cached
+         * mapping */
+        assert_se(catalog_update(database, NULL, catalog_dirs) >= 0);
+        assert_se(catalog_lookup(c, SD_MESSAGE_COREDUMP, &text3) >= 0);
+        assert_se(streq(text, text3));
+}
+
 static void test_catalog_file_lang(void) {
         _cleanup_free_ char *lang = NULL, *lang2 = NULL, *lang3 = NULL, *lang4 = NULL;
 
@@ -166,6 +183,8 @@ int main(int argc, char *argv[]) {
 
         test_catalog_update();
 
+        test_catalog_lookup();
+
         r = catalog_list(stdout, database, true);
         assert_se(r >= 0);
 
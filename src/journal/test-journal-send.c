@@ -24,12 +24,89 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "util.h"
+#include "journal-ring.h"
+#include "journald-native.h"
+
+static void test_ring_next(void) {
+        uint64_t data[8] = {}, length, need;
+        const uint8_t *d = (const uint8_t*) data;
+        const uint64_t size = sizeof(data);
+
+        /* Empty */
+        assert_se(native_ring_next(d, size, 0, 0, &length, &need) == 0);
+        assert_se(native_ring_next(d, size, 4711, 4711, &length, &need) == 0);
+
+        /* A regular record of 5 bytes, padded to 8 */
+        data[0] = 5;
+        assert_se(native_ring_next(d, size, 16, 0, &length, &need) > 0);
+        assert_se(length == 5);
+        assert_se(need == 16);
+
+        /* ... which must be published completely */
+        assert_se(native_ring_next(d, size, 8, 0, &length, &need) == -EBADMSG);
+
+        /* Empty records are fine */
+        data[0] = 0;
+        assert_se(native_ring_next(d, size, 8, 0, &length, &need) > 0);
+        assert_se(length == 0);
+        assert_se(need == 8);
+
+        /* head more than one ring ahead of tail, or behind it */
+        assert_se(native_ring_next(d, size, size + 8, 0, &length, &need) == -EBADMSG);
+        assert_se(native_ring_next(d, size, 0, 8, &length, &need) == -EBADMSG);
+
+        /* Oversized lengths, including ones that overflow when padded */
+        data[0] = size + 1;
+        assert_se(native_ring_next(d, size, size, 0, &length, &need) == -EBADMSG);
+        data[0] = UINT64_MAX - 1;
+        assert_se(native_ring_next(d, size, size, 0, &length, &need) == -EBADMSG);
+
+        /* A record crossing the end of the ring */
+        data[6] = 16;
+        assert_se(native_ring_next(d, size, 48 + 24, 48, &length, &need) == -EBADMSG);
+
+        /* A wrap marker skips the rest of the ring, which must have
+         * been published, too */
+        data[6] = JOURNAL_RING_WRAP;
+        assert_se(native_ring_next(d, size, 48 + 16, 48, &length, &need) > 0);
+        assert_se(length == JOURNAL_RING_WRAP);
+        assert_se(need == 16);
+        assert_se(native_ring_next(d, size, 48 + 8, 48, &length, &need) == -EBADMSG);
+
+        /* Free running counters may wrap around */
+        data[7] = 0;
+        assert_se(native_ring_next(d, size, 0, (uint64_t) -8, &length, &need) > 0);
+        assert_se(length == 0);
+        assert_se(need == 8);
+        assert_se(native_ring_next(d, size, 8, (uint64_t) -size - 16, &length, &need) == -EBADMSG);
+}
+
+static void test_ring(void) {
+        sd_journal_ring *r = NULL;
+        struct iovec iov[2];
+        unsigned i;
+
+        /* Registration fails if journald is not around, that's fine */
+        if (sd_journal_ring_open(&r, 0) < 0)
+                return;
+
+        IOVEC_SET_STRING(iov[0], "MESSAGE=Hello ring");
+        IOVEC_SET_STRING(iov[1], "PRIORITY=6");
+
+        for (i = 0; i < 16; i++)
+                assert_se(sd_journal_ring_sendv(r, iov, 2) >= 0);
+
+        sd_journal_ring_close(r);
+}
 
 int main(int argc, char *argv[]) {
         char huge[4096*1024];
 
         log_set_max_level(LOG_DEBUG);
 
+        test_ring_next();
+
         sd_journal_print(LOG_INFO, "piepapo");
 
         sd_journal_send("MESSAGE=foobar",
@@ -72,6 +149,8 @@ int main(int argc, char *argv[]) {
                         "N_CPUS=%li", sysconf(_SC_NPROCESSORS_ONLN),
                         NULL);
 
+        test_ring();
+
         sleep(1);
 
         return 0;
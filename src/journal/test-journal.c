@@ -167,6 +167,74 @@ static void test_empty(void) {
         journal_file_close(f4);
 }
 
+static void test_compact(void) {
+        JournalFile *f, *c;
+        char t[] = "/tmp/journal-XXXXXX";
+        Object *o;
+        uint64_t p = 0, q;
+        unsigned i;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < 1000; i++) {
+                char a[sizeof("N=") + DECIMAL_STR_MAX(unsigned)], b[sizeof("M=") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec[3];
+                dual_timestamp ts;
+
+                xsprintf(a, "N=%u", i);
+                xsprintf(b, "M=%u", i % 7);
+
+                IOVEC_SET_STRING(iovec[0], "TEST=compact");
+                IOVEC_SET_STRING(iovec[1], a);
+                IOVEC_SET_STRING(iovec[2], b);
+
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, iovec, 3, NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(journal_file_compact(f, "compact.journal", true, NULL, NULL) == 0);
+        assert_se(journal_file_open("compact.journal", O_RDONLY, 0, false, false, NULL, NULL, NULL, &c) == 0);
+
+        journal_file_print_header(c);
+
+        assert_se(c->header->state == STATE_ARCHIVED);
+        assert_se(sd_id128_equal(c->header->seqnum_id, f->header->seqnum_id));
+        assert_se(le64toh(c->header->n_entries) == 1000);
+        assert_se(le64toh(c->header->n_data) == le64toh(f->header->n_data));
+
+        /* One array for all entries, and one for each data object
+         * that is referenced more than once */
+        assert_se(le64toh(c->header->n_entry_arrays) == 1 + 1 + 7);
+        assert_se(le64toh(c->header->data_hash_table_size) / sizeof(HashItem) < 2 * le64toh(f->header->n_data));
+
+        for (i = 0; i < 1000; i++) {
+                uint64_t seqnum;
+
+                assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+                seqnum = le64toh(o->entry.seqnum);
+
+                assert_se(journal_file_move_to_entry_by_seqnum(c, seqnum, DIRECTION_DOWN, &o, &q) == 1);
+                assert_se(le64toh(o->entry.seqnum) == seqnum);
+        }
+
+        assert_se(journal_file_find_data_object(c, "M=3", 3, NULL, &q) == 1);
+        assert_se(journal_file_next_entry_for_data(c, NULL, 0, q, DIRECTION_UP, &o, NULL) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 998);
+
+        journal_file_close(c);
+        journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+}
+
 int main(int argc, char *argv[]) {
         arg_keep = argc > 1;
 
@@ -176,6 +244,7 @@ int main(int argc, char *argv[]) {
 
         test_non_empty();
         test_empty();
+        test_compact();
 
         return 0;
 }
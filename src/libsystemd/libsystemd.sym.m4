@@ -163,6 +163,13 @@ global:
         sd_pid_notify_with_fds;
 } LIBSYSTEMD_217;
 
+LIBSYSTEMD_220 {
+global:
+        sd_journal_ring_open;
+        sd_journal_ring_close;
+        sd_journal_ring_sendv;
+} LIBSYSTEMD_219;
+
 m4_ifdef(`ENABLE_KDBUS',
 LIBSYSTEMD_FUTURE {
 global:
@@ -383,6 +390,7 @@ global:
         sd_event_add_child;
         sd_event_add_defer;
         sd_event_add_exit;
+        sd_event_add_inotify;
         sd_event_wait;
         sd_event_prepare;
         sd_event_dispatch;
@@ -396,6 +404,31 @@ global:
         sd_event_get_exit_code;
         sd_event_set_watchdog;
         sd_event_get_watchdog;
+        sd_event_set_timer_wheel;
+        sd_event_get_timer_wheel;
+        sd_event_set_io_uring;
+        sd_event_get_io_uring;
+        sd_event_set_batch;
+        sd_event_get_batch;
+        sd_event_set_profile;
+        sd_event_get_profile;
+        sd_event_get_profile_descriptions;
+        sd_event_get_profile_stats;
+        sd_event_get_profile_histogram;
+        sd_event_set_slow_threshold;
+        sd_event_get_slow_threshold;
+        sd_event_set_coalesce;
+        sd_event_get_coalesce;
+        sd_event_get_wakeups;
+        sd_event_set_submit;
+        sd_event_get_submit;
+        sd_event_submit;
+        sd_event_group_new;
+        sd_event_group_ref;
+        sd_event_group_unref;
+        sd_event_group_get_n_events;
+        sd_event_group_get_event;
+        sd_event_group_submit;
         sd_event_source_ref;
         sd_event_source_unref;
         sd_event_source_set_description;
@@ -420,6 +453,7 @@ global:
         sd_event_source_get_time_clock;
         sd_event_source_get_signal;
         sd_event_source_get_child_pid;
+        sd_event_source_get_inotify_mask;
         sd_event_source_get_event;
 
         /* sd-utf8 */
@@ -28,15 +28,22 @@
 /*
  * Our default bloom filter has the following parameters:
  *
- * m=512   (bits in the filter)
+ * m=1024  (bits in the filter)
  * k=8     (hash functions)
  *
  * We use SipHash24 as hash function with a number of (originally
  * randomized) but fixed hash keys.
  *
+ * Signals carrying string lists add a few dozen entries to the
+ * filter, which saturates 512 bits quickly, while the cost of
+ * filling in a filter only depends on k, not on m. See
+ * test-bus-kernel-bloom for the false positive rates of a few
+ * parameter sets. The parameters are picked by whoever creates the
+ * bus, all peers read them back from the kernel on HELLO.
+ *
  */
 
-#define DEFAULT_BLOOM_SIZE (512/8) /* m: filter size */
+#define DEFAULT_BLOOM_SIZE (1024/8) /* m: filter size */
 #define DEFAULT_BLOOM_N_HASH 8     /* k: number of hash functions */
 
 void bloom_add_pair(uint64_t filter[], size_t size, unsigned n_hash, const char *a, const char *b);
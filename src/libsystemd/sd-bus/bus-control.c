@@ -713,6 +713,248 @@ fail:
         return r;
 }
 
+#define CREDS_CACHE_MATCH(name)                                         \
+        strjoina("type='signal',"                                       \
+                 "sender='org.freedesktop.DBus',"                       \
+                 "path='/org/freedesktop/DBus',"                        \
+                 "interface='org.freedesktop.DBus',"                    \
+                 "member='NameOwnerChanged',"                           \
+                 "arg0='", (name), "'")
+
+struct creds_cache_entry {
+        sd_bus *bus;
+        sd_bus_creds *creds;
+
+        /* Of the AddMatch call for this peer */
+        uint64_t cookie;
+};
+
+static void creds_cache_entry_free(struct creds_cache_entry *e) {
+        if (!e)
+                return;
+
+        sd_bus_creds_unref(e->creds);
+        free(e);
+}
+
+static void creds_cache_entry_unwatch(struct creds_cache_entry *e) {
+        if (!e)
+                return;
+
+        /* Nobody waits for this, see bus_remove_match_internal() */
+        (void) bus_remove_match_internal(e->bus, CREDS_CACHE_MATCH(e->creds->unique_name), 0);
+        creds_cache_entry_free(e);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(struct creds_cache_entry*, creds_cache_entry_unwatch);
+
+static int creds_cache_filter(sd_bus *bus, sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        const char *name, *old_owner, *new_owner;
+        int r;
+
+        assert(bus);
+        assert(m);
+
+        if (hashmap_isempty(bus->creds_cache))
+                return 0;
+
+        if (!sd_bus_message_is_signal(m, "org.freedesktop.DBus", "NameOwnerChanged") ||
+            !streq_ptr(m->sender, "org.freedesktop.DBus"))
+                return 0;
+
+        r = sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner);
+        if (r < 0)
+                return 0;
+
+        /* Unique names are never reused, hence we only need to drop
+         * the entry once the connection is gone */
+        if (isempty(new_owner))
+                creds_cache_entry_unwatch(hashmap_remove(bus->creds_cache, name));
+
+        return 0;
+}
+
+static int creds_cache_add_match_reply(sd_bus *bus, sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        struct creds_cache_entry *e;
+        uint64_t cookie;
+        Iterator i;
+
+        assert(bus);
+        assert(m);
+
+        if (!sd_bus_message_is_method_error(m, NULL))
+                return 0;
+
+        if (sd_bus_message_get_reply_cookie(m, &cookie) < 0)
+                return 0;
+
+        /* Without the match we would not learn when the peer goes
+         * away, hence forget it right-away */
+        HASHMAP_FOREACH(e, bus->creds_cache, i)
+                if (e->cookie == cookie) {
+                        log_debug("Failed to watch %s, not caching its credentials: %s",
+                                  e->creds->unique_name, strna(sd_bus_message_get_error(m)->message));
+
+                        hashmap_remove(bus->creds_cache, e->creds->unique_name);
+                        creds_cache_entry_free(e);
+                        break;
+                }
+
+        return 0;
+}
+
+int bus_creds_cache_enable(sd_bus *bus) {
+        int r;
+
+        assert(bus);
+
+        if (bus->creds_cache)
+                return 0;
+
+        /* The bus driver's idea of a peer's credentials never changes
+         * for the lifetime of its connection, hence we may cache them
+         * per unique name, as long as we learn when the connection
+         * goes away. This subscribes to NameOwnerChanged for every
+         * cached peer, hence only connections that dispatch incoming
+         * messages may enable this, or the signals would pile up in
+         * the read queue. */
+
+        if (bus->is_kernel || !bus->bus_client)
+                return -EOPNOTSUPP;
+
+        bus->creds_cache = hashmap_new(&string_hash_ops);
+        if (!bus->creds_cache)
+                return -ENOMEM;
+
+        /* All peers share one local filter, only the matches we ask
+         * the bus driver for are per peer */
+        r = sd_bus_add_filter(bus, NULL, creds_cache_filter, NULL);
+        if (r < 0) {
+                hashmap_free(bus->creds_cache);
+                bus->creds_cache = NULL;
+                return r;
+        }
+
+        return 1;
+}
+
+void bus_creds_cache_flush(sd_bus *bus) {
+        struct creds_cache_entry *e;
+        unsigned i;
+
+        assert(bus);
+
+        while ((e = hashmap_steal_first(bus->creds_cache)))
+                creds_cache_entry_free(e);
+
+        hashmap_free(bus->creds_cache);
+        bus->creds_cache = NULL;
+
+        for (i = 0; i < BUS_CREDS_CACHE_SEEN_MAX; i++) {
+                free(bus->creds_cache_seen[i]);
+                bus->creds_cache_seen[i] = NULL;
+        }
+}
+
+static bool creds_cache_seen(sd_bus *bus, const char *name) {
+        unsigned i;
+        char *n;
+
+        assert(bus);
+        assert(name);
+
+        /* Watching a peer costs us messages of our own, which
+         * doesn't pay off for peers that talk to us only once, like
+         * most clients of PID 1 do. Hence we only start caching
+         * when we are asked about a peer for the second time, and
+         * remember the last few peers for that. These don't need to
+         * be watched, since we store no data about them. */
+
+        for (i = 0; i < BUS_CREDS_CACHE_SEEN_MAX; i++)
+                if (streq_ptr(bus->creds_cache_seen[i], name))
+                        return true;
+
+        n = strdup(name);
+        if (!n)
+                return false;
+
+        i = bus->creds_cache_seen_next++ % BUS_CREDS_CACHE_SEEN_MAX;
+        free(bus->creds_cache_seen[i]);
+        bus->creds_cache_seen[i] = n;
+
+        return false;
+}
+
+static int creds_cache_watch(sd_bus *bus, const char *name, struct creds_cache_entry **ret) {
+        struct creds_cache_entry *e;
+        int r;
+
+        assert(bus);
+        assert(name);
+        assert(ret);
+
+        /* Subscribes to the disappearance of a peer we are about to
+         * cache. The bus driver processes our calls in order, hence
+         * it installs the match before it answers what we ask it
+         * about the peer next, and we cannot miss the peer going away
+         * in between. We don't wait for the reply, so that peers
+         * that talk to us only once don't cost us an extra round
+         * trip. */
+
+        e = new0(struct creds_cache_entry, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->bus = bus;
+
+        e->creds = bus_creds_new();
+        if (!e->creds) {
+                creds_cache_entry_free(e);
+                return -ENOMEM;
+        }
+
+        e->creds->unique_name = strdup(name);
+        if (!e->creds->unique_name) {
+                creds_cache_entry_free(e);
+                return -ENOMEM;
+        }
+
+        e->creds->mask |= SD_BUS_CREDS_UNIQUE_NAME;
+
+        r = bus_add_match_internal_async(bus, CREDS_CACHE_MATCH(name), creds_cache_add_match_reply, NULL, &e->cookie);
+        if (r < 0) {
+                creds_cache_entry_free(e);
+                return r;
+        }
+
+        *ret = e;
+        return 0;
+}
+
+static void creds_cache_put(sd_bus *bus, struct creds_cache_entry *e, pid_t pid, sd_bus_creds *c) {
+        assert(bus);
+        assert(e);
+
+        /* Remembers what the bus driver told us about a unique
+         * name. This is best-effort only. */
+
+        if (pid > 0) {
+                e->creds->pid = pid;
+                e->creds->mask |= SD_BUS_CREDS_PID;
+        }
+
+        if (c && (c->mask & SD_BUS_CREDS_EUID)) {
+                e->creds->euid = c->euid;
+                e->creds->mask |= SD_BUS_CREDS_EUID;
+        }
+
+        if (c && (c->mask & SD_BUS_CREDS_SELINUX_CONTEXT) && !(e->creds->mask & SD_BUS_CREDS_SELINUX_CONTEXT)) {
+                e->creds->label = strdup(c->label);
+                if (e->creds->label)
+                        e->creds->mask |= SD_BUS_CREDS_SELINUX_CONTEXT;
+        }
+}
+
 static int bus_get_name_creds_dbus1(
                 sd_bus *bus,
                 const char *name,
@@ -721,13 +963,28 @@ static int bus_get_name_creds_dbus1(
 
         _cleanup_bus_message_unref_ sd_bus_message *reply_unique = NULL, *reply = NULL;
         _cleanup_bus_creds_unref_ sd_bus_creds *c = NULL;
+        _cleanup_(creds_cache_entry_unwatchp) struct creds_cache_entry *watch = NULL;
+        struct creds_cache_entry *e = NULL;
+        sd_bus_creds *cached = NULL;
         const char *unique = NULL;
         pid_t pid = 0;
         int r;
 
+        /* An entry in the cache implies that the name still exists */
+        if (bus->creds_cache && name[0] == ':') {
+                e = hashmap_get(bus->creds_cache, name);
+                if (e)
+                        cached = e->creds;
+                else if (mask != 0 && creds_cache_seen(bus, name) && creds_cache_watch(bus, name, &watch) >= 0)
+                        e = watch;
+        }
+
+        if (cached)
+                unique = cached->unique_name;
+
         /* Only query the owner if the caller wants to know it or if
          * the caller just wants to check whether a name exists */
-        if ((mask & SD_BUS_CREDS_UNIQUE_NAME) || mask == 0) {
+        else if ((mask & SD_BUS_CREDS_UNIQUE_NAME) || mask == 0) {
                 r = sd_bus_call_method(
                                 bus,
                                 "org.freedesktop.DBus",
@@ -771,33 +1028,41 @@ static int bus_get_name_creds_dbus1(
 
                         uint32_t u;
 
-                        r = sd_bus_call_method(
-                                        bus,
-                                        "org.freedesktop.DBus",
-                                        "/org/freedesktop/DBus",
-                                        "org.freedesktop.DBus",
-                                        "GetConnectionUnixProcessID",
-                                        NULL,
-                                        &reply,
-                                        "s",
-                                        unique ? unique : name);
-                        if (r < 0)
-                                return r;
+                        if (cached && (cached->mask & SD_BUS_CREDS_PID))
+                                u = cached->pid;
+                        else {
+                                r = sd_bus_call_method(
+                                                bus,
+                                                "org.freedesktop.DBus",
+                                                "/org/freedesktop/DBus",
+                                                "org.freedesktop.DBus",
+                                                "GetConnectionUnixProcessID",
+                                                NULL,
+                                                &reply,
+                                                "s",
+                                                unique ? unique : name);
+                                if (r < 0)
+                                        return r;
 
-                        r = sd_bus_message_read(reply, "u", &u);
-                        if (r < 0)
-                                return r;
+                                r = sd_bus_message_read(reply, "u", &u);
+                                if (r < 0)
+                                        return r;
+
+                                reply = sd_bus_message_unref(reply);
+                        }
 
                         pid = u;
                         if (mask & SD_BUS_CREDS_PID) {
                                 c->pid = u;
                                 c->mask |= SD_BUS_CREDS_PID;
                         }
-
-                        reply = sd_bus_message_unref(reply);
                 }
 
-                if (mask & SD_BUS_CREDS_EUID) {
+                if ((mask & SD_BUS_CREDS_EUID) && cached && (cached->mask & SD_BUS_CREDS_EUID)) {
+                        c->euid = cached->euid;
+                        c->mask |= SD_BUS_CREDS_EUID;
+
+                } else if (mask & SD_BUS_CREDS_EUID) {
                         uint32_t u;
 
                         r = sd_bus_call_method(
@@ -823,7 +1088,14 @@ static int bus_get_name_creds_dbus1(
                         reply = sd_bus_message_unref(reply);
                 }
 
-                if (mask & SD_BUS_CREDS_SELINUX_CONTEXT) {
+                if ((mask & SD_BUS_CREDS_SELINUX_CONTEXT) && cached && (cached->mask & SD_BUS_CREDS_SELINUX_CONTEXT)) {
+                        c->label = strdup(cached->label);
+                        if (!c->label)
+                                return -ENOMEM;
+
+                        c->mask |= SD_BUS_CREDS_SELINUX_CONTEXT;
+
+                } else if (mask & SD_BUS_CREDS_SELINUX_CONTEXT) {
                         _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
                         const void *p = NULL;
                         size_t sz = 0;
@@ -854,6 +1126,13 @@ static int bus_get_name_creds_dbus1(
                         }
                 }
 
+                if (e) {
+                        creds_cache_put(bus, e, pid, c);
+
+                        if (watch && hashmap_put(bus->creds_cache, watch->creds->unique_name, watch) >= 0)
+                                watch = NULL;
+                }
+
                 r = bus_creds_add_more(c, mask, pid, 0);
                 if (r < 0)
                         return r;
@@ -1171,6 +1450,102 @@ static int add_name_change_match(sd_bus *bus,
         return 0;
 }
 
+bool bus_match_bloom(
+                const struct bus_match_component *components,
+                unsigned n_components,
+                void *bloom,
+                size_t size,
+                unsigned n_hash) {
+
+        bool using_bloom = false;
+        unsigned i;
+
+        assert(components || n_components == 0);
+        assert(bloom);
+
+        memzero(bloom, size);
+
+        for (i = 0; i < n_components; i++) {
+                const struct bus_match_component *c = &components[i];
+
+                switch (c->type) {
+
+                case BUS_MATCH_MESSAGE_TYPE:
+                        bloom_add_pair(bloom, size, n_hash, "message-type", bus_message_type_to_string(c->value_u8));
+                        using_bloom = true;
+                        break;
+
+                case BUS_MATCH_INTERFACE:
+                        bloom_add_pair(bloom, size, n_hash, "interface", c->value_str);
+                        using_bloom = true;
+                        break;
+
+                case BUS_MATCH_MEMBER:
+                        bloom_add_pair(bloom, size, n_hash, "member", c->value_str);
+                        using_bloom = true;
+                        break;
+
+                case BUS_MATCH_PATH:
+                        bloom_add_pair(bloom, size, n_hash, "path", c->value_str);
+                        using_bloom = true;
+                        break;
+
+                case BUS_MATCH_PATH_NAMESPACE:
+                        if (!streq(c->value_str, "/")) {
+                                bloom_add_pair(bloom, size, n_hash, "path-slash-prefix", c->value_str);
+                                using_bloom = true;
+                        }
+                        break;
+
+                case BUS_MATCH_ARG...BUS_MATCH_ARG_LAST: {
+                        char buf[sizeof("arg")-1 + 2 + 1];
+
+                        xsprintf(buf, "arg%i", c->type - BUS_MATCH_ARG);
+                        bloom_add_pair(bloom, size, n_hash, buf, c->value_str);
+                        using_bloom = true;
+                        break;
+                }
+
+                case BUS_MATCH_ARG_PATH...BUS_MATCH_ARG_PATH_LAST: {
+                        char buf[sizeof("arg")-1 + 2 + sizeof("-slash-prefix")];
+
+                        xsprintf(buf, "arg%i-slash-prefix", c->type - BUS_MATCH_ARG_PATH);
+                        bloom_add_pair(bloom, size, n_hash, buf, c->value_str);
+                        using_bloom = true;
+                        break;
+                }
+
+                case BUS_MATCH_ARG_NAMESPACE...BUS_MATCH_ARG_NAMESPACE_LAST: {
+                        char buf[sizeof("arg")-1 + 2 + sizeof("-dot-prefix")];
+
+                        xsprintf(buf, "arg%i-dot-prefix", c->type - BUS_MATCH_ARG_NAMESPACE);
+                        bloom_add_pair(bloom, size, n_hash, buf, c->value_str);
+                        using_bloom = true;
+                        break;
+                }
+
+                case BUS_MATCH_SENDER:
+                case BUS_MATCH_DESTINATION:
+                        /* The bloom filter includes neither the
+                           sender, which is matched by the kernel
+                           directly, nor the destination, since it
+                           is only available for broadcast messages
+                           which do not carry a destination since
+                           they are undirected. */
+                        break;
+
+                case BUS_MATCH_ROOT:
+                case BUS_MATCH_VALUE:
+                case BUS_MATCH_LEAF:
+                case _BUS_MATCH_NODE_TYPE_MAX:
+                case _BUS_MATCH_NODE_TYPE_INVALID:
+                        assert_not_reached("Invalid match type?");
+                }
+        }
+
+        return using_bloom;
+}
+
 int bus_add_match_internal_kernel(
                 sd_bus *bus,
                 struct bus_match_component *components,
@@ -1184,7 +1559,7 @@ int bus_add_match_internal_kernel(
         const char *sender = NULL;
         size_t sender_length = 0;
         uint64_t src_id = KDBUS_MATCH_ID_ANY;
-        bool using_bloom = false;
+        bool using_bloom;
         unsigned i;
         bool matches_name_change = true;
         const char *name_change_arg[3] = {};
@@ -1196,7 +1571,8 @@ int bus_add_match_internal_kernel(
         if (bus->hello_flags & KDBUS_HELLO_MONITOR)
                 return 0;
 
-        bloom = alloca0(bus->bloom_size);
+        bloom = alloca(bus->bloom_size);
+        using_bloom = bus_match_bloom(components, n_components, bloom, bus->bloom_size, bus->bloom_n_hash);
 
         sz = ALIGN8(offsetof(struct kdbus_cmd_match, items));
 
@@ -1225,87 +1601,31 @@ int bus_add_match_internal_kernel(
                 case BUS_MATCH_MESSAGE_TYPE:
                         if (c->value_u8 != SD_BUS_MESSAGE_SIGNAL)
                                 matches_name_change = false;
-
-                        bloom_add_pair(bloom, bus->bloom_size, bus->bloom_n_hash, "message-type", bus_message_type_to_string(c->value_u8));
-                        using_bloom = true;
                         break;
 
                 case BUS_MATCH_INTERFACE:
                         if (!streq(c->value_str, "org.freedesktop.DBus"))
                                 matches_name_change = false;
-
-                        bloom_add_pair(bloom, bus->bloom_size, bus->bloom_n_hash, "interface", c->value_str);
-                        using_bloom = true;
                         break;
 
                 case BUS_MATCH_MEMBER:
                         if (!streq(c->value_str, "NameOwnerChanged"))
                                 matches_name_change = false;
-
-                        bloom_add_pair(bloom, bus->bloom_size, bus->bloom_n_hash, "member", c->value_str);
-                        using_bloom = true;
                         break;
 
                 case BUS_MATCH_PATH:
                         if (!streq(c->value_str, "/org/freedesktop/DBus"))
                                 matches_name_change = false;
-
-                        bloom_add_pair(bloom, bus->bloom_size, bus->bloom_n_hash, "path", c->value_str);
-                        using_bloom = true;
-                        break;
-
-                case BUS_MATCH_PATH_NAMESPACE:
-                        if (!streq(c->value_str, "/")) {
-                                bloom_add_pair(bloom, bus->bloom_size, bus->bloom_n_hash, "path-slash-prefix", c->value_str);
-                                using_bloom = true;
-                        }
                         break;
 
-                case BUS_MATCH_ARG...BUS_MATCH_ARG_LAST: {
-                        char buf[sizeof("arg")-1 + 2 + 1];
-
+                case BUS_MATCH_ARG...BUS_MATCH_ARG_LAST:
                         if (c->type - BUS_MATCH_ARG < 3)
                                 name_change_arg[c->type - BUS_MATCH_ARG] = c->value_str;
-
-                        xsprintf(buf, "arg%i", c->type - BUS_MATCH_ARG);
-                        bloom_add_pair(bloom, bus->bloom_size, bus->bloom_n_hash, buf, c->value_str);
-                        using_bloom = true;
                         break;
-                }
-
-                case BUS_MATCH_ARG_PATH...BUS_MATCH_ARG_PATH_LAST: {
-                        char buf[sizeof("arg")-1 + 2 + sizeof("-slash-prefix")];
 
-                        xsprintf(buf, "arg%i-slash-prefix", c->type - BUS_MATCH_ARG_PATH);
-                        bloom_add_pair(bloom, bus->bloom_size, bus->bloom_n_hash, buf, c->value_str);
-                        using_bloom = true;
+                default:
                         break;
                 }
-
-                case BUS_MATCH_ARG_NAMESPACE...BUS_MATCH_ARG_NAMESPACE_LAST: {
-                        char buf[sizeof("arg")-1 + 2 + sizeof("-dot-prefix")];
-
-                        xsprintf(buf, "arg%i-dot-prefix", c->type - BUS_MATCH_ARG_NAMESPACE);
-                        bloom_add_pair(bloom, bus->bloom_size, bus->bloom_n_hash, buf, c->value_str);
-                        using_bloom = true;
-                        break;
-                }
-
-                case BUS_MATCH_DESTINATION:
-                        /* The bloom filter does not include
-                           the destination, since it is only
-                           available for broadcast messages
-                           which do not carry a destination
-                           since they are undirected. */
-                        break;
-
-                case BUS_MATCH_ROOT:
-                case BUS_MATCH_VALUE:
-                case BUS_MATCH_LEAF:
-                case _BUS_MATCH_NODE_TYPE_MAX:
-                case _BUS_MATCH_NODE_TYPE_INVALID:
-                        assert_not_reached("Invalid match type?");
-                }
         }
 
         if (using_bloom)
@@ -1384,6 +1704,48 @@ static int bus_add_match_internal_dbus1(
                         e);
 }
 
+int bus_add_match_internal_async(
+                sd_bus *bus,
+                const char *match,
+                sd_bus_message_handler_t callback,
+                void *userdata,
+                uint64_t *cookie) {
+
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        int r;
+
+        assert(bus);
+        assert(!bus->is_kernel);
+        assert(match);
+        assert(callback);
+
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
+        r = sd_bus_message_new_method_call(
+                        bus,
+                        &m,
+                        "org.freedesktop.DBus",
+                        "/org/freedesktop/DBus",
+                        "org.freedesktop.DBus",
+                        "AddMatch");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(m, "s", internal_match(bus, match));
+        if (r < 0)
+                return r;
+
+        r = sd_bus_call_async(bus, NULL, m, callback, userdata, 0);
+        if (r < 0)
+                return r;
+
+        if (cookie)
+                *cookie = BUS_MESSAGE_COOKIE(m);
+
+        return 0;
+}
+
 int bus_add_match_internal(
                 sd_bus *bus,
                 const char *match,
@@ -1426,23 +1788,36 @@ static int bus_remove_match_internal_dbus1(
                 sd_bus *bus,
                 const char *match) {
 
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
         const char *e;
+        int r;
 
         assert(bus);
         assert(match);
 
+        /* Matches are removed when the bus is freed, too */
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
         e = internal_match(bus, match);
 
-        return sd_bus_call_method(
+        /* Nobody looks at the outcome, hence don't wait for it
+         * either */
+        r = sd_bus_message_new_method_call(
                         bus,
+                        &m,
                         "org.freedesktop.DBus",
                         "/org/freedesktop/DBus",
                         "org.freedesktop.DBus",
-                        "RemoveMatch",
-                        NULL,
-                        NULL,
-                        "s",
-                        e);
+                        "RemoveMatch");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(m, "s", e);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(bus, m, NULL);
 }
 
 int bus_remove_match_internal(
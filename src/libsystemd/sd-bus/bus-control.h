@@ -25,9 +25,14 @@
 #include "bus-match.h"
 
 int bus_add_match_internal(sd_bus *bus, const char *match, struct bus_match_component *components, unsigned n_components, uint64_t cookie);
+int bus_add_match_internal_async(sd_bus *bus, const char *match, sd_bus_message_handler_t callback, void *userdata, uint64_t *cookie);
 int bus_remove_match_internal(sd_bus *bus, const char *match, uint64_t cookie);
 
 int bus_add_match_internal_kernel(sd_bus *bus, struct bus_match_component *components, unsigned n_components, uint64_t cookie);
+bool bus_match_bloom(const struct bus_match_component *components, unsigned n_components, void *bloom, size_t size, unsigned n_hash);
 int bus_remove_match_internal_kernel(sd_bus *bus, uint64_t cookie);
 
 int bus_get_name_creds_kdbus(sd_bus *bus, const char *name, uint64_t mask, bool allow_activator, sd_bus_creds **creds);
+
+int bus_creds_cache_enable(sd_bus *bus);
+void bus_creds_cache_flush(sd_bus *bus);
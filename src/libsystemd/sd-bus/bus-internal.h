@@ -112,6 +112,9 @@ struct node_vtable {
         const sd_bus_vtable *vtable;
         sd_bus_object_find_t find;
 
+        /* Introspection XML of the vtable, generated on first use */
+        char *introspection;
+
         unsigned last_iteration;
 
         LIST_FIELDS(struct node_vtable, vtables);
@@ -172,6 +175,16 @@ static inline bool BUS_IS_OPEN(enum bus_state state) {
         return state > BUS_UNSET && state < BUS_CLOSING;
 }
 
+/* Message buffers are cached per connection in power-of-two size
+ * classes, from 256 bytes to 64K */
+#define BUS_BUFFER_CLASS_SHIFT 8
+#define BUS_BUFFER_CLASSES 9
+#define BUS_BUFFER_CACHE_MAX 16
+
+/* How many peers we remember having looked up once, so that we start
+ * caching their credentials when they come back */
+#define BUS_CREDS_CACHE_SEEN_MAX 16
+
 enum bus_auth {
         _BUS_AUTH_INVALID,
         BUS_AUTH_EXTERNAL,
@@ -211,11 +224,18 @@ struct sd_bus {
         bool manual_peer_interface:1;
         bool is_system:1;
         bool is_user:1;
+        bool corked:1;
+        bool accept_memfd:1;
+        bool can_memfd:1;
+        bool properties_changed_flushing:1;
 
         int use_memfd;
 
         void *rbuffer;
         size_t rbuffer_size;
+        size_t rbuffer_allocated;
+        /* Messages before this offset were taken out of rbuffer already */
+        size_t rbuffer_offset;
 
         sd_bus_message **rqueue;
         unsigned rqueue_size;
@@ -237,9 +257,22 @@ struct sd_bus {
         LIST_HEAD(struct filter_callback, filter_callbacks);
 
         Hashmap *nodes;
+        Hashmap *node_chains;
         Hashmap *vtable_methods;
         Hashmap *vtable_properties;
 
+        /* Credentials of peers as reported by the bus driver, by
+         * unique name, see bus_creds_cache_enable() */
+        Hashmap *creds_cache;
+        char *creds_cache_seen[BUS_CREDS_CACHE_SEEN_MAX];
+        unsigned creds_cache_seen_next;
+
+        /* PropertiesChanged signals waiting to be coalesced, by
+         * object path, see
+         * bus_set_properties_changed_latency() */
+        OrderedHashmap *properties_changed;
+        usec_t properties_changed_latency;
+
         union sockaddr_union sockaddr;
         socklen_t sockaddr_size;
 
@@ -286,6 +319,13 @@ struct sd_bus {
         struct memfd_cache memfd_cache[MEMFD_CACHE_MAX];
         unsigned n_memfd_cache;
 
+        /* The same applies to the cache of message buffers */
+        pthread_mutex_t buffer_cache_mutex;
+        void *buffer_cache[BUS_BUFFER_CLASSES][BUS_BUFFER_CACHE_MAX];
+        unsigned n_buffer_cache[BUS_BUFFER_CLASSES];
+        uint64_t n_buffer_allocated;
+        uint64_t n_buffer_reused;
+
         pid_t original_pid;
 
         uint64_t hello_flags;
@@ -296,6 +336,7 @@ struct sd_bus {
         sd_event_source *input_io_event_source;
         sd_event_source *output_io_event_source;
         sd_event_source *time_event_source;
+        sd_event_source *properties_changed_event_source;
         sd_event_source *quit_event_source;
         sd_event *event;
         int event_priority;
@@ -367,6 +408,15 @@ int bus_next_address(sd_bus *bus);
 int bus_seal_synthetic_message(sd_bus *b, sd_bus_message *m);
 
 int bus_rqueue_make_room(sd_bus *bus);
+int bus_dispatch_wqueue(sd_bus *bus);
+
+int bus_call_batch(sd_bus *bus, sd_bus_message **m, unsigned n, uint64_t usec, sd_bus_error *error, sd_bus_message **reply);
+
+size_t bus_buffer_size(size_t size) _const_;
+void *bus_pop_buffer(sd_bus *bus, size_t size, size_t *allocated);
+void *bus_resize_buffer(sd_bus *bus, void *p, size_t size, size_t *allocated);
+void bus_push_buffer(sd_bus *bus, void *p, size_t allocated);
+void bus_flush_buffers(sd_bus *bus);
 
 bool bus_pid_changed(sd_bus *bus);
 
@@ -383,6 +433,12 @@ char *bus_address_escape(const char *v);
 #define BUS_DONT_DESTROY(bus) \
         _cleanup_bus_unref_ _unused_ sd_bus *_dont_destroy_##bus = sd_bus_ref(bus)
 
+/* Sealed memfds in message bodies smaller than this are copied into
+ * the socket, since passing them is more expensive than that */
+#define BUS_SOCKET_MEMFD_MIN_SIZE (64*1024)
+
+int bus_negotiate_memfd(sd_bus *bus, int b);
+
 int bus_set_address_system(sd_bus *bus);
 int bus_set_address_user(sd_bus *bus);
 int bus_set_address_system_remote(sd_bus *b, const char *host);
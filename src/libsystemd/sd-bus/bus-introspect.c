@@ -171,6 +171,48 @@ int introspect_write_interface(struct introspect *i, const sd_bus_vtable *v) {
         return 0;
 }
 
+int introspect_write_interface_cached(struct introspect *i, const sd_bus_vtable *v, char **cache) {
+        struct introspect j = {};
+        int r;
+
+        assert(i);
+        assert(v);
+        assert(cache);
+
+        if (*cache) {
+                fputs(*cache, i->f);
+                return 0;
+        }
+
+        j.trusted = i->trusted;
+        j.f = open_memstream(&j.introspection, &j.size);
+        if (!j.f)
+                return -ENOMEM;
+
+        r = introspect_write_interface(&j, v);
+        if (r < 0)
+                goto finish;
+
+        fflush(j.f);
+        if (ferror(j.f)) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        fclose(j.f);
+        j.f = NULL;
+
+        fputs(j.introspection, i->f);
+
+        *cache = j.introspection;
+        j.introspection = NULL;
+        r = 0;
+
+finish:
+        introspect_free(&j);
+        return r;
+}
+
 int introspect_finish(struct introspect *i, sd_bus *bus, sd_bus_message *m, sd_bus_message **reply) {
         sd_bus_message *q;
         int r;
@@ -38,5 +38,9 @@ int introspect_begin(struct introspect *i, bool trusted);
 int introspect_write_default_interfaces(struct introspect *i, bool object_manager);
 int introspect_write_child_nodes(struct introspect *i, Set *s, const char *prefix);
 int introspect_write_interface(struct introspect *i, const sd_bus_vtable *v);
+
+/* Same as introspect_write_interface(), but formats the vtable only
+ * on the first invocation and keeps the XML in *cache for later ones */
+int introspect_write_interface_cached(struct introspect *i, const sd_bus_vtable *v, char **cache);
 int introspect_finish(struct introspect *i, sd_bus *bus, sd_bus_message *m, sd_bus_message **reply);
 void introspect_free(struct introspect *i);
@@ -162,34 +162,35 @@ static void add_bloom_arg(void *data, size_t size, unsigned n_hash, unsigned i,
         *e = 0;
         bloom_add_pair(data, size, n_hash, buf, t);
 
+        /* arg0namespace= and arg0path= also match the argument
+         * itself, hence add it in full, too, like the path */
         strcpy(e, "-dot-prefix");
+        bloom_add_pair(data, size, n_hash, buf, t);
         bloom_add_prefixes(data, size, n_hash, buf, t, '.');
         strcpy(e, "-slash-prefix");
+        bloom_add_pair(data, size, n_hash, buf, t);
         bloom_add_prefixes(data, size, n_hash, buf, t, '/');
 }
 
-static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter *bloom) {
-        void *data;
+int bus_message_bloom(sd_bus_message *m, void *data, size_t size, unsigned n_hash) {
         unsigned i;
         int r;
 
         assert(m);
-        assert(bloom);
+        assert(data);
 
-        data = bloom->data;
-        memzero(data, m->bus->bloom_size);
-        bloom->generation = 0;
+        memzero(data, size);
 
-        bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "message-type", bus_message_type_to_string(m->header->type));
+        bloom_add_pair(data, size, n_hash, "message-type", bus_message_type_to_string(m->header->type));
 
         if (m->interface)
-                bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "interface", m->interface);
+                bloom_add_pair(data, size, n_hash, "interface", m->interface);
         if (m->member)
-                bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "member", m->member);
+                bloom_add_pair(data, size, n_hash, "member", m->member);
         if (m->path) {
-                bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path", m->path);
-                bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path-slash-prefix", m->path);
-                bloom_add_prefixes(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path-slash-prefix", m->path, '/');
+                bloom_add_pair(data, size, n_hash, "path", m->path);
+                bloom_add_pair(data, size, n_hash, "path-slash-prefix", m->path);
+                bloom_add_prefixes(data, size, n_hash, "path-slash-prefix", m->path, '/');
         }
 
         r = sd_bus_message_rewind(m, true);
@@ -211,8 +212,8 @@ static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter
                         if (r < 0)
                                 return r;
 
-                        add_bloom_arg(data, m->bus->bloom_size, m->bus->bloom_n_hash, i, t);
-                } if (type == SD_BUS_TYPE_ARRAY && STR_IN_SET(contents, "s", "o", "g")) {
+                        add_bloom_arg(data, size, n_hash, i, t);
+                } else if (type == SD_BUS_TYPE_ARRAY && STR_IN_SET(contents, "s", "o", "g")) {
 
                         /* As well as array of simple strings of any kinds */
                         r = sd_bus_message_enter_container(m, type, contents);
@@ -220,7 +221,7 @@ static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter
                                 return r;
 
                         while ((r = sd_bus_message_read_basic(m, contents[0], &t)) > 0)
-                                add_bloom_arg(data, m->bus->bloom_size, m->bus->bloom_n_hash, i, t);
+                                add_bloom_arg(data, size, n_hash, i, t);
                         if (r < 0)
                                 return r;
 
@@ -238,6 +239,15 @@ static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter
         return 0;
 }
 
+static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter *bloom) {
+        assert(m);
+        assert(bloom);
+
+        bloom->generation = 0;
+
+        return bus_message_bloom(m, bloom->data, m->bus->bloom_size, m->bus->bloom_n_hash);
+}
+
 static int bus_message_setup_kmsg(sd_bus *b, sd_bus_message *m) {
         struct bus_body_part *part;
         struct kdbus_item *d;
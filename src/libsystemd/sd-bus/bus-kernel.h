@@ -95,3 +95,5 @@ int bus_kernel_fix_attach_mask(void);
 int bus_kernel_get_bus_name(sd_bus *bus, char **name);
 
 int bus_kernel_cmd_free(sd_bus *bus, uint64_t offset);
+
+int bus_message_bloom(sd_bus_message *m, void *data, size_t size, unsigned n_hash);
@@ -67,10 +67,33 @@ static inline bool BUS_MATCH_IS_COMPARE(enum bus_match_node_type t) {
 }
 
 static inline bool BUS_MATCH_CAN_HASH(enum bus_match_node_type t) {
-        return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH) ||
-                (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST);
+        /* Prefix matches are hashed too, they are looked up by
+         * each prefix of the tested value. Only sender matches need
+         * to be iterated, since dbus-daemon does not tell us the
+         * well-known names of the sender. */
+        return t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_ARG_NAMESPACE_LAST;
 }
 
+static inline char BUS_MATCH_SEPARATOR(enum bus_match_node_type t) {
+        if (t == BUS_MATCH_PATH_NAMESPACE || (t >= BUS_MATCH_ARG_PATH && t <= BUS_MATCH_ARG_PATH_LAST))
+                return '/';
+
+        if (t >= BUS_MATCH_ARG_NAMESPACE && t <= BUS_MATCH_ARG_NAMESPACE_LAST)
+                return '.';
+
+        return 0;
+}
+
+/* Message arguments, extracted once per message and only as far as
+ * some match asks for them */
+struct match_args {
+        sd_bus_message *message;
+        unsigned n_args;
+        int error;
+        const char *str[64];
+        char **strv[64];
+};
+
 static void bus_match_node_free(struct bus_match_node *node) {
         assert(node);
         assert(node->parent);
@@ -260,17 +283,241 @@ static bool value_node_same(
         }
 }
 
-int bus_match_run(
+static int match_args_get(struct match_args *a, unsigned i, const char **str, char ***strv) {
+        sd_bus_message *m;
+        unsigned j;
+        int r;
+
+        assert(a);
+        assert(i < ELEMENTSOF(a->str));
+        assert(str);
+        assert(strv);
+
+        m = a->message;
+
+        if (i >= a->n_args && a->error == 0) {
+
+                /* Callbacks might have read from the message since
+                 * we extracted the last argument, hence start over
+                 * and skip what we have already */
+                r = sd_bus_message_rewind(m, true);
+                if (r < 0)
+                        goto fail;
+
+                for (j = 0; j < a->n_args; j++) {
+                        r = sd_bus_message_skip(m, NULL);
+                        if (r < 0)
+                                goto fail;
+                }
+
+                while (a->n_args <= i) {
+                        const char *contents;
+                        char type;
+
+                        r = sd_bus_message_peek_type(m, &type, &contents);
+                        if (r < 0)
+                                goto fail;
+                        if (r == 0) {
+                                r = -ENXIO;
+                                goto fail;
+                        }
+
+                        /* Don't match against arguments after the first one we don't understand */
+                        if (!IN_SET(type, SD_BUS_TYPE_STRING, SD_BUS_TYPE_OBJECT_PATH, SD_BUS_TYPE_SIGNATURE) &&
+                            !(type == SD_BUS_TYPE_ARRAY && STR_IN_SET(contents, "s", "o", "g"))) {
+                                r = -ENXIO;
+                                goto fail;
+                        }
+
+                        if (type == SD_BUS_TYPE_ARRAY) {
+                                r = sd_bus_message_read_strv(m, &a->strv[a->n_args]);
+                                if (r < 0)
+                                        goto fail;
+
+                                a->str[a->n_args] = NULL;
+                        } else {
+                                r = sd_bus_message_read_basic(m, type, &a->str[a->n_args]);
+                                if (r < 0)
+                                        goto fail;
+
+                                a->strv[a->n_args] = NULL;
+                        }
+
+                        a->n_args++;
+                }
+        }
+
+        if (i >= a->n_args)
+                return a->error;
+
+        *str = a->str[i];
+        *strv = a->strv[i];
+        return 0;
+
+fail:
+        a->error = r;
+        return r;
+}
+
+static void match_args_done(struct match_args *a) {
+        unsigned i;
+
+        assert(a);
+
+        for (i = 0; i < a->n_args; i++)
+                strv_free(a->strv[i]);
+}
+
+static int match_run(sd_bus *bus, struct bus_match_node *node, sd_bus_message *m, struct match_args *args);
+
+static int match_run_key(
                 sd_bus *bus,
                 struct bus_match_node *node,
-                sd_bus_message *m) {
+                char *key,
+                size_t n,
+                sd_bus_message *m,
+                struct match_args *args) {
 
-        _cleanup_strv_free_ char **test_strv = NULL;
+        struct bus_match_node *found;
+        char c;
+
+        /* Looks up the first n characters of key */
+
+        c = key[n];
+        key[n] = 0;
+        found = hashmap_get(node->compare.children, key);
+        key[n] = c;
+
+        if (!found)
+                return 0;
+
+        return match_run(bus, found, m, args);
+}
+
+static int match_run_value(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value,
+                sd_bus_message *m,
+                struct match_args *args) {
+
+        _cleanup_free_ char *buffer = NULL;
+        struct bus_match_node *c;
+        Iterator i;
+        size_t l, k;
+        char sep, *p;
+        int r;
+
+        assert(node);
+        assert(value);
+
+        c = hashmap_get(node->compare.children, value);
+        if (c) {
+                r = match_run(bus, c, m, args);
+                if (r != 0)
+                        return r;
+        }
+
+        sep = BUS_MATCH_SEPARATOR(node->type);
+        if (sep == 0)
+                return 0;
+
+        if (bus && bus->match_callbacks_modified)
+                return 0;
+
+        /* We need a writable copy with room for one more character */
+        l = strlen(value);
+        if (l < 256)
+                p = alloca(l + 2);
+        else {
+                p = buffer = malloc(l + 2);
+                if (!p)
+                        return -ENOMEM;
+        }
+        memcpy(p, value, l + 1);
+
+        /* The sets of prefixes looked up below are disjoint, so that
+         * no match is run twice for the same value. See
+         * simple_pattern_check() and complex_pattern_check() for the
+         * semantics. */
+
+        if (node->type == BUS_MATCH_PATH_NAMESPACE ||
+            (node->type >= BUS_MATCH_ARG_NAMESPACE && node->type <= BUS_MATCH_ARG_NAMESPACE_LAST)) {
+
+                /* "/foo" matches "/foo/bar", "foo" matches "foo.bar" */
+                for (k = 0; k < l; k++)
+                        if (p[k] == sep) {
+                                r = match_run_key(bus, node, p, k, m, args);
+                                if (r != 0)
+                                        return r;
+
+                                if (bus && bus->match_callbacks_modified)
+                                        return 0;
+                        }
+
+                return 0;
+        }
+
+        /* "/foo/" matches "/foo/bar" */
+        for (k = 0; k + 1 < l; k++)
+                if (p[k] == sep) {
+                        r = match_run_key(bus, node, p, k + 1, m, args);
+                        if (r != 0)
+                                return r;
+
+                        if (bus && bus->match_callbacks_modified)
+                                return 0;
+                }
+
+        if (l == 0 || p[l-1] != sep) {
+                /* "/foo/" matches "/foo" */
+                p[l] = sep;
+                p[l+1] = 0;
+
+                return match_run_key(bus, node, p, l + 1, m, args);
+        }
+
+        /* "/foo" matches "/foo/", unless that's covered by the
+         * prefixes above already */
+        if (l < 2 || p[l-2] != sep) {
+                r = match_run_key(bus, node, p, l - 1, m, args);
+                if (r != 0)
+                        return r;
+
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
+        }
+
+        /* "/foo/bar" matches "/foo/". This is the only case we cannot
+         * look up, but values ending in the separator are rare. */
+        HASHMAP_FOREACH(c, node->compare.children, i) {
+                if (strlen(c->value.str) <= l || !startswith(c->value.str, p))
+                        continue;
+
+                r = match_run(bus, c, m, args);
+                if (r != 0)
+                        return r;
+
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
+        }
+
+        return 0;
+}
+
+static int match_run(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                sd_bus_message *m,
+                struct match_args *args) {
+
+        char **test_strv = NULL;
         const char *test_str = NULL;
         uint8_t test_u8 = 0;
         int r;
 
         assert(m);
+        assert(args);
 
         if (!node)
                 return 0;
@@ -279,8 +526,8 @@ int bus_match_run(
                 return 0;
 
         /* Not these special semantics: when traversing the tree we
-         * usually let bus_match_run() when called for a node
-         * recursively invoke bus_match_run(). There's are two
+         * usually let match_run() when called for a node
+         * recursively invoke match_run(). There's are two
          * exceptions here though, which are BUS_NODE_ROOT (which
          * cannot have a sibling), and BUS_NODE_VALUE (whose siblings
          * are invoked anyway by its parent. */
@@ -293,7 +540,7 @@ int bus_match_run(
                  * we won't call any. The children of the root node
                  * are compares or leaves, they will automatically
                  * call their siblings. */
-                return bus_match_run(bus, node->child, m);
+                return match_run(bus, node->child, m, args);
 
         case BUS_MATCH_VALUE:
 
@@ -303,7 +550,7 @@ int bus_match_run(
                  * automatically call their siblings */
 
                 assert(node->child);
-                return bus_match_run(bus, node->child, m);
+                return match_run(bus, node->child, m, args);
 
         case BUS_MATCH_LEAF:
 
@@ -344,7 +591,7 @@ int bus_match_run(
                                 return 0;
                 }
 
-                return bus_match_run(bus, node->next, m);
+                return match_run(bus, node->next, m, args);
 
         case BUS_MATCH_MESSAGE_TYPE:
                 test_u8 = m->header->type;
@@ -373,15 +620,15 @@ int bus_match_run(
                 break;
 
         case BUS_MATCH_ARG ... BUS_MATCH_ARG_LAST:
-                (void) bus_message_get_arg(m, node->type - BUS_MATCH_ARG, &test_str, &test_strv);
+                (void) match_args_get(args, node->type - BUS_MATCH_ARG, &test_str, &test_strv);
                 break;
 
         case BUS_MATCH_ARG_PATH ... BUS_MATCH_ARG_PATH_LAST:
-                (void) bus_message_get_arg(m, node->type - BUS_MATCH_ARG_PATH, &test_str, &test_strv);
+                (void) match_args_get(args, node->type - BUS_MATCH_ARG_PATH, &test_str, &test_strv);
                 break;
 
         case BUS_MATCH_ARG_NAMESPACE ... BUS_MATCH_ARG_NAMESPACE_LAST:
-                (void) bus_message_get_arg(m, node->type - BUS_MATCH_ARG_NAMESPACE, &test_str, &test_strv);
+                (void) match_args_get(args, node->type - BUS_MATCH_ARG_NAMESPACE, &test_str, &test_strv);
                 break;
 
         default:
@@ -393,30 +640,28 @@ int bus_match_run(
 
                 /* Lookup via hash table, nice! So let's jump directly. */
 
-                if (test_str)
-                        found = hashmap_get(node->compare.children, test_str);
-                else if (test_strv) {
+                if (test_str) {
+                        r = match_run_value(bus, node, test_str, m, args);
+                        if (r != 0)
+                                return r;
+                } else if (test_strv) {
                         char **i;
 
                         STRV_FOREACH(i, test_strv) {
-                                found = hashmap_get(node->compare.children, *i);
-                                if (found) {
-                                        r = bus_match_run(bus, found, m);
-                                        if (r != 0)
-                                                return r;
-                                }
-                        }
+                                r = match_run_value(bus, node, *i, m, args);
+                                if (r != 0)
+                                        return r;
 
-                        found = NULL;
-                } else if (node->type == BUS_MATCH_MESSAGE_TYPE)
+                                if (bus && bus->match_callbacks_modified)
+                                        return 0;
+                        }
+                } else if (node->type == BUS_MATCH_MESSAGE_TYPE) {
                         found = hashmap_get(node->compare.children, UINT_TO_PTR(test_u8));
-                else
-                        found = NULL;
-
-                if (found) {
-                        r = bus_match_run(bus, found, m);
-                        if (r != 0)
-                                return r;
+                        if (found) {
+                                r = match_run(bus, found, m, args);
+                                if (r != 0)
+                                        return r;
+                        }
                 }
         } else {
                 struct bus_match_node *c;
@@ -427,7 +672,7 @@ int bus_match_run(
                         if (!value_node_test(c, node->type, test_u8, test_str, test_strv, m))
                                 continue;
 
-                        r = bus_match_run(bus, c, m);
+                        r = match_run(bus, c, m, args);
                         if (r != 0)
                                 return r;
                 }
@@ -437,7 +682,25 @@ int bus_match_run(
                 return 0;
 
         /* And now, let's invoke our siblings */
-        return bus_match_run(bus, node->next, m);
+        return match_run(bus, node->next, m, args);
+}
+
+int bus_match_run(
+                sd_bus *bus,
+                struct bus_match_node *root,
+                sd_bus_message *m) {
+
+        struct match_args args = {
+                .message = m,
+        };
+        int r;
+
+        assert(m);
+
+        r = match_run(bus, root, m, &args);
+        match_args_done(&args);
+
+        return r;
 }
 
 static int bus_match_add_compare_value(
@@ -79,7 +79,7 @@ static void message_free_part(sd_bus_message *m, struct bus_body_part *part) {
         } else if (part->munmap_this)
                 munmap(part->mmap_begin, part->mapped);
         else if (part->free_this)
-                free(part->data);
+                bus_push_buffer(m->bus, part->data, part->allocated);
 
         if (part != &m->body)
                 free(part);
@@ -125,7 +125,7 @@ static void message_free(sd_bus_message *m) {
         assert(m);
 
         if (m->free_header)
-                free(m->header);
+                bus_push_buffer(m->bus, m->header, m->header_allocated);
 
         message_reset_parts(m);
 
@@ -181,15 +181,18 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, b
                 return (uint8_t*) m->header + old_size;
 
         if (m->free_header) {
-                np = realloc(m->header, ALIGN8(new_size));
-                if (!np)
-                        goto poison;
+                if (ALIGN8(new_size) > m->header_allocated) {
+                        np = bus_resize_buffer(m->bus, m->header, ALIGN8(new_size), &m->header_allocated);
+                        if (!np)
+                                goto poison;
+                } else
+                        np = m->header;
         } else {
                 /* Initially, the header is allocated as part of of
                  * the sd_bus_message itself, let's replace it by
                  * dynamic data */
 
-                np = malloc(ALIGN8(new_size));
+                np = bus_pop_buffer(m->bus, ALIGN8(new_size), &m->header_allocated);
                 if (!np)
                         goto poison;
 
@@ -1294,8 +1297,7 @@ static int part_make_space(
                 if (part->allocated == 0 || sz > part->allocated) {
                         size_t new_allocated;
 
-                        new_allocated = sz > 0 ? 2 * sz : 64;
-                        n = realloc(part->data, new_allocated);
+                        n = bus_resize_buffer(m->bus, part->data, sz > 0 ? 2 * sz : 64, &new_allocated);
                         if (!n) {
                                 m->poisoned = true;
                                 return -ENOMEM;
@@ -2922,6 +2924,86 @@ static int bus_message_close_header(sd_bus_message *m) {
         return 0;
 }
 
+static int message_append_field_memfds(sd_bus_message *m) {
+        struct bus_body_part *part;
+        size_t offset = 0;
+        uint64_t *q;
+        uint8_t *p;
+        unsigned i;
+
+        assert(m);
+        assert(!BUS_MESSAGE_IS_GVARIANT(m));
+        assert(m->n_out_of_band > 0);
+
+        /* (field id byte + (signature length + signature 'at' + NUL) +
+         * array length + padding + (body offset, memfd offset, size) triplets) */
+        p = message_extend_fields(m, 8, 16 + 24 * m->n_out_of_band, false);
+        if (!p)
+                return -ENOMEM;
+
+        p[0] = BUS_MESSAGE_HEADER_MEMFDS;
+        p[1] = 2;
+        p[2] = SD_BUS_TYPE_ARRAY;
+        p[3] = SD_BUS_TYPE_UINT64;
+        p[4] = 0;
+        memzero(p + 5, 3);
+        ((uint32_t*) p)[2] = 24 * m->n_out_of_band;
+        ((uint32_t*) p)[3] = 0;
+
+        q = (uint64_t*) (p + 16);
+        MESSAGE_FOREACH_PART(part, i, m) {
+                if (!part->out_of_band) {
+                        offset += part->size;
+                        continue;
+                }
+
+                *(q++) = offset;
+                *(q++) = part->memfd_offset;
+                *(q++) = part->size;
+        }
+
+        return 0;
+}
+
+static int message_setup_out_of_band(sd_bus_message *m) {
+        struct bus_body_part *part;
+        unsigned i;
+        int r;
+
+        assert(m);
+
+        /* On socket connections where the peer agreed to it, pass
+         * sealed memfds of sufficient size along with the message,
+         * instead of copying their contents into the socket. */
+
+        if (!m->bus || !m->bus->can_memfd || m->bus->is_kernel)
+                return 0;
+
+        if (BUS_MESSAGE_IS_GVARIANT(m))
+                return 0;
+
+        MESSAGE_FOREACH_PART(part, i, m) {
+                if (part->memfd < 0 || !part->sealed || part->size < BUS_SOCKET_MEMFD_MIN_SIZE)
+                        continue;
+
+                if (m->n_fds + m->n_out_of_band >= BUS_FDS_MAX)
+                        break;
+
+                part->out_of_band = true;
+                m->n_out_of_band++;
+                m->out_of_band_size += part->size;
+        }
+
+        if (m->n_out_of_band <= 0)
+                return 0;
+
+        r = message_append_field_memfds(m);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
 int bus_message_seal(sd_bus_message *m, uint64_t cookie, usec_t timeout) {
         struct bus_body_part *part;
         size_t a;
@@ -2969,10 +3051,19 @@ int bus_message_seal(sd_bus_message *m, uint64_t cookie, usec_t timeout) {
                         return r;
         }
 
+        r = message_setup_out_of_band(m);
+        if (r < 0)
+                return r;
+
         r = bus_message_close_header(m);
         if (r < 0)
                 return r;
 
+        /* The peer learns about the out-of-band parts only from the
+         * fields, hence the header carries what is actually written */
+        if (m->n_out_of_band > 0)
+                m->header->dbus1.body_size = m->body_size - m->out_of_band_size;
+
         if (BUS_MESSAGE_IS_GVARIANT(m))
                 m->header->dbus2.cookie = cookie;
         else
@@ -5143,11 +5234,178 @@ static int message_skip_fields(
         }
 }
 
+static int message_peek_field_memfds(
+                sd_bus_message *m,
+                size_t *ri,
+                const uint64_t **ret,
+                unsigned *n) {
+
+        uint32_t l;
+        void *q;
+        int r;
+
+        assert(m);
+        assert(ri);
+        assert(ret);
+        assert(n);
+
+        r = message_peek_field_uint32(m, ri, (size_t) -1, &l);
+        if (r < 0)
+                return r;
+
+        if (l <= 0 || l % 24 != 0 || l / 24 > BUS_FDS_MAX)
+                return -EBADMSG;
+
+        r = message_peek_fields(m, ri, 8, l, &q);
+        if (r < 0)
+                return r;
+
+        *ret = q;
+        *n = l / 24;
+
+        return 0;
+}
+
+static int message_splice_memfds(
+                sd_bus_message *m,
+                const uint64_t *memfds,
+                unsigned n_memfds,
+                unsigned first_fd) {
+
+        _cleanup_free_ struct bus_body_part **parts = NULL;
+        struct bus_body_part *part, *last = NULL;
+        uint64_t begin = 0, total = 0;
+        unsigned i, n_parts = 0, k = 0;
+        uint8_t *data;
+        int r;
+
+        assert(m);
+        assert(memfds);
+        assert(n_memfds > 0);
+        assert(first_fd + n_memfds == m->n_fds);
+
+        /* The body we read from the socket lacks the parts that were
+         * passed as memfds. Validate what the peer claims about them,
+         * then insert them where they belong. This cannot fail after
+         * the validation, so that the memfds stay owned by the caller
+         * on failure. */
+
+        for (i = 0; i < n_memfds; i++) {
+                uint64_t offset, memfd_offset, size, memfd_size = 0;
+                int fd;
+
+                offset = BUS_MESSAGE_BSWAP64(m, memfds[i*3]);
+                memfd_offset = BUS_MESSAGE_BSWAP64(m, memfds[i*3+1]);
+                size = BUS_MESSAGE_BSWAP64(m, memfds[i*3+2]);
+
+                if (offset < begin || offset > m->body_size)
+                        return -EBADMSG;
+                if (size <= 0 || memfd_offset + size < memfd_offset)
+                        return -EBADMSG;
+                if (total + size < total || m->body_size + total + size > SIZE_MAX)
+                        return -EBADMSG;
+
+                fd = m->fds[first_fd + i];
+
+                r = memfd_get_sealed(fd);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -EBADMSG;
+
+                r = memfd_get_size(fd, &memfd_size);
+                if (r < 0)
+                        return r;
+                if (memfd_offset + size > memfd_size)
+                        return -EBADMSG;
+
+                if (offset > begin)
+                        n_parts++;
+                n_parts++;
+
+                begin = offset;
+                total += size;
+        }
+
+        if (m->body_size > begin)
+                n_parts++;
+
+        /* The first part is embedded in the message, allocate the rest */
+        parts = new0(struct bus_body_part*, n_parts);
+        if (!parts)
+                return -ENOMEM;
+
+        for (i = 1; i < n_parts; i++) {
+                parts[i] = new0(struct bus_body_part, 1);
+                if (!parts[i]) {
+                        while (--i > 0)
+                                free(parts[i]);
+                        return -ENOMEM;
+                }
+        }
+
+        parts[0] = &m->body;
+        data = m->n_body_parts > 0 ? m->body.data : NULL;
+        zero(m->body);
+
+        begin = 0;
+        for (i = 0; i <= n_memfds; i++) {
+                uint64_t offset;
+
+                offset = i < n_memfds ? BUS_MESSAGE_BSWAP64(m, memfds[i*3]) : m->body_size;
+
+                if (offset > begin) {
+                        part = parts[k++];
+                        part->data = data + begin;
+                        part->size = offset - begin;
+                        part->memfd = -1;
+                        part->sealed = true;
+
+                        if (last)
+                                last->next = part;
+                        last = part;
+                }
+
+                if (i >= n_memfds)
+                        break;
+
+                part = parts[k++];
+                part->memfd = m->fds[first_fd + i];
+                part->memfd_offset = BUS_MESSAGE_BSWAP64(m, memfds[i*3+1]);
+                part->size = BUS_MESSAGE_BSWAP64(m, memfds[i*3+2]);
+                part->sealed = true;
+                part->out_of_band = true;
+
+                if (last)
+                        last->next = part;
+                last = part;
+
+                begin = offset;
+        }
+
+        assert(k == n_parts);
+
+        m->body_end = last;
+        m->n_body_parts = n_parts;
+        m->cached_rindex_part = NULL;
+        m->cached_rindex_part_begin = 0;
+
+        m->n_fds = first_fd;
+        m->n_out_of_band = n_memfds;
+        m->out_of_band_size = total;
+        m->body_size += total;
+        m->user_body_size = m->body_size;
+
+        return 0;
+}
+
 int bus_message_parse_fields(sd_bus_message *m) {
         size_t ri;
         int r;
         uint32_t unix_fds = 0;
         bool unix_fds_set = false;
+        const uint64_t *memfds = NULL;
+        unsigned n_memfds = 0;
         void *offsets = NULL;
         unsigned n_offsets = 0;
         size_t sz = 0;
@@ -5436,6 +5694,26 @@ int bus_message_parse_fields(sd_bus_message *m) {
                         unix_fds_set = true;
                         break;
 
+                case BUS_MESSAGE_HEADER_MEMFDS:
+                        if (BUS_MESSAGE_IS_GVARIANT(m)) /* only applies to dbus1 */
+                                return -EBADMSG;
+
+                        /* Only valid if we agreed to it */
+                        if (!m->bus || !m->bus->can_memfd)
+                                return -EBADMSG;
+
+                        if (memfds)
+                                return -EBADMSG;
+
+                        if (!streq(signature, "at"))
+                                return -EBADMSG;
+
+                        r = message_peek_field_memfds(m, &ri, &memfds, &n_memfds);
+                        if (r < 0)
+                                return -EBADMSG;
+
+                        break;
+
                 default:
                         if (!BUS_MESSAGE_IS_GVARIANT(m))
                                 r = message_skip_fields(m, &ri, (uint32_t) -1, (const char **) &signature);
@@ -5447,7 +5725,8 @@ int bus_message_parse_fields(sd_bus_message *m) {
                 i++;
         }
 
-        if (m->n_fds != unix_fds)
+        /* Memfds passed in place of body parts follow the regular fds */
+        if (m->n_fds != unix_fds + n_memfds)
                 return -EBADMSG;
 
         switch (m->header->type) {
@@ -5492,6 +5771,12 @@ int bus_message_parse_fields(sd_bus_message *m) {
         if (streq_ptr(m->sender, "org.freedesktop.DBus.Local"))
                 return -EBADMSG;
 
+        if (n_memfds > 0) {
+                r = message_splice_memfds(m, memfds, n_memfds, unix_fds);
+                if (r < 0)
+                        return r;
+        }
+
         m->root_container.end = m->user_body_size;
 
         if (BUS_MESSAGE_IS_GVARIANT(m)) {
@@ -5599,59 +5884,6 @@ _public_ int sd_bus_message_read_strv(sd_bus_message *m, char ***l) {
         return 1;
 }
 
-int bus_message_get_arg(sd_bus_message *m, unsigned i, const char **str, char ***strv) {
-        const char *contents;
-        unsigned j;
-        char type;
-        int r;
-
-        assert(m);
-        assert(str);
-        assert(strv);
-
-        r = sd_bus_message_rewind(m, true);
-        if (r < 0)
-                return r;
-
-        for (j = 0;; j++) {
-                r = sd_bus_message_peek_type(m, &type, &contents);
-                if (r < 0)
-                        return r;
-                if (r == 0)
-                        return -ENXIO;
-
-                /* Don't match against arguments after the first one we don't understand */
-                if (!IN_SET(type, SD_BUS_TYPE_STRING, SD_BUS_TYPE_OBJECT_PATH, SD_BUS_TYPE_SIGNATURE) &&
-                    !(type == SD_BUS_TYPE_ARRAY && STR_IN_SET(contents, "s", "o", "g")))
-                        return -ENXIO;
-
-                if (j >= i)
-                        break;
-
-                r = sd_bus_message_skip(m, NULL);
-                if (r < 0)
-                        return r;
-        }
-
-        if (type == SD_BUS_TYPE_ARRAY) {
-
-                r = sd_bus_message_read_strv(m, strv);
-                if (r < 0)
-                        return r;
-
-                *str = NULL;
-
-        } else {
-                r = sd_bus_message_read_basic(m, type, str);
-                if (r < 0)
-                        return r;
-
-                *strv = NULL;
-        }
-
-        return 0;
-}
-
 _public_ int sd_bus_message_get_errno(sd_bus_message *m) {
         assert_return(m, EINVAL);
 
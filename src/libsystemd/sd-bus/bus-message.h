@@ -65,6 +65,7 @@ struct bus_body_part {
         bool munmap_this:1;
         bool sealed:1;
         bool is_zero:1;
+        bool out_of_band:1;
 };
 
 struct sd_bus_message {
@@ -103,6 +104,10 @@ struct sd_bus_message {
         struct bus_header *header;
         void *footer;
 
+        /* Size of the header allocation, if it came from the
+         * buffer cache of the bus */
+        size_t header_allocated;
+
         /* How many bytes are accessible in the above pointers */
         size_t header_accessible;
         size_t footer_accessible;
@@ -122,6 +127,11 @@ struct sd_bus_message {
         uint32_t n_fds;
         int *fds;
 
+        /* Body parts passed as memfds on the socket rather than
+         * written to it, see BUS_MESSAGE_HEADER_MEMFDS */
+        unsigned n_out_of_band;
+        size_t out_of_band_size;
+
         struct bus_container root_container, *containers;
         size_t n_containers;
         size_t containers_allocated;
@@ -179,6 +189,11 @@ static inline size_t BUS_MESSAGE_SIZE(sd_bus_message *m) {
                 m->body_size;
 }
 
+/* The number of bytes that is actually written to the socket */
+static inline size_t BUS_MESSAGE_WIRE_SIZE(sd_bus_message *m) {
+        return BUS_MESSAGE_SIZE(m) - m->out_of_band_size;
+}
+
 static inline size_t BUS_MESSAGE_BODY_BEGIN(sd_bus_message *m) {
         return
                 sizeof(struct bus_header) +
@@ -221,8 +236,6 @@ int bus_message_from_malloc(
                 const char *label,
                 sd_bus_message **ret);
 
-int bus_message_get_arg(sd_bus_message *m, unsigned i, const char **str, char ***strv);
-
 int bus_message_append_ap(sd_bus_message *m, const char *types, va_list ap);
 
 int bus_message_parse_fields(sd_bus_message *m);
@@ -937,7 +937,7 @@ static int process_introspect(
                         fprintf(intro.f, " <interface name=\"%s\">\n", c->interface);
                 }
 
-                r = introspect_write_interface(&intro, c->vtable);
+                r = introspect_write_interface_cached(&intro, c->vtable, &c->introspection);
                 if (r < 0)
                         goto finish;
 
@@ -1192,26 +1192,108 @@ static int process_get_managed_objects(
         return 1;
 }
 
+/* The list of registered nodes a method call to a specific object
+ * path is dispatched to: the node of the path itself, if there is
+ * one, followed by the nodes of all prefixes of it, which might carry
+ * fallback handlers. This only depends on the set of nodes, hence the
+ * cache is flushed whenever a node is allocated or freed. */
+struct node_chain {
+        const char *path;
+        bool exact;
+        unsigned n_nodes;
+        struct node *nodes[];
+};
+
+#define NODE_CHAIN_CACHE_MAX 1024U
+
+void bus_node_chains_flush(sd_bus *bus) {
+        struct node_chain *c;
+
+        assert(bus);
+
+        while ((c = hashmap_steal_first(bus->node_chains)))
+                free(c);
+}
+
+static int node_chain_get(sd_bus *bus, const char *path, struct node_chain **ret) {
+        struct node_chain *c;
+        struct node *i;
+        unsigned n = 0;
+        size_t pl;
+        bool exact;
+        int r;
+
+        assert(bus);
+        assert(path);
+        assert(ret);
+
+        c = hashmap_get(bus->node_chains, path);
+        if (c) {
+                *ret = c;
+                return 0;
+        }
+
+        r = hashmap_ensure_allocated(&bus->node_chains, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        /* Don't let the cache grow without bounds when we are called
+         * for many different paths below a fallback */
+        if (hashmap_size(bus->node_chains) >= NODE_CHAIN_CACHE_MAX)
+                bus_node_chains_flush(bus);
+
+        pl = strlen(path);
+
+        {
+                struct node *nodes[pl + 1];
+                char prefix[pl + 1];
+
+                i = hashmap_get(bus->nodes, path);
+                exact = !!i;
+                if (i)
+                        nodes[n++] = i;
+
+                OBJECT_PATH_FOREACH_PREFIX(prefix, path) {
+                        i = hashmap_get(bus->nodes, prefix);
+                        if (i)
+                                nodes[n++] = i;
+                }
+
+                c = malloc(offsetof(struct node_chain, nodes) + n * sizeof(struct node*) + pl + 1);
+                if (!c)
+                        return -ENOMEM;
+
+                c->exact = exact;
+                c->n_nodes = n;
+                memcpy(c->nodes, nodes, n * sizeof(struct node*));
+                c->path = memcpy(c->nodes + n, path, pl + 1);
+        }
+
+        r = hashmap_put(bus->node_chains, c->path, c);
+        if (r < 0) {
+                free(c);
+                return r;
+        }
+
+        *ret = c;
+        return 0;
+}
+
 static int object_find_and_run(
                 sd_bus *bus,
                 sd_bus_message *m,
-                const char *p,
+                struct node *n,
                 bool require_fallback,
                 bool *found_object) {
 
-        struct node *n;
         struct vtable_member vtable_key, *v;
         int r;
 
         assert(bus);
         assert(m);
-        assert(p);
+        assert(n);
         assert(found_object);
 
-        n = hashmap_get(bus->nodes, p);
-        if (!n)
-                return 0;
-
         /* First, try object callbacks */
         r = node_callbacks_run(bus, m, n->callbacks, require_fallback, found_object);
         if (r != 0)
@@ -1223,7 +1305,7 @@ static int object_find_and_run(
                 return 0;
 
         /* Then, look for a known method */
-        vtable_key.path = (char*) p;
+        vtable_key.path = n->path;
         vtable_key.interface = m->interface;
         vtable_key.member = m->member;
 
@@ -1248,7 +1330,7 @@ static int object_find_and_run(
                         if (r < 0)
                                 return r;
 
-                        vtable_key.path = (char*) p;
+                        vtable_key.path = n->path;
 
                         r = sd_bus_message_read(m, "ss", &vtable_key.interface, &vtable_key.member);
                         if (r < 0)
@@ -1317,7 +1399,6 @@ static int object_find_and_run(
 
 int bus_process_object(sd_bus *bus, sd_bus_message *m) {
         int r;
-        size_t pl;
         bool found_object = false;
 
         assert(bus);
@@ -1339,25 +1420,39 @@ int bus_process_object(sd_bus *bus, sd_bus_message *m) {
         assert(m->path);
         assert(m->member);
 
-        pl = strlen(m->path);
         do {
-                char prefix[pl+1];
+                struct node_chain *chain;
+                unsigned i, n_nodes;
+                bool exact;
 
                 bus->nodes_modified = false;
 
-                r = object_find_and_run(bus, m, m->path, false, &found_object);
-                if (r != 0)
+                r = node_chain_get(bus, m->path, &chain);
+                if (r < 0)
                         return r;
 
-                /* Look for fallback prefixes */
-                OBJECT_PATH_FOREACH_PREFIX(prefix, m->path) {
+                /* The callbacks might register or unregister objects,
+                 * which flushes the chain cache, hence work on a
+                 * copy. */
+                n_nodes = chain->n_nodes;
+                exact = chain->exact;
 
-                        if (bus->nodes_modified)
-                                break;
+                {
+                        struct node *nodes[n_nodes + 1];
 
-                        r = object_find_and_run(bus, m, prefix, true, &found_object);
-                        if (r != 0)
-                                return r;
+                        memcpy(nodes, chain->nodes, n_nodes * sizeof(struct node*));
+
+                        for (i = 0; i < n_nodes; i++) {
+
+                                if (bus->nodes_modified)
+                                        break;
+
+                                /* Only the first node may be the object itself, all
+                                 * others are fallback prefixes */
+                                r = object_find_and_run(bus, m, nodes[i], i > 0 || !exact, &found_object);
+                                if (r != 0)
+                                        return r;
+                        }
                 }
 
         } while (bus->nodes_modified);
@@ -1434,6 +1529,8 @@ static struct node *bus_node_allocate(sd_bus *bus, const char *path) {
                 return NULL;
         }
 
+        bus_node_chains_flush(bus);
+
         if (parent)
                 LIST_PREPEND(siblings, parent->child, n);
 
@@ -1454,6 +1551,7 @@ void bus_node_gc(sd_bus *b, struct node *n) {
                 return;
 
         assert(hashmap_remove(b->nodes, n->path) == n);
+        bus_node_chains_flush(b);
 
         if (n->parent)
                 LIST_REMOVE(siblings, n->parent->child, n);
@@ -1536,7 +1634,10 @@ static unsigned long vtable_member_hash_func(const void *a, const uint8_t hash_k
 
         assert(m);
 
-        ret = string_hash_func(m->path, hash_key);
+        /* The path is always the one of the node the member is
+         * registered on, hence we can hash and compare it by
+         * pointer */
+        ret = trivial_hash_func(m->path, hash_key);
 
         /* Use a slightly different hash key for the interface */
         memcpy(hash_key2, hash_key, HASH_KEY_SIZE);
@@ -1557,9 +1658,8 @@ static int vtable_member_compare_func(const void *a, const void *b) {
         assert(x);
         assert(y);
 
-        r = strcmp(x->path, y->path);
-        if (r != 0)
-                return r;
+        if (x->path != y->path)
+                return x->path < y->path ? -1 : 1;
 
         r = strcmp(x->interface, y->interface);
         if (r != 0)
@@ -1872,7 +1972,7 @@ static int emit_properties_changed_on_interface(
         if (r < 0)
                 return r;
 
-        key.path = prefix;
+        key.path = n->path;
         key.interface = interface;
 
         LIST_FOREACH(vtables, c, n->vtables) {
@@ -2038,31 +2138,19 @@ static int emit_properties_changed_on_interface(
         return 1;
 }
 
-_public_ int sd_bus_emit_properties_changed_strv(
+static int emit_properties_changed(
                 sd_bus *bus,
                 const char *path,
                 const char *interface,
                 char **names) {
 
-        BUS_DONT_DESTROY(bus);
         bool found_interface = false;
         char *prefix;
         int r;
 
-        assert_return(bus, -EINVAL);
-        assert_return(object_path_is_valid(path), -EINVAL);
-        assert_return(interface_name_is_valid(interface), -EINVAL);
-        assert_return(!bus_pid_changed(bus), -ECHILD);
-
-        if (!BUS_IS_OPEN(bus->state))
-                return -ENOTCONN;
-
-        /* A non-NULL but empty names list means nothing needs to be
-           generated. A NULL list OTOH indicates that all properties
-           that are set to EMITS_CHANGE or EMITS_INVALIDATION shall be
-           included in the PropertiesChanged message. */
-        if (names && names[0] == NULL)
-                return 0;
+        assert(bus);
+        assert(path);
+        assert(interface);
 
         do {
                 bus->nodes_modified = false;
@@ -2087,6 +2175,253 @@ _public_ int sd_bus_emit_properties_changed_strv(
         return found_interface ? 0 : -ENOENT;
 }
 
+struct properties_changed {
+        char *path;
+        char *interface;
+
+        /* NULL means all properties marked EMITS_CHANGE or
+         * EMITS_INVALIDATION, like for
+         * sd_bus_emit_properties_changed_strv() */
+        char **names;
+
+        /* The other interfaces of the same object, in the order
+         * they were queued in */
+        struct properties_changed *next;
+};
+
+static void properties_changed_free(struct properties_changed *c) {
+        struct properties_changed *n;
+
+        while (c) {
+                n = c->next;
+
+                free(c->path);
+                free(c->interface);
+                strv_free(c->names);
+                free(c);
+
+                c = n;
+        }
+}
+
+static void properties_changed_emit(sd_bus *bus, struct properties_changed *c) {
+        int r;
+
+        assert(bus);
+
+        /* If the bus is already closed we just drop everything */
+        for (; c; c = c->next) {
+                if (!BUS_IS_OPEN(bus->state))
+                        break;
+
+                r = emit_properties_changed(bus, c->path, c->interface, c->names);
+                if (r < 0 && r != -ENOENT)
+                        log_debug_errno(r, "Failed to emit PropertiesChanged signal for %s, ignoring: %m", c->path);
+        }
+}
+
+void bus_properties_changed_flush(sd_bus *bus) {
+        struct properties_changed *c;
+
+        assert(bus);
+
+        /* Sending the signals below ends up here again, see
+         * bus_send_internal() */
+        if (bus->properties_changed_flushing)
+                return;
+
+        if (bus->properties_changed_event_source) {
+                sd_event_source_set_enabled(bus->properties_changed_event_source, SD_EVENT_OFF);
+                bus->properties_changed_event_source = sd_event_source_unref(bus->properties_changed_event_source);
+        }
+
+        bus->properties_changed_flushing = true;
+
+        /* Signals queued while we are emitting are picked up by this
+         * loop too, in the order they were queued in */
+        while ((c = ordered_hashmap_steal_first(bus->properties_changed))) {
+                properties_changed_emit(bus, c);
+                properties_changed_free(c);
+        }
+
+        bus->properties_changed_flushing = false;
+}
+
+void bus_properties_changed_flush_path(sd_bus *bus, const char *path) {
+        struct properties_changed *c;
+
+        assert(bus);
+        assert(path);
+
+        if (bus->properties_changed_flushing)
+                return;
+
+        c = ordered_hashmap_remove(bus->properties_changed, path);
+        if (!c)
+                return;
+
+        bus->properties_changed_flushing = true;
+        properties_changed_emit(bus, c);
+        bus->properties_changed_flushing = false;
+
+        properties_changed_free(c);
+}
+
+static int properties_changed_callback(sd_event_source *s, uint64_t usec, void *userdata) {
+        sd_bus *bus = userdata;
+        BUS_DONT_DESTROY(bus);
+
+        assert(bus);
+
+        bus_properties_changed_flush(bus);
+        return 1;
+}
+
+static int properties_changed_enqueue(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                char **names) {
+
+        struct properties_changed *first, *last = NULL, *c;
+        char **i;
+        int r;
+
+        assert(bus);
+        assert(bus->event);
+        assert(path);
+        assert(interface);
+
+        STRV_FOREACH(i, names)
+                assert_return(member_name_is_valid(*i), -EINVAL);
+
+        first = ordered_hashmap_get(bus->properties_changed, path);
+        for (c = first; c; c = c->next) {
+                last = c;
+
+                if (!streq(c->interface, interface))
+                        continue;
+
+                /* Merge with the signal already queued for this
+                 * object and interface. All properties covers
+                 * everything. */
+                if (!c->names)
+                        return 0;
+
+                if (!names) {
+                        strv_free(c->names);
+                        c->names = NULL;
+                        return 0;
+                }
+
+                STRV_FOREACH(i, names) {
+                        if (strv_contains(c->names, *i))
+                                continue;
+
+                        r = strv_extend(&c->names, *i);
+                        if (r < 0)
+                                return r;
+                }
+
+                return 0;
+        }
+
+        r = ordered_hashmap_ensure_allocated(&bus->properties_changed, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        if (!bus->properties_changed_event_source) {
+                r = sd_event_add_time(
+                                bus->event,
+                                &bus->properties_changed_event_source,
+                                CLOCK_MONOTONIC,
+                                now(CLOCK_MONOTONIC) + bus->properties_changed_latency, 1,
+                                properties_changed_callback, bus);
+                if (r < 0)
+                        return r;
+
+                r = sd_event_source_set_priority(bus->properties_changed_event_source, bus->event_priority);
+                if (r < 0)
+                        return r;
+
+                (void) sd_event_source_set_description(bus->properties_changed_event_source, "bus-properties-changed");
+        }
+
+        c = new0(struct properties_changed, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->path = strdup(path);
+        c->interface = strdup(interface);
+        if (!c->path || !c->interface) {
+                properties_changed_free(c);
+                return -ENOMEM;
+        }
+
+        if (names) {
+                c->names = strv_copy(names);
+                if (!c->names) {
+                        properties_changed_free(c);
+                        return -ENOMEM;
+                }
+        }
+
+        /* Further interfaces of an object are queued along with the
+         * first one */
+        if (last) {
+                last->next = c;
+                return 0;
+        }
+
+        r = ordered_hashmap_put(bus->properties_changed, c->path, c);
+        if (r < 0) {
+                properties_changed_free(c);
+                return r;
+        }
+
+        return 0;
+}
+
+int bus_set_properties_changed_latency(sd_bus *bus, usec_t latency) {
+        assert(bus);
+
+        bus->properties_changed_latency = latency;
+
+        if (latency == USEC_INFINITY)
+                bus_properties_changed_flush(bus);
+
+        return 0;
+}
+
+_public_ int sd_bus_emit_properties_changed_strv(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                char **names) {
+
+        BUS_DONT_DESTROY(bus);
+
+        assert_return(bus, -EINVAL);
+        assert_return(object_path_is_valid(path), -EINVAL);
+        assert_return(interface_name_is_valid(interface), -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
+        /* A non-NULL but empty names list means nothing needs to be
+           generated. A NULL list OTOH indicates that all properties
+           that are set to EMITS_CHANGE or EMITS_INVALIDATION shall be
+           included in the PropertiesChanged message. */
+        if (names && names[0] == NULL)
+                return 0;
+
+        if (bus->properties_changed_latency != USEC_INFINITY && bus->event)
+                return properties_changed_enqueue(bus, path, interface, names);
+
+        return emit_properties_changed(bus, path, interface, names);
+}
+
 _public_ int sd_bus_emit_properties_changed(
                 sd_bus *bus,
                 const char *path,
@@ -25,3 +25,8 @@
 
 int bus_process_object(sd_bus *bus, sd_bus_message *m);
 void bus_node_gc(sd_bus *b, struct node *n);
+void bus_node_chains_flush(sd_bus *bus);
+
+int bus_set_properties_changed_latency(sd_bus *bus, usec_t latency);
+void bus_properties_changed_flush(sd_bus *bus);
+void bus_properties_changed_flush_path(sd_bus *bus, const char *path);
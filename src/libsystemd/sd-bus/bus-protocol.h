@@ -95,6 +95,14 @@ enum {
         _BUS_MESSAGE_HEADER_MAX
 };
 
+/* Not part of the D-Bus specification: only used on socket
+ * connections where both sides agreed to "NEGOTIATE_MEMFD" during
+ * authentication. Lists the body parts that are passed as sealed
+ * memfds after the regular file descriptors, instead of being
+ * written to the socket, as triplets of the offset into the body as
+ * written, the offset into the memfd and the size. */
+#define BUS_MESSAGE_HEADER_MEMFDS 0x80
+
 /* RequestName parameters */
 
 enum  {
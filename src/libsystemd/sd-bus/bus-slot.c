@@ -171,6 +171,7 @@ void bus_slot_disconnect(sd_bus_slot *slot) {
                 }
 
                 free(slot->node_vtable.interface);
+                free(slot->node_vtable.introspection);
 
                 if (slot->node_vtable.node) {
                         LIST_REMOVE(vtables, slot->node_vtable.node->vtables, &slot->node_vtable);
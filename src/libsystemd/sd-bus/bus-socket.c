@@ -40,6 +40,9 @@
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* Smallest buffer to read messages into */
+#define RBUFFER_SIZE_MIN 4096U
+
 static void iovec_advance(struct iovec iov[], unsigned *idx, size_t size) {
 
         while (size > 0) {
@@ -85,7 +88,7 @@ static int bus_message_setup_iovec(sd_bus_message *m) {
 
         assert(!m->iovec);
 
-        n = 1 + m->n_body_parts;
+        n = 1 + m->n_body_parts - m->n_out_of_band;
         if (n < ELEMENTSOF(m->iovec_fixed))
                 m->iovec = m->iovec_fixed;
         else {
@@ -101,6 +104,9 @@ static int bus_message_setup_iovec(sd_bus_message *m) {
                 goto fail;
 
         MESSAGE_FOREACH_PART(part, i, m)  {
+                if (part->out_of_band)
+                        continue;
+
                 r = bus_body_part_map(part);
                 if (r < 0)
                         goto fail;
@@ -169,15 +175,15 @@ static int bus_socket_write_auth(sd_bus *b) {
 }
 
 static int bus_socket_auth_verify_client(sd_bus *b) {
-        char *e, *f, *start;
+        char *e, *f, *g, *start;
         sd_id128_t peer;
         unsigned i;
         int r;
 
         assert(b);
 
-        /* We expect two response lines: "OK" and possibly
-         * "AGREE_UNIX_FD" */
+        /* We expect up to three response lines: "OK" and possibly
+         * "AGREE_UNIX_FD" and "AGREE_MEMFD" */
 
         e = memmem(b->rbuffer, b->rbuffer_size, "\r\n", 2);
         if (!e)
@@ -194,6 +200,15 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                 start = e + 2;
         }
 
+        if (f && b->accept_memfd) {
+                g = memmem(f + 2, b->rbuffer_size - (f - (char*) b->rbuffer) - 2, "\r\n", 2);
+                if (!g)
+                        return 0;
+
+                start = g + 2;
+        } else
+                g = NULL;
+
         /* Nice! We got all the lines we need. First check the OK
          * line */
 
@@ -230,6 +245,13 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                         (f - e == strlen("\r\nAGREE_UNIX_FD")) &&
                         memcmp(e + 2, "AGREE_UNIX_FD", strlen("AGREE_UNIX_FD")) == 0;
 
+        /* Memfds are passed like any other fd, hence require both */
+        if (g)
+                b->can_memfd =
+                        b->can_fds &&
+                        (g - f == strlen("\r\nAGREE_MEMFD")) &&
+                        memcmp(f + 2, "AGREE_MEMFD", strlen("AGREE_MEMFD")) == 0;
+
         b->rbuffer_size -= (start - (char*) b->rbuffer);
         memmove(b->rbuffer, start, b->rbuffer_size);
 
@@ -471,6 +493,13 @@ static int bus_socket_auth_verify_server(sd_bus *b) {
                                 b->can_fds = true;
                                 r = bus_socket_auth_write(b, "AGREE_UNIX_FD\r\n");
                         }
+                } else if (line_equals(line, l, "NEGOTIATE_MEMFD")) {
+                        if (b->auth == _BUS_AUTH_INVALID || !b->can_fds || !b->accept_memfd)
+                                r = bus_socket_auth_write(b, "ERROR\r\n");
+                        else {
+                                b->can_memfd = true;
+                                r = bus_socket_auth_write(b, "AGREE_MEMFD\r\n");
+                        }
                 } else
                         r = bus_socket_auth_write(b, "ERROR\r\n");
 
@@ -528,6 +557,7 @@ static int bus_socket_read_auth(sd_bus *b) {
                 return -ENOMEM;
 
         b->rbuffer = p;
+        b->rbuffer_allocated = n;
 
         zero(iov);
         iov.iov_base = (uint8_t*) b->rbuffer + b->rbuffer_size;
@@ -656,7 +686,9 @@ static int bus_socket_start_auth_client(sd_bus *b) {
         if (!b->auth_buffer)
                 return -ENOMEM;
 
-        if (b->hello_flags & KDBUS_HELLO_ACCEPT_FD)
+        if ((b->hello_flags & KDBUS_HELLO_ACCEPT_FD) && b->accept_memfd)
+                auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nNEGOTIATE_MEMFD\r\nBEGIN\r\n";
+        else if (b->hello_flags & KDBUS_HELLO_ACCEPT_FD)
                 auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nBEGIN\r\n";
         else
                 auth_suffix = "\r\nBEGIN\r\n";
@@ -781,56 +813,90 @@ int bus_socket_take_fd(sd_bus *b) {
         return bus_socket_start_auth(b);
 }
 
-int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+int bus_socket_write_messages(sd_bus *bus, sd_bus_message **q, unsigned n, size_t *idx) {
         struct iovec *iov;
+        unsigned i, j, n_iovec = 0;
+        size_t size = 0;
         ssize_t k;
-        size_t n;
-        unsigned j;
         int r;
 
         assert(bus);
-        assert(m);
+        assert(q);
+        assert(n > 0);
         assert(idx);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (*idx >= BUS_MESSAGE_SIZE(m))
-                return 0;
+        /* Writes as many of the queued messages as possible with a
+         * single call, starting at *idx bytes into the first one,
+         * and advances *idx by the bytes written. File descriptors
+         * may only be attached to the first message written, hence
+         * we stop before the next message that carries any, including
+         * memfds passed in place of body parts. */
 
-        r = bus_message_setup_iovec(m);
-        if (r < 0)
-                return r;
+        for (i = 0; i < n; i++) {
+                if (i > 0 && (q[i]->n_fds > 0 || q[i]->n_out_of_band > 0))
+                        break;
+
+                r = bus_message_setup_iovec(q[i]);
+                if (r < 0)
+                        return r;
+
+                if (i > 0 && n_iovec + q[i]->n_iovec > IOV_MAX)
+                        break;
+
+                n_iovec += q[i]->n_iovec;
+                size += BUS_MESSAGE_WIRE_SIZE(q[i]);
+        }
+
+        n = i;
+
+        if (*idx >= size)
+                return 0;
 
-        n = m->n_iovec * sizeof(struct iovec);
-        iov = alloca(n);
-        memcpy(iov, m->iovec, n);
+        iov = alloca(n_iovec * sizeof(struct iovec));
+        for (i = 0, j = 0; i < n; i++) {
+                memcpy(iov + j, q[i]->iovec, q[i]->n_iovec * sizeof(struct iovec));
+                j += q[i]->n_iovec;
+        }
 
         j = 0;
         iovec_advance(iov, &j, *idx);
 
         if (bus->prefer_writev)
-                k = writev(bus->output_fd, iov, m->n_iovec);
+                k = writev(bus->output_fd, iov + j, n_iovec - j);
         else {
                 struct msghdr mh;
                 zero(mh);
 
-                if (m->n_fds > 0) {
+                if (q[0]->n_fds + q[0]->n_out_of_band > 0) {
+                        struct bus_body_part *part;
                         struct cmsghdr *control;
-                        control = alloca(CMSG_SPACE(sizeof(int) * m->n_fds));
+                        unsigned n_fds;
+                        int *fds;
+
+                        n_fds = q[0]->n_fds + q[0]->n_out_of_band;
+                        control = alloca(CMSG_SPACE(sizeof(int) * n_fds));
 
                         mh.msg_control = control;
                         control->cmsg_level = SOL_SOCKET;
                         control->cmsg_type = SCM_RIGHTS;
-                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * m->n_fds);
-                        memcpy(CMSG_DATA(control), m->fds, sizeof(int) * m->n_fds);
+                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+
+                        /* The memfds of out-of-band parts follow the
+                         * regular fds, in body order */
+                        fds = mempcpy(CMSG_DATA(control), q[0]->fds, sizeof(int) * q[0]->n_fds);
+                        MESSAGE_FOREACH_PART(part, i, q[0])
+                                if (part->out_of_band)
+                                        *(fds++) = part->memfd;
                 }
 
-                mh.msg_iov = iov;
-                mh.msg_iovlen = m->n_iovec;
+                mh.msg_iov = iov + j;
+                mh.msg_iovlen = n_iovec - j;
 
                 k = sendmsg(bus->output_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
                 if (k < 0 && errno == ENOTSOCK) {
                         bus->prefer_writev = true;
-                        k = writev(bus->output_fd, iov, m->n_iovec);
+                        k = writev(bus->output_fd, iov + j, n_iovec - j);
                 }
         }
 
@@ -841,7 +907,14 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
+int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+        assert(m);
+
+        return bus_socket_write_messages(bus, &m, 1, idx);
+}
+
 static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+        const uint8_t *h;
         uint32_t a, b;
         uint8_t e;
         uint64_t sum;
@@ -850,7 +923,7 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         assert(need);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (bus->rbuffer_size < sizeof(struct bus_header)) {
+        if (bus->rbuffer_size - bus->rbuffer_offset < sizeof(struct bus_header)) {
                 *need = sizeof(struct bus_header) + 8;
 
                 /* Minimum message size:
@@ -872,10 +945,12 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
                 return 0;
         }
 
-        a = ((const uint32_t*) bus->rbuffer)[1];
-        b = ((const uint32_t*) bus->rbuffer)[3];
+        /* Messages that were read ahead need not be aligned */
+        h = (const uint8_t*) bus->rbuffer + bus->rbuffer_offset;
+        memcpy(&a, h + 4, sizeof(a));
+        memcpy(&b, h + 12, sizeof(b));
 
-        e = ((const uint8_t*) bus->rbuffer)[0];
+        e = h[0];
         if (e == BUS_LITTLE_ENDIAN) {
                 a = le32toh(a);
                 b = le32toh(b);
@@ -895,38 +970,57 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
 
 static int bus_socket_make_message(sd_bus *bus, size_t size) {
         sd_bus_message *t;
+        size_t allocated;
+        bool own;
         void *b;
         int r;
 
         assert(bus);
-        assert(bus->rbuffer_size >= size);
+        assert(bus->rbuffer_size - bus->rbuffer_offset >= size);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
         r = bus_rqueue_make_room(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size > size) {
-                b = memdup((const uint8_t*) bus->rbuffer + size,
-                           bus->rbuffer_size - size);
+        /* If the message is all there is in the read buffer it takes
+         * possession of it. Otherwise it gets a copy sized to fit, so
+         * that queued messages don't pin the whole read buffer, and
+         * we continue with the next message in place. */
+        own = bus->rbuffer_offset == 0 && bus->rbuffer_size == size;
+        if (own) {
+                b = bus->rbuffer;
+                allocated = bus->rbuffer_allocated;
+        } else {
+                b = bus_pop_buffer(bus, size, &allocated);
                 if (!b)
                         return -ENOMEM;
-        } else
-                b = NULL;
+
+                memcpy(b, (const uint8_t*) bus->rbuffer + bus->rbuffer_offset, size);
+        }
 
         r = bus_message_from_malloc(bus,
-                                    bus->rbuffer, size,
+                                    b, size,
                                     bus->fds, bus->n_fds,
                                     !bus->bus_client && bus->ucred_valid ? &bus->ucred : NULL,
                                     !bus->bus_client && bus->label[0] ? bus->label : NULL,
                                     &t);
         if (r < 0) {
-                free(b);
+                if (!own)
+                        bus_push_buffer(bus, b, allocated);
                 return r;
         }
 
-        bus->rbuffer = b;
-        bus->rbuffer_size -= size;
+        t->header_allocated = allocated;
+
+        if (own) {
+                bus->rbuffer = NULL;
+                bus->rbuffer_size = bus->rbuffer_allocated = 0;
+        } else {
+                bus->rbuffer_offset += size;
+                if (bus->rbuffer_offset == bus->rbuffer_size)
+                        bus->rbuffer_offset = bus->rbuffer_size = 0;
+        }
 
         bus->fds = NULL;
         bus->n_fds = 0;
@@ -959,18 +1053,37 @@ int bus_socket_read_message(sd_bus *bus) {
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size >= need)
+        if (bus->rbuffer_size - bus->rbuffer_offset >= need)
                 return bus_socket_make_message(bus, need);
 
-        b = realloc(bus->rbuffer, need);
-        if (!b)
-                return -ENOMEM;
+        /* Move the start of the next message to the front, that's at
+         * most one message per read */
+        if (bus->rbuffer_offset > 0) {
+                bus->rbuffer_size -= bus->rbuffer_offset;
+                memmove(bus->rbuffer, (const uint8_t*) bus->rbuffer + bus->rbuffer_offset, bus->rbuffer_size);
+                bus->rbuffer_offset = 0;
+        }
 
-        bus->rbuffer = b;
+        if (bus->rbuffer_allocated < need) {
+                b = bus_resize_buffer(bus, bus->rbuffer, MAX(need, RBUFFER_SIZE_MIN), &bus->rbuffer_allocated);
+                if (!b)
+                        return -ENOMEM;
+
+                bus->rbuffer = b;
+        }
 
         zero(iov);
         iov.iov_base = (uint8_t*) bus->rbuffer + bus->rbuffer_size;
-        iov.iov_len = need - bus->rbuffer_size;
+
+        /* Unless file descriptors may be passed, read as much as
+         * fits, so that we need only one call for a burst of small
+         * messages. File descriptors are associated with the bytes
+         * they were sent with, hence we may not read beyond the
+         * current message then. */
+        if (bus->can_fds)
+                iov.iov_len = need - bus->rbuffer_size;
+        else
+                iov.iov_len = bus->rbuffer_allocated - bus->rbuffer_size;
 
         if (bus->prefer_readv)
                 k = readv(bus->input_fd, &iov, 1);
@@ -1012,7 +1125,7 @@ int bus_socket_read_message(sd_bus *bus) {
                                         return -EIO;
                                 }
 
-                                f = realloc(bus->fds, sizeof(int) + (bus->n_fds + n));
+                                f = realloc(bus->fds, sizeof(int) * (bus->n_fds + n));
                                 if (!f) {
                                         close_many((int*) CMSG_DATA(cmsg), n);
                                         return -ENOMEM;
@@ -1131,6 +1131,57 @@ int bus_map_all_properties(sd_bus *bus,
         return bus_message_map_all_properties(bus, m, map, userdata);
 }
 
+int bus_get_all_properties_many(sd_bus *bus,
+                                const char *destination,
+                                char **paths,
+                                unsigned n,
+                                const char *interface,
+                                sd_bus_error *error,
+                                sd_bus_message **reply) {
+        sd_bus_message **m;
+        unsigned i;
+        int r = 0;
+
+        assert(bus);
+        assert(destination);
+        assert(paths || n == 0);
+        assert(error || n == 0);
+        assert(reply || n == 0);
+
+        /* Issues GetAll for the n objects at once, and waits for all
+         * replies together, see bus_call_batch(). reply[] and error[]
+         * are arrays of n entries. */
+
+        m = new0(sd_bus_message*, n);
+        if (!m)
+                return -ENOMEM;
+
+        for (i = 0; i < n; i++) {
+                r = sd_bus_message_new_method_call(
+                                bus,
+                                m + i,
+                                destination,
+                                paths[i],
+                                "org.freedesktop.DBus.Properties",
+                                "GetAll");
+                if (r < 0)
+                        goto finish;
+
+                r = sd_bus_message_append(m[i], "s", strempty(interface));
+                if (r < 0)
+                        goto finish;
+        }
+
+        r = bus_call_batch(bus, m, n, 0, error, reply);
+
+finish:
+        for (i = 0; i < n; i++)
+                sd_bus_message_unref(m[i]);
+        free(m);
+
+        return r;
+}
+
 int bus_open_transport(BusTransport transport, const char *host, bool user, sd_bus **bus) {
         int r;
 
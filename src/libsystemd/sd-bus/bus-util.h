@@ -59,6 +59,13 @@ int bus_map_all_properties(sd_bus *bus,
                            const char *path,
                            const struct bus_properties_map *map,
                            void *userdata);
+int bus_get_all_properties_many(sd_bus *bus,
+                                const char *destination,
+                                char **paths,
+                                unsigned n,
+                                const char *interface,
+                                sd_bus_error *error,
+                                sd_bus_message **reply);
 
 int bus_async_unregister_and_exit(sd_event *e, sd_bus *bus, const char *name);
 
@@ -151,9 +151,19 @@ static void bus_free(sd_bus *b) {
         assert(hashmap_isempty(b->nodes));
         hashmap_free(b->nodes);
 
+        bus_node_chains_flush(b);
+        hashmap_free(b->node_chains);
+
+        bus_creds_cache_flush(b);
+
+        bus_properties_changed_flush(b);
+        ordered_hashmap_free(b->properties_changed);
+
         bus_kernel_flush_memfd(b);
+        bus_flush_buffers(b);
 
         assert_se(pthread_mutex_destroy(&b->memfd_cache_mutex) == 0);
+        assert_se(pthread_mutex_destroy(&b->buffer_cache_mutex) == 0);
 
         free(b);
 }
@@ -174,8 +184,10 @@ _public_ int sd_bus_new(sd_bus **ret) {
         r->hello_flags |= KDBUS_HELLO_ACCEPT_FD;
         r->attach_flags |= KDBUS_ATTACH_NAMES;
         r->original_pid = getpid();
+        r->properties_changed_latency = USEC_INFINITY;
 
         assert_se(pthread_mutex_init(&r->memfd_cache_mutex, NULL) == 0);
+        assert_se(pthread_mutex_init(&r->buffer_cache_mutex, NULL) == 0);
 
         /* We guarantee that wqueue always has space for at least one
          * entry */
@@ -273,6 +285,15 @@ _public_ int sd_bus_negotiate_fds(sd_bus *bus, int b) {
         return 0;
 }
 
+int bus_negotiate_memfd(sd_bus *bus, int b) {
+        assert_return(bus, -EINVAL);
+        assert_return(bus->state == BUS_UNSET, -EPERM);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        bus->accept_memfd = !!b;
+        return 0;
+}
+
 _public_ int sd_bus_negotiate_timestamp(sd_bus *bus, int b) {
         uint64_t new_flags;
         assert_return(bus, -EINVAL);
@@ -1548,6 +1569,21 @@ int bus_seal_synthetic_message(sd_bus *b, sd_bus_message *m) {
         return bus_message_seal(m, 0xFFFFFFFFULL, 0);
 }
 
+static void log_sent_message(sd_bus_message *m) {
+        assert(m);
+
+        log_debug("Sent message type=%s sender=%s destination=%s object=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " error=%s",
+                  bus_message_type_to_string(m->header->type),
+                  strna(sd_bus_message_get_sender(m)),
+                  strna(sd_bus_message_get_destination(m)),
+                  strna(sd_bus_message_get_path(m)),
+                  strna(sd_bus_message_get_interface(m)),
+                  strna(sd_bus_message_get_member(m)),
+                  BUS_MESSAGE_COOKIE(m),
+                  m->reply_cookie,
+                  strna(m->error.message));
+}
+
 static int bus_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call, size_t *idx) {
         int r;
 
@@ -1562,17 +1598,8 @@ static int bus_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call
         if (r <= 0)
                 return r;
 
-        if (bus->is_kernel || *idx >= BUS_MESSAGE_SIZE(m))
-                log_debug("Sent message type=%s sender=%s destination=%s object=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " error=%s",
-                          bus_message_type_to_string(m->header->type),
-                          strna(sd_bus_message_get_sender(m)),
-                          strna(sd_bus_message_get_destination(m)),
-                          strna(sd_bus_message_get_path(m)),
-                          strna(sd_bus_message_get_interface(m)),
-                          strna(sd_bus_message_get_member(m)),
-                          BUS_MESSAGE_COOKIE(m),
-                          m->reply_cookie,
-                          strna(m->error.message));
+        if (bus->is_kernel || *idx >= BUS_MESSAGE_WIRE_SIZE(m))
+                log_sent_message(m);
 
         return r;
 }
@@ -1585,13 +1612,41 @@ static int dispatch_wqueue(sd_bus *bus) {
 
         while (bus->wqueue_size > 0) {
 
+                if (!bus->is_kernel && bus->wqueue_size > 1) {
+                        unsigned i = 0;
+
+                        /* Write as many queued messages as
+                         * possible at once, see below for the
+                         * rest */
+                        r = bus_socket_write_messages(bus, bus->wqueue, bus->wqueue_size, &bus->windex);
+                        if (r < 0)
+                                return r;
+                        else if (r == 0)
+                                return ret;
+
+                        while (i < bus->wqueue_size && bus->windex >= BUS_MESSAGE_WIRE_SIZE(bus->wqueue[i])) {
+                                bus->windex -= BUS_MESSAGE_WIRE_SIZE(bus->wqueue[i]);
+                                log_sent_message(bus->wqueue[i]);
+                                sd_bus_message_unref(bus->wqueue[i]);
+                                i++;
+                        }
+
+                        if (i > 0) {
+                                bus->wqueue_size -= i;
+                                memmove(bus->wqueue, bus->wqueue + i, sizeof(sd_bus_message*) * bus->wqueue_size);
+                                ret = 1;
+                        }
+
+                        continue;
+                }
+
                 r = bus_write_message(bus, bus->wqueue[0], false, &bus->windex);
                 if (r < 0)
                         return r;
                 else if (r == 0)
                         /* Didn't do anything this time */
                         return ret;
-                else if (bus->is_kernel || bus->windex >= BUS_MESSAGE_SIZE(bus->wqueue[0])) {
+                else if (bus->is_kernel || bus->windex >= BUS_MESSAGE_WIRE_SIZE(bus->wqueue[0])) {
                         /* Fully written. Let's drop the entry from
                          * the queue.
                          *
@@ -1623,6 +1678,26 @@ static int bus_read_message(sd_bus *bus, bool hint_priority, int64_t priority) {
                 return bus_socket_read_message(bus);
 }
 
+int bus_dispatch_wqueue(sd_bus *bus) {
+        int r;
+
+        assert(bus);
+
+        /* Like sd_bus_process(), but only writes queued messages,
+         * never reads new ones */
+
+        if (bus->state != BUS_RUNNING && bus->state != BUS_HELLO)
+                return 0;
+
+        r = dispatch_wqueue(bus);
+        if (r == -ENOTCONN || r == -ECONNRESET || r == -EPIPE || r == -ESHUTDOWN) {
+                bus_enter_closing(bus);
+                return -ECONNRESET;
+        }
+
+        return r;
+}
+
 int bus_rqueue_make_room(sd_bus *bus) {
         assert(bus);
 
@@ -1635,6 +1710,126 @@ int bus_rqueue_make_room(sd_bus *bus) {
         return 0;
 }
 
+static unsigned buffer_class(size_t size) {
+        unsigned c = 0;
+
+        while (c < BUS_BUFFER_CLASSES && ((size_t) 1 << (BUS_BUFFER_CLASS_SHIFT + c)) < size)
+                c++;
+
+        return c;
+}
+
+size_t bus_buffer_size(size_t size) {
+        unsigned c;
+
+        /* Rounds up to the size class, larger buffers are not
+         * cached and hence allocated as requested */
+
+        c = buffer_class(size);
+        if (c >= BUS_BUFFER_CLASSES)
+                return size;
+
+        return (size_t) 1 << (BUS_BUFFER_CLASS_SHIFT + c);
+}
+
+void *bus_pop_buffer(sd_bus *bus, size_t size, size_t *allocated) {
+        unsigned c;
+        void *p;
+
+        assert(allocated);
+
+        size = bus_buffer_size(size);
+        c = buffer_class(size);
+
+        if (bus) {
+                assert_se(pthread_mutex_lock(&bus->buffer_cache_mutex) >= 0);
+
+                if (c < BUS_BUFFER_CLASSES && bus->n_buffer_cache[c] > 0) {
+                        p = bus->buffer_cache[c][--bus->n_buffer_cache[c]];
+                        bus->n_buffer_reused++;
+
+                        assert_se(pthread_mutex_unlock(&bus->buffer_cache_mutex) >= 0);
+
+                        *allocated = size;
+                        return p;
+                }
+
+                bus->n_buffer_allocated++;
+                assert_se(pthread_mutex_unlock(&bus->buffer_cache_mutex) >= 0);
+        }
+
+        p = malloc(size);
+        if (!p)
+                return NULL;
+
+        *allocated = size;
+        return p;
+}
+
+void *bus_resize_buffer(sd_bus *bus, void *p, size_t size, size_t *allocated) {
+        void *n;
+
+        assert(allocated);
+
+        if (!p)
+                return bus_pop_buffer(bus, size, allocated);
+
+        size = bus_buffer_size(size);
+
+        n = realloc(p, size);
+        if (!n)
+                return NULL;
+
+        if (bus) {
+                assert_se(pthread_mutex_lock(&bus->buffer_cache_mutex) >= 0);
+                bus->n_buffer_allocated++;
+                assert_se(pthread_mutex_unlock(&bus->buffer_cache_mutex) >= 0);
+        }
+
+        *allocated = size;
+        return n;
+}
+
+void bus_push_buffer(sd_bus *bus, void *p, size_t allocated) {
+        unsigned c;
+
+        if (!p)
+                return;
+
+        /* Only buffers of precisely the size of a class are cached,
+         * everything else was allocated elsewhere */
+        c = buffer_class(allocated);
+        if (!bus || c >= BUS_BUFFER_CLASSES || bus_buffer_size(allocated) != allocated) {
+                free(p);
+                return;
+        }
+
+        assert_se(pthread_mutex_lock(&bus->buffer_cache_mutex) >= 0);
+
+        if (bus->n_buffer_cache[c] >= BUS_BUFFER_CACHE_MAX) {
+                assert_se(pthread_mutex_unlock(&bus->buffer_cache_mutex) >= 0);
+                free(p);
+                return;
+        }
+
+        bus->buffer_cache[c][bus->n_buffer_cache[c]++] = p;
+
+        assert_se(pthread_mutex_unlock(&bus->buffer_cache_mutex) >= 0);
+}
+
+void bus_flush_buffers(sd_bus *bus) {
+        unsigned c, i;
+
+        assert(bus);
+
+        for (c = 0; c < BUS_BUFFER_CLASSES; c++) {
+                for (i = 0; i < bus->n_buffer_cache[c]; i++)
+                        free(bus->buffer_cache[c][i]);
+
+                bus->n_buffer_cache[c] = 0;
+        }
+}
+
 static int dispatch_rqueue(sd_bus *bus, bool hint_priority, int64_t priority, sd_bus_message **m) {
         int r, ret = 0;
 
@@ -1679,6 +1874,14 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        /* Peers must see the PropertiesChanged signals we held back
+         * for an object before anything else we send about it
+         * later. Messages that are about an object other than their
+         * own path need to flush that one explicitly, see
+         * bus_properties_changed_flush_path(). */
+        if (m->path && !ordered_hashmap_isempty(bus->properties_changed))
+                bus_properties_changed_flush_path(bus, m->path);
+
         if (m->n_fds > 0) {
                 r = sd_bus_can_send(bus, SD_BUS_TYPE_UNIX_FD);
                 if (r < 0)
@@ -1687,6 +1890,11 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
                         return -ENOTSUP;
         }
 
+        /* Messages we received with body parts passed as memfds can
+         * only be forwarded to peers that agreed to that too */
+        if (m->n_out_of_band > 0 && !bus->is_kernel && !bus->can_memfd)
+                return -ENOTSUP;
+
         /* If the cookie number isn't kept, then we know that no reply
          * is expected */
         if (!cookie && !m->sealed)
@@ -1707,7 +1915,7 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
         if (m->dont_send)
                 goto finish;
 
-        if ((bus->state == BUS_RUNNING || bus->state == BUS_HELLO) && bus->wqueue_size <= 0) {
+        if ((bus->state == BUS_RUNNING || bus->state == BUS_HELLO) && bus->wqueue_size <= 0 && !bus->corked) {
                 size_t idx = 0;
 
                 r = bus_write_message(bus, m, hint_sync_call, &idx);
@@ -1720,7 +1928,7 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
                         return r;
                 }
 
-                if (!bus->is_kernel && idx < BUS_MESSAGE_SIZE(m))  {
+                if (!bus->is_kernel && idx < BUS_MESSAGE_WIRE_SIZE(m))  {
                         /* Wasn't fully written. So let's remember how
                          * much was written. Note that the first entry
                          * of the wqueue array is always allocated so
@@ -2040,6 +2248,244 @@ _public_ int sd_bus_call(
         }
 }
 
+static bool bus_error_is_disconnect(int r) {
+        return r == -ENOTCONN || r == -ECONNRESET || r == -EPIPE || r == -ESHUTDOWN;
+}
+
+static int bus_call_batch_internal(
+                sd_bus *bus,
+                sd_bus_message **m,
+                unsigned n,
+                uint64_t usec,
+                sd_bus_error *error,
+                sd_bus_message **reply) {
+
+        _cleanup_hashmap_free_ Hashmap *pending = NULL;
+        _cleanup_free_ uint64_t *cookies = NULL;
+        unsigned i, j, k = 0, n_done = 0;
+        usec_t timeout = 0;
+        int r, n_ok = 0;
+
+        r = bus_ensure_running(bus);
+        if (r < 0)
+                return r;
+
+        pending = hashmap_new(&uint64_hash_ops);
+        if (!pending)
+                return -ENOMEM;
+
+        cookies = new(uint64_t, n);
+        if (!cookies)
+                return -ENOMEM;
+
+        i = bus->rqueue_size;
+
+        for (;;) {
+                usec_t left;
+
+                if (k < n) {
+                        /* Queue as many calls as fit into the write
+                         * queue, and write them out in one go */
+                        bus->corked = true;
+
+                        for (; k < n && bus->wqueue_size < BUS_WQUEUE_MAX; k++) {
+                                _cleanup_bus_message_unref_ sd_bus_message *c = sd_bus_message_ref(m[k]);
+
+                                if (c->header->type != SD_BUS_MESSAGE_METHOD_CALL ||
+                                    (c->header->flags & BUS_MESSAGE_NO_REPLY_EXPECTED))
+                                        r = -EINVAL;
+                                else {
+                                        r = bus_seal_message(bus, c, usec);
+                                        if (r >= 0)
+                                                r = bus_remarshal_message(bus, &c);
+                                        if (r >= 0)
+                                                r = bus_send_internal(bus, c, cookies + k, false);
+                                }
+                                if (r < 0) {
+                                        if (bus_error_is_disconnect(r)) {
+                                                bus->corked = false;
+                                                return r;
+                                        }
+
+                                        sd_bus_error_set_errno(error + k, r);
+                                        n_done++;
+                                        continue;
+                                }
+
+                                r = hashmap_put(pending, cookies + k, UINT_TO_PTR(k + 1));
+                                if (r < 0) {
+                                        bus->corked = false;
+                                        return r;
+                                }
+
+                                timeout = MAX(timeout, calc_elapse(c->timeout));
+                        }
+
+                        bus->corked = false;
+
+                        r = dispatch_wqueue(bus);
+                        if (r < 0) {
+                                if (bus_error_is_disconnect(r)) {
+                                        bus_enter_closing(bus);
+                                        return -ECONNRESET;
+                                }
+
+                                return r;
+                        }
+                }
+
+                while (i < bus->rqueue_size) {
+                        sd_bus_message *incoming = bus->rqueue[i];
+                        uint64_t cookie = BUS_MESSAGE_COOKIE(incoming);
+
+                        j = PTR_TO_UINT(hashmap_remove(pending, &incoming->reply_cookie));
+                        if (j == 0) {
+                                if (hashmap_get(pending, &cookie) &&
+                                    bus->unique_name &&
+                                    incoming->sender &&
+                                    streq(bus->unique_name, incoming->sender)) {
+
+                                        /* One of our own calls, let's not
+                                         * dead-lock, see sd_bus_call() */
+                                        j = PTR_TO_UINT(hashmap_remove(pending, &cookie));
+                                        r = -ELOOP;
+                                } else {
+                                        i++;
+                                        continue;
+                                }
+                        } else if (incoming->header->type == SD_BUS_MESSAGE_METHOD_RETURN) {
+
+                                if (incoming->n_fds <= 0 || (bus->hello_flags & KDBUS_HELLO_ACCEPT_FD))
+                                        r = 0;
+                                else
+                                        r = -EBADMSG;
+                        } else if (incoming->header->type == SD_BUS_MESSAGE_METHOD_ERROR)
+                                r = -EREMOTEIO;
+                        else
+                                r = -EIO;
+
+                        memmove(bus->rqueue + i, bus->rqueue + i + 1, sizeof(sd_bus_message*) * (bus->rqueue_size - i - 1));
+                        bus->rqueue_size--;
+
+                        j--;
+                        n_done++;
+
+                        if (r == 0) {
+                                reply[j] = incoming;
+                                n_ok++;
+                                continue;
+                        }
+
+                        if (r == -EBADMSG)
+                                sd_bus_error_setf(error + j, SD_BUS_ERROR_INCONSISTENT_MESSAGE, "Reply message contained file descriptors which I couldn't accept. Sorry.");
+                        else if (r == -EREMOTEIO)
+                                sd_bus_error_copy(error + j, &incoming->error);
+                        else
+                                sd_bus_error_set_errno(error + j, r);
+
+                        sd_bus_message_unref(incoming);
+                }
+
+                if (n_done >= n)
+                        return n_ok;
+
+                r = bus_read_message(bus, false, 0);
+                if (r < 0) {
+                        if (bus_error_is_disconnect(r)) {
+                                bus_enter_closing(bus);
+                                return -ECONNRESET;
+                        }
+
+                        return r;
+                }
+                if (r > 0)
+                        continue;
+
+                left = (uint64_t) -1;
+                if (timeout > 0) {
+                        usec_t nw;
+
+                        nw = now(CLOCK_MONOTONIC);
+                        left = timeout > nw ? timeout - nw : 0;
+                }
+
+                r = left > 0 ? bus_poll(bus, true, left) : 0;
+                if (r < 0)
+                        return r;
+                if (r == 0) {
+                        Iterator it;
+                        void *p;
+
+                        /* Give up on everything still outstanding */
+                        HASHMAP_FOREACH(p, pending, it)
+                                sd_bus_error_set_errno(error + PTR_TO_UINT(p) - 1, -ETIMEDOUT);
+                        for (; k < n; k++)
+                                sd_bus_error_set_errno(error + k, -ETIMEDOUT);
+
+                        return n_ok;
+                }
+
+                r = dispatch_wqueue(bus);
+                if (r < 0) {
+                        if (bus_error_is_disconnect(r)) {
+                                bus_enter_closing(bus);
+                                return -ECONNRESET;
+                        }
+
+                        return r;
+                }
+        }
+}
+
+int bus_call_batch(
+                sd_bus *bus,
+                sd_bus_message **m,
+                unsigned n,
+                uint64_t usec,
+                sd_bus_error *error,
+                sd_bus_message **reply) {
+
+        unsigned i;
+        int r;
+
+        assert(bus);
+        assert(m || n == 0);
+        assert(error || n == 0);
+        assert(reply || n == 0);
+
+        /* Like sd_bus_call(), but for a series of calls at once. The
+         * calls are queued first and then written out together, and
+         * the replies are collected in whatever order they come
+         * in. Hence the peers process the calls in parallel, and we
+         * pay the round-trip latency once, not once per call.
+         *
+         * reply[] and error[] are arrays of n entries, each of them
+         * is set to the reply or the error of the respective
+         * call. Returns the number of calls that succeeded, or a
+         * negative error if the connection failed, in which case
+         * neither array is filled in. */
+
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
+        for (i = 0; i < n; i++) {
+                assert(!bus_error_is_dirty(error + i));
+                reply[i] = NULL;
+        }
+
+        if (n == 0)
+                return 0;
+
+        r = bus_call_batch_internal(bus, m, n, usec, error, reply);
+        if (r < 0)
+                for (i = 0; i < n; i++) {
+                        reply[i] = sd_bus_message_unref(reply[i]);
+                        sd_bus_error_free(error + i);
+                }
+
+        return r;
+}
+
 _public_ int sd_bus_get_fd(sd_bus *bus) {
 
         assert_return(bus, -EINVAL);
@@ -2828,6 +3274,8 @@ _public_ int sd_bus_flush(sd_bus *bus) {
         if (r < 0)
                 return r;
 
+        bus_properties_changed_flush(bus);
+
         if (bus->wqueue_size <= 0)
                 return 0;
 
@@ -3191,6 +3639,10 @@ _public_ int sd_bus_detach_event(sd_bus *bus) {
 
         detach_io_events(bus);
 
+        /* Without an event loop there's nobody to wake us up for
+         * queued PropertiesChanged signals, hence send them now */
+        bus_properties_changed_flush(bus);
+
         if (bus->time_event_source) {
                 sd_event_source_set_enabled(bus->time_event_source, SD_EVENT_OFF);
                 bus->time_event_source = sd_event_source_unref(bus->time_event_source);
@@ -22,7 +22,175 @@
 #include "sd-bus.h"
 #include "bus-dump.h"
 #include "bus-util.h"
+#include "bus-internal.h"
+#include "bus-control.h"
 #include "util.h"
+#include "capability.h"
+
+static unsigned n_checked = 0;
+static usec_t t_checked = 0;
+
+static int check_filter(sd_bus *bus, sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        usec_t ts;
+        int r;
+
+        if (!sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Test"))
+                return 0;
+
+        ts = now(CLOCK_MONOTONIC);
+
+        r = sd_bus_query_sender_privilege(m, CAP_SYS_ADMIN);
+        assert_se(r >= 0);
+
+        t_checked += now(CLOCK_MONOTONIC) - ts;
+        n_checked++;
+
+        return 1;
+}
+
+static void test_authorization(unsigned n) {
+        _cleanup_bus_close_unref_ sd_bus *server = NULL, *client = NULL;
+        const char *unique;
+        unsigned i, j;
+        usec_t t[2];
+        int r;
+
+        /* Measures what checking the sender of a method call costs,
+         * like check_access() in bus-objects.c does, with and without
+         * the credentials cache */
+
+        r = sd_bus_open_user(&server);
+        if (r >= 0)
+                r = sd_bus_open_user(&client);
+        if (r < 0) {
+                log_info("Failed to connect to user bus, skipping authorization test: %s", strerror(-r));
+                return;
+        }
+
+        assert_se(sd_bus_get_unique_name(server, &unique) >= 0);
+
+        for (j = 0; j < 2; j++) {
+                _cleanup_bus_slot_unref_ sd_bus_slot *slot = NULL;
+
+                /* The cache is opt-in */
+                if (j == 0)
+                        assert_se(!server->creds_cache);
+                else
+                        assert_se(bus_creds_cache_enable(server) > 0);
+
+                assert_se(sd_bus_add_filter(server, &slot, check_filter, NULL) >= 0);
+
+                n_checked = 0;
+                t_checked = 0;
+
+                for (i = 0; i < n; i++) {
+                        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                        assert_se(sd_bus_message_new_method_call(client, &m, unique, "/", "org.freedesktop.systemd.test", "Test") >= 0);
+                        assert_se(sd_bus_send(client, m, NULL) >= 0);
+
+                        if (i % 256 != 255 && i != n - 1)
+                                continue;
+
+                        assert_se(sd_bus_flush(client) >= 0);
+
+                        while (n_checked <= i) {
+                                r = sd_bus_process(server, NULL);
+                                assert_se(r >= 0);
+                                if (r == 0)
+                                        assert_se(sd_bus_wait(server, (uint64_t) -1) >= 0);
+                        }
+                }
+
+                t[j] = t_checked;
+        }
+
+        log_info("Checked the sender of %u calls: %llu ns per call uncached, %llu ns per call cached.",
+                 n,
+                 (unsigned long long) (t[0] * NSEC_PER_USEC / n),
+                 (unsigned long long) (t[1] * NSEC_PER_USEC / n));
+
+        /* The entry is dropped when the client disconnects */
+        assert_se(hashmap_size(server->creds_cache) == 1);
+
+        sd_bus_close_unrefp(&client);
+        client = NULL;
+
+        while (!hashmap_isempty(server->creds_cache)) {
+                r = sd_bus_process(server, NULL);
+                assert_se(r >= 0);
+                if (r == 0)
+                        assert_se(sd_bus_wait(server, (uint64_t) -1) >= 0);
+        }
+}
+
+static void process_timed(sd_bus *bus, usec_t *t) {
+        usec_t ts;
+        int r;
+
+        ts = now(CLOCK_MONOTONIC);
+        r = sd_bus_process(bus, NULL);
+        *t += now(CLOCK_MONOTONIC) - ts;
+
+        assert_se(r >= 0);
+        if (r == 0)
+                assert_se(sd_bus_wait(bus, (uint64_t) -1) >= 0);
+}
+
+static void test_authorization_once(unsigned n) {
+        _cleanup_bus_close_unref_ sd_bus *server = NULL;
+        const char *unique;
+        unsigned i, j;
+        usec_t t[2];
+        int r;
+
+        /* Like test_authorization(), but every client makes a single
+         * call only, as each systemctl invocation does with PID 1.
+         * That's the worst case for the cache, which would need to
+         * watch each client and clean up after it. Counts all the time
+         * the server spends processing, not only the checks. */
+
+        r = sd_bus_open_user(&server);
+        if (r < 0) {
+                log_info("Failed to connect to user bus, skipping authorization test: %s", strerror(-r));
+                return;
+        }
+
+        assert_se(sd_bus_get_unique_name(server, &unique) >= 0);
+
+        for (j = 0; j < 2; j++) {
+                _cleanup_bus_slot_unref_ sd_bus_slot *slot = NULL;
+
+                if (j == 1)
+                        assert_se(bus_creds_cache_enable(server) > 0);
+
+                assert_se(sd_bus_add_filter(server, &slot, check_filter, NULL) >= 0);
+
+                n_checked = 0;
+                t[j] = 0;
+
+                for (i = 0; i < n; i++) {
+                        _cleanup_bus_close_unref_ sd_bus *client = NULL;
+                        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                        assert_se(sd_bus_open_user(&client) >= 0);
+                        assert_se(sd_bus_message_new_method_call(client, &m, unique, "/", "org.freedesktop.systemd.test", "Test") >= 0);
+                        assert_se(sd_bus_send(client, m, NULL) >= 0);
+                        assert_se(sd_bus_flush(client) >= 0);
+
+                        while (n_checked <= i)
+                                process_timed(server, &t[j]);
+                }
+
+                /* One call is not enough to get cached */
+                assert_se(hashmap_isempty(server->creds_cache));
+        }
+
+        log_info("Checked the sender of %u clients with one call each: %llu ns per client uncached, %llu ns per client cached.",
+                 n,
+                 (unsigned long long) (t[0] * NSEC_PER_USEC / n),
+                 (unsigned long long) (t[1] * NSEC_PER_USEC / n));
+}
 
 int main(int argc, char *argv[]) {
         _cleanup_bus_creds_unref_ sd_bus_creds *creds = NULL;
@@ -42,5 +210,8 @@ int main(int argc, char *argv[]) {
                 bus_creds_dump(creds, NULL, true);
         }
 
+        test_authorization(10000);
+        test_authorization_once(500);
+
         return 0;
 }
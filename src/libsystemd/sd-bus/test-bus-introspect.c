@@ -47,7 +47,9 @@ static const sd_bus_vtable vtable[] = {
 };
 
 int main(int argc, char *argv[]) {
+        char *uncached, *cache = NULL;
         struct introspect intro;
+        unsigned i;
 
         log_set_max_level(LOG_DEBUG);
 
@@ -62,5 +64,26 @@ int main(int argc, char *argv[]) {
 
         introspect_free(&intro);
 
+        /* The cached variant must generate the same XML, both when
+         * it fills the cache and when it uses it */
+        assert_se(introspect_begin(&intro, false) >= 0);
+        assert_se(introspect_write_interface(&intro, vtable) >= 0);
+        fflush(intro.f);
+        uncached = strdup(intro.introspection);
+        assert_se(uncached);
+        introspect_free(&intro);
+
+        for (i = 0; i < 2; i++) {
+                assert_se(introspect_begin(&intro, false) >= 0);
+                assert_se(introspect_write_interface_cached(&intro, vtable, &cache) >= 0);
+                assert_se(cache);
+                fflush(intro.f);
+                assert_se(streq(intro.introspection, uncached));
+                introspect_free(&intro);
+        }
+
+        free(cache);
+        free(uncached);
+
         return 0;
 }
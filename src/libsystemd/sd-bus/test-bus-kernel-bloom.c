@@ -19,6 +19,8 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <sys/socket.h>
+
 #include "util.h"
 #include "log.h"
 
@@ -26,6 +28,9 @@
 #include "bus-message.h"
 #include "bus-error.h"
 #include "bus-kernel.h"
+#include "bus-control.h"
+#include "bus-match.h"
+#include "bus-bloom.h"
 #include "bus-util.h"
 
 static void test_one(
@@ -91,9 +96,124 @@ static void test_one(
         sd_bus_unref(b);
 }
 
+#define N_SUBSCRIBERS 256
+
+static bool bloom_covers(const uint64_t *bloom, const uint64_t *mask, size_t size) {
+        size_t i;
+
+        for (i = 0; i < size / 8; i++)
+                if ((bloom[i] & mask[i]) != mask[i])
+                        return false;
+
+        return true;
+}
+
+static void test_rate(sd_bus *bus, const char *name, const char *signature, size_t size, unsigned n_hash) {
+        _cleanup_free_ uint64_t *blooms = NULL, *masks = NULL;
+        unsigned i, j, false_positives = 0;
+        usec_t t = 0;
+
+        blooms = new0(uint64_t, N_SUBSCRIBERS * size / 8);
+        masks = new0(uint64_t, N_SUBSCRIBERS * size / 8);
+        assert_se(blooms && masks);
+
+        for (i = 0; i < N_SUBSCRIBERS; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+                char path[sizeof("/org/freedesktop/systemd1/unit/") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(path, "/org/freedesktop/systemd1/unit/%u", i);
+
+                assert_se(sd_bus_message_new_signal(bus, &m, path, "org.freedesktop.DBus.Properties", "PropertiesChanged") >= 0);
+
+                if (streq(signature, "sa{sv}as"))
+                        assert_se(sd_bus_message_append(m, "sa{sv}as", "org.freedesktop.systemd1.Unit", 0, 2, "ActiveState", "SubState") >= 0);
+                else
+                        assert_se(sd_bus_message_append(m, "sas", path, 8, "a", "b", "c", "d", "e", "f", "g", "h") >= 0);
+
+                assert_se(bus_message_seal(m, i + 1, 0) >= 0);
+
+                t -= now(CLOCK_MONOTONIC);
+                assert_se(bus_message_bloom(m, blooms + i * size / 8, size, n_hash) >= 0);
+                t += now(CLOCK_MONOTONIC);
+        }
+
+        for (i = 0; i < N_SUBSCRIBERS; i++) {
+                _cleanup_free_ char *match = NULL;
+                struct bus_match_component *components = NULL;
+                unsigned n_components = 0;
+
+                if (streq(signature, "sa{sv}as"))
+                        assert_se(asprintf(&match, "type='signal',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',"
+                                           "path='/org/freedesktop/systemd1/unit/%u',arg0='org.freedesktop.systemd1.Unit'", i) >= 0);
+                else
+                        assert_se(asprintf(&match, "type='signal',arg0path='/org/freedesktop/systemd1/unit/%u',arg1='h'", i) >= 0);
+
+                assert_se(bus_match_parse(match, &components, &n_components) >= 0);
+                assert_se(bus_match_bloom(components, n_components, masks + i * size / 8, size, n_hash));
+                bus_match_parse_free(components, n_components);
+        }
+
+        for (i = 0; i < N_SUBSCRIBERS; i++)
+                for (j = 0; j < N_SUBSCRIBERS; j++) {
+                        bool covered;
+
+                        covered = bloom_covers(blooms + j * size / 8, masks + i * size / 8, size);
+
+                        /* A bloom filter never drops a matching message */
+                        if (i == j)
+                                assert_se(covered);
+                        else if (covered)
+                                false_positives++;
+                }
+
+        log_info("%s: m=%4zu k=%2u: %u/%u false positives (%.4f%%), %llu ns per signal",
+                 name, size * 8, n_hash,
+                 false_positives, N_SUBSCRIBERS * (N_SUBSCRIBERS - 1),
+                 100.0 * false_positives / (N_SUBSCRIBERS * (N_SUBSCRIBERS - 1)),
+                 (unsigned long long) (t * NSEC_PER_USEC / N_SUBSCRIBERS));
+}
+
+static void test_rates(void) {
+        static const struct {
+                size_t size;
+                unsigned n_hash;
+        } parameters[] = {
+                { DEFAULT_BLOOM_SIZE, DEFAULT_BLOOM_N_HASH },
+                { DEFAULT_BLOOM_SIZE, 4 },
+                { DEFAULT_BLOOM_SIZE, 16 },
+                { DEFAULT_BLOOM_SIZE * 2, DEFAULT_BLOOM_N_HASH },
+                { DEFAULT_BLOOM_SIZE * 4, DEFAULT_BLOOM_N_HASH },
+        };
+
+        _cleanup_bus_unref_ sd_bus *bus = NULL;
+        int pair[2];
+        unsigned i;
+
+        /* Compare message and match blooms of a population of
+         * subscribers outside of the kernel, so that the false
+         * positive rate and the per-signal cost of the bloom
+         * parameters can be measured everywhere. */
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, pair[0], pair[0]) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(parameters); i++) {
+                assert_se(bloom_validate_parameters(parameters[i].size, parameters[i].n_hash));
+
+                test_rate(bus, "PropertiesChanged", "sa{sv}as", parameters[i].size, parameters[i].n_hash);
+                test_rate(bus, "string list", "sas", parameters[i].size, parameters[i].n_hash);
+        }
+
+        safe_close(pair[1]);
+}
+
 int main(int argc, char *argv[]) {
         log_set_max_level(LOG_DEBUG);
 
+        test_rates();
+
         test_one("/foo/bar/waldo", "waldo.com", "Piep", false, "foobar", "", true);
         test_one("/foo/bar/waldo", "waldo.com", "Piep", false, "foobar", "path='/foo/bar/waldo'", true);
         test_one("/foo/bar/waldo", "waldo.com", "Piep", false, "foobar", "path='/foo/bar/waldo/tuut'", false);
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <byteswap.h>
 #include <math.h>
+#include <sys/socket.h>
 
 #ifdef HAVE_GLIB
 #include <gio/gio.h>
@@ -37,6 +38,7 @@
 
 #include "sd-bus.h"
 #include "bus-message.h"
+#include "bus-internal.h"
 #include "bus-util.h"
 #include "bus-dump.h"
 #include "bus-label.h"
@@ -81,6 +83,91 @@ static void test_bus_label_escape(void) {
         test_bus_label_escape_one(":1", "_3a1");
 }
 
+static void test_buffers(unsigned n) {
+        _cleanup_bus_close_unref_ sd_bus *client = NULL, *server = NULL;
+        uint64_t client_allocated, server_allocated;
+        unsigned i, j, n_received = 0, n_pinning = 0;
+        sd_id128_t id;
+        int fds[2];
+        usec_t t;
+
+        /* Sends a stream of small signals over a socket, and counts
+         * how many message buffers had to be allocated for them on
+         * each side, rather than taken from the cache */
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, fds) >= 0);
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        assert_se(sd_bus_new(&server) >= 0);
+        assert_se(sd_bus_set_fd(server, fds[0], fds[0]) >= 0);
+        assert_se(sd_bus_set_server(server, 1, id) >= 0);
+        assert_se(sd_bus_start(server) >= 0);
+
+        assert_se(sd_bus_new(&client) >= 0);
+        assert_se(sd_bus_set_fd(client, fds[1], fds[1]) >= 0);
+        assert_se(sd_bus_negotiate_fds(client, false) >= 0);
+        assert_se(sd_bus_start(client) >= 0);
+
+        while (client->state != BUS_RUNNING || server->state != BUS_RUNNING) {
+                assert_se(sd_bus_process(client, NULL) >= 0);
+                assert_se(sd_bus_process(server, NULL) >= 0);
+        }
+
+        client_allocated = client->n_buffer_allocated;
+        server_allocated = server->n_buffer_allocated;
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i += 64) {
+                for (j = i; j < MIN(i + 64, n); j++) {
+                        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                        assert_se(sd_bus_message_new_signal(client, &m, "/org/freedesktop/test", "org.freedesktop.Test", "Changed") >= 0);
+                        assert_se(sd_bus_message_append(m, "sus", "foobar", j, "waldo") >= 0);
+                        assert_se(sd_bus_send(client, m, NULL) >= 0);
+                }
+
+                assert_se(sd_bus_flush(client) >= 0);
+
+                while (n_received < j) {
+                        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+                        unsigned u;
+                        int r;
+
+                        r = sd_bus_process(server, &m);
+                        assert_se(r > 0);
+                        if (!m)
+                                continue;
+
+                        assert_se(sd_bus_message_read(m, "sus", NULL, &u, NULL) > 0);
+                        assert_se(u == n_received);
+                        n_received++;
+
+                        if (m->header_allocated >= 4096)
+                                n_pinning++;
+                }
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        client_allocated = client->n_buffer_allocated - client_allocated;
+        server_allocated = server->n_buffer_allocated - server_allocated;
+
+        log_info("Sent %u messages in %s, %llu ns per message, %.2f buffer allocations per message when sending, %.2f when receiving.",
+                 n,
+                 format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1),
+                 (unsigned long long) (t * NSEC_PER_USEC / n),
+                 (double) client_allocated / n,
+                 (double) server_allocated / n);
+
+        /* After the first few messages all buffers come from the
+         * cache */
+        assert_se(client_allocated < n / 10);
+        assert_se(server_allocated < n / 10);
+
+        /* Messages read ahead get buffers of their own size, only a
+         * message read on its own keeps the whole read buffer */
+        assert_se(n_pinning < n / 10);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *copy = NULL;
         int r, boolean;
@@ -98,6 +185,10 @@ int main(int argc, char *argv[]) {
         double dbl;
         uint64_t u64;
 
+        /* Runs on a private connection, hence also without a
+         * system bus */
+        test_buffers(10000);
+
         r = sd_bus_default_system(&bus);
         if (r < 0)
                 return EXIT_TEST_SKIP;
@@ -31,8 +31,10 @@
 #include "strv.h"
 
 #include "sd-bus.h"
+#include "event-util.h"
 #include "bus-internal.h"
 #include "bus-message.h"
+#include "bus-objects.h"
 #include "bus-util.h"
 #include "bus-dump.h"
 
@@ -232,6 +234,222 @@ static int enumerator_callback(sd_bus *bus, const char *path, void *userdata, ch
         return 1;
 }
 
+static int dispatch_handler(sd_bus *bus, sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned *n_called = userdata;
+
+        (*n_called)++;
+        return 1;
+}
+
+static const sd_bus_vtable dispatch_vtable[] = {
+        SD_BUS_VTABLE_START(0),
+        SD_BUS_METHOD("Ping", NULL, NULL, dispatch_handler, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_VTABLE_END
+};
+
+static void test_dispatch(unsigned n) {
+        _cleanup_bus_unref_ sd_bus *bus = NULL;
+        sd_bus_message *m[16] = {};
+        unsigned i, n_called = 0;
+        sd_id128_t id;
+        int fds[2];
+        usec_t t;
+
+        /* Measures how long it takes to find and invoke the handler
+         * of a method call on an object below a fallback vtable,
+         * without any socket I/O involved */
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, fds) >= 0);
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, fds[0], fds[0]) >= 0);
+        assert_se(sd_bus_set_server(bus, 1, id) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        assert_se(sd_bus_add_fallback_vtable(bus, NULL, "/org/freedesktop/test/dispatch", "org.freedesktop.Test", dispatch_vtable, NULL, &n_called) >= 0);
+        assert_se(sd_bus_add_object_vtable(bus, NULL, "/org/freedesktop/test/other", "org.freedesktop.Test", vtable2, NULL) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(m); i++) {
+                char path[sizeof("/org/freedesktop/test/dispatch/unit/object") + DECIMAL_STR_MAX(unsigned)];
+
+                sprintf(path, "/org/freedesktop/test/dispatch/unit/object%u", i);
+
+                assert_se(sd_bus_message_new_method_call(bus, &m[i], NULL, path, "org.freedesktop.Test", "Ping") >= 0);
+                assert_se(sd_bus_message_set_expect_reply(m[i], false) >= 0);
+                assert_se(bus_message_seal(m[i], i + 1, 0) >= 0);
+        }
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                bus->iteration_counter++;
+                assert_se(bus_process_object(bus, m[i % ELEMENTSOF(m)]) > 0);
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        assert_se(n_called == n);
+
+        log_info("Dispatched %u method calls, %llu ns per call.", n, (unsigned long long) (t * NSEC_PER_USEC / n));
+
+        for (i = 0; i < ELEMENTSOF(m); i++)
+                sd_bus_message_unref(m[i]);
+
+        safe_close(fds[1]);
+}
+
+static int coalesce_get(sd_bus *bus, const char *path, const char *interface, const char *property, sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+        unsigned *state = userdata;
+
+        return sd_bus_message_append(reply, "u", *state);
+}
+
+static const sd_bus_vtable coalesce_vtable[] = {
+        SD_BUS_VTABLE_START(0),
+        SD_BUS_PROPERTY("State", "u", coalesce_get, 0, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+        SD_BUS_PROPERTY("Counter", "u", coalesce_get, 0, SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION),
+        SD_BUS_VTABLE_END
+};
+
+#define COALESCE_OBJECTS 50U
+#define COALESCE_ROUNDS 10U
+
+static int coalesce_receive(sd_bus *client, sd_bus *server, unsigned *n_signals, uint64_t *n_bytes, unsigned *last_state) {
+        int r;
+
+        for (;;) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+                const char *interface, *name;
+
+                r = sd_bus_process(client, &m);
+                assert_se(r >= 0);
+                if (r == 0) {
+                        if (server->wqueue_size <= 0)
+                                return 0;
+
+                        assert_se(sd_bus_process(server, NULL) >= 0);
+                        continue;
+                }
+
+                if (!m || !sd_bus_message_is_signal(m, "org.freedesktop.DBus.Properties", "PropertiesChanged"))
+                        continue;
+
+                (*n_signals)++;
+                *n_bytes += BUS_MESSAGE_SIZE(m);
+
+                if (!streq(m->path, "/org/freedesktop/test/coalesce/object0"))
+                        continue;
+
+                assert_se(sd_bus_message_read(m, "s", &interface) > 0);
+                assert_se(sd_bus_message_enter_container(m, 'a', "{sv}") > 0);
+
+                while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+                        assert_se(sd_bus_message_read(m, "s", &name) > 0);
+
+                        if (streq(name, "State"))
+                                assert_se(sd_bus_message_read(m, "v", "u", last_state) > 0);
+                        else
+                                assert_se(sd_bus_message_skip(m, "v") > 0);
+
+                        assert_se(sd_bus_message_exit_container(m) > 0);
+                }
+                assert_se(r >= 0);
+        }
+}
+
+static void test_properties_changed(usec_t latency, unsigned *ret_signals) {
+        _cleanup_bus_close_unref_ sd_bus *client = NULL, *server = NULL;
+        _cleanup_event_unref_ sd_event *e = NULL;
+        unsigned i, j, state = 0, last_state = (unsigned) -1, n_signals = 0;
+        uint64_t n_bytes = 0;
+        sd_id128_t id;
+        int fds[2];
+
+        /* Changes the properties of a number of objects repeatedly,
+         * as PID 1 does with units during boot, sending other signals
+         * in between, each time running
+         * one event loop iteration, and counts the PropertiesChanged
+         * signals that make it to the peer */
+
+        assert_se(sd_event_default(&e) >= 0);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, fds) >= 0);
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        assert_se(sd_bus_new(&server) >= 0);
+        assert_se(sd_bus_set_fd(server, fds[0], fds[0]) >= 0);
+        assert_se(sd_bus_set_server(server, 1, id) >= 0);
+        assert_se(sd_bus_start(server) >= 0);
+        assert_se(sd_bus_attach_event(server, e, SD_EVENT_PRIORITY_NORMAL) >= 0);
+
+        assert_se(sd_bus_new(&client) >= 0);
+        assert_se(sd_bus_set_fd(client, fds[1], fds[1]) >= 0);
+        assert_se(sd_bus_start(client) >= 0);
+
+        while (client->state != BUS_RUNNING || server->state != BUS_RUNNING) {
+                assert_se(sd_bus_process(client, NULL) >= 0);
+                assert_se(sd_bus_process(server, NULL) >= 0);
+        }
+
+        assert_se(sd_bus_add_fallback_vtable(server, NULL, "/org/freedesktop/test/coalesce", "org.freedesktop.Test", coalesce_vtable, NULL, &state) >= 0);
+        assert_se(sd_bus_add_fallback_vtable(server, NULL, "/org/freedesktop/test/coalesce", "org.freedesktop.Test2", coalesce_vtable, NULL, &state) >= 0);
+        assert_se(bus_set_properties_changed_latency(server, latency) >= 0);
+
+        for (i = 0; i < COALESCE_ROUNDS; i++) {
+                state = i;
+
+                for (j = 0; j < COALESCE_OBJECTS; j++) {
+                        char path[sizeof("/org/freedesktop/test/coalesce/object") + DECIMAL_STR_MAX(unsigned)];
+
+                        sprintf(path, "/org/freedesktop/test/coalesce/object%u", j);
+
+                        assert_se(sd_bus_emit_properties_changed_strv(server, path, "org.freedesktop.Test", NULL) >= 0);
+                        assert_se(sd_bus_emit_properties_changed(server, path, "org.freedesktop.Test2", "State", NULL) >= 0);
+                        assert_se(sd_bus_emit_properties_changed(server, path, "org.freedesktop.Test2", "Counter", NULL) >= 0);
+
+                        /* Other traffic in between, like PID 1's
+                         * JobNew signals, does not get in the way */
+                        assert_se(sd_bus_emit_signal(server, "/org/freedesktop/test/coalesce", "org.freedesktop.Test", "JobNew", NULL) >= 0);
+                }
+
+                assert_se(sd_event_run(e, 0) >= 0);
+                assert_se(coalesce_receive(client, server, &n_signals, &n_bytes, &last_state) >= 0);
+        }
+
+        while (!ordered_hashmap_isempty(server->properties_changed))
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        assert_se(coalesce_receive(client, server, &n_signals, &n_bytes, &last_state) >= 0);
+
+        /* Whatever got merged, the peer must end up with the final value */
+        assert_se(last_state == COALESCE_ROUNDS - 1);
+
+        if (latency == USEC_INFINITY)
+                log_info("PropertiesChanged without coalescing: %u signals, %llu bytes.", n_signals, (unsigned long long) n_bytes);
+        else
+                log_info("PropertiesChanged coalesced with %llu us latency: %u signals, %llu bytes.", (unsigned long long) latency, n_signals, (unsigned long long) n_bytes);
+
+        *ret_signals = n_signals;
+
+        /* Nothing else we send about an object may overtake what is
+         * held back for it, while messages about other objects leave
+         * it alone */
+        state = COALESCE_ROUNDS;
+        assert_se(sd_bus_emit_properties_changed(server, "/org/freedesktop/test/coalesce/object0", "org.freedesktop.Test2", "State", NULL) >= 0);
+        assert_se(sd_bus_emit_properties_changed(server, "/org/freedesktop/test/coalesce/object1", "org.freedesktop.Test2", "State", NULL) >= 0);
+        assert_se(sd_bus_emit_signal(server, "/org/freedesktop/test/coalesce", "org.freedesktop.Test", "Other", NULL) >= 0);
+        assert_se(latency == USEC_INFINITY || ordered_hashmap_size(server->properties_changed) == 2);
+        assert_se(sd_bus_emit_signal(server, "/org/freedesktop/test/coalesce/object0", "org.freedesktop.Test", "Removed", NULL) >= 0);
+        assert_se(latency == USEC_INFINITY || ordered_hashmap_size(server->properties_changed) == 1);
+        assert_se(coalesce_receive(client, server, &n_signals, &n_bytes, &last_state) >= 0);
+        assert_se(last_state == COALESCE_ROUNDS);
+
+        /* As with PID 1's UnitRemoved, which is sent from another
+         * path than the unit it is about */
+        bus_properties_changed_flush_path(server, "/org/freedesktop/test/coalesce/object1");
+        assert_se(ordered_hashmap_isempty(server->properties_changed));
+
+        assert_se(sd_bus_detach_event(server) >= 0);
+}
+
 static void *server(void *p) {
         struct context *c = p;
         sd_bus *bus = NULL;
@@ -287,6 +505,97 @@ fail:
         return INT_TO_PTR(r);
 }
 
+static void test_batch(sd_bus *bus, unsigned n) {
+        char *paths[] = { (char*) "/value/a", (char*) "/value/b", (char*) "/value/c" };
+        sd_bus_message *m[3], *reply[3], **calls, **replies;
+        sd_bus_error error[3], *errors;
+        const char *s;
+        unsigned i;
+        usec_t t, u;
+        int level;
+
+        for (i = 0; i < 3; i++)
+                error[i] = SD_BUS_ERROR_NULL;
+
+        assert_se(bus_get_all_properties_many(bus, "org.freedesktop.systemd.test", paths, 3, "org.freedesktop.systemd.ValueTest", error, reply) == 3);
+
+        for (i = 0; i < 3; i++) {
+                assert_se(reply[i]);
+                assert_se(!sd_bus_error_is_set(error + i));
+                assert_se(sd_bus_message_enter_container(reply[i], 'a', "{sv}") > 0);
+                assert_se(sd_bus_message_enter_container(reply[i], 'e', "sv") > 0);
+                assert_se(sd_bus_message_read(reply[i], "s", &s) > 0);
+                assert_se(streq(s, "Value"));
+                assert_se(sd_bus_message_read(reply[i], "v", "s", &s) > 0);
+                assert_se(endswith(s, paths[i]));
+                reply[i] = sd_bus_message_unref(reply[i]);
+        }
+
+        /* Errors are reported per call */
+        assert_se(sd_bus_message_new_method_call(bus, m + 0, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "AlterSomething") >= 0);
+        assert_se(sd_bus_message_append(m[0], "s", "batch") >= 0);
+        assert_se(sd_bus_message_new_method_call(bus, m + 1, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "Doesntexist") >= 0);
+        assert_se(sd_bus_message_new_method_call(bus, m + 2, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "NoOperation") >= 0);
+
+        assert_se(bus_call_batch(bus, m, 3, 0, error, reply) == 2);
+
+        assert_se(sd_bus_message_read(reply[0], "s", &s) > 0);
+        assert_se(streq(s, "<<<batch>>>"));
+        assert_se(!reply[1]);
+        assert_se(sd_bus_error_has_name(error + 1, SD_BUS_ERROR_UNKNOWN_METHOD));
+        assert_se(reply[2]);
+
+        for (i = 0; i < 3; i++) {
+                sd_bus_message_unref(m[i]);
+                sd_bus_message_unref(reply[i]);
+                sd_bus_error_free(error + i);
+        }
+
+        /* Compare the latency of calls in a row with one batch of
+         * them, without the server logging every iteration */
+        calls = new(sd_bus_message*, n);
+        replies = new(sd_bus_message*, n);
+        errors = new(sd_bus_error, n);
+        assert_se(calls && replies && errors);
+
+        level = log_get_max_level();
+        log_set_max_level(LOG_CRIT);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *r = NULL;
+
+                assert_se(sd_bus_call_method(bus, "org.freedesktop.systemd.test", paths[i % 3], "org.freedesktop.DBus.Properties", "GetAll", NULL, &r, "s", "") >= 0);
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        u = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                assert_se(sd_bus_message_new_method_call(bus, calls + i, "org.freedesktop.systemd.test", paths[i % 3], "org.freedesktop.DBus.Properties", "GetAll") >= 0);
+                assert_se(sd_bus_message_append(calls[i], "s", "") >= 0);
+                errors[i] = SD_BUS_ERROR_NULL;
+        }
+        assert_se(bus_call_batch(bus, calls, n, 0, errors, replies) == (int) n);
+        u = now(CLOCK_MONOTONIC) - u;
+
+        log_set_max_level(level);
+
+        for (i = 0; i < n; i++) {
+                assert_se(replies[i]->reply_cookie == BUS_MESSAGE_COOKIE(calls[i]));
+                sd_bus_message_unref(calls[i]);
+                sd_bus_message_unref(replies[i]);
+        }
+
+        log_info("%u GetAll calls: %llu ns per call in a row, %llu ns per call batched.",
+                 n,
+                 (unsigned long long) (t * NSEC_PER_USEC / n),
+                 (unsigned long long) (u * NSEC_PER_USEC / n));
+
+        free(calls);
+        free(replies);
+        free(errors);
+}
+
 static int client(struct context *c) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_bus_unref_ sd_bus *bus = NULL;
@@ -504,6 +813,8 @@ static int client(struct context *c) {
         sd_bus_message_unref(reply);
         reply = NULL;
 
+        test_batch(bus, 1000);
+
         r = sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "Exit", &error, NULL, "");
         assert_se(r >= 0);
 
@@ -513,6 +824,7 @@ static int client(struct context *c) {
 }
 
 int main(int argc, char *argv[]) {
+        unsigned n_immediate, n_next_iteration, n_delayed;
         struct context c = {};
         pthread_t s;
         void *p;
@@ -520,6 +832,17 @@ int main(int argc, char *argv[]) {
 
         zero(c);
 
+        test_dispatch(100000);
+
+        test_properties_changed(USEC_INFINITY, &n_immediate);
+        test_properties_changed(0, &n_next_iteration);
+        test_properties_changed(100 * USEC_PER_MSEC, &n_delayed);
+
+        assert_se(n_immediate == COALESCE_ROUNDS * COALESCE_OBJECTS * 3);
+        assert_se(n_next_iteration == COALESCE_ROUNDS * COALESCE_OBJECTS * 2);
+        assert_se(n_delayed >= COALESCE_OBJECTS * 2);
+        assert_se(n_delayed <= n_next_iteration);
+
         c.automatic_integer_property = 4711;
         assert_se(c.automatic_string_property = strdup("dudeldu"));
 
@@ -24,10 +24,12 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 
 #include "log.h"
 #include "util.h"
 #include "macro.h"
+#include "memfd-util.h"
 
 #include "sd-bus.h"
 #include "bus-internal.h"
@@ -42,8 +44,33 @@ struct context {
 
         bool client_anonymous_auth;
         bool server_anonymous_auth;
+
+        bool client_negotiate_memfd;
+        bool server_negotiate_memfd;
 };
 
+#define DATA_SIZE (4U*1024U*1024U)
+#define DATA_ROUNDS 16U
+
+static int verify_data(sd_bus_message *m) {
+        const uint8_t *p;
+        size_t l, i;
+        int r;
+
+        r = sd_bus_message_read_array(m, 'y', (const void**) &p, &l);
+        if (r < 0)
+                return r;
+
+        if (l != DATA_SIZE)
+                return -EBADMSG;
+
+        for (i = 0; i < l; i++)
+                if (p[i] != (uint8_t) i)
+                        return -EBADMSG;
+
+        return 0;
+}
+
 static void *server(void *p) {
         struct context *c = p;
         sd_bus *bus = NULL;
@@ -58,6 +85,7 @@ static void *server(void *p) {
         assert_se(sd_bus_set_server(bus, 1, id) >= 0);
         assert_se(sd_bus_set_anonymous(bus, c->server_anonymous_auth) >= 0);
         assert_se(sd_bus_negotiate_fds(bus, c->server_negotiate_unix_fds) >= 0);
+        assert_se(bus_negotiate_memfd(bus, c->server_negotiate_memfd) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
         while (!quit) {
@@ -87,6 +115,8 @@ static void *server(void *p) {
                 if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Exit")) {
 
                         assert_se((sd_bus_can_send(bus, 'h') >= 1) == (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds));
+                        assert_se(bus->can_memfd == (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds &&
+                                                     c->server_negotiate_memfd && c->client_negotiate_memfd));
 
                         r = sd_bus_message_new_method_return(m, &reply);
                         if (r < 0) {
@@ -96,6 +126,20 @@ static void *server(void *p) {
 
                         quit = true;
 
+                } else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Data")) {
+
+                        r = verify_data(m);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to verify data: %m");
+                                goto fail;
+                        }
+
+                        r = sd_bus_message_new_method_return(m, &reply);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to allocate return: %m");
+                                goto fail;
+                        }
+
                 } else if (sd_bus_message_is_method_call(m, NULL, NULL)) {
                         r = sd_bus_message_new_method_error(
                                         m,
@@ -127,18 +171,79 @@ fail:
         return INT_TO_PTR(r);
 }
 
+static int send_data(sd_bus *bus) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_close_ int fd = -1;
+        uint8_t *p = NULL;
+        size_t i;
+        int r;
+
+        /* Large arrays are passed as memfds, if both sides agreed to
+         * it, and copied through the socket otherwise */
+
+        fd = memfd_new_and_map(NULL, DATA_SIZE, (void**) &p);
+        if (fd < 0)
+                return log_error_errno(fd, "Failed to allocate memfd: %m");
+
+        for (i = 0; i < DATA_SIZE; i++)
+                p[i] = (uint8_t) i;
+
+        assert_se(munmap(p, DATA_SIZE) >= 0);
+
+        r = sd_bus_message_new_method_call(
+                        bus,
+                        &m,
+                        "org.freedesktop.systemd.test",
+                        "/",
+                        "org.freedesktop.systemd.test",
+                        "Data");
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate method call: %m");
+
+        r = sd_bus_message_append_array_memfd(m, 'y', fd, 0, DATA_SIZE);
+        if (r < 0)
+                return log_error_errno(r, "Failed to append memfd: %m");
+
+        r = sd_bus_call(bus, m, 0, &error, &reply);
+        if (r < 0) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        return 0;
+}
+
 static int client(struct context *c) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
         _cleanup_bus_unref_ sd_bus *bus = NULL;
         sd_bus_error error = SD_BUS_ERROR_NULL;
+        usec_t t;
+        unsigned i;
         int r;
 
         assert_se(sd_bus_new(&bus) >= 0);
         assert_se(sd_bus_set_fd(bus, c->fds[1], c->fds[1]) >= 0);
         assert_se(sd_bus_negotiate_fds(bus, c->client_negotiate_unix_fds) >= 0);
+        assert_se(bus_negotiate_memfd(bus, c->client_negotiate_memfd) >= 0);
         assert_se(sd_bus_set_anonymous(bus, c->client_anonymous_auth) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < DATA_ROUNDS; i++) {
+                r = send_data(bus);
+                if (r < 0)
+                        return r;
+        }
+
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_info("Sent %u arrays of %u bytes in %s, %s: %llu MB/s",
+                 DATA_ROUNDS, DATA_SIZE, format_timespan((char[FORMAT_TIMESPAN_MAX]) {}, FORMAT_TIMESPAN_MAX, t, 0),
+                 bus->can_memfd ? "as memfds" : "copied",
+                 (unsigned long long) ((uint64_t) DATA_ROUNDS * DATA_SIZE * USEC_PER_SEC / MAX(t, 1U) / (1024*1024)));
+
         r = sd_bus_message_new_method_call(
                         bus,
                         &m,
@@ -159,7 +264,8 @@ static int client(struct context *c) {
 }
 
 static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_fds,
-                    bool client_anonymous_auth, bool server_anonymous_auth) {
+                    bool client_anonymous_auth, bool server_anonymous_auth,
+                    bool client_negotiate_memfd, bool server_negotiate_memfd) {
 
         struct context c;
         pthread_t s;
@@ -174,6 +280,8 @@ static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_f
         c.server_negotiate_unix_fds = server_negotiate_unix_fds;
         c.client_anonymous_auth = client_anonymous_auth;
         c.server_anonymous_auth = server_anonymous_auth;
+        c.client_negotiate_memfd = client_negotiate_memfd;
+        c.server_negotiate_memfd = server_negotiate_memfd;
 
         r = pthread_create(&s, NULL, server, &c);
         if (r != 0)
@@ -197,26 +305,38 @@ static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_f
 int main(int argc, char *argv[]) {
         int r;
 
-        r = test_one(true, true, false, false);
+        r = test_one(true, true, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, false, false, false);
+        r = test_one(true, false, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(false, true, false, false);
+        r = test_one(false, true, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(false, false, false, false);
+        r = test_one(false, false, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, true, true);
+        r = test_one(true, true, true, true, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, false, true);
+        r = test_one(true, true, false, true, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, true, false);
+        r = test_one(true, true, true, false, false, false);
         assert_se(r == -EPERM);
 
+        r = test_one(true, true, false, false, true, true);
+        assert_se(r >= 0);
+
+        r = test_one(true, true, false, false, true, false);
+        assert_se(r >= 0);
+
+        r = test_one(true, true, false, false, false, true);
+        assert_se(r >= 0);
+
+        r = test_one(false, true, false, false, true, true);
+        assert_se(r >= 0);
+
         return EXIT_SUCCESS;
 }
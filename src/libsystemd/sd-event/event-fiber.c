@@ -0,0 +1,485 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/mman.h>
+#include <ucontext.h>
+
+#include "util.h"
+#include "event-fiber.h"
+
+/* Stacks are mapped lazily by the kernel, hence this only costs
+ * address space for the parts never touched. The lowest page is a
+ * guard page. */
+#define FIBER_STACK_SIZE (256U*1024U)
+
+/* Stacks of finished fibers are kept for reuse */
+#define FIBER_STACK_POOL_MAX 16U
+
+struct Fiber {
+        unsigned n_ref;
+
+        sd_event *event;
+
+        fiber_func_t func;
+        fiber_done_t done;
+        void *userdata;
+
+        ucontext_t context;
+        ucontext_t caller;
+        void *stack;
+
+        /* What the suspended fiber waits on */
+        sd_event_source *source;
+        sd_event_source *timer;
+        sd_bus_slot *slot;
+
+        /* Handed over to the fiber when it is resumed */
+        int wakeup;
+        uint32_t revents;
+        siginfo_t siginfo;
+        sd_bus_message *reply;
+
+        int result;
+
+        bool running:1;
+        bool finished:1;
+        bool cancelled:1;
+};
+
+static thread_local Fiber *current = NULL;
+
+static thread_local void *stack_pool[FIBER_STACK_POOL_MAX];
+static thread_local unsigned n_stack_pool = 0;
+
+static void *stack_alloc(void) {
+        void *p;
+
+        if (n_stack_pool > 0)
+                return stack_pool[--n_stack_pool];
+
+        p = mmap(NULL, FIBER_STACK_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_STACK, -1, 0);
+        if (p == MAP_FAILED)
+                return NULL;
+
+        if (mprotect(p, page_size(), PROT_NONE) < 0) {
+                munmap(p, FIBER_STACK_SIZE);
+                return NULL;
+        }
+
+        return p;
+}
+
+static void stack_free(void *p) {
+        if (!p)
+                return;
+
+        if (n_stack_pool < FIBER_STACK_POOL_MAX) {
+                stack_pool[n_stack_pool++] = p;
+                return;
+        }
+
+        munmap(p, FIBER_STACK_SIZE);
+}
+
+static void fiber_release(Fiber *f) {
+        assert(f);
+
+        f->source = sd_event_source_unref(f->source);
+        f->timer = sd_event_source_unref(f->timer);
+        f->slot = sd_bus_slot_unref(f->slot);
+        f->reply = sd_bus_message_unref(f->reply);
+}
+
+static void fiber_trampoline(void) {
+        Fiber *f = current;
+
+        assert(f);
+
+        f->result = f->func(f->userdata);
+        f->finished = true;
+
+        /* Returning continues in the caller context, see uc_link */
+}
+
+static void fiber_finish(Fiber *f) {
+        assert(f);
+        assert(f->finished);
+
+        fiber_release(f);
+
+        stack_free(f->stack);
+        f->stack = NULL;
+
+        if (f->done)
+                f->done(f, f->result, f->userdata);
+
+        /* Drop the reference the fiber held on itself while it
+         * was alive */
+        fiber_unref(f);
+}
+
+static void fiber_resume(Fiber *f) {
+        Fiber *previous;
+
+        assert(f);
+        assert(!f->running);
+        assert(!f->finished);
+
+        fiber_ref(f);
+
+        previous = current;
+        current = f;
+        f->running = true;
+
+        assert_se(swapcontext(&f->caller, &f->context) >= 0);
+
+        f->running = false;
+        current = previous;
+
+        if (f->finished)
+                fiber_finish(f);
+
+        fiber_unref(f);
+}
+
+static int fiber_suspend(Fiber *f) {
+        assert(f);
+        assert(f == current);
+
+        assert_se(swapcontext(&f->context, &f->caller) >= 0);
+
+        return f->wakeup;
+}
+
+static void fiber_wake(Fiber *f, int r) {
+        assert(f);
+
+        f->wakeup = r;
+        fiber_resume(f);
+}
+
+static int fiber_start_handler(sd_event_source *s, void *userdata) {
+        Fiber *f = userdata;
+
+        f->source = sd_event_source_unref(f->source);
+        fiber_wake(f, 0);
+
+        return 0;
+}
+
+int fiber_new(sd_event *e, Fiber **ret, fiber_func_t func, fiber_done_t done, void *userdata) {
+        Fiber *f;
+        int r;
+
+        assert(e);
+        assert(func);
+
+        f = new0(Fiber, 1);
+        if (!f)
+                return -ENOMEM;
+
+        f->n_ref = 1;
+        f->event = sd_event_ref(e);
+        f->func = func;
+        f->done = done;
+        f->userdata = userdata;
+
+        f->stack = stack_alloc();
+        if (!f->stack) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        if (getcontext(&f->context) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        f->context.uc_stack.ss_sp = f->stack;
+        f->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+        f->context.uc_link = &f->caller;
+        makecontext(&f->context, fiber_trampoline, 0);
+
+        /* Fibers are started from the event loop, never from the
+         * caller's context */
+        r = sd_event_add_defer(e, &f->source, fiber_start_handler, f);
+        if (r < 0)
+                goto fail;
+
+        (void) sd_event_source_set_description(f->source, "fiber-start");
+
+        if (ret)
+                *ret = fiber_ref(f);
+
+        return 0;
+
+fail:
+        stack_free(f->stack);
+        sd_event_unref(f->event);
+        free(f);
+        return r;
+}
+
+Fiber *fiber_ref(Fiber *f) {
+        if (!f)
+                return NULL;
+
+        assert(f->n_ref > 0);
+        f->n_ref++;
+
+        return f;
+}
+
+Fiber *fiber_unref(Fiber *f) {
+        if (!f)
+                return NULL;
+
+        assert(f->n_ref > 0);
+        f->n_ref--;
+
+        if (f->n_ref > 0)
+                return NULL;
+
+        /* A fiber that did not finish keeps a reference on itself */
+        assert(f->finished);
+        assert(!f->stack);
+
+        sd_event_unref(f->event);
+        free(f);
+
+        return NULL;
+}
+
+int fiber_cancel(Fiber *f) {
+        assert(f);
+
+        if (f->finished || f->cancelled)
+                return 0;
+
+        f->cancelled = true;
+
+        /* A running fiber notices when it waits the next time */
+        if (f->running)
+                return 0;
+
+        fiber_release(f);
+        fiber_wake(f, -ECANCELED);
+
+        return 1;
+}
+
+int fiber_get_result(Fiber *f) {
+        assert(f);
+
+        if (!f->finished)
+                return -EBUSY;
+
+        return f->result;
+}
+
+Fiber *fiber_current(void) {
+        return current;
+}
+
+static int fiber_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        Fiber *f = userdata;
+
+        f->revents = revents;
+        fiber_wake(f, 0);
+
+        return 0;
+}
+
+static int fiber_time_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        fiber_wake(userdata, 0);
+        return 0;
+}
+
+static int fiber_timeout_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        fiber_wake(userdata, -ETIMEDOUT);
+        return 0;
+}
+
+static int fiber_child_handler(sd_event_source *s, const siginfo_t *si, void *userdata) {
+        Fiber *f = userdata;
+
+        f->siginfo = *si;
+        fiber_wake(f, 0);
+
+        return 0;
+}
+
+static int fiber_bus_reply_handler(sd_bus *bus, sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        Fiber *f = userdata;
+
+        f->reply = sd_bus_message_ref(m);
+        fiber_wake(f, 0);
+
+        return 0;
+}
+
+static int fiber_add_timer(Fiber *f, uint64_t usec, sd_event_time_handler_t callback) {
+        usec_t n;
+        int r;
+
+        assert(f);
+
+        if (usec == USEC_INFINITY)
+                return 0;
+
+        r = sd_event_now(f->event, CLOCK_MONOTONIC, &n);
+        if (r < 0)
+                return r;
+
+        /* Saturate instead of wrapping around */
+        n = usec >= USEC_INFINITY - n ? USEC_INFINITY - 1 : n + usec;
+
+        return sd_event_add_time(f->event, &f->timer, CLOCK_MONOTONIC, n, 0, callback, f);
+}
+
+int fiber_yield(void) {
+        Fiber *f = current;
+        int r;
+
+        assert(f);
+
+        if (f->cancelled)
+                return -ECANCELED;
+
+        r = sd_event_add_defer(f->event, &f->source, fiber_start_handler, f);
+        if (r < 0)
+                return r;
+
+        r = fiber_suspend(f);
+        fiber_release(f);
+
+        return r;
+}
+
+int fiber_sleep(uint64_t usec) {
+        Fiber *f = current;
+        int r;
+
+        assert(f);
+        assert(usec != USEC_INFINITY);
+
+        if (f->cancelled)
+                return -ECANCELED;
+
+        r = fiber_add_timer(f, usec, fiber_time_handler);
+        if (r < 0)
+                return r;
+
+        r = fiber_suspend(f);
+        fiber_release(f);
+
+        return r;
+}
+
+int fiber_wait_fd(int fd, uint32_t events, uint64_t usec, uint32_t *revents) {
+        Fiber *f = current;
+        int r;
+
+        assert(f);
+        assert(fd >= 0);
+
+        if (f->cancelled)
+                return -ECANCELED;
+
+        r = sd_event_add_io(f->event, &f->source, fd, events, fiber_io_handler, f);
+        if (r < 0)
+                return r;
+
+        r = fiber_add_timer(f, usec, fiber_timeout_handler);
+        if (r < 0)
+                goto finish;
+
+        r = fiber_suspend(f);
+        if (r >= 0 && revents)
+                *revents = f->revents;
+
+finish:
+        fiber_release(f);
+        return r;
+}
+
+int fiber_wait_child(pid_t pid, int options, siginfo_t *si) {
+        Fiber *f = current;
+        int r;
+
+        assert(f);
+        assert(pid > 1);
+
+        if (f->cancelled)
+                return -ECANCELED;
+
+        r = sd_event_add_child(f->event, &f->source, pid, options, fiber_child_handler, f);
+        if (r < 0)
+                return r;
+
+        r = fiber_suspend(f);
+        if (r >= 0 && si)
+                *si = f->siginfo;
+
+        fiber_release(f);
+        return r;
+}
+
+int fiber_bus_call(sd_bus *bus, sd_bus_message *m, uint64_t usec, sd_bus_error *error, sd_bus_message **reply) {
+        Fiber *f = current;
+        sd_bus_message *rep;
+        int r;
+
+        assert(f);
+        assert(bus);
+        assert(m);
+
+        if (f->cancelled)
+                return -ECANCELED;
+
+        /* Like sd_bus_call(), but other event sources are dispatched
+         * while waiting for the reply. The bus needs to be attached
+         * to the event loop of the fiber for that. */
+        r = sd_bus_call_async(bus, &f->slot, m, fiber_bus_reply_handler, f, usec);
+        if (r < 0)
+                return r;
+
+        r = fiber_suspend(f);
+        if (r < 0) {
+                fiber_release(f);
+                return r;
+        }
+
+        rep = f->reply;
+        f->reply = NULL;
+        fiber_release(f);
+
+        if (sd_bus_message_is_method_error(rep, NULL)) {
+                r = sd_bus_error_copy(error, sd_bus_message_get_error(rep));
+                sd_bus_message_unref(rep);
+                return r;
+        }
+
+        if (reply)
+                *reply = rep;
+        else
+                sd_bus_message_unref(rep);
+
+        return 1;
+}
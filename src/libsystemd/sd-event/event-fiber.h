@@ -0,0 +1,63 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <signal.h>
+
+#include "macro.h"
+#include "sd-event.h"
+#include "sd-bus.h"
+
+/* A fiber runs a function on a stack of its own, on top of an event
+ * loop. Whenever the function waits for something, the fiber is
+ * suspended and the event loop continues, until the event source it
+ * waits on is dispatched and resumes it. This allows writing
+ * multi-step asynchronous operations as straight code instead of
+ * chains of callbacks.
+ *
+ * Fibers are strictly cooperative, and must only be used from the
+ * thread of their event loop. They keep the event loop referenced
+ * until they are done. The fiber_wait_*() calls may only be used from
+ * within a fiber, and return -ECANCELED once it has been cancelled. */
+
+typedef struct Fiber Fiber;
+
+typedef int (*fiber_func_t)(void *userdata);
+typedef void (*fiber_done_t)(Fiber *f, int r, void *userdata);
+
+int fiber_new(sd_event *e, Fiber **ret, fiber_func_t func, fiber_done_t done, void *userdata);
+Fiber *fiber_ref(Fiber *f);
+Fiber *fiber_unref(Fiber *f);
+
+int fiber_cancel(Fiber *f);
+int fiber_get_result(Fiber *f);
+
+Fiber *fiber_current(void);
+
+int fiber_yield(void);
+int fiber_sleep(uint64_t usec);
+int fiber_wait_fd(int fd, uint32_t events, uint64_t usec, uint32_t *revents);
+int fiber_wait_child(pid_t pid, int options, siginfo_t *si);
+int fiber_bus_call(sd_bus *bus, sd_bus_message *m, uint64_t usec, sd_bus_error *error, sd_bus_message **reply);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(Fiber*, fiber_unref);
+#define _cleanup_fiber_unref_ _cleanup_(fiber_unrefp)
@@ -26,6 +26,8 @@
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(sd_event*, sd_event_unref);
 DEFINE_TRIVIAL_CLEANUP_FUNC(sd_event_source*, sd_event_source_unref);
+DEFINE_TRIVIAL_CLEANUP_FUNC(sd_event_group*, sd_event_group_unref);
 
 #define _cleanup_event_unref_ _cleanup_(sd_event_unrefp)
 #define _cleanup_event_source_unref_ _cleanup_(sd_event_source_unrefp)
+#define _cleanup_event_group_unref_ _cleanup_(sd_event_group_unrefp)
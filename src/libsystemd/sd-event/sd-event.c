@@ -21,24 +21,41 @@
 
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
 #include <pthread.h>
 
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
 #include "sd-id128.h"
 #include "sd-daemon.h"
 #include "macro.h"
 #include "prioq.h"
+#include "timer-wheel.h"
 #include "hashmap.h"
 #include "util.h"
 #include "time-util.h"
 #include "missing.h"
 #include "set.h"
+#include "strv.h"
 #include "list.h"
+#include "mempool.h"
 
 #include "sd-event.h"
 
 #define EPOLL_QUEUE_MAX 512U
+#define URING_ENTRIES 256U
 #define DEFAULT_ACCURACY_USEC (250 * USEC_PER_MSEC)
+#define PROFILE_HISTOGRAM_BUCKETS 32U
+
+/* A wait that returns sooner than this found something ready
+ * right-away, and did not actually put us to sleep */
+#define WAKEUP_MIN_USEC 100U
 
 typedef enum EventSourceType {
         SOURCE_IO,
@@ -52,34 +69,81 @@ typedef enum EventSourceType {
         SOURCE_DEFER,
         SOURCE_POST,
         SOURCE_EXIT,
+        SOURCE_INOTIFY,
         SOURCE_WATCHDOG,
         _SOURCE_EVENT_SOURCE_TYPE_MAX,
         _SOURCE_EVENT_SOURCE_TYPE_INVALID = -1
 } EventSourceType;
 
+static const char* const event_source_type_table[_SOURCE_EVENT_SOURCE_TYPE_MAX] = {
+        [SOURCE_IO] = "io",
+        [SOURCE_TIME_REALTIME] = "realtime",
+        [SOURCE_TIME_BOOTTIME] = "boottime",
+        [SOURCE_TIME_MONOTONIC] = "monotonic",
+        [SOURCE_TIME_REALTIME_ALARM] = "realtime-alarm",
+        [SOURCE_TIME_BOOTTIME_ALARM] = "boottime-alarm",
+        [SOURCE_SIGNAL] = "signal",
+        [SOURCE_CHILD] = "child",
+        [SOURCE_DEFER] = "defer",
+        [SOURCE_POST] = "post",
+        [SOURCE_EXIT] = "exit",
+        [SOURCE_INOTIFY] = "inotify",
+        [SOURCE_WATCHDOG] = "watchdog",
+};
+
+DEFINE_PRIVATE_STRING_TABLE_LOOKUP_TO_STRING(event_source_type, int);
+
+/* Dispatch statistics, shared by all event sources with the same
+ * description, or, lacking one, the same type */
+typedef struct EventProfile {
+        char *key;
+        sd_event_stats stats;
+} EventProfile;
+
+typedef struct PendingBucket PendingBucket;
+typedef struct InotifyWatch InotifyWatch;
+typedef struct SourcePool SourcePool;
+typedef struct UringPoll UringPoll;
+typedef struct EventUring EventUring;
+
 #define EVENT_SOURCE_IS_TIME(t) IN_SET((t), SOURCE_TIME_REALTIME, SOURCE_TIME_BOOTTIME, SOURCE_TIME_MONOTONIC, SOURCE_TIME_REALTIME_ALARM, SOURCE_TIME_BOOTTIME_ALARM)
 
+/* Event sources are allocated with only as much of the union at the
+ * end as their type needs. The fields needed for queueing and
+ * dispatching come first, and fill the first 64 bytes on 64bit
+ * archs. */
 struct sd_event_source {
         unsigned n_ref;
 
-        sd_event *event;
-        void *userdata;
-        sd_event_handler_t prepare;
-
-        char *description;
-
         EventSourceType type:5;
+        EventSourceType pool_type:5;
         int enabled:3;
         bool pending:1;
         bool dispatching:1;
         bool floating:1;
 
+        sd_event *event;
+        void *userdata;
+        sd_event_handler_t prepare;
+
         int64_t priority;
         unsigned pending_index;
         unsigned prepare_index;
         unsigned pending_iteration;
         unsigned prepare_iteration;
 
+        SourcePool *pool;
+
+        char *description;
+
+        /* Only maintained while profiling */
+        usec_t pending_time;
+        EventProfile *profile;
+
+        /* Only used in batch mode, instead of pending_index */
+        PendingBucket *pending_bucket;
+        LIST_FIELDS(sd_event_source, pending);
+
         LIST_FIELDS(sd_event_source, sources);
 
         union {
@@ -89,12 +153,15 @@ struct sd_event_source {
                         uint32_t events;
                         uint32_t revents;
                         bool registered:1;
+                        UringPoll *uring_poll;
                 } io;
                 struct {
                         sd_event_time_handler_t callback;
                         usec_t next, accuracy;
                         unsigned earliest_index;
                         unsigned latest_index;
+                        TimerWheelNode earliest_node;
+                        TimerWheelNode latest_node;
                 } time;
                 struct {
                         sd_event_signal_handler_t callback;
@@ -117,9 +184,96 @@ struct sd_event_source {
                         sd_event_handler_t callback;
                         unsigned prioq_index;
                 } exit;
+                struct {
+                        sd_event_inotify_handler_t callback;
+                        uint32_t mask;
+                        InotifyWatch *watch;
+                        LIST_FIELDS(sd_event_source, watch);
+
+                        /* Events read but not dispatched yet, in
+                         * the format the kernel returns them */
+                        uint8_t *events;
+                        size_t events_size, events_allocated;
+                } inotify;
         };
 };
 
+typedef struct SubmitItem SubmitItem;
+
+struct SubmitItem {
+        sd_event_submit_handler_t callback;
+        void *userdata;
+        SubmitItem *next;
+};
+
+/* Each event loop allocates its event sources from one mempool per
+ * type. Event sources might be referenced beyond the lifetime of the
+ * event loop, hence the pools are only released when the event loop
+ * and all event sources allocated from them are gone. */
+struct SourcePool {
+        unsigned n_ref;
+        struct mempool pools[_SOURCE_EVENT_SOURCE_TYPE_MAX];
+};
+
+#define SOURCE_SIZE(member) \
+        ALIGN(offsetof(sd_event_source, member) + sizeof(((sd_event_source*) NULL)->member))
+
+/* In batch mode pending event sources are queued per priority, in the
+ * order they became pending. Only enabled ones are queued, disabled
+ * pending ones are requeued at the end when they are enabled again.
+ * The buckets themselves are ordered by priority, and are only
+ * queued while they are not empty. */
+struct PendingBucket {
+        int64_t priority;
+        unsigned prioq_index;
+        unsigned n_sources;
+        LIST_HEAD(sd_event_source, sources);
+        sd_event_source *tail;
+};
+
+/* All inotify event sources of an event loop share one inotify fd.
+ * The kernel hands out the same watch descriptor for all watches on
+ * the same inode, hence event sources are grouped by it. The mask of
+ * a watch only ever grows while it exists, events are filtered by the
+ * mask of each event source. */
+struct InotifyWatch {
+        int wd;
+        LIST_HEAD(sd_event_source, sources);
+};
+
+/* With the io_uring backend every IO event source has a poll request
+ * in flight. Requests may complete after their event source is gone,
+ * hence they are allocated separately and only point back to the
+ * event source for as long as it is interested in them. */
+struct UringPoll {
+        sd_event_source *source;
+        uint32_t events;
+        bool oneshot:1;
+        bool armed:1;
+        LIST_FIELDS(UringPoll, polls);
+};
+
+#ifdef HAVE_IO_URING
+struct EventUring {
+        int fd;
+
+        void *ring;
+        size_t ring_size;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *sq_flags;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_cqe *cqes;
+        unsigned sq_entries;
+
+        /* The ring fd has been handed out for polling */
+        bool exported:1;
+
+        LIST_HEAD(UringPoll, polls);
+};
+#endif
+
 struct clock_data {
         int fd;
 
@@ -134,6 +288,25 @@ struct clock_data {
         Prioq *latest;
         usec_t next;
 
+        /* If the timer wheel is enabled for the event loop, the two
+         * prioqs are replaced by two timer wheels keyed by the same
+         * times. These only contain the enabled, non-pending event
+         * sources. */
+        TimerWheel *earliest_wheel;
+        TimerWheel *latest_wheel;
+
+        /* With the io_uring backend the non-alarm clocks are served
+         * by timeout requests instead of timerfds. Completions of
+         * requests from an older generation are stale. The alarm
+         * clocks keep their timerfds, with a read request in
+         * flight. */
+#ifdef HAVE_IO_URING
+        struct __kernel_timespec uring_ts;
+        uint64_t uring_buf;
+        unsigned uring_generation;
+        bool uring_armed:1;
+#endif
+
         bool needs_rearm:1;
 };
 
@@ -143,6 +316,7 @@ struct sd_event {
         int epoll_fd;
         int signal_fd;
         int watchdog_fd;
+        int inotify_fd;
 
         Prioq *pending;
         Prioq *prepare;
@@ -163,9 +337,14 @@ struct sd_event {
 
         Hashmap *child_sources;
         unsigned n_enabled_child_sources;
+        unsigned n_child_sources_stopped;
 
         Set *post_sources;
 
+        Hashmap *inotify_watches;
+
+        SourcePool *source_pool;
+
         Prioq *exit;
 
         pid_t original_pid;
@@ -178,6 +357,7 @@ struct sd_event {
         bool exit_requested:1;
         bool need_process_child:1;
         bool watchdog:1;
+        bool timer_wheel:1;
 
         int exit_code;
 
@@ -186,6 +366,51 @@ struct sd_event {
 
         usec_t watchdog_last, watchdog_period;
 
+        /* Callbacks submitted from other threads. They are pushed
+         * onto submit_queue with a compare-and-swap and the consumer
+         * takes the whole list at once, hence this is a lock-free
+         * stack which we reverse before dispatching. Whoever pushes
+         * onto an empty list signals submit_fd. */
+        int submit_fd;
+        sd_event_source *submit_source;
+        SubmitItem *submit_queue;
+        unsigned n_submit_pending;
+
+        /* If set, poll, timeout and read requests are queued on this
+         * io_uring and submitted with a single io_uring_enter() call
+         * per iteration, instead of using epoll_fd. The fds of IO
+         * sources are still added to epoll_fd, which is never waited
+         * on then, so that bad fds are refused right away. */
+        EventUring *uring;
+        uint64_t watchdog_buf;
+
+        /* Dispatch statistics per description, and a histogram of
+         * the time spent from wakeup to the end of dispatching, in
+         * power-of-two microsecond buckets */
+        bool profile:1;
+        Hashmap *profiles;
+        uint64_t histogram[PROFILE_HISTOGRAM_BUCKETS];
+        usec_t slow_usec;
+
+        /* If set, time sources get this accuracy by default, and
+         * wakeups of all clocks are placed on the grid of the
+         * monotonic clock */
+        usec_t coalesce_usec;
+
+        /* How often we went to sleep and were woken up again, and how
+         * often a timer was among the reasons */
+        uint64_t n_wakeups;
+        uint64_t n_timer_wakeups;
+        bool timer_elapsed:1;
+        bool slept:1;
+
+        /* If set, pending event sources are kept in pending_buckets
+         * instead of the pending prioq, and sd_event_dispatch()
+         * dispatches all of the same priority at once */
+        bool batch:1;
+        Hashmap *buckets;
+        Prioq *pending_buckets;
+
         unsigned n_sources;
 
         LIST_HEAD(sd_event_source, sources);
@@ -226,6 +451,138 @@ static int pending_prioq_compare(const void *a, const void *b) {
         return 0;
 }
 
+static int pending_bucket_compare(const void *a, const void *b) {
+        const PendingBucket *x = a, *y = b;
+
+        if (x->priority < y->priority)
+                return -1;
+        if (x->priority > y->priority)
+                return 1;
+
+        return 0;
+}
+
+static PendingBucket *event_get_pending_bucket(sd_event *e, int64_t priority) {
+        PendingBucket *b;
+
+        assert(e);
+
+        b = hashmap_get(e->buckets, &priority);
+        if (b)
+                return b;
+
+        if (hashmap_ensure_allocated(&e->buckets, &uint64_hash_ops) < 0)
+                return NULL;
+
+        b = new0(PendingBucket, 1);
+        if (!b)
+                return NULL;
+
+        b->priority = priority;
+        b->prioq_index = PRIOQ_IDX_NULL;
+
+        if (hashmap_put(e->buckets, &b->priority, b) < 0) {
+                free(b);
+                return NULL;
+        }
+
+        return b;
+}
+
+static int source_pending_link(sd_event_source *s) {
+        sd_event *e = s->event;
+        PendingBucket *b;
+        int r;
+
+        assert(!s->pending_bucket);
+
+        b = event_get_pending_bucket(e, s->priority);
+        if (!b)
+                return -ENOMEM;
+
+        if (!b->sources) {
+                r = prioq_ensure_allocated(&e->pending_buckets, pending_bucket_compare);
+                if (r < 0)
+                        return r;
+
+                r = prioq_put(e->pending_buckets, b, &b->prioq_index);
+                if (r < 0)
+                        return r;
+
+                LIST_PREPEND(pending, b->sources, s);
+        } else
+                LIST_INSERT_AFTER(pending, b->sources, b->tail, s);
+
+        b->tail = s;
+        b->n_sources++;
+        s->pending_bucket = b;
+
+        return 0;
+}
+
+static void source_pending_unlink(sd_event_source *s) {
+        PendingBucket *b = s->pending_bucket;
+
+        if (!b)
+                return;
+
+        if (b->tail == s)
+                b->tail = s->pending_prev;
+
+        LIST_REMOVE(pending, b->sources, s);
+        b->n_sources--;
+        s->pending_bucket = NULL;
+
+        if (!b->sources)
+                prioq_remove(s->event->pending_buckets, b, &b->prioq_index);
+}
+
+static int source_pending_put(sd_event_source *s) {
+        assert(s);
+        assert(s->pending);
+
+        if (!s->event->batch)
+                return prioq_put(s->event->pending, s, &s->pending_index);
+
+        if (s->enabled == SD_EVENT_OFF)
+                return 0;
+
+        return source_pending_link(s);
+}
+
+static void source_pending_remove(sd_event_source *s) {
+        assert(s);
+
+        if (!s->event->batch)
+                prioq_remove(s->event->pending, s, &s->pending_index);
+        else
+                source_pending_unlink(s);
+}
+
+static void source_pending_reshuffle(sd_event_source *s) {
+        assert(s);
+        assert(s->pending);
+
+        if (!s->event->batch) {
+                prioq_reshuffle(s->event->pending, s, &s->pending_index);
+                return;
+        }
+
+        if (s->enabled == SD_EVENT_OFF) {
+                source_pending_unlink(s);
+                return;
+        }
+
+        if (s->pending_bucket && s->pending_bucket->priority == s->priority)
+                return;
+
+        source_pending_unlink(s);
+
+        /* If we are out of memory the event source stays pending,
+         * but is not dispatched until it is made pending again */
+        (void) source_pending_link(s);
+}
+
 static int prepare_prioq_compare(const void *a, const void *b) {
         const sd_event_source *x = a, *y = b;
 
@@ -360,130 +717,603 @@ static void free_clock_data(struct clock_data *d) {
         safe_close(d->fd);
         prioq_free(d->earliest);
         prioq_free(d->latest);
+        timer_wheel_free(d->earliest_wheel);
+        timer_wheel_free(d->latest_wheel);
 }
 
-static void event_free(sd_event *e) {
-        sd_event_source *s;
+static void event_submit_flush(sd_event *e) {
+        SubmitItem *i;
 
         assert(e);
 
-        while ((s = e->sources)) {
-                assert(s->floating);
-                source_disconnect(s);
-                sd_event_source_unref(s);
+        i = __sync_lock_test_and_set(&e->submit_queue, NULL);
+        while (i) {
+                SubmitItem *next = i->next;
+
+                free(i);
+                __sync_sub_and_fetch(&e->n_submit_pending, 1);
+                i = next;
         }
+}
 
-        assert(e->n_sources == 0);
+#ifdef HAVE_IO_URING
 
-        if (e->default_event_ptr)
-                *(e->default_event_ptr) = NULL;
+/* Requests that complete into a poll request carry a pointer to it as
+ * user data. All others have the lowest bit set and carry the type of
+ * the event source they are for, in the same way as the epoll data of
+ * the timerfds and the signalfd does, plus a generation counter. */
+#define URING_DATA(type, generation) ((((uint64_t) (generation)) << 8) | ((uint64_t) (type) << 1) | 1U)
+#define URING_DATA_IS_POLL(d) (((d) & 1U) == 0)
+#define URING_DATA_TYPE(d) ((EventSourceType) (((d) >> 1) & 0x7fU))
+#define URING_DATA_GENERATION(d) ((unsigned) ((d) >> 8))
+#define URING_DATA_IGNORE URING_DATA(_SOURCE_EVENT_SOURCE_TYPE_MAX, 0)
 
-        safe_close(e->epoll_fd);
-        safe_close(e->signal_fd);
-        safe_close(e->watchdog_fd);
+static void uring_free(EventUring *u) {
+        UringPoll *p;
 
-        free_clock_data(&e->realtime);
-        free_clock_data(&e->boottime);
-        free_clock_data(&e->monotonic);
-        free_clock_data(&e->realtime_alarm);
-        free_clock_data(&e->boottime_alarm);
+        if (!u)
+                return;
 
-        prioq_free(e->pending);
-        prioq_free(e->prepare);
-        prioq_free(e->exit);
+        /* Closing the ring cancels everything still in flight */
+        if (u->ring && u->ring != MAP_FAILED)
+                munmap(u->ring, u->ring_size);
+        if (u->sqes && u->sqes != MAP_FAILED)
+                munmap(u->sqes, u->sqes_size);
+        safe_close(u->fd);
 
-        free(e->signal_sources);
+        while ((p = u->polls)) {
+                assert(!p->source);
 
-        hashmap_free(e->child_sources);
-        set_free(e->post_sources);
-        free(e);
+                LIST_REMOVE(polls, u->polls, p);
+                free(p);
+        }
+
+        free(u);
 }
 
-_public_ int sd_event_new(sd_event** ret) {
-        sd_event *e;
+static int uring_submit(EventUring *u, unsigned min_complete, unsigned flags, const void *arg, size_t argsz) {
+        unsigned n;
         int r;
 
-        assert_return(ret, -EINVAL);
+        assert(u);
 
-        e = new0(sd_event, 1);
-        if (!e)
+        /* We never use a kernel side submission thread, hence the
+         * kernel looks at the submission queue only when we enter
+         * it, and the syscall orders the memory accesses for us */
+        n = *u->sq_tail - *u->sq_head;
+
+        r = io_uring_enter(u->fd, n, min_complete, flags, arg, argsz);
+        if (r < 0)
+                return -errno;
+
+        return r;
+}
+
+static struct io_uring_sqe *uring_get_sqe(EventUring *u) {
+        struct io_uring_sqe *sqe;
+        unsigned tail, idx;
+
+        assert(u);
+
+        tail = *u->sq_tail;
+        if (tail - *u->sq_head >= u->sq_entries) {
+                /* The queue is full, hand what we have to the kernel */
+                if (uring_submit(u, 0, 0, NULL, 0) < 0)
+                        return NULL;
+
+                if (tail - *u->sq_head >= u->sq_entries) {
+                        errno = EBUSY;
+                        return NULL;
+                }
+        }
+
+        idx = tail & *u->sq_mask;
+        sqe = u->sqes + idx;
+        memzero(sqe, sizeof(*sqe));
+
+        u->sq_array[idx] = idx;
+        *u->sq_tail = tail + 1;
+
+        return sqe;
+}
+
+static struct io_uring_cqe *uring_peek_cqe(EventUring *u) {
+        unsigned head;
+
+        assert(u);
+
+        head = *u->cq_head;
+        if (head == *(volatile unsigned*) u->cq_tail)
+                return NULL;
+
+        /* Pairs with the barrier the kernel issues before it moves
+         * the tail */
+        __sync_synchronize();
+
+        return u->cqes + (head & *u->cq_mask);
+}
+
+static void uring_advance_cqe(EventUring *u) {
+        assert(u);
+
+        __sync_synchronize();
+        *u->cq_head = *u->cq_head + 1;
+}
+
+static int uring_new(EventUring **ret) {
+        struct io_uring_params params = {};
+        struct __kernel_timespec ts = {};
+        struct io_uring_sqe *sqe;
+        struct io_uring_cqe *cqe;
+        EventUring *u;
+        int r;
+
+        assert(ret);
+
+        u = new0(EventUring, 1);
+        if (!u)
                 return -ENOMEM;
 
-        e->n_ref = 1;
-        e->signal_fd = e->watchdog_fd = e->epoll_fd = e->realtime.fd = e->boottime.fd = e->monotonic.fd = e->realtime_alarm.fd = e->boottime_alarm.fd = -1;
-        e->realtime.next = e->boottime.next = e->monotonic.next = e->realtime_alarm.next = e->boottime_alarm.next = USEC_INFINITY;
-        e->original_pid = getpid();
-        e->perturb = USEC_INFINITY;
+        u->fd = io_uring_setup(URING_ENTRIES, &params);
+        if (u->fd < 0) {
+                r = -errno;
+                goto fail;
+        }
 
-        assert_se(sigemptyset(&e->sigset) == 0);
+        /* We map both rings at once, and rely on the kernel to keep
+         * completions when the completion queue overflows and to take
+         * a timeout when waiting */
+        if ((params.features & (IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG)) !=
+            (IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG)) {
+                r = -EOPNOTSUPP;
+                goto fail;
+        }
 
-        e->pending = prioq_new(pending_prioq_compare);
-        if (!e->pending) {
-                r = -ENOMEM;
+        u->ring_size = MAX(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                           params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+        u->ring = mmap(NULL, u->ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+        if (u->ring == MAP_FAILED) {
+                r = -errno;
                 goto fail;
         }
 
-        e->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-        if (e->epoll_fd < 0) {
+        u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        u->sqes = mmap(NULL, u->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+        if (u->sqes == MAP_FAILED) {
                 r = -errno;
                 goto fail;
         }
 
-        *ret = e;
+        u->sq_head = (unsigned*) ((uint8_t*) u->ring + params.sq_off.head);
+        u->sq_tail = (unsigned*) ((uint8_t*) u->ring + params.sq_off.tail);
+        u->sq_mask = (unsigned*) ((uint8_t*) u->ring + params.sq_off.ring_mask);
+        u->sq_array = (unsigned*) ((uint8_t*) u->ring + params.sq_off.array);
+        u->sq_flags = (unsigned*) ((uint8_t*) u->ring + params.sq_off.flags);
+        u->cq_head = (unsigned*) ((uint8_t*) u->ring + params.cq_off.head);
+        u->cq_tail = (unsigned*) ((uint8_t*) u->ring + params.cq_off.tail);
+        u->cq_mask = (unsigned*) ((uint8_t*) u->ring + params.cq_off.ring_mask);
+        u->cqes = (struct io_uring_cqe*) ((uint8_t*) u->ring + params.cq_off.cqes);
+        u->sq_entries = params.sq_entries;
+
+        /* Timeouts on CLOCK_BOOTTIME and CLOCK_REALTIME are the most
+         * recent feature we need, and there is no flag announcing
+         * them. Hence, try one that has elapsed already. */
+        sqe = uring_get_sqe(u);
+        assert(sqe);
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = PTR_TO_UINT64(&ts);
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS|IORING_TIMEOUT_BOOTTIME;
+        sqe->user_data = URING_DATA_IGNORE;
+
+        r = uring_submit(u, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0)
+                goto fail;
+
+        cqe = uring_peek_cqe(u);
+        if (!cqe || cqe->res != -ETIME) {
+                r = -EOPNOTSUPP;
+                goto fail;
+        }
+        uring_advance_cqe(u);
+
+        *ret = u;
         return 0;
 
 fail:
-        event_free(e);
+        uring_free(u);
         return r;
 }
 
-_public_ sd_event* sd_event_ref(sd_event *e) {
-        assert_return(e, NULL);
+static int uring_queue_poll(EventUring *u, UringPoll *p, int fd) {
+        struct io_uring_sqe *sqe;
+        uint32_t events;
 
-        assert(e->n_ref >= 1);
-        e->n_ref++;
+        assert(u);
+        assert(p);
+        assert(!p->armed);
 
-        return e;
+        sqe = uring_get_sqe(u);
+        if (!sqe)
+                return -errno;
+
+        /* Poll requests are one-shot. We re-arm them after each
+         * completion, which gives us the level-triggered behaviour of
+         * epoll. Edge-triggered sources get a request that stays
+         * armed instead. */
+        events = p->events & ~EPOLLET;
+#if __BYTE_ORDER == __BIG_ENDIAN
+        events = (events << 16) | (events >> 16);
+#endif
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        if (p->events & EPOLLET)
+                sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = PTR_TO_UINT64(p);
+
+        p->armed = true;
+        return 0;
 }
 
-_public_ sd_event* sd_event_unref(sd_event *e) {
+static int uring_queue_fd(EventUring *u, int fd, EventSourceType type, uint64_t *buf) {
+        struct io_uring_sqe *sqe;
 
-        if (!e)
-                return NULL;
+        assert(u);
+        assert(fd >= 0);
 
-        assert(e->n_ref >= 1);
-        e->n_ref--;
+        sqe = uring_get_sqe(u);
+        if (!sqe)
+                return -errno;
 
-        if (e->n_ref <= 0)
-                event_free(e);
+        /* Timerfds are read right away, the signalfd needs to be read
+         * by us rather than by a kernel worker, hence we only poll
+         * it */
+        sqe->fd = fd;
+        sqe->user_data = URING_DATA(type, 0);
 
-        return NULL;
+        if (buf) {
+                sqe->opcode = IORING_OP_READ;
+                sqe->addr = PTR_TO_UINT64(buf);
+                sqe->len = sizeof(*buf);
+        } else {
+                sqe->opcode = IORING_OP_POLL_ADD;
+#if __BYTE_ORDER == __BIG_ENDIAN
+                sqe->poll32_events = EPOLLIN << 16;
+#else
+                sqe->poll32_events = EPOLLIN;
+#endif
+        }
+
+        return 0;
 }
 
-static bool event_pid_changed(sd_event *e) {
-        assert(e);
+static void uring_cancel(EventUring *u, uint8_t opcode, uint64_t data) {
+        struct io_uring_sqe *sqe;
 
-        /* We don't support people creating am event loop and keeping
-         * it around over a fork(). Let's complain. */
+        assert(u);
 
-        return e->original_pid != getpid();
+        sqe = uring_get_sqe(u);
+        if (!sqe)
+                return;
+
+        /* If this fails the request simply stays around until it
+         * completes or the ring is closed, we ignore its completion
+         * either way */
+        sqe->opcode = opcode;
+        sqe->addr = data;
+        sqe->user_data = URING_DATA_IGNORE;
 }
 
-static int source_io_unregister(sd_event_source *s) {
-        int r;
+static void source_io_uring_detach(sd_event_source *s) {
+        EventUring *u;
+        UringPoll *p;
 
         assert(s);
         assert(s->type == SOURCE_IO);
 
-        if (!s->io.registered)
-                return 0;
+        p = s->io.uring_poll;
+        if (!p)
+                return;
 
-        r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->io.fd, NULL);
-        if (r < 0)
-                return -errno;
+        u = s->event->uring;
+        assert(u);
 
-        s->io.registered = false;
-        return 0;
+        s->io.uring_poll = NULL;
+        p->source = NULL;
+
+        if (!p->armed) {
+                LIST_REMOVE(polls, u->polls, p);
+                free(p);
+                return;
+        }
+
+        uring_cancel(u, IORING_OP_POLL_REMOVE, PTR_TO_UINT64(p));
+}
+
+static int source_io_uring_register(sd_event_source *s, int enabled, uint32_t events) {
+        EventUring *u;
+        UringPoll *p;
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_IO);
+
+        u = s->event->uring;
+        assert(u);
+
+        p = new0(UringPoll, 1);
+        if (!p)
+                return -ENOMEM;
+
+        p->source = s;
+        p->events = events;
+        p->oneshot = enabled == SD_EVENT_ONESHOT;
+        LIST_PREPEND(polls, u->polls, p);
+
+        r = uring_queue_poll(u, p, s->io.fd);
+        if (r < 0) {
+                LIST_REMOVE(polls, u->polls, p);
+                free(p);
+                return r;
+        }
+
+        /* Changing a request in flight races with its completion,
+         * hence we simply replace it */
+        source_io_uring_detach(s);
+
+        s->io.uring_poll = p;
+        return 0;
+}
+
+#endif
+
+static const size_t source_size_table[_SOURCE_EVENT_SOURCE_TYPE_MAX] = {
+        [SOURCE_IO] = SOURCE_SIZE(io),
+        [SOURCE_TIME_REALTIME] = SOURCE_SIZE(time),
+        [SOURCE_TIME_BOOTTIME] = SOURCE_SIZE(time),
+        [SOURCE_TIME_MONOTONIC] = SOURCE_SIZE(time),
+        [SOURCE_TIME_REALTIME_ALARM] = SOURCE_SIZE(time),
+        [SOURCE_TIME_BOOTTIME_ALARM] = SOURCE_SIZE(time),
+        [SOURCE_SIGNAL] = SOURCE_SIZE(signal),
+        [SOURCE_CHILD] = SOURCE_SIZE(child),
+        [SOURCE_DEFER] = SOURCE_SIZE(defer),
+        [SOURCE_POST] = SOURCE_SIZE(post),
+        [SOURCE_EXIT] = SOURCE_SIZE(exit),
+        [SOURCE_INOTIFY] = SOURCE_SIZE(inotify),
+};
+
+static SourcePool *source_pool_new(void) {
+        EventSourceType t;
+        SourcePool *p;
+
+        p = new0(SourcePool, 1);
+        if (!p)
+                return NULL;
+
+        p->n_ref = 1;
+
+        for (t = 0; t < _SOURCE_EVENT_SOURCE_TYPE_MAX; t++) {
+                p->pools[t].tile_size = source_size_table[t];
+                p->pools[t].at_least = 16;
+        }
+
+        return p;
+}
+
+static void source_pool_unref(SourcePool *p) {
+        EventSourceType t;
+
+        if (!p)
+                return;
+
+        assert(p->n_ref > 0);
+        p->n_ref--;
+
+        if (p->n_ref > 0)
+                return;
+
+        for (t = 0; t < _SOURCE_EVENT_SOURCE_TYPE_MAX; t++)
+                mempool_drop(&p->pools[t]);
+
+        free(p);
+}
+
+static void event_free_profiles(sd_event *e) {
+        EventProfile *p;
+
+        assert(e);
+
+        while ((p = hashmap_steal_first(e->profiles))) {
+                free(p->key);
+                free(p);
+        }
+
+        hashmap_free(e->profiles);
+        e->profiles = NULL;
+}
+
+static void event_free(sd_event *e) {
+        sd_event_source *s;
+
+        assert(e);
+
+        while ((s = e->sources)) {
+                assert(s->floating);
+                source_disconnect(s);
+                sd_event_source_unref(s);
+        }
+
+        assert(e->n_sources == 0);
+
+        if (e->default_event_ptr)
+                *(e->default_event_ptr) = NULL;
+
+        if (e->n_wakeups > 0)
+                log_debug("Event loop was woken up %" PRIu64 " times, %" PRIu64 " times by timers.",
+                          e->n_wakeups, e->n_timer_wakeups);
+
+#ifdef HAVE_IO_URING
+        uring_free(e->uring);
+#endif
+        safe_close(e->epoll_fd);
+        safe_close(e->signal_fd);
+        safe_close(e->watchdog_fd);
+        safe_close(e->inotify_fd);
+
+        event_submit_flush(e);
+        safe_close(e->submit_fd);
+
+        free_clock_data(&e->realtime);
+        free_clock_data(&e->boottime);
+        free_clock_data(&e->monotonic);
+        free_clock_data(&e->realtime_alarm);
+        free_clock_data(&e->boottime_alarm);
+
+        prioq_free(e->pending);
+        prioq_free(e->prepare);
+        prioq_free(e->exit);
+
+        free(e->signal_sources);
+
+        event_free_profiles(e);
+
+        hashmap_free_free(e->buckets);
+        prioq_free(e->pending_buckets);
+
+        hashmap_free(e->child_sources);
+        set_free(e->post_sources);
+        hashmap_free(e->inotify_watches);
+        source_pool_unref(e->source_pool);
+        free(e);
+}
+
+_public_ int sd_event_new(sd_event** ret) {
+        sd_event *e;
+        const char *b;
+        int r;
+
+        assert_return(ret, -EINVAL);
+
+        e = new0(sd_event, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->n_ref = 1;
+        e->signal_fd = e->watchdog_fd = e->inotify_fd = e->submit_fd = e->epoll_fd = e->realtime.fd = e->boottime.fd = e->monotonic.fd = e->realtime_alarm.fd = e->boottime_alarm.fd = -1;
+        e->realtime.next = e->boottime.next = e->monotonic.next = e->realtime_alarm.next = e->boottime_alarm.next = USEC_INFINITY;
+        e->original_pid = getpid();
+        e->perturb = USEC_INFINITY;
+
+        assert_se(sigemptyset(&e->sigset) == 0);
+
+        e->pending = prioq_new(pending_prioq_compare);
+        if (!e->pending) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        e->source_pool = source_pool_new();
+        if (!e->source_pool) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        e->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (e->epoll_fd < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        /* Stick to epoll if the io_uring backend is unavailable */
+        b = secure_getenv("SYSTEMD_EVENT_IO_URING");
+        if (b && parse_boolean(b) > 0)
+                (void) sd_event_set_io_uring(e, true);
+
+        /* Allows turning on coalescing for all daemons at once */
+        b = secure_getenv("SYSTEMD_EVENT_COALESCE_USEC");
+        if (b) {
+                usec_t u;
+
+                if (parse_sec(b, &u) >= 0 && u != USEC_INFINITY)
+                        e->coalesce_usec = u;
+        }
+
+        *ret = e;
+        return 0;
+
+fail:
+        event_free(e);
+        return r;
+}
+
+_public_ sd_event* sd_event_ref(sd_event *e) {
+        assert_return(e, NULL);
+
+        assert(e->n_ref >= 1);
+        e->n_ref++;
+
+        return e;
+}
+
+_public_ sd_event* sd_event_unref(sd_event *e) {
+
+        if (!e)
+                return NULL;
+
+        assert(e->n_ref >= 1);
+        e->n_ref--;
+
+        if (e->n_ref <= 0)
+                event_free(e);
+
+        return NULL;
+}
+
+static bool event_pid_changed(sd_event *e) {
+        assert(e);
+
+        /* We don't support people creating am event loop and keeping
+         * it around over a fork(). Let's complain. */
+
+        return e->original_pid != getpid();
+}
+
+static int source_io_unregister(sd_event_source *s) {
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_IO);
+
+        if (!s->io.registered)
+                return 0;
+
+#ifdef HAVE_IO_URING
+        if (s->event->uring) {
+                /* If the fd was closed already, epoll forgot about
+                 * it by itself */
+                r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->io.fd, NULL);
+                if (r < 0 && !IN_SET(errno, EBADF, ENOENT))
+                        return -errno;
+
+                source_io_uring_detach(s);
+                s->io.registered = false;
+
+                /* The poll request keeps a reference to the file
+                 * until its removal was submitted. Don't delay that,
+                 * the fd might be closed next. */
+                r = uring_submit(s->event->uring, 0, 0, NULL, 0);
+                return r < 0 ? r : 0;
+        }
+#endif
+
+        r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->io.fd, NULL);
+        if (r < 0)
+                return -errno;
+
+        s->io.registered = false;
+        return 0;
 }
 
 static int source_io_register(
@@ -498,6 +1328,33 @@ static int source_io_register(
         assert(s->type == SOURCE_IO);
         assert(enabled != SD_EVENT_OFF);
 
+#ifdef HAVE_IO_URING
+        if (s->event->uring) {
+                bool added = false;
+
+                /* Poll requests fail only once they are processed,
+                 * but callers expect epoll_ctl()'s errors right
+                 * away, e.g. EPERM for files that cannot be polled */
+                if (!s->io.registered) {
+                        r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_ADD, s->io.fd, &ev);
+                        if (r < 0)
+                                return -errno;
+
+                        added = true;
+                }
+
+                r = source_io_uring_register(s, enabled, events);
+                if (r < 0) {
+                        if (added)
+                                (void) epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->io.fd, NULL);
+                        return r;
+                }
+
+                s->io.registered = true;
+                return 0;
+        }
+#endif
+
         ev.events = events;
         ev.data.ptr = s;
 
@@ -590,6 +1447,40 @@ static struct clock_data* event_get_clock_data(sd_event *e, EventSourceType t) {
         }
 }
 
+static usec_t time_event_source_latest(const sd_event_source *s) {
+        assert(s);
+
+        if (s->time.accuracy > USEC_INFINITY - 1 - s->time.next)
+                return USEC_INFINITY - 1;
+
+        return s->time.next + s->time.accuracy;
+}
+
+static void event_source_time_reshuffle(sd_event_source *s) {
+        struct clock_data *d;
+
+        assert(s);
+        assert(EVENT_SOURCE_IS_TIME(s->type));
+
+        d = event_get_clock_data(s->event, s->type);
+        assert(d);
+
+        if (s->event->timer_wheel) {
+                if (s->enabled == SD_EVENT_OFF || s->pending) {
+                        timer_wheel_remove(d->earliest_wheel, &s->time.earliest_node);
+                        timer_wheel_remove(d->latest_wheel, &s->time.latest_node);
+                } else {
+                        timer_wheel_put(d->earliest_wheel, &s->time.earliest_node, s->time.next);
+                        timer_wheel_put(d->latest_wheel, &s->time.latest_node, time_event_source_latest(s));
+                }
+        } else {
+                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
+                prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        }
+
+        d->needs_rearm = true;
+}
+
 static bool need_signal(sd_event *e, int signal) {
         return (e->signal_sources && e->signal_sources[signal] &&
                 e->signal_sources[signal]->enabled != SD_EVENT_OFF)
@@ -616,6 +1507,16 @@ static int event_update_signal_fd(sd_event *e) {
         if (!add_to_epoll)
                 return 0;
 
+#ifdef HAVE_IO_URING
+        if (e->uring) {
+                r = uring_queue_fd(e->uring, e->signal_fd, SOURCE_SIGNAL, NULL);
+                if (r < 0)
+                        e->signal_fd = safe_close(e->signal_fd);
+
+                return r;
+        }
+#endif
+
         ev.events = EPOLLIN;
         ev.data.ptr = INT_TO_PTR(SOURCE_SIGNAL);
 
@@ -628,27 +1529,80 @@ static int event_update_signal_fd(sd_event *e) {
         return 0;
 }
 
-static void source_disconnect(sd_event_source *s) {
-        sd_event *event;
+static int event_make_inotify_fd(sd_event *e) {
+        struct epoll_event ev = {};
+        int fd, r;
 
-        assert(s);
+        assert(e);
 
-        if (!s->event)
-                return;
+        if (e->inotify_fd >= 0)
+                return 0;
 
-        assert(s->event->n_sources > 0);
+        fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (fd < 0)
+                return -errno;
 
-        switch (s->type) {
+#ifdef HAVE_IO_URING
+        if (e->uring) {
+                r = uring_queue_fd(e->uring, fd, SOURCE_INOTIFY, NULL);
+                if (r < 0) {
+                        safe_close(fd);
+                        return r;
+                }
 
-        case SOURCE_IO:
-                if (s->io.fd >= 0)
-                        source_io_unregister(s);
+                e->inotify_fd = fd;
+                return 0;
+        }
+#endif
 
-                break;
+        ev.events = EPOLLIN;
+        ev.data.ptr = INT_TO_PTR(SOURCE_INOTIFY);
 
-        case SOURCE_TIME_REALTIME:
-        case SOURCE_TIME_BOOTTIME:
-        case SOURCE_TIME_MONOTONIC:
+        r = epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        if (r < 0) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        e->inotify_fd = fd;
+        return 0;
+}
+
+static void inotify_watch_free(sd_event *e, InotifyWatch *w, bool remove_watch) {
+        assert(e);
+        assert(w);
+        assert(!w->sources);
+
+        /* The kernel removed the watch on its own if the inode went
+         * away or its file system was unmounted */
+        if (remove_watch)
+                (void) inotify_rm_watch(e->inotify_fd, w->wd);
+
+        hashmap_remove(e->inotify_watches, INT_TO_PTR(w->wd));
+        free(w);
+}
+
+static void source_disconnect(sd_event_source *s) {
+        sd_event *event;
+
+        assert(s);
+
+        if (!s->event)
+                return;
+
+        assert(s->event->n_sources > 0);
+
+        switch (s->type) {
+
+        case SOURCE_IO:
+                if (s->io.fd >= 0)
+                        source_io_unregister(s);
+
+                break;
+
+        case SOURCE_TIME_REALTIME:
+        case SOURCE_TIME_BOOTTIME:
+        case SOURCE_TIME_MONOTONIC:
         case SOURCE_TIME_REALTIME_ALARM:
         case SOURCE_TIME_BOOTTIME_ALARM: {
                 struct clock_data *d;
@@ -656,8 +1610,13 @@ static void source_disconnect(sd_event_source *s) {
                 d = event_get_clock_data(s->event, s->type);
                 assert(d);
 
-                prioq_remove(d->earliest, s, &s->time.earliest_index);
-                prioq_remove(d->latest, s, &s->time.latest_index);
+                if (s->event->timer_wheel) {
+                        timer_wheel_remove(d->earliest_wheel, &s->time.earliest_node);
+                        timer_wheel_remove(d->latest_wheel, &s->time.latest_node);
+                } else {
+                        prioq_remove(d->earliest, s, &s->time.earliest_index);
+                        prioq_remove(d->latest, s, &s->time.latest_index);
+                }
                 d->needs_rearm = true;
                 break;
         }
@@ -681,6 +1640,11 @@ static void source_disconnect(sd_event_source *s) {
 
         case SOURCE_CHILD:
                 if (s->child.pid > 0) {
+                        if (s->child.options & (WSTOPPED|WCONTINUED)) {
+                                assert(s->event->n_child_sources_stopped > 0);
+                                s->event->n_child_sources_stopped--;
+                        }
+
                         if (s->enabled != SD_EVENT_OFF) {
                                 assert(s->event->n_enabled_child_sources > 0);
                                 s->event->n_enabled_child_sources--;
@@ -712,12 +1676,28 @@ static void source_disconnect(sd_event_source *s) {
                 prioq_remove(s->event->exit, s, &s->exit.prioq_index);
                 break;
 
+        case SOURCE_INOTIFY:
+                if (s->inotify.watch) {
+                        InotifyWatch *w = s->inotify.watch;
+
+                        LIST_REMOVE(inotify.watch, w->sources, s);
+                        s->inotify.watch = NULL;
+
+                        if (!w->sources)
+                                inotify_watch_free(s->event, w, true);
+                }
+
+                free(s->inotify.events);
+                s->inotify.events = NULL;
+                s->inotify.events_size = s->inotify.events_allocated = 0;
+                break;
+
         default:
                 assert_not_reached("Wut? I shouldn't exist.");
         }
 
         if (s->pending)
-                prioq_remove(s->event->pending, s, &s->pending_index);
+                source_pending_remove(s);
 
         if (s->prepare)
                 prioq_remove(s->event->prepare, s, &s->prepare_index);
@@ -734,11 +1714,16 @@ static void source_disconnect(sd_event_source *s) {
 }
 
 static void source_free(sd_event_source *s) {
+        SourcePool *p;
+
         assert(s);
 
         source_disconnect(s);
         free(s->description);
-        free(s);
+
+        p = s->pool;
+        mempool_free_tile(&p->pools[s->pool_type], s);
+        source_pool_unref(p);
 }
 
 static int source_set_pending(sd_event_source *s, bool b) {
@@ -754,25 +1739,18 @@ static int source_set_pending(sd_event_source *s, bool b) {
 
         if (b) {
                 s->pending_iteration = s->event->iteration;
+                s->pending_time = s->event->profile ? now(CLOCK_MONOTONIC) : 0;
 
-                r = prioq_put(s->event->pending, s, &s->pending_index);
+                r = source_pending_put(s);
                 if (r < 0) {
                         s->pending = false;
                         return r;
                 }
         } else
-                assert_se(prioq_remove(s->event->pending, s, &s->pending_index));
-
-        if (EVENT_SOURCE_IS_TIME(s->type)) {
-                struct clock_data *d;
-
-                d = event_get_clock_data(s->event, s->type);
-                assert(d);
+                source_pending_remove(s);
 
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                d->needs_rearm = true;
-        }
+        if (EVENT_SOURCE_IS_TIME(s->type))
+                event_source_time_reshuffle(s);
 
         return 0;
 }
@@ -782,10 +1760,14 @@ static sd_event_source *source_new(sd_event *e, bool floating, EventSourceType t
 
         assert(e);
 
-        s = new0(sd_event_source, 1);
+        s = mempool_alloc0_tile(&e->source_pool->pools[type]);
         if (!s)
                 return NULL;
 
+        s->pool = e->source_pool;
+        s->pool->n_ref++;
+        s->pool_type = type;
+
         s->n_ref = 1;
         s->event = e;
         s->floating = floating;
@@ -841,6 +1823,12 @@ _public_ int sd_event_add_io(
         return 0;
 }
 
+static usec_t event_default_accuracy(sd_event *e) {
+        assert(e);
+
+        return e->coalesce_usec > 0 ? e->coalesce_usec : DEFAULT_ACCURACY_USEC;
+}
+
 static void initialize_perturb(sd_event *e) {
         sd_id128_t bootid = {};
 
@@ -874,6 +1862,28 @@ static int event_setup_timer_fd(
         if (_likely_(d->fd >= 0))
                 return 0;
 
+#ifdef HAVE_IO_URING
+        if (e->uring) {
+                /* Only the alarm clocks need a timerfd, which we
+                 * read through the ring, hence it is blocking */
+                if (!IN_SET(clock, CLOCK_REALTIME_ALARM, CLOCK_BOOTTIME_ALARM))
+                        return 0;
+
+                fd = timerfd_create(clock, TFD_CLOEXEC);
+                if (fd < 0)
+                        return -errno;
+
+                r = uring_queue_fd(e->uring, fd, clock_to_event_source_type(clock), &d->uring_buf);
+                if (r < 0) {
+                        safe_close(fd);
+                        return r;
+                }
+
+                d->fd = fd;
+                return 0;
+        }
+#endif
+
         fd = timerfd_create(clock, TFD_NONBLOCK|TFD_CLOEXEC);
         if (fd < 0)
                 return -errno;
@@ -926,16 +1936,30 @@ _public_ int sd_event_add_time(
         d = event_get_clock_data(e, type);
         assert(d);
 
-        if (!d->earliest) {
-                d->earliest = prioq_new(earliest_time_prioq_compare);
-                if (!d->earliest)
-                        return -ENOMEM;
-        }
+        if (e->timer_wheel) {
+                if (!d->earliest_wheel) {
+                        d->earliest_wheel = timer_wheel_new();
+                        if (!d->earliest_wheel)
+                                return -ENOMEM;
+                }
 
-        if (!d->latest) {
-                d->latest = prioq_new(latest_time_prioq_compare);
-                if (!d->latest)
-                        return -ENOMEM;
+                if (!d->latest_wheel) {
+                        d->latest_wheel = timer_wheel_new();
+                        if (!d->latest_wheel)
+                                return -ENOMEM;
+                }
+        } else {
+                if (!d->earliest) {
+                        d->earliest = prioq_new(earliest_time_prioq_compare);
+                        if (!d->earliest)
+                                return -ENOMEM;
+                }
+
+                if (!d->latest) {
+                        d->latest = prioq_new(latest_time_prioq_compare);
+                        if (!d->latest)
+                                return -ENOMEM;
+                }
         }
 
         if (d->fd < 0) {
@@ -949,14 +1973,25 @@ _public_ int sd_event_add_time(
                 return -ENOMEM;
 
         s->time.next = usec;
-        s->time.accuracy = accuracy == 0 ? DEFAULT_ACCURACY_USEC : accuracy;
+        s->time.accuracy = accuracy == 0 ? event_default_accuracy(e) : accuracy;
         s->time.callback = callback;
         s->time.earliest_index = s->time.latest_index = PRIOQ_IDX_NULL;
+        timer_wheel_node_init(&s->time.earliest_node);
+        timer_wheel_node_init(&s->time.latest_node);
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
         d->needs_rearm = true;
 
+        if (e->timer_wheel) {
+                event_source_time_reshuffle(s);
+
+                if (ret)
+                        *ret = s;
+
+                return 0;
+        }
+
         r = prioq_put(d->earliest, s, &s->time.earliest_index);
         if (r < 0)
                 goto fail;
@@ -1095,6 +2130,9 @@ _public_ int sd_event_add_child(
 
         e->n_enabled_child_sources ++;
 
+        if (options & (WSTOPPED|WCONTINUED))
+                e->n_child_sources_stopped ++;
+
         if (!previous) {
                 assert_se(sigaddset(&e->sigset, SIGCHLD) == 0);
 
@@ -1226,6 +2264,79 @@ _public_ int sd_event_add_exit(
         return 0;
 }
 
+_public_ int sd_event_add_inotify(
+                sd_event *e,
+                sd_event_source **ret,
+                const char *path,
+                uint32_t mask,
+                sd_event_inotify_handler_t callback,
+                void *userdata) {
+
+        InotifyWatch *w;
+        sd_event_source *s;
+        int wd, r;
+
+        assert_return(e, -EINVAL);
+        assert_return(path, -EINVAL);
+        assert_return(callback, -EINVAL);
+        assert_return(!(mask & (IN_MASK_ADD|IN_ONESHOT)), -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        r = hashmap_ensure_allocated(&e->inotify_watches, NULL);
+        if (r < 0)
+                return r;
+
+        r = event_make_inotify_fd(e);
+        if (r < 0)
+                return r;
+
+        /* Other event sources might watch the same inode already,
+         * hence never narrow the mask of the watch */
+        wd = inotify_add_watch(e->inotify_fd, path, mask|IN_MASK_ADD);
+        if (wd < 0)
+                return -errno;
+
+        w = hashmap_get(e->inotify_watches, INT_TO_PTR(wd));
+        if (!w) {
+                w = new0(InotifyWatch, 1);
+                if (!w) {
+                        (void) inotify_rm_watch(e->inotify_fd, wd);
+                        return -ENOMEM;
+                }
+
+                w->wd = wd;
+
+                r = hashmap_put(e->inotify_watches, INT_TO_PTR(wd), w);
+                if (r < 0) {
+                        (void) inotify_rm_watch(e->inotify_fd, wd);
+                        free(w);
+                        return r;
+                }
+        }
+
+        s = source_new(e, !ret, SOURCE_INOTIFY);
+        if (!s) {
+                if (!w->sources)
+                        inotify_watch_free(e, w, true);
+
+                return -ENOMEM;
+        }
+
+        s->inotify.callback = callback;
+        s->inotify.mask = mask;
+        s->inotify.watch = w;
+        s->userdata = userdata;
+        s->enabled = SD_EVENT_ON;
+
+        LIST_PREPEND(inotify.watch, w->sources, s);
+
+        if (ret)
+                *ret = s;
+
+        return 0;
+}
+
 _public_ sd_event_source* sd_event_source_ref(sd_event_source *s) {
         assert_return(s, NULL);
 
@@ -1268,6 +2379,9 @@ _public_ int sd_event_source_set_description(sd_event_source *s, const char *des
         assert_return(s, -EINVAL);
         assert_return(!event_pid_changed(s->event), -ECHILD);
 
+        /* Account to the new description from now on */
+        s->profile = NULL;
+
         return free_and_strdup(&s->description, description);
 }
 
@@ -1412,7 +2526,7 @@ _public_ int sd_event_source_set_priority(sd_event_source *s, int64_t priority)
         s->priority = priority;
 
         if (s->pending)
-                prioq_reshuffle(s->event->pending, s, &s->pending_index);
+                source_pending_reshuffle(s);
 
         if (s->prepare)
                 prioq_reshuffle(s->event->prepare, s, &s->prepare_index);
@@ -1463,18 +2577,10 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                 case SOURCE_TIME_BOOTTIME:
                 case SOURCE_TIME_MONOTONIC:
                 case SOURCE_TIME_REALTIME_ALARM:
-                case SOURCE_TIME_BOOTTIME_ALARM: {
-                        struct clock_data *d;
-
+                case SOURCE_TIME_BOOTTIME_ALARM:
                         s->enabled = m;
-                        d = event_get_clock_data(s->event, s->type);
-                        assert(d);
-
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                        d->needs_rearm = true;
+                        event_source_time_reshuffle(s);
                         break;
-                }
 
                 case SOURCE_SIGNAL:
                         assert(need_signal(s->event, s->signal.sig));
@@ -1514,6 +2620,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
 
                 case SOURCE_DEFER:
                 case SOURCE_POST:
+                case SOURCE_INOTIFY:
                         s->enabled = m;
                         break;
 
@@ -1536,18 +2643,10 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                 case SOURCE_TIME_BOOTTIME:
                 case SOURCE_TIME_MONOTONIC:
                 case SOURCE_TIME_REALTIME_ALARM:
-                case SOURCE_TIME_BOOTTIME_ALARM: {
-                        struct clock_data *d;
-
+                case SOURCE_TIME_BOOTTIME_ALARM:
                         s->enabled = m;
-                        d = event_get_clock_data(s->event, s->type);
-                        assert(d);
-
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                        d->needs_rearm = true;
+                        event_source_time_reshuffle(s);
                         break;
-                }
 
                 case SOURCE_SIGNAL:
                         /* Check status before enabling. */
@@ -1568,7 +2667,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         /* Check status before enabling. */
                         if (s->enabled == SD_EVENT_OFF) {
                                 if (!need_signal(s->event, SIGCHLD)) {
-                                        assert_se(sigaddset(&s->event->sigset, s->signal.sig) == 0);
+                                        assert_se(sigaddset(&s->event->sigset, SIGCHLD) == 0);
 
                                         r = event_update_signal_fd(s->event);
                                         if (r < 0) {
@@ -1590,6 +2689,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
 
                 case SOURCE_DEFER:
                 case SOURCE_POST:
+                case SOURCE_INOTIFY:
                         s->enabled = m;
                         break;
 
@@ -1599,7 +2699,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
         }
 
         if (s->pending)
-                prioq_reshuffle(s->event->pending, s, &s->pending_index);
+                source_pending_reshuffle(s);
 
         if (s->prepare)
                 prioq_reshuffle(s->event->prepare, s, &s->prepare_index);
@@ -1618,8 +2718,6 @@ _public_ int sd_event_source_get_time(sd_event_source *s, uint64_t *usec) {
 }
 
 _public_ int sd_event_source_set_time(sd_event_source *s, uint64_t usec) {
-        struct clock_data *d;
-
         assert_return(s, -EINVAL);
         assert_return(usec != (uint64_t) -1, -EINVAL);
         assert_return(EVENT_SOURCE_IS_TIME(s->type), -EDOM);
@@ -1629,13 +2727,7 @@ _public_ int sd_event_source_set_time(sd_event_source *s, uint64_t usec) {
         s->time.next = usec;
 
         source_set_pending(s, false);
-
-        d = event_get_clock_data(s->event, s->type);
-        assert(d);
-
-        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-        d->needs_rearm = true;
+        event_source_time_reshuffle(s);
 
         return 0;
 }
@@ -1651,8 +2743,6 @@ _public_ int sd_event_source_get_time_accuracy(sd_event_source *s, uint64_t *use
 }
 
 _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec) {
-        struct clock_data *d;
-
         assert_return(s, -EINVAL);
         assert_return(usec != (uint64_t) -1, -EINVAL);
         assert_return(EVENT_SOURCE_IS_TIME(s->type), -EDOM);
@@ -1660,17 +2750,12 @@ _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec
         assert_return(!event_pid_changed(s->event), -ECHILD);
 
         if (usec == 0)
-                usec = DEFAULT_ACCURACY_USEC;
+                usec = event_default_accuracy(s->event);
 
         s->time.accuracy = usec;
 
         source_set_pending(s, false);
-
-        d = event_get_clock_data(s->event, s->type);
-        assert(d);
-
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-        d->needs_rearm = true;
+        event_source_time_reshuffle(s);
 
         return 0;
 }
@@ -1695,6 +2780,16 @@ _public_ int sd_event_source_get_child_pid(sd_event_source *s, pid_t *pid) {
         return 0;
 }
 
+_public_ int sd_event_source_get_inotify_mask(sd_event_source *s, uint32_t *mask) {
+        assert_return(s, -EINVAL);
+        assert_return(mask, -EINVAL);
+        assert_return(s->type == SOURCE_INOTIFY, -EDOM);
+        assert_return(!event_pid_changed(s->event), -ECHILD);
+
+        *mask = s->inotify.mask;
+        return 0;
+}
+
 _public_ int sd_event_source_set_prepare(sd_event_source *s, sd_event_handler_t callback) {
         int r;
 
@@ -1822,13 +2917,107 @@ static usec_t sleep_between(sd_event *e, usec_t a, usec_t b) {
         return b;
 }
 
+static usec_t clock_sleep_between(sd_event *e, struct clock_data *d, usec_t a, usec_t b) {
+        usec_t x, m, offset, c;
+        clockid_t clock;
+
+        assert(e);
+        assert(d);
+
+        if (e->coalesce_usec <= 0 || d == &e->monotonic)
+                return sleep_between(e, a, b);
+
+        /* The grid of each clock is aligned to its own epoch, hence
+         * wakeups for different clocks usually don't line up. When
+         * coalescing, translate the window into the monotonic clock
+         * and pick the time on its grid instead. The perturbation is
+         * derived from the boot ID, hence this grid is the same for
+         * all processes on the system. */
+
+        clock = d == &e->realtime || d == &e->realtime_alarm ? CLOCK_REALTIME : CLOCK_BOOTTIME;
+
+        x = now(clock);
+        m = now(CLOCK_MONOTONIC);
+        if (x < m || a < x - m)
+                return sleep_between(e, a, b);
+
+        offset = x - m;
+
+        c = sleep_between(e, a - offset, b - offset);
+        if (c == 0)
+                return 0;
+
+        return c + offset;
+}
+
+#ifdef HAVE_IO_URING
+static int event_arm_uring_timeout(sd_event *e, struct clock_data *d, usec_t t) {
+        struct io_uring_sqe *sqe;
+        EventSourceType type;
+        unsigned flags;
+
+        assert(e);
+        assert(e->uring);
+        assert(d);
+
+        if (d->next == t)
+                return 0;
+
+        if (d == &e->realtime) {
+                type = SOURCE_TIME_REALTIME;
+                flags = IORING_TIMEOUT_REALTIME;
+        } else if (d == &e->boottime) {
+                type = SOURCE_TIME_BOOTTIME;
+                flags = IORING_TIMEOUT_BOOTTIME;
+        } else {
+                assert(d == &e->monotonic);
+                type = SOURCE_TIME_MONOTONIC;
+                flags = 0;
+        }
+
+        /* Removing and adding a timeout costs no syscall, both are
+         * submitted together with the next wait */
+        if (d->uring_armed) {
+                uring_cancel(e->uring, IORING_OP_TIMEOUT_REMOVE, URING_DATA(type, d->uring_generation));
+                d->uring_armed = false;
+        }
+
+        d->uring_generation++;
+        d->next = USEC_INFINITY;
+
+        if (t == USEC_INFINITY)
+                return 0;
+
+        sqe = uring_get_sqe(e->uring);
+        if (!sqe)
+                return -errno;
+
+        if (t == 0) {
+                d->uring_ts.tv_sec = 0;
+                d->uring_ts.tv_nsec = 1;
+        } else {
+                d->uring_ts.tv_sec = t / USEC_PER_SEC;
+                d->uring_ts.tv_nsec = (t % USEC_PER_SEC) * NSEC_PER_USEC;
+        }
+
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = PTR_TO_UINT64(&d->uring_ts);
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS|flags;
+        sqe->user_data = URING_DATA(type, d->uring_generation);
+
+        d->uring_armed = true;
+        d->next = t;
+        return 0;
+}
+#endif
+
 static int event_arm_timer(
                 sd_event *e,
                 struct clock_data *d) {
 
         struct itimerspec its = {};
-        sd_event_source *a, *b;
-        usec_t t;
+        usec_t earliest = USEC_INFINITY, latest = USEC_INFINITY, t;
         int r;
 
         assert(e);
@@ -1839,8 +3028,36 @@ static int event_arm_timer(
         else
                 d->needs_rearm = false;
 
-        a = prioq_peek(d->earliest);
-        if (!a || a->enabled == SD_EVENT_OFF) {
+        if (e->timer_wheel) {
+                TimerWheelNode *a, *b;
+
+                a = timer_wheel_peek(d->earliest_wheel);
+                if (a) {
+                        b = timer_wheel_peek(d->latest_wheel);
+                        assert_se(b);
+
+                        earliest = a->key;
+                        latest = b->key;
+                }
+        } else {
+                sd_event_source *a, *b;
+
+                a = prioq_peek(d->earliest);
+                if (a && a->enabled != SD_EVENT_OFF) {
+                        b = prioq_peek(d->latest);
+                        assert_se(b && b->enabled != SD_EVENT_OFF);
+
+                        earliest = a->time.next;
+                        latest = b->time.next + b->time.accuracy;
+                }
+        }
+
+#ifdef HAVE_IO_URING
+        if (e->uring && d != &e->realtime_alarm && d != &e->boottime_alarm)
+                return event_arm_uring_timeout(e, d, earliest == USEC_INFINITY ? USEC_INFINITY : clock_sleep_between(e, d, earliest, latest));
+#endif
+
+        if (earliest == USEC_INFINITY) {
 
                 if (d->fd < 0)
                         return 0;
@@ -1857,10 +3074,7 @@ static int event_arm_timer(
                 return 0;
         }
 
-        b = prioq_peek(d->latest);
-        assert_se(b && b->enabled != SD_EVENT_OFF);
-
-        t = sleep_between(e, a->time.next, b->time.next + b->time.accuracy);
+        t = clock_sleep_between(e, d, earliest, latest);
         if (d->next == t)
                 return 0;
 
@@ -1920,6 +3134,8 @@ static int flush_timer(sd_event *e, int fd, uint32_t events, usec_t *next) {
         if (_unlikely_(ss != sizeof(x)))
                 return -EIO;
 
+        e->timer_elapsed = true;
+
         if (next)
                 *next = USEC_INFINITY;
 
@@ -1937,6 +3153,28 @@ static int process_timer(
         assert(e);
         assert(d);
 
+        if (e->timer_wheel) {
+                TimerWheelNode *w;
+
+                if (!d->earliest_wheel)
+                        return 0;
+
+                /* Everything that is due is taken off the wheel in
+                 * one go, pending sources are not kept in it */
+                while ((w = timer_wheel_pop(d->earliest_wheel, n))) {
+                        s = container_of(w, sd_event_source, time.earliest_node);
+
+                        r = source_set_pending(s, true);
+                        if (r < 0) {
+                                event_source_time_reshuffle(s);
+                                return r;
+                        }
+                }
+
+                timer_wheel_advance(d->latest_wheel, n);
+                return 0;
+        }
+
         for (;;) {
                 s = prioq_peek(d->earliest);
                 if (!s ||
@@ -1948,24 +3186,18 @@ static int process_timer(
                 r = source_set_pending(s, true);
                 if (r < 0)
                         return r;
-
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                d->needs_rearm = true;
         }
 
         return 0;
 }
 
-static int process_child(sd_event *e) {
+static int process_child_scan(sd_event *e) {
         sd_event_source *s;
         Iterator i;
         int r;
 
         assert(e);
 
-        e->need_process_child = false;
-
         /*
            So, this is ugly. We iteratively invoke waitid() with P_PID
            + WNOHANG for each PID we wait for, instead of using
@@ -2024,6 +3256,54 @@ static int process_child(sd_event *e) {
         return 0;
 }
 
+static int process_child(sd_event *e) {
+        sd_event_source *s;
+        siginfo_t si = {};
+        int r;
+
+        assert(e);
+
+        e->need_process_child = false;
+
+        if (e->n_enabled_child_sources == 0)
+                return 0;
+
+        /* Stopped and continued children are not covered by the
+         * probe below */
+        if (e->n_child_sources_stopped > 0)
+                return process_child_scan(e);
+
+        /* Before checking every child individually, peek at any
+         * exited child with a single P_ALL probe, and look it up by
+         * its PID. As the probe does not reap, it keeps returning the
+         * same child until that one got dispatched, hence we come
+         * back here after every reaped child, see source_dispatch().
+         * This way the work done scales with the children that
+         * exited, not with the ones we watch. Only if the probe turns
+         * up a child we can't act on, we fall back to the scan. */
+
+        r = waitid(P_ALL, 0, &si, WEXITED|WNOHANG|WNOWAIT);
+        if (r < 0) {
+                if (errno != ECHILD)
+                        return -errno;
+
+                return process_child_scan(e);
+        }
+
+        if (si.si_pid == 0)
+                return 0;
+
+        s = hashmap_get(e->child_sources, INT_TO_PTR(si.si_pid));
+        if (!s || s->enabled == SD_EVENT_OFF)
+                return process_child_scan(e);
+
+        if (s->pending)
+                return 0;
+
+        s->child.siginfo = si;
+        return source_set_pending(s, true);
+}
+
 static int process_signal(sd_event *e, uint32_t events) {
         bool read_one = false;
         int r;
@@ -2073,12 +3353,211 @@ static int process_signal(sd_event *e, uint32_t events) {
         }
 }
 
-static int source_dispatch(sd_event_source *s) {
-        int r = 0;
+static int inotify_watch_queue(sd_event *e, InotifyWatch *w, const struct inotify_event *ev) {
+        sd_event_source *s, *n;
+        size_t l;
+        int r;
+
+        assert(e);
+        assert(w);
+        assert(ev);
+
+        l = sizeof(struct inotify_event) + ev->len;
+
+        LIST_FOREACH(inotify.watch, s, w->sources) {
+                if (s->enabled == SD_EVENT_OFF)
+                        continue;
+
+                if (!(ev->mask & s->inotify.mask & IN_ALL_EVENTS) &&
+                    !(ev->mask & (IN_IGNORED|IN_UNMOUNT|IN_Q_OVERFLOW)))
+                        continue;
+
+                if (!GREEDY_REALLOC(s->inotify.events, s->inotify.events_allocated, s->inotify.events_size + l))
+                        return -ENOMEM;
+
+                memcpy(s->inotify.events + s->inotify.events_size, ev, l);
+                s->inotify.events_size += l;
+
+                r = source_set_pending(s, true);
+                if (r < 0)
+                        return r;
+        }
+
+        if (!(ev->mask & IN_IGNORED))
+                return 0;
+
+        /* The watch is gone, the event sources stay around but will
+         * not see any further events */
+        LIST_FOREACH_SAFE(inotify.watch, s, n, w->sources) {
+                LIST_REMOVE(inotify.watch, w->sources, s);
+                s->inotify.watch = NULL;
+        }
+
+        inotify_watch_free(e, w, false);
+        return 0;
+}
+
+static int process_inotify(sd_event *e, uint32_t events) {
+        union {
+                struct inotify_event ev;
+                uint8_t raw[INOTIFY_EVENT_MAX * 32];
+        } buffer;
+        struct inotify_event *ev;
+        ssize_t l;
+        int r;
+
+        assert(e);
+
+        assert_return(events == EPOLLIN, -EIO);
+
+        /* Read as many events as possible at once, and sort them into
+         * the event sources right-away, which are then dispatched
+         * with all events they collected */
+        l = read(e->inotify_fd, &buffer, sizeof(buffer));
+        if (l < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                        return 0;
+
+                return -errno;
+        }
+
+        FOREACH_INOTIFY_EVENT(ev, buffer, l) {
+                InotifyWatch *w;
+                Iterator i;
+
+                if (ev->wd >= 0) {
+                        w = hashmap_get(e->inotify_watches, INT_TO_PTR(ev->wd));
+                        if (!w)
+                                continue;
+
+                        r = inotify_watch_queue(e, w, ev);
+                        if (r < 0)
+                                return r;
+
+                        continue;
+                }
+
+                /* The queue overflowed, tell everybody */
+                HASHMAP_FOREACH(w, e->inotify_watches, i) {
+                        r = inotify_watch_queue(e, w, ev);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        return 1;
+}
+
+static EventProfile *event_get_profile(sd_event *e, const char *key) {
+        EventProfile *p;
+        int r;
+
+        assert(e);
+        assert(key);
+
+        p = hashmap_get(e->profiles, key);
+        if (p)
+                return p;
+
+        r = hashmap_ensure_allocated(&e->profiles, &string_hash_ops);
+        if (r < 0)
+                return NULL;
+
+        p = new0(EventProfile, 1);
+        if (!p)
+                return NULL;
+
+        p->key = strdup(key);
+        if (!p->key) {
+                free(p);
+                return NULL;
+        }
+
+        r = hashmap_put(e->profiles, p->key, p);
+        if (r < 0) {
+                free(p->key);
+                free(p);
+                return NULL;
+        }
+
+        return p;
+}
+
+static void source_account(sd_event *e, sd_event_source *s, usec_t before, usec_t after) {
+        EventProfile *p;
+        const char *key;
+        usec_t t;
+
+        assert(e);
+        assert(s);
+
+        key = s->description ?: event_source_type_to_string(s->type);
+        t = after - before;
+
+        if (e->slow_usec > 0 && t >= e->slow_usec) {
+                char ts[FORMAT_TIMESPAN_MAX];
+
+                log_warning("Event source '%s' took %s to dispatch.", key,
+                            format_timespan(ts, sizeof(ts), t, USEC_PER_MSEC));
+        }
+
+        if (!e->profile)
+                return;
+
+        p = s->profile;
+        if (!p) {
+                p = event_get_profile(e, key);
+                if (!p)
+                        return;
+
+                /* Disconnected sources are about to be freed */
+                if (s->event)
+                        s->profile = p;
+        }
+
+        p->stats.n_dispatched++;
+        p->stats.dispatch_usec += t;
+        p->stats.dispatch_usec_max = MAX(p->stats.dispatch_usec_max, t);
+
+        if (s->pending_time > 0 && s->pending_time <= before) {
+                t = before - s->pending_time;
+
+                p->stats.delay_usec += t;
+                p->stats.delay_usec_max = MAX(p->stats.delay_usec_max, t);
+        }
+
+        /* Defer sources stay pending, count from now on */
+        s->pending_time = s->type == SOURCE_DEFER && s->pending ? after : 0;
+}
+
+static void event_account_iteration(sd_event *e) {
+        unsigned b = 0;
+        usec_t t;
+
+        assert(e);
+
+        t = now(CLOCK_MONOTONIC);
+        t = t > e->timestamp.monotonic ? t - e->timestamp.monotonic : 0;
+
+        if (t > 0)
+                b = MIN(64U - __builtin_clzll(t), PROFILE_HISTOGRAM_BUCKETS - 1);
+
+        e->histogram[b]++;
+}
+
+static int source_dispatch(sd_event_source *s) {
+        sd_event *e;
+        usec_t before = 0;
+        bool timed;
+        int r = 0;
 
         assert(s);
         assert(s->pending || s->type == SOURCE_EXIT);
 
+        /* The callback might disconnect the event source */
+        e = s->event;
+        timed = e->profile || e->slow_usec > 0;
+
         if (s->type != SOURCE_DEFER && s->type != SOURCE_EXIT) {
                 r = source_set_pending(s, false);
                 if (r < 0)
@@ -2110,6 +3589,9 @@ static int source_dispatch(sd_event_source *s) {
 
         s->dispatching = true;
 
+        if (_unlikely_(timed))
+                before = now(CLOCK_MONOTONIC);
+
         switch (s->type) {
 
         case SOURCE_IO:
@@ -2137,10 +3619,16 @@ static int source_dispatch(sd_event_source *s) {
 
                 r = s->child.callback(s, &s->child.siginfo, s->userdata);
 
-                /* Now, reap the PID for good. */
-                if (zombie)
+                /* Now, reap the PID for good. This might uncover
+                 * other exited children process_child() couldn't see
+                 * so far, hence check again. */
+                if (zombie) {
                         waitid(P_PID, s->child.pid, &s->child.siginfo, WNOHANG|WEXITED);
 
+                        if (e->n_enabled_child_sources > 0)
+                                e->need_process_child = true;
+                }
+
                 break;
         }
 
@@ -2156,6 +3644,43 @@ static int source_dispatch(sd_event_source *s) {
                 r = s->exit.callback(s, s->userdata);
                 break;
 
+        case SOURCE_INOTIFY: {
+                _cleanup_free_ uint8_t *events = NULL;
+                size_t size, allocated, p = 0;
+
+                /* Take the queued events, as the callback might free
+                 * the event source */
+                events = s->inotify.events;
+                size = s->inotify.events_size;
+                allocated = s->inotify.events_allocated;
+                s->inotify.events = NULL;
+                s->inotify.events_size = s->inotify.events_allocated = 0;
+
+                while (p < size) {
+                        const struct inotify_event *ev = (const struct inotify_event*) (events + p);
+
+                        p += sizeof(struct inotify_event) + ev->len;
+
+                        r = s->inotify.callback(s, ev, s->userdata);
+                        if (r < 0 || s->n_ref == 0 || s->enabled == SD_EVENT_OFF)
+                                break;
+                }
+
+                /* If the event source was turned off meanwhile keep
+                 * the remaining events for later */
+                if (p < size && r >= 0 && s->n_ref > 0) {
+                        memmove(events, events + p, size - p);
+                        s->inotify.events = events;
+                        s->inotify.events_size = size - p;
+                        s->inotify.events_allocated = allocated;
+                        events = NULL;
+
+                        r = source_set_pending(s, true);
+                }
+
+                break;
+        }
+
         case SOURCE_WATCHDOG:
         case _SOURCE_EVENT_SOURCE_TYPE_MAX:
         case _SOURCE_EVENT_SOURCE_TYPE_INVALID:
@@ -2164,6 +3689,9 @@ static int source_dispatch(sd_event_source *s) {
 
         s->dispatching = false;
 
+        if (_unlikely_(timed))
+                source_account(e, s, before, now(CLOCK_MONOTONIC));
+
         if (r < 0) {
                 if (s->description)
                         log_debug_errno(r, "Event source '%s' returned error, disabling: %m", s->description);
@@ -2247,6 +3775,13 @@ static sd_event_source* event_next_pending(sd_event *e) {
 
         assert(e);
 
+        if (e->batch) {
+                PendingBucket *b;
+
+                b = prioq_peek(e->pending_buckets);
+                return b ? b->sources : NULL;
+        }
+
         p = prioq_peek(e->pending);
         if (!p)
                 return NULL;
@@ -2339,6 +3874,16 @@ _public_ int sd_event_prepare(sd_event *e) {
         if (event_next_pending(e) || e->need_process_child)
                 goto pending;
 
+#ifdef HAVE_IO_URING
+        /* Whoever polls the ring fd instead of calling
+         * sd_event_wait() relies on our requests being in flight */
+        if (e->uring && e->uring->exported) {
+                r = uring_submit(e->uring, 0, 0, NULL, 0);
+                if (r < 0)
+                        return r;
+        }
+#endif
+
         e->state = SD_EVENT_PREPARED;
 
         return 0;
@@ -2352,40 +3897,32 @@ pending:
         return r;
 }
 
-_public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
+static int event_epoll_wait(sd_event *e, uint64_t timeout) {
         struct epoll_event *ev_queue;
         unsigned ev_queue_max;
+        usec_t before = 0;
         int r, m, i;
 
-        assert_return(e, -EINVAL);
-        assert_return(!event_pid_changed(e), -ECHILD);
-        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
-        assert_return(e->state == SD_EVENT_PREPARED, -EBUSY);
-
-        if (e->exit_requested) {
-                e->state = SD_EVENT_PENDING;
-                return 1;
-        }
+        assert(e);
 
         ev_queue_max = CLAMP(e->n_sources, 1U, EPOLL_QUEUE_MAX);
         ev_queue = newa(struct epoll_event, ev_queue_max);
 
+        if (timeout != 0)
+                before = now(CLOCK_MONOTONIC);
+
         m = epoll_wait(e->epoll_fd, ev_queue, ev_queue_max,
                        timeout == (uint64_t) -1 ? -1 : (int) ((timeout + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
-        if (m < 0) {
-                if (errno == EINTR) {
-                        e->state = SD_EVENT_PENDING;
-                        return 1;
-                }
-
-                r = -errno;
-
-                goto finish;
-        }
+        if (m < 0)
+                return -errno;
 
         dual_timestamp_get(&e->timestamp);
         e->timestamp_boottime = now(CLOCK_BOOTTIME);
 
+        /* We went to sleep if we ran into the timeout, or if it took
+         * a while until anything was ready */
+        e->slept = timeout != 0 && (m == 0 || e->timestamp.monotonic >= before + WAKEUP_MIN_USEC);
+
         for (i = 0; i < m; i++) {
 
                 if (ev_queue[i].data.ptr == INT_TO_PTR(SOURCE_TIME_REALTIME))
@@ -2400,116 +3937,400 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
                         r = flush_timer(e, e->boottime_alarm.fd, ev_queue[i].events, &e->boottime_alarm.next);
                 else if (ev_queue[i].data.ptr == INT_TO_PTR(SOURCE_SIGNAL))
                         r = process_signal(e, ev_queue[i].events);
+                else if (ev_queue[i].data.ptr == INT_TO_PTR(SOURCE_INOTIFY))
+                        r = process_inotify(e, ev_queue[i].events);
                 else if (ev_queue[i].data.ptr == INT_TO_PTR(SOURCE_WATCHDOG))
                         r = flush_timer(e, e->watchdog_fd, ev_queue[i].events, NULL);
                 else
                         r = process_io(e, ev_queue[i].data.ptr, ev_queue[i].events);
 
                 if (r < 0)
-                        goto finish;
+                        return r;
         }
 
-        r = process_watchdog(e);
-        if (r < 0)
-                goto finish;
-
-        r = process_timer(e, e->timestamp.realtime, &e->realtime);
-        if (r < 0)
-                goto finish;
-
-        r = process_timer(e, e->timestamp_boottime, &e->boottime);
-        if (r < 0)
-                goto finish;
-
-        r = process_timer(e, e->timestamp.monotonic, &e->monotonic);
-        if (r < 0)
-                goto finish;
+        return 0;
+}
 
-        r = process_timer(e, e->timestamp.realtime, &e->realtime_alarm);
-        if (r < 0)
-                goto finish;
+#ifdef HAVE_IO_URING
+static int uring_process_poll(sd_event *e, UringPoll *p, const struct io_uring_cqe *cqe) {
+        EventUring *u = e->uring;
+        sd_event_source *s;
+        int r;
 
-        r = process_timer(e, e->timestamp_boottime, &e->boottime_alarm);
-        if (r < 0)
-                goto finish;
+        assert(e);
+        assert(p);
+        assert(cqe);
+
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+                p->armed = false;
+
+        s = p->source;
+        if (!s) {
+                /* The event source let go of it, hence once it is
+                 * done it is ours to free */
+                if (!p->armed) {
+                        LIST_REMOVE(polls, u->polls, p);
+                        free(p);
+                }
 
-        if (e->need_process_child) {
-                r = process_child(e);
-                if (r < 0)
-                        goto finish;
+                return 0;
         }
 
-        if (event_next_pending(e)) {
-                e->state = SD_EVENT_PENDING;
+        /* The fd was checked when the source was enabled, hence this
+         * is about this source only, e.g. its fd was closed
+         * meanwhile. epoll would silently stop watching it, we do
+         * the same, but say so. */
+        if (cqe->res < 0) {
+                if (s->description)
+                        log_debug_errno(cqe->res, "Poll request of event source '%s' failed, disabling: %m", s->description);
+                else
+                        log_debug_errno(cqe->res, "Poll request of event source %p failed, disabling: %m", s);
 
-                return 1;
+                return sd_event_source_set_enabled(s, SD_EVENT_OFF);
         }
 
-        r = 0;
+        r = process_io(e, s, (uint32_t) cqe->res & (p->events|EPOLLERR|EPOLLHUP));
+        if (r < 0)
+                return r;
 
-finish:
-        e->state = SD_EVENT_PASSIVE;
+        if (!p->armed && !p->oneshot)
+                return uring_queue_poll(u, p, s->io.fd);
 
-        return r;
+        return 0;
 }
 
-_public_ int sd_event_dispatch(sd_event *e) {
-        sd_event_source *p;
+static int uring_process_cqe(sd_event *e, const struct io_uring_cqe *cqe) {
+        EventSourceType type;
+        struct clock_data *d;
         int r;
 
-        assert_return(e, -EINVAL);
-        assert_return(!event_pid_changed(e), -ECHILD);
-        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
-        assert_return(e->state == SD_EVENT_PENDING, -EBUSY);
+        assert(e);
+        assert(cqe);
 
-        if (e->exit_requested)
-                return dispatch_exit(e);
+        if (URING_DATA_IS_POLL(cqe->user_data))
+                return uring_process_poll(e, UINT64_TO_PTR(cqe->user_data), cqe);
 
-        p = event_next_pending(e);
-        if (p) {
-                sd_event_ref(e);
+        type = URING_DATA_TYPE(cqe->user_data);
 
-                e->state = SD_EVENT_RUNNING;
-                r = source_dispatch(p);
-                e->state = SD_EVENT_PASSIVE;
+        switch (type) {
 
-                sd_event_unref(e);
+        case SOURCE_TIME_REALTIME:
+        case SOURCE_TIME_BOOTTIME:
+        case SOURCE_TIME_MONOTONIC:
+                d = event_get_clock_data(e, type);
 
-                return r;
-        }
+                /* Timeouts that were removed or replaced meanwhile
+                 * are stale */
+                if (URING_DATA_GENERATION(cqe->user_data) != d->uring_generation)
+                        return 0;
 
-        e->state = SD_EVENT_PASSIVE;
+                d->uring_armed = false;
+                d->next = USEC_INFINITY;
+                e->timer_elapsed = true;
+                return 0;
 
-        return 1;
-}
+        case SOURCE_TIME_REALTIME_ALARM:
+        case SOURCE_TIME_BOOTTIME_ALARM:
+                d = event_get_clock_data(e, type);
 
-_public_ int sd_event_run(sd_event *e, uint64_t timeout) {
-        int r;
+                if (cqe->res == -ECANCELED)
+                        return 0;
+                if (cqe->res >= 0) {
+                        if (cqe->res != sizeof(d->uring_buf))
+                                return -EIO;
 
-        assert_return(e, -EINVAL);
-        assert_return(!event_pid_changed(e), -ECHILD);
-        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
-        assert_return(e->state == SD_EVENT_PASSIVE, -EBUSY);
+                        d->next = USEC_INFINITY;
+                        e->timer_elapsed = true;
+                } else if (!IN_SET(cqe->res, -EAGAIN, -EINTR))
+                        return cqe->res;
 
-        r = sd_event_prepare(e);
-        if (r > 0)
-                return sd_event_dispatch(e);
-        else if (r < 0)
-                return r;
+                return uring_queue_fd(e->uring, d->fd, type, &d->uring_buf);
 
-        r = sd_event_wait(e, timeout);
-        if (r > 0)
-                return sd_event_dispatch(e);
-        else
-                return r;
-}
+        case SOURCE_SIGNAL:
+                if (cqe->res < 0)
+                        return cqe->res;
 
-_public_ int sd_event_loop(sd_event *e) {
-        int r;
+                r = process_signal(e, (uint32_t) cqe->res);
+                if (r < 0)
+                        return r;
 
-        assert_return(e, -EINVAL);
-        assert_return(!event_pid_changed(e), -ECHILD);
-        assert_return(e->state == SD_EVENT_PASSIVE, -EBUSY);
+                return uring_queue_fd(e->uring, e->signal_fd, SOURCE_SIGNAL, NULL);
+
+        case SOURCE_INOTIFY:
+                if (cqe->res < 0)
+                        return cqe->res;
+
+                r = process_inotify(e, (uint32_t) cqe->res);
+                if (r < 0)
+                        return r;
+
+                return uring_queue_fd(e->uring, e->inotify_fd, SOURCE_INOTIFY, NULL);
+
+        case SOURCE_WATCHDOG:
+                /* The watchdog might have been turned off meanwhile */
+                if (e->watchdog_fd < 0 || cqe->res == -ECANCELED)
+                        return 0;
+
+                e->timer_elapsed = true;
+                return uring_queue_fd(e->uring, e->watchdog_fd, SOURCE_WATCHDOG, &e->watchdog_buf);
+
+        default:
+                /* Removals and cancellations */
+                return 0;
+        }
+}
+
+static int event_uring_wait(sd_event *e, uint64_t timeout) {
+        struct io_uring_getevents_arg arg = {};
+        struct __kernel_timespec ts;
+        EventUring *u = e->uring;
+        bool wait, overflow, timed_out = false;
+        usec_t before = 0;
+        unsigned i;
+        int r;
+
+        assert(e);
+        assert(u);
+
+        /* Submit everything queued since the last iteration and wait
+         * for completions, all in one go. If nothing was queued and
+         * we shall not wait we don't need to enter the kernel at
+         * all. */
+        wait = timeout != 0 && !uring_peek_cqe(u);
+        overflow = *(volatile unsigned*) u->sq_flags & IORING_SQ_CQ_OVERFLOW;
+
+        if (wait || overflow || *u->sq_tail != *u->sq_head) {
+                unsigned flags = IORING_ENTER_EXT_ARG;
+
+                if (wait || overflow)
+                        flags |= IORING_ENTER_GETEVENTS;
+
+                if (wait && timeout != (uint64_t) -1) {
+                        ts.tv_sec = timeout / USEC_PER_SEC;
+                        ts.tv_nsec = (timeout % USEC_PER_SEC) * NSEC_PER_USEC;
+                        arg.ts = PTR_TO_UINT64(&ts);
+                }
+
+                if (wait)
+                        before = now(CLOCK_MONOTONIC);
+
+                r = uring_submit(u, wait ? 1 : 0, flags, &arg, sizeof(arg));
+                if (r == -ETIME)
+                        timed_out = true;
+                else if (r < 0)
+                        return r;
+        }
+
+        dual_timestamp_get(&e->timestamp);
+        e->timestamp_boottime = now(CLOCK_BOOTTIME);
+
+        /* We went to sleep if we ran into the timeout, or if it took
+         * a while until anything completed. Whatever we just
+         * submitted might have completed right-away. */
+        e->slept = wait && (timed_out || e->timestamp.monotonic >= before + WAKEUP_MIN_USEC);
+
+        for (i = 0; i <= *u->cq_mask; i++) {
+                struct io_uring_cqe *cqe, c;
+
+                cqe = uring_peek_cqe(u);
+                if (!cqe)
+                        break;
+
+                c = *cqe;
+                uring_advance_cqe(u);
+
+                r = uring_process_cqe(e, &c);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+#endif
+
+_public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(e->state == SD_EVENT_PREPARED, -EBUSY);
+
+        if (e->exit_requested) {
+                e->state = SD_EVENT_PENDING;
+                return 1;
+        }
+
+        e->timer_elapsed = false;
+        e->slept = false;
+
+#ifdef HAVE_IO_URING
+        if (e->uring)
+                r = event_uring_wait(e, timeout);
+        else
+#endif
+                r = event_epoll_wait(e, timeout);
+        if (r == -EINTR) {
+                e->state = SD_EVENT_PENDING;
+                return 1;
+        }
+        if (r < 0)
+                goto finish;
+
+        if (e->slept) {
+                e->n_wakeups++;
+
+                if (e->timer_elapsed)
+                        e->n_timer_wakeups++;
+        }
+
+        r = process_watchdog(e);
+        if (r < 0)
+                goto finish;
+
+        r = process_timer(e, e->timestamp.realtime, &e->realtime);
+        if (r < 0)
+                goto finish;
+
+        r = process_timer(e, e->timestamp_boottime, &e->boottime);
+        if (r < 0)
+                goto finish;
+
+        r = process_timer(e, e->timestamp.monotonic, &e->monotonic);
+        if (r < 0)
+                goto finish;
+
+        r = process_timer(e, e->timestamp.realtime, &e->realtime_alarm);
+        if (r < 0)
+                goto finish;
+
+        r = process_timer(e, e->timestamp_boottime, &e->boottime_alarm);
+        if (r < 0)
+                goto finish;
+
+        if (e->need_process_child) {
+                r = process_child(e);
+                if (r < 0)
+                        goto finish;
+        }
+
+        if (event_next_pending(e)) {
+                e->state = SD_EVENT_PENDING;
+
+                return 1;
+        }
+
+        r = 0;
+
+finish:
+        e->state = SD_EVENT_PASSIVE;
+
+        return r;
+}
+
+static int event_dispatch_batch(sd_event *e, sd_event_source *p) {
+        PendingBucket *b;
+        int64_t priority;
+        unsigned n;
+        int r;
+
+        assert(e);
+        assert(p);
+        assert(p->pending_bucket);
+
+        /* Dispatch everything that is queued in the bucket already,
+         * but stop as soon as something more important comes up, so
+         * that priorities are honoured as without batching. Sources
+         * that become pending meanwhile are queued after the ones we
+         * look at. */
+        b = p->pending_bucket;
+        priority = b->priority;
+
+        for (n = b->n_sources; n > 0; n--) {
+                p = event_next_pending(e);
+                if (!p || p->priority != priority || e->exit_requested)
+                        break;
+
+                /* Defer sources stay pending, let the others go first
+                 * next time */
+                if (p->type == SOURCE_DEFER && p->pending_next) {
+                        source_pending_unlink(p);
+                        r = source_pending_link(p);
+                        if (r < 0)
+                                return r;
+                }
+
+                r = source_dispatch(p);
+                if (r < 0)
+                        return r;
+        }
+
+        return 1;
+}
+
+_public_ int sd_event_dispatch(sd_event *e) {
+        sd_event_source *p;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(e->state == SD_EVENT_PENDING, -EBUSY);
+
+        if (e->exit_requested)
+                return dispatch_exit(e);
+
+        p = event_next_pending(e);
+        if (p) {
+                sd_event_ref(e);
+
+                e->state = SD_EVENT_RUNNING;
+                if (e->batch)
+                        r = event_dispatch_batch(e, p);
+                else
+                        r = source_dispatch(p);
+                e->state = SD_EVENT_PASSIVE;
+
+                if (_unlikely_(e->profile))
+                        event_account_iteration(e);
+
+                sd_event_unref(e);
+
+                return r;
+        }
+
+        e->state = SD_EVENT_PASSIVE;
+
+        return 1;
+}
+
+_public_ int sd_event_run(sd_event *e, uint64_t timeout) {
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(e->state == SD_EVENT_PASSIVE, -EBUSY);
+
+        r = sd_event_prepare(e);
+        if (r > 0)
+                return sd_event_dispatch(e);
+        else if (r < 0)
+                return r;
+
+        r = sd_event_wait(e, timeout);
+        if (r > 0)
+                return sd_event_dispatch(e);
+        else
+                return r;
+}
+
+_public_ int sd_event_loop(sd_event *e) {
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+        assert_return(e->state == SD_EVENT_PASSIVE, -EBUSY);
 
         sd_event_ref(e);
 
@@ -2531,6 +4352,13 @@ _public_ int sd_event_get_fd(sd_event *e) {
         assert_return(e, -EINVAL);
         assert_return(!event_pid_changed(e), -ECHILD);
 
+#ifdef HAVE_IO_URING
+        if (e->uring) {
+                e->uring->exported = true;
+                return e->uring->fd;
+        }
+#endif
+
         return e->epoll_fd;
 }
 
@@ -2652,7 +4480,7 @@ _public_ int sd_event_set_watchdog(sd_event *e, int b) {
                 sd_notify(false, "WATCHDOG=1");
                 e->watchdog_last = now(CLOCK_MONOTONIC);
 
-                e->watchdog_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+                e->watchdog_fd = timerfd_create(CLOCK_MONOTONIC, e->uring ? TFD_CLOEXEC : TFD_NONBLOCK|TFD_CLOEXEC);
                 if (e->watchdog_fd < 0)
                         return -errno;
 
@@ -2660,6 +4488,17 @@ _public_ int sd_event_set_watchdog(sd_event *e, int b) {
                 if (r < 0)
                         goto fail;
 
+#ifdef HAVE_IO_URING
+                if (e->uring) {
+                        r = uring_queue_fd(e->uring, e->watchdog_fd, SOURCE_WATCHDOG, &e->watchdog_buf);
+                        if (r < 0)
+                                goto fail;
+
+                        e->watchdog = true;
+                        return e->watchdog;
+                }
+#endif
+
                 ev.events = EPOLLIN;
                 ev.data.ptr = INT_TO_PTR(SOURCE_WATCHDOG);
 
@@ -2671,7 +4510,12 @@ _public_ int sd_event_set_watchdog(sd_event *e, int b) {
 
         } else {
                 if (e->watchdog_fd >= 0) {
-                        epoll_ctl(e->epoll_fd, EPOLL_CTL_DEL, e->watchdog_fd, NULL);
+#ifdef HAVE_IO_URING
+                        if (e->uring)
+                                uring_cancel(e->uring, IORING_OP_ASYNC_CANCEL, URING_DATA(SOURCE_WATCHDOG, 0));
+                        else
+#endif
+                                epoll_ctl(e->epoll_fd, EPOLL_CTL_DEL, e->watchdog_fd, NULL);
                         e->watchdog_fd = safe_close(e->watchdog_fd);
                 }
         }
@@ -2690,3 +4534,588 @@ _public_ int sd_event_get_watchdog(sd_event *e) {
 
         return e->watchdog;
 }
+
+_public_ int sd_event_set_timer_wheel(sd_event *e, int b) {
+        sd_event_source *s;
+
+        assert_return(e, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (e->timer_wheel == !!b)
+                return e->timer_wheel;
+
+        /* Existing time sources are not moved over */
+        LIST_FOREACH(sources, s, e->sources)
+                if (EVENT_SOURCE_IS_TIME(s->type))
+                        return -EBUSY;
+
+        e->timer_wheel = !!b;
+        return e->timer_wheel;
+}
+
+_public_ int sd_event_get_timer_wheel(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->timer_wheel;
+}
+
+_public_ int sd_event_set_io_uring(sd_event *e, int b) {
+#ifdef HAVE_IO_URING
+        EventUring *u = NULL;
+        int r;
+#endif
+
+        assert_return(e, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (!!e->uring == !!b)
+                return !!e->uring;
+
+        /* Nothing may be registered with the old backend yet */
+        if (e->n_sources > 0 || e->signal_fd >= 0 || e->watchdog_fd >= 0 || e->inotify_fd >= 0 ||
+            e->realtime.fd >= 0 || e->boottime.fd >= 0 || e->monotonic.fd >= 0 ||
+            e->realtime_alarm.fd >= 0 || e->boottime_alarm.fd >= 0)
+                return -EBUSY;
+
+#ifdef HAVE_IO_URING
+        if (b) {
+                r = uring_new(&u);
+                if (r < 0)
+                        return r;
+
+                e->uring = u;
+        } else {
+                uring_free(e->uring);
+                e->uring = NULL;
+        }
+
+        return !!e->uring;
+#else
+        return -EOPNOTSUPP;
+#endif
+}
+
+_public_ int sd_event_get_io_uring(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return !!e->uring;
+}
+
+_public_ int sd_event_set_batch(sd_event *e, int b) {
+        sd_event_source *s;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (e->batch == !!b)
+                return e->batch;
+
+        /* Move all pending event sources over */
+        LIST_FOREACH(sources, s, e->sources)
+                if (s->pending)
+                        source_pending_remove(s);
+
+        e->batch = !!b;
+
+        LIST_FOREACH(sources, s, e->sources)
+                if (s->pending) {
+                        r = source_pending_put(s);
+                        if (r < 0)
+                                return r;
+                }
+
+        return e->batch;
+}
+
+_public_ int sd_event_get_batch(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->batch;
+}
+
+_public_ int sd_event_set_profile(sd_event *e, int b) {
+        sd_event_source *s;
+
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (e->profile == !!b)
+                return e->profile;
+
+        /* Start over on every change */
+        LIST_FOREACH(sources, s, e->sources) {
+                s->profile = NULL;
+                s->pending_time = 0;
+        }
+
+        event_free_profiles(e);
+        zero(e->histogram);
+
+        e->profile = !!b;
+        return e->profile;
+}
+
+_public_ int sd_event_get_profile(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->profile;
+}
+
+_public_ int sd_event_get_profile_descriptions(sd_event *e, char ***ret) {
+        _cleanup_strv_free_ char **l = NULL;
+        EventProfile *p;
+        Iterator i;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(ret, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        l = new0(char*, 1);
+        if (!l)
+                return -ENOMEM;
+
+        HASHMAP_FOREACH(p, e->profiles, i) {
+                r = strv_extend(&l, p->key);
+                if (r < 0)
+                        return r;
+        }
+
+        strv_sort(l);
+
+        *ret = l;
+        l = NULL;
+
+        return 0;
+}
+
+_public_ int sd_event_get_profile_stats(sd_event *e, const char *description, sd_event_stats *ret) {
+        EventProfile *p;
+
+        assert_return(e, -EINVAL);
+        assert_return(description, -EINVAL);
+        assert_return(ret, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        p = hashmap_get(e->profiles, description);
+        if (!p)
+                return -ENOENT;
+
+        *ret = p->stats;
+        return 0;
+}
+
+_public_ int sd_event_get_profile_histogram(sd_event *e, uint64_t *buckets, size_t n) {
+        assert_return(e, -EINVAL);
+        assert_return(buckets || n == 0, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        /* Bucket 0 counts iterations that took less than 1us, bucket
+         * i > 0 those that took less than 2^i us but at least half
+         * that, and the last bucket everything longer */
+        n = MIN(n, (size_t) PROFILE_HISTOGRAM_BUCKETS);
+        memcpy(buckets, e->histogram, n * sizeof(uint64_t));
+
+        return (int) PROFILE_HISTOGRAM_BUCKETS;
+}
+
+_public_ int sd_event_set_slow_threshold(sd_event *e, uint64_t usec) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        e->slow_usec = usec;
+        return 0;
+}
+
+_public_ int sd_event_get_slow_threshold(sd_event *e, uint64_t *usec) {
+        assert_return(e, -EINVAL);
+        assert_return(usec, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        *usec = e->slow_usec;
+        return 0;
+}
+
+_public_ int sd_event_set_coalesce(sd_event *e, uint64_t usec) {
+        assert_return(e, -EINVAL);
+        assert_return(usec != (uint64_t) -1, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (e->coalesce_usec == usec)
+                return 0;
+
+        /* Only time sources added or changed from now on pick up
+         * the new default accuracy, but all clocks move to the new
+         * grid right-away */
+        e->coalesce_usec = usec;
+
+        e->realtime.needs_rearm = e->boottime.needs_rearm = e->monotonic.needs_rearm =
+                e->realtime_alarm.needs_rearm = e->boottime_alarm.needs_rearm = true;
+
+        return 0;
+}
+
+_public_ int sd_event_get_coalesce(sd_event *e, uint64_t *usec) {
+        assert_return(e, -EINVAL);
+        assert_return(usec, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        *usec = e->coalesce_usec;
+        return 0;
+}
+
+_public_ int sd_event_get_wakeups(sd_event *e, uint64_t *wakeups, uint64_t *timer_wakeups) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (wakeups)
+                *wakeups = e->n_wakeups;
+        if (timer_wakeups)
+                *timer_wakeups = e->n_timer_wakeups;
+
+        return 0;
+}
+
+static int submit_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        sd_event *e = userdata;
+        SubmitItem *i, *list = NULL;
+        uint64_t x;
+        int r;
+
+        assert(e);
+
+        /* This can only fail with EAGAIN, in which case we simply
+         * look at what is queued anyway */
+        (void) read(fd, &x, sizeof(x));
+
+        /* Take everything queued so far, and restore the submission
+         * order */
+        i = __sync_lock_test_and_set(&e->submit_queue, NULL);
+        while (i) {
+                SubmitItem *next = i->next;
+
+                i->next = list;
+                list = i;
+                i = next;
+        }
+
+        while ((i = list)) {
+                list = i->next;
+
+                r = i->callback(e, i->userdata);
+                if (r < 0)
+                        log_debug_errno(r, "Submitted callback returned error, ignoring: %m");
+
+                free(i);
+                __sync_sub_and_fetch(&e->n_submit_pending, 1);
+        }
+
+        return 0;
+}
+
+_public_ int sd_event_set_submit(sd_event *e, int b) {
+        sd_event_source *s;
+        int r, fd;
+
+        assert_return(e, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if ((e->submit_fd >= 0) == !!b)
+                return !!b;
+
+        if (b) {
+                fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+                if (fd < 0)
+                        return -errno;
+
+                /* The event source is floating, so that it doesn't
+                 * keep the event loop alive */
+                s = source_new(e, true, SOURCE_IO);
+                if (!s) {
+                        safe_close(fd);
+                        return -ENOMEM;
+                }
+
+                s->io.fd = fd;
+                s->io.events = EPOLLIN;
+                s->io.callback = submit_io_handler;
+                s->userdata = e;
+                s->enabled = SD_EVENT_ON;
+
+                r = source_io_register(s, s->enabled, s->io.events);
+                if (r < 0) {
+                        source_free(s);
+                        safe_close(fd);
+                        return r;
+                }
+
+                e->submit_fd = fd;
+                e->submit_source = s;
+        } else {
+                e->submit_source = sd_event_source_unref(e->submit_source);
+                event_submit_flush(e);
+                e->submit_fd = safe_close(e->submit_fd);
+        }
+
+        return !!b;
+}
+
+_public_ int sd_event_get_submit(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->submit_fd >= 0;
+}
+
+_public_ int sd_event_submit(sd_event *e, sd_event_submit_handler_t callback, void *userdata) {
+        SubmitItem *i, *old;
+        uint64_t one = 1;
+
+        /* This may be called from any thread */
+
+        assert_return(e, -EINVAL);
+        assert_return(callback, -EINVAL);
+        assert_return(e->submit_fd >= 0, -EOPNOTSUPP);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        i = new(SubmitItem, 1);
+        if (!i)
+                return -ENOMEM;
+
+        i->callback = callback;
+        i->userdata = userdata;
+
+        __sync_add_and_fetch(&e->n_submit_pending, 1);
+
+        do {
+                old = e->submit_queue;
+                i->next = old;
+        } while (!__sync_bool_compare_and_swap(&e->submit_queue, old, i));
+
+        /* Only the first item after the loop emptied the queue needs
+         * to wake it up. EAGAIN means the counter is about to
+         * overflow, hence a wakeup is pending anyway. */
+        if (!old && write(e->submit_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                return -errno;
+
+        return 0;
+}
+
+struct sd_event_group {
+        unsigned n_ref;
+
+        sd_event **events;
+        unsigned n_events;
+
+        pthread_t *threads;
+        unsigned n_threads;
+
+        /* Written once to make all loops exit */
+        int quit_fd;
+
+        unsigned next;
+};
+
+static void* group_thread(void *p) {
+        sd_event *e = p;
+        sigset_t fullset;
+        int r;
+
+        /* No signals in this thread please */
+        assert_se(sigfillset(&fullset) == 0);
+        assert_se(pthread_sigmask(SIG_BLOCK, &fullset, NULL) == 0);
+
+        prctl(PR_SET_NAME, (unsigned long) "sd-event");
+
+        r = sd_event_loop(e);
+        if (r < 0)
+                log_debug_errno(r, "Event loop of group failed: %m");
+
+        return NULL;
+}
+
+static int group_quit_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        return sd_event_exit(sd_event_source_get_event(s), 0);
+}
+
+static void group_free(sd_event_group *g) {
+        uint64_t one = 1;
+        unsigned i;
+
+        assert(g);
+
+        if (g->n_threads > 0)
+                assert_se(write(g->quit_fd, &one, sizeof(one)) == sizeof(one));
+
+        /* The last reference might be dropped from within one of the
+         * loops of the group, whose thread cannot wait for itself.
+         * That loop might not get to see the quit request before we
+         * close quit_fd below, hence we tell it directly to exit once
+         * the current callback returns. It stays around until then,
+         * as it holds a reference of its own while running. */
+        for (i = 0; i < g->n_threads; i++)
+                if (pthread_equal(pthread_self(), g->threads[i])) {
+                        (void) sd_event_exit(g->events[i], 0);
+                        assert_se(pthread_detach(g->threads[i]) == 0);
+                } else
+                        assert_se(pthread_join(g->threads[i], NULL) == 0);
+
+        for (i = 0; i < g->n_events; i++)
+                sd_event_unref(g->events[i]);
+
+        safe_close(g->quit_fd);
+
+        free(g->events);
+        free(g->threads);
+        free(g);
+}
+
+_public_ int sd_event_group_new(sd_event_group **ret, unsigned n_events) {
+        sd_event_group *g;
+        unsigned i;
+        int r;
+
+        assert_return(ret, -EINVAL);
+
+        if (n_events == 0) {
+                long c;
+
+                c = sysconf(_SC_NPROCESSORS_ONLN);
+                n_events = c > 0 ? (unsigned) c : 1;
+        }
+
+        g = new0(sd_event_group, 1);
+        if (!g)
+                return -ENOMEM;
+
+        g->n_ref = 1;
+
+        g->quit_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        if (g->quit_fd < 0) {
+                free(g);
+                return -errno;
+        }
+
+        g->events = new0(sd_event*, n_events);
+        g->threads = new0(pthread_t, n_events);
+        if (!g->events || !g->threads) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        for (; g->n_events < n_events; g->n_events++) {
+                sd_event *e;
+
+                r = sd_event_new(&e);
+                if (r < 0)
+                        goto fail;
+
+                g->events[g->n_events] = e;
+
+                r = sd_event_set_submit(e, true);
+                if (r < 0)
+                        goto fail;
+
+                r = sd_event_add_io(e, NULL, g->quit_fd, EPOLLIN, group_quit_handler, NULL);
+                if (r < 0)
+                        goto fail;
+        }
+
+        for (i = 0; i < g->n_events; i++) {
+                r = pthread_create(&g->threads[i], NULL, group_thread, g->events[i]);
+                if (r != 0) {
+                        r = -r;
+                        goto fail;
+                }
+
+                g->n_threads++;
+        }
+
+        *ret = g;
+        return 0;
+
+fail:
+        group_free(g);
+        return r;
+}
+
+_public_ sd_event_group* sd_event_group_ref(sd_event_group *g) {
+
+        /* This may be called from any thread */
+
+        assert_return(g, NULL);
+
+        assert_se(__sync_fetch_and_add(&g->n_ref, 1) >= 1);
+
+        return g;
+}
+
+_public_ sd_event_group* sd_event_group_unref(sd_event_group *g) {
+        unsigned n;
+
+        /* This may be called from any thread, including the ones
+         * of the group itself */
+
+        if (!g)
+                return NULL;
+
+        n = __sync_sub_and_fetch(&g->n_ref, 1);
+        assert(n != (unsigned) -1);
+
+        if (n == 0)
+                group_free(g);
+
+        return NULL;
+}
+
+_public_ int sd_event_group_get_n_events(sd_event_group *g) {
+        assert_return(g, -EINVAL);
+
+        return (int) g->n_events;
+}
+
+_public_ sd_event* sd_event_group_get_event(sd_event_group *g, unsigned i) {
+        assert_return(g, NULL);
+        assert_return(i < g->n_events, NULL);
+
+        return g->events[i];
+}
+
+_public_ int sd_event_group_submit(sd_event_group *g, sd_event_submit_handler_t callback, void *userdata) {
+        unsigned i, start, best, best_pending = (unsigned) -1;
+
+        /* This may be called from any thread */
+
+        assert_return(g, -EINVAL);
+        assert_return(callback, -EINVAL);
+
+        /* Hand the callback to the loop with the least work queued,
+         * starting the search at a different loop each time, so that
+         * idle loops get their share evenly */
+        start = best = __sync_fetch_and_add(&g->next, 1) % g->n_events;
+        for (i = 0; i < g->n_events; i++) {
+                unsigned k, pending;
+
+                k = (start + i) % g->n_events;
+                pending = __sync_add_and_fetch(&g->events[k]->n_submit_pending, 0);
+                if (pending < best_pending) {
+                        best = k;
+                        best_pending = pending;
+
+                        if (pending == 0)
+                                break;
+                }
+        }
+
+        return sd_event_submit(g->events[best], callback, userdata);
+}
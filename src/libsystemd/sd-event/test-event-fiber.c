@@ -0,0 +1,316 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "sd-event.h"
+#include "sd-bus.h"
+#include "bus-util.h"
+#include "bus-error.h"
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+#include "event-fiber.h"
+
+static unsigned n_done = 0;
+
+static void done_handler(Fiber *f, int r, void *userdata) {
+        assert_se(fiber_get_result(f) == r);
+        n_done++;
+}
+
+static int pipe_fds[2] = { -1, -1 };
+
+static int reader_fiber(void *userdata) {
+        uint32_t revents = 0;
+        char c;
+
+        assert_se(fiber_current());
+
+        /* Nothing written yet */
+        assert_se(fiber_wait_fd(pipe_fds[0], EPOLLIN, 10 * USEC_PER_MSEC, NULL) == -ETIMEDOUT);
+
+        assert_se(fiber_wait_fd(pipe_fds[0], EPOLLIN, USEC_INFINITY, &revents) >= 0);
+        assert_se(revents & EPOLLIN);
+        assert_se(read(pipe_fds[0], &c, 1) == 1);
+
+        return c;
+}
+
+static int writer_fiber(void *userdata) {
+        usec_t t;
+
+        t = now(CLOCK_MONOTONIC);
+        assert_se(fiber_sleep(50 * USEC_PER_MSEC) >= 0);
+        assert_se(now(CLOCK_MONOTONIC) - t >= 50 * USEC_PER_MSEC);
+
+        assert_se(fiber_yield() >= 0);
+        assert_se(write(pipe_fds[1], "x", 1) == 1);
+
+        return 0;
+}
+
+static void test_basic(void) {
+        _cleanup_fiber_unref_ Fiber *reader = NULL, *writer = NULL;
+        sd_event *e = NULL;
+
+        assert_se(sd_event_default(&e) >= 0);
+        assert_se(pipe2(pipe_fds, O_CLOEXEC|O_NONBLOCK) >= 0);
+
+        n_done = 0;
+        assert_se(fiber_new(e, &reader, reader_fiber, done_handler, NULL) >= 0);
+        assert_se(fiber_new(e, &writer, writer_fiber, done_handler, NULL) >= 0);
+
+        /* Fibers are not started before the event loop runs */
+        assert_se(fiber_get_result(reader) == -EBUSY);
+        assert_se(!fiber_current());
+
+        while (n_done < 2)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        assert_se(fiber_get_result(reader) == 'x');
+        assert_se(fiber_get_result(writer) == 0);
+        assert_se(!fiber_current());
+
+        safe_close_pair(pipe_fds);
+        sd_event_unref(e);
+}
+
+static int child_fiber(void *userdata) {
+        siginfo_t si = {};
+        pid_t pid;
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0)
+                _exit(42);
+
+        assert_se(fiber_wait_child(pid, WEXITED, &si) >= 0);
+        assert_se(si.si_pid == pid);
+        assert_se(si.si_code == CLD_EXITED);
+
+        assert_se(sd_event_exit(userdata, 0) >= 0);
+
+        return si.si_status;
+}
+
+static void test_child(void) {
+        _cleanup_fiber_unref_ Fiber *f = NULL;
+        sigset_t ss, old;
+        sd_event *e = NULL;
+
+        assert_se(sigemptyset(&ss) >= 0);
+        assert_se(sigaddset(&ss, SIGCHLD) >= 0);
+        assert_se(sigprocmask(SIG_BLOCK, &ss, &old) >= 0);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(fiber_new(e, &f, child_fiber, NULL, e) >= 0);
+        assert_se(sd_event_loop(e) >= 0);
+        assert_se(fiber_get_result(f) == 42);
+
+        sd_event_unref(e);
+        assert_se(sigprocmask(SIG_SETMASK, &old, NULL) >= 0);
+}
+
+static int cancel_fiber(void *userdata) {
+        int r;
+
+        r = fiber_sleep(USEC_PER_SEC * 3600);
+        assert_se(r == -ECANCELED);
+
+        /* Once cancelled, every further wait fails right-away */
+        assert_se(fiber_yield() == -ECANCELED);
+
+        return r;
+}
+
+static int cancel_time_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        assert_se(fiber_cancel(userdata) > 0);
+        assert_se(fiber_cancel(userdata) == 0);
+
+        return sd_event_exit(sd_event_source_get_event(s), 0);
+}
+
+static void test_cancel(void) {
+        _cleanup_fiber_unref_ Fiber *f = NULL;
+        sd_event_source *s = NULL;
+        sd_event *e = NULL;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        n_done = 0;
+        assert_se(fiber_new(e, &f, cancel_fiber, done_handler, NULL) >= 0);
+        assert_se(sd_event_add_time(e, &s, CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + 10 * USEC_PER_MSEC, 0, cancel_time_handler, f) >= 0);
+        assert_se(sd_event_loop(e) >= 0);
+
+        assert_se(n_done == 1);
+        assert_se(fiber_get_result(f) == -ECANCELED);
+
+        sd_event_source_unref(s);
+        sd_event_unref(e);
+}
+
+static int server_filter(sd_bus *bus, sd_bus_message *m, void *userdata, sd_bus_error *error) {
+
+        if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Ping"))
+                return sd_bus_reply_method_return(m, "s", "pong");
+
+        if (sd_bus_message_is_method_call(m, NULL, NULL))
+                return sd_bus_reply_method_errorf(m, SD_BUS_ERROR_UNKNOWN_METHOD, "Unknown method.");
+
+        return 0;
+}
+
+static int call(sd_bus *bus, const char *member, sd_bus_error *error, sd_bus_message **reply) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        int r;
+
+        r = sd_bus_message_new_method_call(bus, &m, NULL, "/", "org.freedesktop.systemd.test", member);
+        if (r < 0)
+                return r;
+
+        return fiber_bus_call(bus, m, 0, error, reply);
+}
+
+static int bus_fiber(void *userdata) {
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        sd_bus *bus = userdata;
+        const char *s;
+        unsigned i;
+
+        /* Several calls in a row, each waiting for the previous
+         * reply, without blocking the server on the same loop */
+        for (i = 0; i < 3; i++) {
+                reply = sd_bus_message_unref(reply);
+                assert_se(call(bus, "Ping", &error, &reply) > 0);
+                assert_se(sd_bus_message_read(reply, "s", &s) >= 0);
+                assert_se(streq(s, "pong"));
+        }
+
+        assert_se(call(bus, "Foo", &error, NULL) == -EBADR);
+        assert_se(sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD));
+
+        return sd_event_exit(sd_bus_get_event(bus), 0);
+}
+
+static void test_bus(void) {
+        _cleanup_bus_close_unref_ sd_bus *client = NULL, *server = NULL;
+        _cleanup_fiber_unref_ Fiber *f = NULL;
+        sd_event *e = NULL;
+        sd_id128_t id;
+        int fds[2];
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, fds) >= 0);
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        assert_se(sd_bus_new(&server) >= 0);
+        assert_se(sd_bus_set_fd(server, fds[0], fds[0]) >= 0);
+        assert_se(sd_bus_set_server(server, 1, id) >= 0);
+        assert_se(sd_bus_add_filter(server, NULL, server_filter, NULL) >= 0);
+        assert_se(sd_bus_start(server) >= 0);
+        assert_se(sd_bus_attach_event(server, e, 0) >= 0);
+
+        assert_se(sd_bus_new(&client) >= 0);
+        assert_se(sd_bus_set_fd(client, fds[1], fds[1]) >= 0);
+        assert_se(sd_bus_start(client) >= 0);
+        assert_se(sd_bus_attach_event(client, e, 0) >= 0);
+
+        assert_se(fiber_new(e, &f, bus_fiber, NULL, client) >= 0);
+        assert_se(sd_event_loop(e) >= 0);
+        assert_se(fiber_get_result(f) == 0);
+
+        sd_bus_detach_event(client);
+        sd_bus_detach_event(server);
+        sd_event_unref(e);
+}
+
+static unsigned n_switches = 0;
+
+static int yield_fiber(void *userdata) {
+        unsigned i, n = PTR_TO_UINT(userdata);
+
+        for (i = 0; i < n; i++) {
+                assert_se(fiber_yield() >= 0);
+                n_switches++;
+        }
+
+        return 0;
+}
+
+static int yield_defer_handler(sd_event_source *s, void *userdata) {
+        if (++n_switches >= PTR_TO_UINT(userdata))
+                assert_se(sd_event_source_set_enabled(s, SD_EVENT_OFF) >= 0);
+
+        return 0;
+}
+
+static void test_switch(unsigned n) {
+        _cleanup_fiber_unref_ Fiber *f = NULL;
+        sd_event_source *s = NULL;
+        sd_event *e = NULL;
+        usec_t t, u;
+
+        /* Compares resuming a fiber once per iteration with plain
+         * callbacks, i.e. the cost of the context switches */
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        n_switches = 0;
+        assert_se(sd_event_add_defer(e, &s, yield_defer_handler, UINT_TO_PTR(n)) >= 0);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ON) >= 0);
+        t = now(CLOCK_MONOTONIC);
+        while (n_switches < n)
+                assert_se(sd_event_run(e, 0) > 0);
+        t = now(CLOCK_MONOTONIC) - t;
+        s = sd_event_source_unref(s);
+
+        n_switches = 0;
+        assert_se(fiber_new(e, &f, yield_fiber, NULL, UINT_TO_PTR(n)) >= 0);
+        u = now(CLOCK_MONOTONIC);
+        while (fiber_get_result(f) == -EBUSY)
+                assert_se(sd_event_run(e, 0) > 0);
+        u = now(CLOCK_MONOTONIC) - u;
+        assert_se(n_switches == n);
+
+        log_info("Dispatched %u iterations, %llu ns per callback, %llu ns per fiber resumption.",
+                 n,
+                 (unsigned long long) (t * NSEC_PER_USEC / n),
+                 (unsigned long long) (u * NSEC_PER_USEC / n));
+
+        sd_event_unref(e);
+}
+
+int main(int argc, char *argv[]) {
+
+        log_parse_environment();
+        log_open();
+
+        test_basic();
+        test_child();
+        test_cancel();
+        test_bus();
+
+        test_switch(argc > 1 ? (unsigned) atoi(argv[1]) : 100000);
+
+        return 0;
+}
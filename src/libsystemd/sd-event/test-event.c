@@ -19,10 +19,19 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pthread.h>
+
 #include "sd-event.h"
 #include "log.h"
 #include "util.h"
 #include "macro.h"
+#include "strv.h"
+
+/* The scaling tests are quick and quiet by default, set
+ * $SYSTEMD_BENCHMARK=1 to run them at full size and see timings */
+static bool arg_benchmark = false;
+
+#define log_bench(...) log_full(arg_benchmark ? LOG_INFO : LOG_DEBUG, __VA_ARGS__)
 
 static int prepare_handler(sd_event_source *s, void *userdata) {
         log_info("preparing %c", PTR_TO_INT(userdata));
@@ -160,11 +169,878 @@ static int exit_handler(sd_event_source *s, void *userdata) {
         return 3;
 }
 
-int main(int argc, char *argv[]) {
+static unsigned n_children_exited = 0;
+
+static int child_many_handler(sd_event_source *s, const siginfo_t *si, void *userdata) {
+
+        assert_se(si->si_code == CLD_EXITED);
+        assert_se(si->si_status == 7);
+
+        n_children_exited++;
+
+        sd_event_source_unref(s);
+        return 1;
+}
+
+static void test_child_many(unsigned n) {
+        sd_event *e = NULL;
+        int p[2] = { -1, -1 }, q[2] = { -1, -1 };
+        unsigned i, m;
+        usec_t t;
+        sigset_t ss;
+        char c = 'x';
+
+        /* Watch many children at once, and let first a few of them
+         * exit one by one, and then all the others at the same
+         * time. The cost of dispatching should scale with the
+         * children that exited, not with the ones watched. */
+
+        assert_se(sigemptyset(&ss) >= 0);
+        assert_se(sigaddset(&ss, SIGCHLD) >= 0);
+        assert_se(sigprocmask(SIG_BLOCK, &ss, NULL) >= 0);
+
+        /* A child exits for every byte written to p, and all exit
+         * when p is closed. q sees EOF once they are all gone. */
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+        assert_se(pipe2(q, O_CLOEXEC) >= 0);
+        assert_se(sd_event_new(&e) >= 0);
+
+        for (i = 0; i < n; i++) {
+                pid_t pid;
+
+                pid = fork();
+                if (pid < 0) {
+                        log_warning_errno(errno, "Failed to fork child %u, continuing with what we got: %m", i);
+                        n = i;
+                        break;
+                }
+
+                if (pid == 0) {
+                        safe_close(p[1]);
+                        (void) read(p[0], &c, 1);
+                        _exit(7);
+                }
+
+                assert_se(sd_event_add_child(e, NULL, pid, WEXITED, child_many_handler, NULL) >= 0);
+        }
+
+        n_children_exited = 0;
+        m = MIN(MAX(n / 100, 1U), n);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < m; i++) {
+                assert_se(write(p[1], &c, 1) == 1);
+
+                while (n_children_exited <= i)
+                        assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        if (m > 0)
+                log_bench("Dispatched %u of %u children exiting one by one in %s per child.",
+                         m, n, format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t / m, 1));
+
+        p[1] = safe_close(p[1]);
+        q[1] = safe_close(q[1]);
+
+        assert_se(read(q[0], &c, 1) == 0);
+
+        t = now(CLOCK_MONOTONIC);
+        while (n_children_exited < n)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("Dispatched %u children exiting at once in %s.",
+                 n - m, format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1));
+
+        sd_event_unref(e);
+        safe_close_pair(p);
+        safe_close_pair(q);
+}
+
+static unsigned n_timers_elapsed = 0;
+
+static int time_many_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        uint64_t next;
+
+        assert_se(sd_event_source_get_time(s, &next) >= 0);
+        assert_se(usec >= next);
+
+        n_timers_elapsed++;
+        return 0;
+}
+
+static void test_time_many(unsigned n, bool wheel) {
+        sd_event_source **s;
+        sd_event *e = NULL;
+        usec_t base, t;
+        unsigned i;
+
+        s = new0(sd_event_source*, n);
+        assert_se(s);
+
+        srand(0);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_timer_wheel(e, wheel) == wheel);
+        assert_se(sd_event_get_timer_wheel(e) == wheel);
+
+        base = now(CLOCK_MONOTONIC);
+
+        /* Add timeouts somewhere in the second minute from now */
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++)
+                assert_se(sd_event_add_time(e, &s[i], CLOCK_MONOTONIC,
+                                            base + USEC_PER_MINUTE + rand() % USEC_PER_MINUTE, 0,
+                                            time_many_handler, NULL) >= 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("%s: added %u timers in %s.", wheel ? "wheel" : "prioq",
+                 n, format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1));
+
+        assert_se(sd_event_set_timer_wheel(e, !wheel) == -EBUSY);
+
+        /* Push timeouts out as connections see activity, and go
+         * through the loop every now and then */
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n * 4; i++) {
+                assert_se(sd_event_source_set_time(s[rand() % n], base + USEC_PER_MINUTE + rand() % USEC_PER_MINUTE) >= 0);
+
+                if (i % 64 == 0)
+                        assert_se(sd_event_run(e, 0) == 0);
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("%s: updated %u timers in %s.", wheel ? "wheel" : "prioq",
+                 n * 4, format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1));
+
+        /* Let all of them elapse within the next 100ms */
+        base = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                assert_se(sd_event_source_set_time(s[i], base + rand() % (100 * USEC_PER_MSEC)) >= 0);
+                assert_se(sd_event_source_set_time_accuracy(s[i], 1 + rand() % (10 * USEC_PER_MSEC)) >= 0);
+        }
+
+        n_timers_elapsed = 0;
+        t = now(CLOCK_MONOTONIC);
+        while (n_timers_elapsed < n)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("%s: dispatched %u timers in %s.", wheel ? "wheel" : "prioq",
+                 n, format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1));
+
+        for (i = 0; i < n; i++)
+                sd_event_source_unref(s[i]);
+
+        free(s);
+        sd_event_unref(e);
+}
+
+#define SUBMIT_THREADS 4U
+#define SUBMIT_ITEMS 10000U
+
+static unsigned submit_last[SUBMIT_THREADS];
+static unsigned n_submitted = 0;
+
+static int submit_handler(sd_event *e, void *userdata) {
+        unsigned t, seq;
+
+        t = PTR_TO_UINT(userdata) / SUBMIT_ITEMS;
+        seq = PTR_TO_UINT(userdata) % SUBMIT_ITEMS;
+
+        /* Items from the same thread arrive in order */
+        assert_se(t < SUBMIT_THREADS);
+        assert_se(seq == submit_last[t]);
+        submit_last[t]++;
+
+        if (++n_submitted == SUBMIT_THREADS * SUBMIT_ITEMS)
+                return sd_event_exit(e, 0);
+
+        return 0;
+}
+
+static void* submit_thread(void *p) {
+        sd_event *e = p;
+        static unsigned n_threads = 0;
+        unsigned t, i;
+
+        t = __sync_fetch_and_add(&n_threads, 1);
+
+        for (i = 0; i < SUBMIT_ITEMS; i++)
+                assert_se(sd_event_submit(e, submit_handler, UINT_TO_PTR(t * SUBMIT_ITEMS + i)) >= 0);
+
+        return NULL;
+}
+
+static void test_submit(void) {
+        pthread_t threads[SUBMIT_THREADS];
+        sd_event *e = NULL;
+        unsigned i;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_submit(e, submit_handler, NULL) == -EOPNOTSUPP);
+        assert_se(sd_event_set_submit(e, true) == 1);
+        assert_se(sd_event_get_submit(e) == 1);
+
+        for (i = 0; i < SUBMIT_THREADS; i++)
+                assert_se(pthread_create(&threads[i], NULL, submit_thread, e) == 0);
+
+        assert_se(sd_event_loop(e) >= 0);
+
+        for (i = 0; i < SUBMIT_THREADS; i++)
+                assert_se(pthread_join(threads[i], NULL) == 0);
+
+        assert_se(n_submitted == SUBMIT_THREADS * SUBMIT_ITEMS);
+
+        sd_event_unref(e);
+}
+
+typedef struct GroupItem {
+        sd_event_group *group;
+        unsigned hops;
+} GroupItem;
+
+static unsigned n_group_done = 0;
+static int group_fd = -1;
+
+static int group_handler(sd_event *e, void *userdata) {
+        GroupItem *i = userdata;
+        int state;
+
+        state = sd_event_get_state(e);
+        assert_se(state == SD_EVENT_RUNNING);
+
+        /* Pass it on to another loop */
+        if (--i->hops > 0)
+                return sd_event_submit(sd_event_group_get_event(i->group, i->hops % sd_event_group_get_n_events(i->group)), group_handler, i);
+
+        free(i);
+
+        if (__sync_add_and_fetch(&n_group_done, 1) == SUBMIT_ITEMS)
+                assert_se(write(group_fd, "x", 1) == 1);
+
+        return 0;
+}
+
+static int group_release_fd = -1;
+static pid_t group_unref_tid = 0;
+
+static int group_unref_handler(sd_event *e, void *userdata) {
+        sd_event_group *g = userdata;
+        char c;
+
+        group_unref_tid = gettid();
+
+        /* Wait until the main thread let go, so that we drop the last
+         * reference from one of the group's own threads */
+        assert_se(read(group_release_fd, &c, 1) == 1);
+        assert_se(!sd_event_group_unref(g));
+
+        assert_se(write(group_fd, &c, 1) == 1);
+        return 0;
+}
+
+static void test_group(unsigned n_events) {
+        _cleanup_close_pair_ int p[2] = { -1, -1 }, q[2] = { -1, -1 };
+        char task[sizeof("/proc/self/task/") + DECIMAL_STR_MAX(pid_t)];
+        sd_event_group *g = NULL;
+        usec_t t;
+        unsigned i;
+        char c;
+
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+        group_fd = p[1];
+
+        assert_se(sd_event_group_new(&g, n_events) >= 0);
+        assert_se(sd_event_group_get_n_events(g) == (int) n_events);
+        assert_se(sd_event_group_get_event(g, 0));
+        assert_se(!sd_event_group_get_event(g, n_events));
+
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < SUBMIT_ITEMS; i++) {
+                GroupItem *item;
+
+                item = new(GroupItem, 1);
+                assert_se(item);
+                item->group = g;
+                item->hops = 8;
+
+                assert_se(sd_event_group_submit(g, group_handler, item) >= 0);
+        }
+
+        assert_se(read(p[0], &c, 1) == 1);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("Passed %u items 8 times between %u loops in %s.", SUBMIT_ITEMS, n_events,
+                 format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1));
+
+        assert_se(pipe2(q, O_CLOEXEC) >= 0);
+        group_release_fd = q[0];
+
+        assert_se(sd_event_group_submit(g, group_unref_handler, sd_event_group_ref(g)) >= 0);
+        assert_se(!sd_event_group_unref(g));
+        assert_se(write(q[1], &c, 1) == 1);
+
+        assert_se(read(p[0], &c, 1) == 1);
+
+        /* The thread that dropped the last reference must terminate
+         * on its own, as nobody joins it */
+        assert_se(group_unref_tid > 0);
+        sprintf(task, "/proc/self/task/"PID_FMT, group_unref_tid);
+        t = now(CLOCK_MONOTONIC);
+        while (access(task, F_OK) >= 0) {
+                assert_se(now(CLOCK_MONOTONIC) < t + 10 * USEC_PER_SEC);
+                usleep(USEC_PER_MSEC);
+        }
+}
+
+static unsigned n_profile_dispatched = 0;
+
+static int profile_defer_handler(sd_event_source *s, void *userdata) {
+
+        usleep(2 * USEC_PER_MSEC);
+
+        if (++n_profile_dispatched >= 5)
+                assert_se(sd_event_source_set_enabled(s, SD_EVENT_OFF) >= 0);
+
+        return 0;
+}
+
+static int profile_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        char x;
+
+        assert_se(read(fd, &x, 1) == 1);
+        return 0;
+}
+
+static void test_profile(void) {
+        _cleanup_strv_free_ char **l = NULL;
+        sd_event_source *s = NULL, *t = NULL;
+        static const char ch = 'x';
+        uint64_t h[64], usec, n = 0;
+        sd_event *e = NULL;
+        sd_event_stats stats;
+        int p[2] = { -1, -1 };
+        unsigned i;
+        int r;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_get_profile(e) == 0);
+        assert_se(sd_event_get_profile_stats(e, "slow", &stats) == -ENOENT);
+        assert_se(sd_event_set_profile(e, true) == 1);
+
+        assert_se(sd_event_set_slow_threshold(e, USEC_PER_MSEC) >= 0);
+        assert_se(sd_event_get_slow_threshold(e, &usec) >= 0);
+        assert_se(usec == USEC_PER_MSEC);
+
+        assert_se(sd_event_add_defer(e, &s, profile_defer_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ON) >= 0);
+        assert_se(sd_event_source_set_description(s, "slow") >= 0);
+
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+        assert_se(sd_event_add_io(e, &t, p[0], EPOLLIN, profile_io_handler, NULL) >= 0);
+        assert_se(write(p[1], &ch, 1) == 1);
+
+        for (i = 0; i < 6; i++)
+                assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_profile_dispatched == 5);
+
+        assert_se(sd_event_get_profile_descriptions(e, &l) >= 0);
+        assert_se(strv_equal(l, STRV_MAKE("io", "slow")));
+
+        assert_se(sd_event_get_profile_stats(e, "slow", &stats) >= 0);
+        assert_se(stats.n_dispatched == 5);
+        assert_se(stats.dispatch_usec >= 10 * USEC_PER_MSEC);
+        assert_se(stats.dispatch_usec_max >= 2 * USEC_PER_MSEC);
+        assert_se(stats.dispatch_usec_max <= stats.dispatch_usec);
+
+        /* The IO event had to wait for at least one slow callback */
+        assert_se(sd_event_get_profile_stats(e, "io", &stats) >= 0);
+        assert_se(stats.n_dispatched == 1);
+        assert_se(stats.delay_usec >= 2 * USEC_PER_MSEC);
+
+        r = sd_event_get_profile_histogram(e, h, ELEMENTSOF(h));
+        assert_se(r > 0 && r <= (int) ELEMENTSOF(h));
+        for (i = 0; i < (unsigned) r; i++)
+                n += h[i];
+        assert_se(n == 6);
+
+        /* Turning it off drops everything */
+        assert_se(sd_event_set_profile(e, false) == 0);
+        assert_se(sd_event_get_profile_stats(e, "slow", &stats) == -ENOENT);
+
+        sd_event_source_unref(s);
+        sd_event_source_unref(t);
+        sd_event_unref(e);
+        safe_close_pair(p);
+}
+
+static char batch_order[8];
+static unsigned n_batch_order = 0;
+static sd_event_source *batch_defer = NULL;
+
+static int batch_defer_handler(sd_event_source *s, void *userdata) {
+        assert_se(n_batch_order < ELEMENTSOF(batch_order) - 1);
+        batch_order[n_batch_order++] = 'D';
+
+        return sd_event_source_set_enabled(s, SD_EVENT_OFF);
+}
+
+static int batch_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        char x;
+
+        assert_se(read(fd, &x, 1) == 1);
+
+        assert_se(n_batch_order < ELEMENTSOF(batch_order) - 1);
+        batch_order[n_batch_order++] = (char) PTR_TO_INT(userdata);
+
+        /* Something more important shows up while dispatching */
+        if (userdata == INT_TO_PTR('A'))
+                assert_se(sd_event_source_set_enabled(batch_defer, SD_EVENT_ONESHOT) >= 0);
+
+        return 0;
+}
+
+static void test_batch_order(void) {
+        sd_event_source *s[4] = {};
+        static const char ch = 'x';
+        int p[4][2];
+        sd_event *e = NULL;
+        unsigned i;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_batch(e, true) == 1);
+        assert_se(sd_event_get_batch(e) == 1);
+
+        assert_se(sd_event_add_defer(e, &batch_defer, batch_defer_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_enabled(batch_defer, SD_EVENT_OFF) >= 0);
+        assert_se(sd_event_source_set_priority(batch_defer, -10) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(p); i++) {
+                assert_se(pipe2(p[i], O_CLOEXEC) >= 0);
+                assert_se(sd_event_add_io(e, &s[i], p[i][0], EPOLLIN, batch_io_handler, INT_TO_PTR('A' + i)) >= 0);
+                assert_se(write(p[i][1], &ch, 1) == 1);
+        }
+
+        /* A lower priority source is only dispatched once everything
+         * else is done */
+        assert_se(sd_event_source_set_priority(s[3], 10) >= 0);
+
+        /* B and C are dispatched in one go, but only after the defer
+         * source A enabled */
+        n_batch_order = 0;
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(streq(batch_order, "A"));
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(streq(batch_order, "AD"));
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(streq(batch_order, "ADBC"));
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(streq(batch_order, "ADBCD"));
+        assert_se(sd_event_run(e, 0) == 0);
+
+        for (i = 0; i < ELEMENTSOF(p); i++) {
+                sd_event_source_unref(s[i]);
+                safe_close_pair(p[i]);
+        }
+
+        batch_defer = sd_event_source_unref(batch_defer);
+        sd_event_unref(e);
+}
+
+static unsigned n_sockets_dispatched = 0;
+
+static int sockets_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        char x;
+
+        /* Stay readable for the next round */
+        assert_se(read(fd, &x, 1) == 1);
+        assert_se(write(PTR_TO_INT(userdata), &x, 1) == 1);
+
+        n_sockets_dispatched++;
+        return 0;
+}
+
+static void test_sockets_many(unsigned n, bool batch) {
+        static const char ch = 'x';
+        sd_event_source **s;
+        sd_event *e = NULL;
+        unsigned i, rounds = 0;
+        int *p;
+        usec_t t;
+
+        /* Many connections that are all ready at the same time */
+
+        s = new0(sd_event_source*, n);
+        p = new(int, n * 2);
+        assert_se(s && p);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_batch(e, batch) == batch);
+
+        for (i = 0; i < n; i++) {
+                assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, p + i*2) >= 0);
+                assert_se(sd_event_add_io(e, &s[i], p[i*2], EPOLLIN, sockets_handler, INT_TO_PTR(p[i*2+1])) >= 0);
+                assert_se(write(p[i*2+1], &ch, 1) == 1);
+        }
+
+        n_sockets_dispatched = 0;
+        t = now(CLOCK_MONOTONIC);
+        while (n_sockets_dispatched < n * 20) {
+                assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+                rounds++;
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("%s: dispatched %u ready sockets in %u iterations in %s, %llu ns per event.",
+                 batch ? "batch" : "single", n_sockets_dispatched, rounds,
+                 format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1),
+                 (unsigned long long) (t * NSEC_PER_USEC / n_sockets_dispatched));
+
+        for (i = 0; i < n; i++) {
+                sd_event_source_unref(s[i]);
+                safe_close_pair(p + i*2);
+        }
+
+        free(s);
+        free(p);
+        sd_event_unref(e);
+}
+
+struct inotify_context {
+        unsigned n_events;
+        uint32_t mask;
+        char last[16];
+};
+
+static int inotify_handler(sd_event_source *s, const struct inotify_event *ev, void *userdata) {
+        struct inotify_context *c = userdata;
+
+        c->n_events++;
+        c->mask |= ev->mask;
+        strncpy(c->last, ev->len > 0 ? ev->name : "", sizeof(c->last) - 1);
+
+        return 0;
+}
+
+static void test_inotify(bool with_uring) {
+        struct inotify_context a = {}, b = {}, c = {};
+        char p[] = "/tmp/test-event-inotify.XXXXXX";
+        sd_event_source *x = NULL, *y = NULL, *z = NULL;
+        const char *f, *g;
+        sd_event *e = NULL;
+        uint32_t mask;
+
+        assert_se(mkdtemp(p));
+        f = strjoina(p, "/foo");
+        g = strjoina(p, "/bar");
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        if (with_uring && sd_event_set_io_uring(e, true) < 0) {
+                log_info("io_uring backend not available, skipping.");
+                sd_event_unref(e);
+                assert_se(rmdir(p) >= 0);
+                return;
+        }
+
+        /* Both share one watch */
+        assert_se(sd_event_add_inotify(e, &x, p, IN_CREATE, inotify_handler, &a) >= 0);
+        assert_se(sd_event_add_inotify(e, &y, p, IN_DELETE, inotify_handler, &b) >= 0);
+        assert_se(sd_event_add_inotify(e, NULL, p, IN_CREATE|IN_ONESHOT, inotify_handler, &b) == -EINVAL);
+        assert_se(sd_event_source_get_inotify_mask(y, &mask) >= 0);
+        assert_se(mask == IN_DELETE);
+
+        assert_se(touch(f) >= 0);
+        assert_se(touch(g) >= 0);
+        while (sd_event_run(e, 0) > 0)
+                ;
+
+        assert_se(a.n_events == 2);
+        assert_se(streq(a.last, "bar"));
+        assert_se(b.n_events == 0);
+
+        assert_se(sd_event_add_inotify(e, &z, f, IN_ATTRIB|IN_DELETE_SELF, inotify_handler, &c) >= 0);
+
+        /* Events queued while an event source is off are kept */
+        assert_se(sd_event_source_set_enabled(x, SD_EVENT_ONESHOT) >= 0);
+        assert_se(unlink(f) >= 0);
+        assert_se(touch(f) >= 0);
+        assert_se(touch(strjoina(p, "/baz")) >= 0);
+        assert_se(sd_event_run(e, 0) > 0);
+        while (sd_event_run(e, 0) > 0)
+                ;
+
+        assert_se(a.n_events == 3);
+        assert_se(streq(a.last, "foo"));
+        assert_se(b.n_events == 1);
+        assert_se(streq(b.last, "foo"));
+        assert_se(c.mask & IN_DELETE_SELF);
+        assert_se(c.mask & IN_IGNORED);
+
+        assert_se(sd_event_source_set_enabled(x, SD_EVENT_ON) >= 0);
+        while (sd_event_run(e, 0) > 0)
+                ;
+        assert_se(a.n_events == 4);
+        assert_se(streq(a.last, "baz"));
+
+        /* The watch stays as long as somebody needs it */
+        x = sd_event_source_unref(x);
+        assert_se(unlink(g) >= 0);
+        while (sd_event_run(e, 0) > 0)
+                ;
+        assert_se(a.n_events == 4);
+        assert_se(b.n_events == 2);
+        assert_se(streq(b.last, "bar"));
+
+        sd_event_source_unref(y);
+        sd_event_source_unref(z);
+        sd_event_unref(e);
+
+        assert_se(rm_rf_dangerous(p, false, true, false) >= 0);
+}
+
+static unsigned n_coalesce_elapsed = 0;
+
+static int coalesce_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        uint64_t t;
+
+        /* Coalescing may delay timers, but never fires them early */
+        assert_se(sd_event_source_get_time(s, &t) >= 0);
+        assert_se(usec >= t);
+
+        n_coalesce_elapsed++;
+        return 0;
+}
+
+static int coalesce_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        return 0;
+}
+
+static void test_coalesce(void) {
+        static const clockid_t clocks[] = { CLOCK_MONOTONIC, CLOCK_REALTIME, CLOCK_BOOTTIME, CLOCK_MONOTONIC };
+        sd_event_source *s[ELEMENTSOF(clocks)], *io = NULL;
+        _cleanup_close_pair_ int p[2] = { -1, -1 };
+        uint64_t u, wakeups, timer_wakeups, before;
+        sd_event *e = NULL;
+        unsigned i;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_coalesce(e, 200 * USEC_PER_MSEC) >= 0);
+        assert_se(sd_event_get_coalesce(e, &u) >= 0);
+        assert_se(u == 200 * USEC_PER_MSEC);
+
+        /* Waiting for something that is ready already is not a
+         * wakeup */
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+        assert_se(write(p[1], "x", 1) == 1);
+        assert_se(sd_event_add_io(e, &io, p[0], EPOLLIN, coalesce_io_handler, NULL) >= 0);
+        assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+        io = sd_event_source_unref(io);
+
+        assert_se(sd_event_get_wakeups(e, &wakeups, &timer_wakeups) >= 0);
+        assert_se(wakeups == 0);
+        assert_se(timer_wakeups == 0);
+
+        /* Timers that elapsed already, on different clocks, are all
+         * dispatched, and if we slept at all it was for them */
+        for (i = 0; i < ELEMENTSOF(s); i++)
+                assert_se(sd_event_add_time(e, &s[i], clocks[i], 1, 0, coalesce_handler, NULL) >= 0);
+
+        assert_se(sd_event_source_get_time_accuracy(s[0], &u) >= 0);
+        assert_se(u == 200 * USEC_PER_MSEC);
+
+        while (n_coalesce_elapsed < ELEMENTSOF(s))
+                assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+
+        assert_se(sd_event_get_wakeups(e, &wakeups, &timer_wakeups) >= 0);
+        assert_se(wakeups == timer_wakeups);
+
+        /* Timers within 30ms of each other are coalesced. All grid
+         * points are 250ms apart, hence at most one of them lies
+         * before the last timer, and the rest follows with the next
+         * wakeup. Being woken up late only merges more of them. */
+        n_coalesce_elapsed = 0;
+        before = timer_wakeups;
+        u = now(CLOCK_MONOTONIC);
+        for (i = 0; i < ELEMENTSOF(s); i++) {
+                s[i] = sd_event_source_unref(s[i]);
+                assert_se(sd_event_add_time(e, &s[i], CLOCK_MONOTONIC, u + i * 10 * USEC_PER_MSEC, 0, coalesce_handler, NULL) >= 0);
+        }
+
+        while (n_coalesce_elapsed < ELEMENTSOF(s))
+                assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+
+        assert_se(sd_event_get_wakeups(e, &wakeups, &timer_wakeups) >= 0);
+        assert_se(timer_wakeups - before <= 2);
+        assert_se(wakeups == timer_wakeups);
+
+        for (i = 0; i < ELEMENTSOF(s); i++)
+                sd_event_source_unref(s[i]);
+        sd_event_unref(e);
+}
+
+static int churn_time_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        return 0;
+}
+
+static int churn_defer_handler(sd_event_source *s, void *userdata) {
+        return 0;
+}
+
+static void test_churn(unsigned n) {
+        sd_event_source *s[128];
+        sd_event *e = NULL;
+        unsigned i, j;
+        usec_t t;
+
+        /* Short-lived event sources, like timeouts of transactions
+         * that are added and removed all the time */
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                for (j = 0; j < ELEMENTSOF(s); j += 2) {
+                        assert_se(sd_event_add_time(e, &s[j], CLOCK_MONOTONIC, USEC_INFINITY - 1, 0, churn_time_handler, NULL) >= 0);
+                        assert_se(sd_event_add_defer(e, &s[j+1], churn_defer_handler, NULL) >= 0);
+                        assert_se(sd_event_source_set_enabled(s[j+1], SD_EVENT_OFF) >= 0);
+                }
+
+                for (j = 0; j < ELEMENTSOF(s); j++)
+                        s[j] = sd_event_source_unref(s[j]);
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("Added and removed %u event sources in %s, %llu ns per event source.",
+                 n * (unsigned) ELEMENTSOF(s),
+                 format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1),
+                 (unsigned long long) (t * NSEC_PER_USEC / (n * ELEMENTSOF(s))));
+
+        sd_event_unref(e);
+}
+
+static unsigned n_loop_iterations = 0;
+
+static int loop_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        int *p = userdata;
+        char x;
+
+        assert_se(read(fd, &x, 1) == 1);
+        assert_se(write(p[1], &x, 1) == 1);
+
+        n_loop_iterations++;
+        return 0;
+}
+
+static int loop_time_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ON) >= 0);
+
+        n_loop_iterations++;
+        return 0;
+}
+
+static void test_loop(unsigned n, bool with_uring) {
+        sd_event_source *s = NULL;
+        static const char ch = 'x';
+        sd_event *e = NULL;
+        int p[2] = { -1, -1 };
+        const char *name;
+        usec_t t;
+        int r;
+
+        /* Measure a loop iteration that dispatches an IO event, and
+         * one that dispatches a timer that elapsed already */
+
+        assert_se(sd_event_new(&e) >= 0);
+        r = sd_event_set_io_uring(e, with_uring);
+        if (r < 0) {
+                log_info_errno(r, "io_uring backend not available, skipping: %m");
+                sd_event_unref(e);
+                return;
+        }
+        assert_se(sd_event_get_io_uring(e) == with_uring);
+        name = with_uring ? "io_uring" : "epoll";
+
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+        assert_se(sd_event_add_io(e, &s, p[0], EPOLLIN, loop_io_handler, p) >= 0);
+        assert_se(write(p[1], &ch, 1) == 1);
+
+        n_loop_iterations = 0;
+        t = now(CLOCK_MONOTONIC);
+        while (n_loop_iterations < n)
+                assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("%s: %u IO iterations in %s, %llu ns per iteration.", name,
+                 n, format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1),
+                 (unsigned long long) (t * NSEC_PER_USEC / n));
+
+        s = sd_event_source_unref(s);
+        safe_close_pair(p);
+
+        assert_se(sd_event_add_time(e, &s, CLOCK_MONOTONIC, 0, 1, loop_time_handler, NULL) >= 0);
+
+        n_loop_iterations = 0;
+        t = now(CLOCK_MONOTONIC);
+        while (n_loop_iterations < n)
+                assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_bench("%s: %u timer iterations in %s, %llu ns per iteration.", name,
+                 n, format_timespan(alloca(FORMAT_TIMESPAN_MAX), FORMAT_TIMESPAN_MAX, t, 1),
+                 (unsigned long long) (t * NSEC_PER_USEC / n));
+
+        sd_event_source_unref(s);
+        sd_event_unref(e);
+}
+
+static void test_io_errors(bool with_uring) {
+        _cleanup_close_pair_ int p[2] = { -1, -1 };
+        _cleanup_close_ int null_fd = -1;
+        sd_event_source *s = NULL;
+        sd_event *e = NULL;
+        int fd;
+
+        assert_se(sd_event_new(&e) >= 0);
+        if (sd_event_set_io_uring(e, with_uring) < 0) {
+                log_info("io_uring backend not available, skipping.");
+                sd_event_unref(e);
+                return;
+        }
+
+        /* Both backends refuse fds that cannot be watched right away,
+         * callers rely on that to fall back to something else */
+        null_fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+        assert_se(null_fd >= 0);
+        assert_se(sd_event_add_io(e, NULL, null_fd, EPOLLIN, io_handler, NULL) == -EPERM);
+
+        fd = fcntl(null_fd, F_DUPFD_CLOEXEC, 3);
+        assert_se(fd >= 0);
+        safe_close(fd);
+        assert_se(sd_event_add_io(e, NULL, fd, EPOLLIN, io_handler, NULL) == -EBADF);
+
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+        assert_se(sd_event_add_io(e, &s, p[0], EPOLLIN, io_handler, NULL) >= 0);
+        assert_se(sd_event_add_io(e, NULL, p[0], EPOLLIN, io_handler, NULL) == -EEXIST);
+
+        /* Once disabled, the fd may be watched anew */
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_OFF) >= 0);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ON) >= 0);
+
+        sd_event_source_unref(s);
+        sd_event_unref(e);
+}
+
+static void test_basic(bool with_uring) {
         sd_event *e = NULL;
         sd_event_source *w = NULL, *x = NULL, *y = NULL, *z = NULL, *q = NULL, *t = NULL;
         static const char ch = 'x';
         int a[2] = { -1, -1 }, b[2] = { -1, -1}, d[2] = { -1, -1}, k[2] = { -1, -1 };
+        int r;
 
         assert_se(pipe(a) >= 0);
         assert_se(pipe(b) >= 0);
@@ -173,6 +1049,17 @@ int main(int argc, char *argv[]) {
 
         assert_se(sd_event_default(&e) >= 0);
 
+        if (with_uring) {
+                r = sd_event_set_io_uring(e, true);
+                if (r < 0) {
+                        log_info_errno(r, "io_uring backend not available, skipping: %m");
+                        sd_event_unref(e);
+                        return;
+                }
+
+                assert_se(sd_event_get_io_uring(e) > 0);
+        }
+
         assert_se(sd_event_set_watchdog(e, true) >= 0);
 
         /* Test whether we cleanly can destroy an io event source from its own handler */
@@ -183,6 +1070,7 @@ int main(int argc, char *argv[]) {
         assert_se(got_unref);
 
         got_a = false, got_b = false, got_c = false, got_d = 0;
+        do_quit = false;
 
         /* Add a oneshot handler, trigger it, re-enable it, and trigger
          * it again. */
@@ -248,6 +1136,43 @@ int main(int argc, char *argv[]) {
         safe_close_pair(b);
         safe_close_pair(d);
         safe_close_pair(k);
+}
+
+int main(int argc, char *argv[]) {
+        const char *b;
+
+        b = getenv("SYSTEMD_BENCHMARK");
+        arg_benchmark = b && parse_boolean(b) > 0;
+
+        test_basic(false);
+        test_basic(true);
+
+        test_io_errors(false);
+        test_io_errors(true);
+
+        test_child_many(arg_benchmark ? 1000 : 10);
+
+        test_time_many(arg_benchmark ? 10000 : 100, false);
+        test_time_many(arg_benchmark ? 10000 : 100, true);
+
+        test_submit();
+        test_group(4);
+
+        test_profile();
+
+        test_inotify(false);
+        test_inotify(true);
+
+        test_coalesce();
+
+        test_churn(arg_benchmark ? 2000 : 20);
+
+        test_batch_order();
+        test_sockets_many(arg_benchmark ? 1000 : 10, false);
+        test_sockets_many(arg_benchmark ? 1000 : 10, true);
+
+        test_loop(arg_benchmark ? 20000 : 100, false);
+        test_loop(arg_benchmark ? 20000 : 100, true);
 
         return 0;
 }
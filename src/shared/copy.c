@@ -27,6 +27,7 @@
 #include "copy.h"
 
 #define COPY_BUFFER_SIZE (16*1024)
+#define COPY_SPARSE_BUFFER_SIZE (256*1024)
 
 int copy_bytes(int fdf, int fdt, off_t max_bytes, bool try_reflink) {
         bool try_sendfile = true;
@@ -97,6 +98,68 @@ int copy_bytes(int fdf, int fdt, off_t max_bytes, bool try_reflink) {
         return 0;
 }
 
+int copy_bytes_sparse(int fdf, int fdt, off_t max_bytes) {
+        _cleanup_free_ void *buf = NULL;
+        off_t offset;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        /* Like copy_bytes(), but punches holes into the destination
+         * for runs of NUL bytes, instead of writing them out. This is
+         * useful for large, mostly empty files, such as coredumps,
+         * which we'd otherwise have to write and later compress
+         * page by page. The destination must be seekable. */
+
+        buf = malloc(COPY_SPARSE_BUFFER_SIZE);
+        if (!buf)
+                return -ENOMEM;
+
+        for (;;) {
+                size_t m = COPY_SPARSE_BUFFER_SIZE;
+                ssize_t n, k;
+
+                if (max_bytes != (off_t) -1) {
+
+                        if (max_bytes <= 0)
+                                return -EFBIG;
+
+                        if ((off_t) m > max_bytes)
+                                m = (size_t) max_bytes;
+                }
+
+                n = read(fdf, buf, m);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return -errno;
+                }
+                if (n == 0) /* EOF */
+                        break;
+
+                k = sparse_write(fdt, buf, (size_t) n, page_size());
+                if (k < 0)
+                        return (int) k;
+
+                if (max_bytes != (off_t) -1) {
+                        assert(max_bytes >= n);
+                        max_bytes -= n;
+                }
+        }
+
+        /* If the data ended in a hole we only seeked over it, hence
+         * make sure the file size covers it. */
+        offset = lseek(fdt, 0, SEEK_CUR);
+        if (offset == (off_t) -1)
+                return -errno;
+
+        if (ftruncate(fdt, offset) < 0)
+                return -errno;
+
+        return 0;
+}
+
 static int fd_copy_symlink(int df, const char *from, const struct stat *st, int dt, const char *to) {
         _cleanup_free_ char *target = NULL;
         int r;
@@ -191,6 +191,76 @@ static inline int getrandom(void *buffer, size_t count, unsigned flags) {
 }
 #endif
 
+#ifndef __NR_io_uring_setup
+#  if defined __alpha__
+#    define __NR_io_uring_setup 535
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_io_uring_setup 4425
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_io_uring_setup 6425
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_io_uring_setup 5425
+#    endif
+#  else
+#    define __NR_io_uring_setup 425
+#  endif
+#endif
+
+#ifndef __NR_io_uring_enter
+#  if defined __alpha__
+#    define __NR_io_uring_enter 536
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_io_uring_enter 4426
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_io_uring_enter 6426
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_io_uring_enter 5426
+#    endif
+#  else
+#    define __NR_io_uring_enter 426
+#  endif
+#endif
+
+#ifndef __NR_io_uring_register
+#  if defined __alpha__
+#    define __NR_io_uring_register 537
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_io_uring_register 4427
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_io_uring_register 6427
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_io_uring_register 5427
+#    endif
+#  else
+#    define __NR_io_uring_register 427
+#  endif
+#endif
+
+#ifdef HAVE_IO_URING
+struct io_uring_params;
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+        return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void *arg, size_t argsz) {
+        return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static inline int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+        return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+#endif
+
 #ifndef GRND_NONBLOCK
 #define GRND_NONBLOCK 0x0001
 #endif
@@ -0,0 +1,364 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "timer-wheel.h"
+
+/* Each level has 64 slots, indexed by one 6bit digit of the key. A
+ * node is placed on the level of the most significant digit in which
+ * its key differs from the current position of the wheel, and into
+ * the slot for its own value of that digit. Hence every node on a
+ * lower level comes before all nodes on the levels above, and the
+ * smallest key is at the root of the first occupied slot. When the
+ * wheel reaches the start of a slot above level 0 the nodes in it are
+ * cascaded, i.e. placed anew, which moves them at least one level
+ * down. Keys already passed are kept in the slot of the current
+ * position on level 0. */
+
+#define WHEEL_BITS 6U
+#define WHEEL_SLOTS (1U << WHEEL_BITS)
+#define WHEEL_LEVELS ((64U + WHEEL_BITS - 1U) / WHEEL_BITS)
+
+struct TimerWheel {
+        uint64_t now;
+        unsigned n_nodes;
+
+        uint64_t occupied[WHEEL_LEVELS];
+        TimerWheelNode *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+TimerWheel *timer_wheel_new(void) {
+        return new0(TimerWheel, 1);
+}
+
+void timer_wheel_free(TimerWheel *w) {
+        free(w);
+}
+
+void timer_wheel_node_init(TimerWheelNode *n) {
+        assert(n);
+
+        n->idx = TIMER_WHEEL_IDX_NULL;
+        n->child = n->next = n->prev = NULL;
+}
+
+static TimerWheelNode *heap_meld(TimerWheelNode *a, TimerWheelNode *b) {
+
+        /* Both are roots, the one with the larger key becomes the
+         * first child of the other */
+
+        if (!a)
+                return b;
+        if (!b)
+                return a;
+
+        if (b->key < a->key) {
+                TimerWheelNode *t = a;
+                a = b;
+                b = t;
+        }
+
+        b->prev = a;
+        b->next = a->child;
+        if (a->child)
+                a->child->prev = b;
+        a->child = b;
+
+        return a;
+}
+
+static TimerWheelNode *heap_merge_pairs(TimerWheelNode *first) {
+        TimerWheelNode *a, *b, *stack = NULL, *root = NULL;
+
+        /* Meld the siblings pairwise from the left, then the pairs
+         * from the right */
+
+        while ((a = first)) {
+                b = a->next;
+                first = b ? b->next : NULL;
+
+                a->next = a->prev = NULL;
+                if (b)
+                        b->next = b->prev = NULL;
+
+                a = heap_meld(a, b);
+                a->next = stack;
+                stack = a;
+        }
+
+        while ((a = stack)) {
+                stack = a->next;
+                a->next = NULL;
+                root = heap_meld(root, a);
+        }
+
+        return root;
+}
+
+static void heap_remove(TimerWheelNode **root, TimerWheelNode *n) {
+        TimerWheelNode *sub;
+
+        sub = heap_merge_pairs(n->child);
+
+        if (*root == n)
+                *root = sub;
+        else {
+                if (n->prev->child == n)
+                        n->prev->child = n->next;
+                else
+                        n->prev->next = n->next;
+                if (n->next)
+                        n->next->prev = n->prev;
+
+                *root = heap_meld(*root, sub);
+        }
+
+        n->child = n->next = n->prev = NULL;
+}
+
+static TimerWheelNode *heap_flatten(TimerWheelNode *root) {
+        TimerWheelNode *n, *last;
+
+        /* Turns the heap into a list linked by the next pointers, in
+         * O(n): the children of each node are spliced in right after
+         * it */
+
+        for (n = root; n; n = n->next) {
+                if (!n->child)
+                        continue;
+
+                for (last = n->child; last->next; last = last->next)
+                        ;
+
+                last->next = n->next;
+                n->next = n->child;
+                n->child = NULL;
+        }
+
+        return root;
+}
+
+static unsigned key_level(uint64_t key, uint64_t now) {
+        uint64_t x;
+
+        x = key ^ now;
+        if (x == 0)
+                return 0;
+
+        return (63U - __builtin_clzll(x)) / WHEEL_BITS;
+}
+
+static unsigned key_slot(uint64_t key, unsigned level) {
+        return (unsigned) (key >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1U);
+}
+
+static uint64_t slot_start(TimerWheel *w, unsigned level, unsigned slot) {
+        unsigned shift = (level + 1U) * WHEEL_BITS;
+        uint64_t prefix;
+
+        prefix = shift >= 64U ? 0 : (w->now >> shift) << shift;
+
+        return prefix | ((uint64_t) slot << (level * WHEEL_BITS));
+}
+
+static void wheel_link(TimerWheel *w, TimerWheelNode *n) {
+        unsigned level, slot;
+        uint64_t k;
+
+        k = MAX(n->key, w->now);
+        level = key_level(k, w->now);
+        slot = key_slot(k, level);
+
+        n->child = n->next = n->prev = NULL;
+        w->slots[level][slot] = heap_meld(w->slots[level][slot], n);
+        w->occupied[level] |= UINT64_C(1) << slot;
+        n->idx = level * WHEEL_SLOTS + slot;
+}
+
+static void wheel_unlink(TimerWheel *w, TimerWheelNode *n) {
+        unsigned level, slot;
+
+        level = n->idx / WHEEL_SLOTS;
+        slot = n->idx % WHEEL_SLOTS;
+
+        heap_remove(&w->slots[level][slot], n);
+        if (!w->slots[level][slot])
+                w->occupied[level] &= ~(UINT64_C(1) << slot);
+
+        n->idx = TIMER_WHEEL_IDX_NULL;
+}
+
+static int wheel_first_level(TimerWheel *w) {
+        unsigned l;
+
+        for (l = 0; l < WHEEL_LEVELS; l++)
+                if (w->occupied[l])
+                        return l;
+
+        return -1;
+}
+
+static TimerWheelNode *wheel_take_slot(TimerWheel *w, unsigned level, unsigned slot) {
+        TimerWheelNode *list;
+
+        list = heap_flatten(w->slots[level][slot]);
+        w->slots[level][slot] = NULL;
+        w->occupied[level] &= ~(UINT64_C(1) << slot);
+
+        return list;
+}
+
+static void wheel_cascade(TimerWheel *w, unsigned level, unsigned slot) {
+        TimerWheelNode *list, *n;
+
+        list = wheel_take_slot(w, level, slot);
+
+        while ((n = list)) {
+                list = n->next;
+                wheel_link(w, n);
+        }
+}
+
+static void wheel_rewind(TimerWheel *w, uint64_t now) {
+        TimerWheelNode *list = NULL, *n, *m;
+        unsigned l, s;
+
+        /* The clock went backwards. This should be rare, hence we
+         * simply place all nodes anew. */
+
+        for (l = 0; l < WHEEL_LEVELS; l++)
+                for (s = 0; s < WHEEL_SLOTS; s++) {
+                        m = wheel_take_slot(w, l, s);
+
+                        while ((n = m)) {
+                                m = n->next;
+                                n->next = list;
+                                list = n;
+                        }
+                }
+
+        w->now = now;
+
+        while ((n = list)) {
+                list = n->next;
+                wheel_link(w, n);
+        }
+}
+
+static TimerWheelNode *wheel_due(TimerWheel *w, uint64_t now) {
+
+        if (now < w->now)
+                wheel_rewind(w, now);
+
+        for (;;) {
+                unsigned s;
+                uint64_t t;
+                int l;
+
+                l = wheel_first_level(w);
+                if (l < 0)
+                        break;
+
+                s = __builtin_ctzll(w->occupied[l]);
+                t = slot_start(w, l, s);
+                if (t > now)
+                        break;
+
+                w->now = t;
+
+                if (l == 0)
+                        return w->slots[0][s];
+
+                wheel_cascade(w, l, s);
+        }
+
+        w->now = now;
+        return NULL;
+}
+
+void timer_wheel_put(TimerWheel *w, TimerWheelNode *n, uint64_t key) {
+        assert(w);
+        assert(n);
+
+        if (timer_wheel_node_linked(n))
+                timer_wheel_remove(w, n);
+
+        n->key = key;
+        wheel_link(w, n);
+        w->n_nodes++;
+}
+
+void timer_wheel_remove(TimerWheel *w, TimerWheelNode *n) {
+        assert(w);
+        assert(n);
+
+        if (!timer_wheel_node_linked(n))
+                return;
+
+        assert(w->n_nodes > 0);
+
+        wheel_unlink(w, n);
+        w->n_nodes--;
+}
+
+TimerWheelNode *timer_wheel_peek(TimerWheel *w) {
+        int l;
+
+        if (!w)
+                return NULL;
+
+        l = wheel_first_level(w);
+        if (l < 0)
+                return NULL;
+
+        return w->slots[l][__builtin_ctzll(w->occupied[l])];
+}
+
+TimerWheelNode *timer_wheel_pop(TimerWheel *w, uint64_t now) {
+        TimerWheelNode *n;
+
+        if (!w)
+                return NULL;
+
+        n = wheel_due(w, now);
+        if (n)
+                timer_wheel_remove(w, n);
+
+        return n;
+}
+
+void timer_wheel_advance(TimerWheel *w, uint64_t now) {
+        assert(w);
+
+        (void) wheel_due(w, now);
+}
+
+unsigned timer_wheel_size(TimerWheel *w) {
+        if (!w)
+                return 0;
+
+        return w->n_nodes;
+}
+
+bool timer_wheel_isempty(TimerWheel *w) {
+        if (!w)
+                return true;
+
+        return w->n_nodes == 0;
+}
@@ -0,0 +1,65 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "macro.h"
+
+/* A hierarchical timing wheel, ordering nodes by a 64bit key, usually
+ * a timestamp. Nodes are sorted into coarser slots the further their
+ * key is away from the current position of the wheel, and are moved
+ * into finer slots as the wheel advances. Each slot is a pairing heap,
+ * hence insertion and looking up the smallest key are O(1), removal is
+ * O(log n) amortized, and nothing ever allocates, the nodes are
+ * embedded in the objects they order. */
+
+typedef struct TimerWheel TimerWheel;
+typedef struct TimerWheelNode TimerWheelNode;
+
+struct TimerWheelNode {
+        uint64_t key;
+        unsigned idx;
+
+        /* prev points to the parent for the first child */
+        TimerWheelNode *child, *next, *prev;
+};
+
+#define TIMER_WHEEL_IDX_NULL ((unsigned) -1)
+
+TimerWheel *timer_wheel_new(void);
+void timer_wheel_free(TimerWheel *w);
+
+void timer_wheel_node_init(TimerWheelNode *n);
+
+void timer_wheel_put(TimerWheel *w, TimerWheelNode *n, uint64_t key);
+void timer_wheel_remove(TimerWheel *w, TimerWheelNode *n);
+
+TimerWheelNode *timer_wheel_peek(TimerWheel *w);
+TimerWheelNode *timer_wheel_pop(TimerWheel *w, uint64_t now);
+void timer_wheel_advance(TimerWheel *w, uint64_t now);
+
+unsigned timer_wheel_size(TimerWheel *w) _pure_;
+bool timer_wheel_isempty(TimerWheel *w) _pure_;
+
+static inline bool timer_wheel_node_linked(const TimerWheelNode *n) {
+        return n->idx != TIMER_WHEEL_IDX_NULL;
+}
@@ -4181,16 +4181,13 @@ static int print_property(const char *name, sd_bus_message *m, const char *conte
         return 0;
 }
 
-static int show_one(
+static int show_one_reply(
                 const char *verb,
-                sd_bus *bus,
-                const char *path,
+                sd_bus_message *reply,
                 bool show_properties,
                 bool *new_line,
                 bool *ellipsized) {
 
-        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
-        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
         UnitStatusInfo info = {
                 .memory_current = (uint64_t) -1,
                 .memory_limit = (uint64_t) -1,
@@ -4198,25 +4195,9 @@ static int show_one(
         ExecStatusInfo *p;
         int r;
 
-        assert(path);
+        assert(reply);
         assert(new_line);
 
-        log_debug("Showing one %s", path);
-
-        r = sd_bus_call_method(
-                        bus,
-                        "org.freedesktop.systemd1",
-                        path,
-                        "org.freedesktop.DBus.Properties",
-                        "GetAll",
-                        &error,
-                        &reply,
-                        "s", "");
-        if (r < 0) {
-                log_error("Failed to get properties: %s", bus_error_message(&error, r));
-                return r;
-        }
-
         r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "{sv}");
         if (r < 0)
                 return bus_log_parse_error(r);
@@ -4300,6 +4281,89 @@ static int show_one(
         return r;
 }
 
+static int show_one(
+                const char *verb,
+                sd_bus *bus,
+                const char *path,
+                bool show_properties,
+                bool *new_line,
+                bool *ellipsized) {
+
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r;
+
+        assert(path);
+
+        log_debug("Showing one %s", path);
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "GetAll",
+                        &error,
+                        &reply,
+                        "s", "");
+        if (r < 0) {
+                log_error("Failed to get properties: %s", bus_error_message(&error, r));
+                return r;
+        }
+
+        return show_one_reply(verb, reply, show_properties, new_line, ellipsized);
+}
+
+/* How many units' properties are requested at once */
+#define SHOW_BATCH_MAX 256U
+
+static int show_many(
+                const char *verb,
+                sd_bus *bus,
+                char **paths,
+                bool show_properties,
+                bool *new_line,
+                bool *ellipsized) {
+
+        sd_bus_message *reply[SHOW_BATCH_MAX];
+        sd_bus_error error[SHOW_BATCH_MAX];
+        unsigned i, k, n;
+        int r = 0, ret = 0;
+
+        /* Requests the properties of a batch of units at a time, so
+         * that we wait for one round-trip per batch instead of one
+         * per unit */
+
+        for (n = strv_length(paths); n > 0 && r >= 0; paths += k, n -= k) {
+                k = MIN(n, SHOW_BATCH_MAX);
+
+                for (i = 0; i < k; i++)
+                        error[i] = SD_BUS_ERROR_NULL;
+
+                log_debug("Showing %u units, starting with %s", k, paths[0]);
+
+                r = bus_get_all_properties_many(bus, "org.freedesktop.systemd1", paths, k, NULL, error, reply);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to get properties: %m");
+
+                for (i = 0; i < k; i++) {
+                        if (r >= 0 && reply[i]) {
+                                r = show_one_reply(verb, reply[i], show_properties, new_line, ellipsized);
+                                if (r > 0 && ret == 0)
+                                        ret = r;
+                        } else if (r >= 0) {
+                                r = -sd_bus_error_get_errno(error + i);
+                                log_error("Failed to get properties: %s", bus_error_message(error + i, r));
+                        }
+
+                        sd_bus_message_unref(reply[i]);
+                        sd_bus_error_free(error + i);
+                }
+        }
+
+        return r < 0 ? r : ret;
+}
+
 static int get_unit_dbus_path_by_pid(
                 sd_bus *bus,
                 uint32_t pid,
@@ -4345,9 +4409,10 @@ static int show_all(
 
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_free_ UnitInfo *unit_infos = NULL;
+        _cleanup_strv_free_ char **paths = NULL;
         const UnitInfo *u;
         unsigned c;
-        int r, ret = 0;
+        int r;
 
         r = get_unit_list(bus, NULL, NULL, &unit_infos, 0, &reply);
         if (r < 0)
@@ -4359,21 +4424,17 @@ static int show_all(
 
         qsort_safe(unit_infos, c, sizeof(UnitInfo), compare_unit_info);
 
-        for (u = unit_infos; u < unit_infos + c; u++) {
-                _cleanup_free_ char *p = NULL;
+        paths = new0(char*, c + 1);
+        if (!paths)
+                return log_oom();
 
-                p = unit_dbus_path_from_name(u->id);
-                if (!p)
+        for (u = unit_infos; u < unit_infos + c; u++) {
+                paths[u - unit_infos] = unit_dbus_path_from_name(u->id);
+                if (!paths[u - unit_infos])
                         return log_oom();
-
-                r = show_one(verb, bus, p, show_properties, new_line, ellipsized);
-                if (r < 0)
-                        return r;
-                else if (r > 0 && ret == 0)
-                        ret = r;
         }
 
-        return ret;
+        return show_many(verb, bus, paths, show_properties, new_line, ellipsized);
 }
 
 static int show_system_status(sd_bus *bus) {
@@ -4461,10 +4522,11 @@ static int show(sd_bus *bus, char **args) {
                         ret = show_all(args[0], bus, false, &new_line, &ellipsized);
         } else {
                 _cleanup_free_ char **patterns = NULL;
+                _cleanup_strv_free_ char **paths = NULL;
                 char **name;
 
                 STRV_FOREACH(name, args + 1) {
-                        _cleanup_free_ char *unit = NULL;
+                        char *unit = NULL;
                         uint32_t id;
 
                         if (safe_atou32(*name, &id) < 0) {
@@ -4486,12 +4548,8 @@ static int show(sd_bus *bus, char **args) {
                                 }
                         }
 
-                        r = show_one(args[0], bus, unit, show_properties,
-                                     &new_line, &ellipsized);
-                        if (r < 0)
-                                return r;
-                        else if (r > 0 && ret == 0)
-                                ret = r;
+                        if (strv_consume(&paths, unit) < 0)
+                                return log_oom();
                 }
 
                 if (!strv_isempty(patterns)) {
@@ -4502,20 +4560,22 @@ static int show(sd_bus *bus, char **args) {
                                 log_error_errno(r, "Failed to expand names: %m");
 
                         STRV_FOREACH(name, names) {
-                                _cleanup_free_ char *unit;
+                                char *unit;
 
                                 unit = unit_dbus_path_from_name(*name);
                                 if (!unit)
                                         return log_oom();
 
-                                r = show_one(args[0], bus, unit, show_properties,
-                                             &new_line, &ellipsized);
-                                if (r < 0)
-                                        return r;
-                                else if (r > 0 && ret == 0)
-                                        ret = r;
+                                if (strv_consume(&paths, unit) < 0)
+                                        return log_oom();
                         }
                 }
+
+                r = show_many(args[0], bus, paths, show_properties, &new_line, &ellipsized);
+                if (r < 0)
+                        return r;
+                else if (r > 0 && ret == 0)
+                        ret = r;
         }
 
         if (ellipsized && !arg_quiet)
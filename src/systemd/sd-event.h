@@ -25,6 +25,7 @@
 #include <sys/types.h>
 #include <sys/signalfd.h>
 #include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <inttypes.h>
 #include <signal.h>
 
@@ -37,12 +38,14 @@
   - Scales better with a large number of time events because it does not require one timerfd each
   - Automatically tries to coalesce timer events system-wide
   - Handles signals and child PIDs
+  - Shares one inotify fd between all inotify watches
 */
 
 _SD_BEGIN_DECLARATIONS;
 
 typedef struct sd_event sd_event;
 typedef struct sd_event_source sd_event_source;
+typedef struct sd_event_group sd_event_group;
 
 enum {
         SD_EVENT_OFF = 0,
@@ -66,11 +69,25 @@ enum {
         SD_EVENT_PRIORITY_IDLE = 100
 };
 
+/* Dispatch statistics of all event sources with the same description,
+ * collected while profiling is enabled. All times in microseconds.
+ * The delay is the time from an event source becoming pending until
+ * it is dispatched. */
+typedef struct sd_event_stats {
+        uint64_t n_dispatched;
+        uint64_t dispatch_usec;
+        uint64_t dispatch_usec_max;
+        uint64_t delay_usec;
+        uint64_t delay_usec_max;
+} sd_event_stats;
+
 typedef int (*sd_event_handler_t)(sd_event_source *s, void *userdata);
 typedef int (*sd_event_io_handler_t)(sd_event_source *s, int fd, uint32_t revents, void *userdata);
 typedef int (*sd_event_time_handler_t)(sd_event_source *s, uint64_t usec, void *userdata);
 typedef int (*sd_event_signal_handler_t)(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata);
 typedef int (*sd_event_child_handler_t)(sd_event_source *s, const siginfo_t *si, void *userdata);
+typedef int (*sd_event_inotify_handler_t)(sd_event_source *s, const struct inotify_event *event, void *userdata);
+typedef int (*sd_event_submit_handler_t)(sd_event *e, void *userdata);
 
 int sd_event_default(sd_event **e);
 
@@ -85,6 +102,7 @@ int sd_event_add_child(sd_event *e, sd_event_source **s, pid_t pid, int options,
 int sd_event_add_defer(sd_event *e, sd_event_source **s, sd_event_handler_t callback, void *userdata);
 int sd_event_add_post(sd_event *e, sd_event_source **s, sd_event_handler_t callback, void *userdata);
 int sd_event_add_exit(sd_event *e, sd_event_source **s, sd_event_handler_t callback, void *userdata);
+int sd_event_add_inotify(sd_event *e, sd_event_source **s, const char *path, uint32_t mask, sd_event_inotify_handler_t callback, void *userdata);
 
 int sd_event_prepare(sd_event *e);
 int sd_event_wait(sd_event *e, uint64_t timeout);
@@ -101,6 +119,32 @@ int sd_event_get_tid(sd_event *e, pid_t *tid);
 int sd_event_get_exit_code(sd_event *e, int *code);
 int sd_event_set_watchdog(sd_event *e, int b);
 int sd_event_get_watchdog(sd_event *e);
+int sd_event_set_timer_wheel(sd_event *e, int b);
+int sd_event_get_timer_wheel(sd_event *e);
+int sd_event_set_io_uring(sd_event *e, int b);
+int sd_event_get_io_uring(sd_event *e);
+int sd_event_set_batch(sd_event *e, int b);
+int sd_event_get_batch(sd_event *e);
+int sd_event_set_profile(sd_event *e, int b);
+int sd_event_get_profile(sd_event *e);
+int sd_event_get_profile_descriptions(sd_event *e, char ***ret);
+int sd_event_get_profile_stats(sd_event *e, const char *description, sd_event_stats *ret);
+int sd_event_get_profile_histogram(sd_event *e, uint64_t *buckets, size_t n);
+int sd_event_set_slow_threshold(sd_event *e, uint64_t usec);
+int sd_event_get_slow_threshold(sd_event *e, uint64_t *usec);
+int sd_event_set_coalesce(sd_event *e, uint64_t usec);
+int sd_event_get_coalesce(sd_event *e, uint64_t *usec);
+int sd_event_get_wakeups(sd_event *e, uint64_t *wakeups, uint64_t *timer_wakeups);
+int sd_event_set_submit(sd_event *e, int b);
+int sd_event_get_submit(sd_event *e);
+int sd_event_submit(sd_event *e, sd_event_submit_handler_t callback, void *userdata);
+
+int sd_event_group_new(sd_event_group **ret, unsigned n_events);
+sd_event_group* sd_event_group_ref(sd_event_group *g);
+sd_event_group* sd_event_group_unref(sd_event_group *g);
+int sd_event_group_get_n_events(sd_event_group *g);
+sd_event* sd_event_group_get_event(sd_event_group *g, unsigned i);
+int sd_event_group_submit(sd_event_group *g, sd_event_submit_handler_t callback, void *userdata);
 
 sd_event_source* sd_event_source_ref(sd_event_source *s);
 sd_event_source* sd_event_source_unref(sd_event_source *s);
@@ -129,6 +173,7 @@ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec);
 int sd_event_source_get_time_clock(sd_event_source *s, clockid_t *clock);
 int sd_event_source_get_signal(sd_event_source *s);
 int sd_event_source_get_child_pid(sd_event_source *s, pid_t *pid);
+int sd_event_source_get_inotify_mask(sd_event_source *s, uint32_t *mask);
 
 _SD_END_DECLARATIONS;
 
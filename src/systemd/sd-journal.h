@@ -62,6 +62,13 @@ int sd_journal_perror_with_location(const char *file, const char *line, const ch
 
 int sd_journal_stream_fd(const char *identifier, int priority, int level_prefix);
 
+/* Write to daemon through a shared memory ring, without a syscall per entry */
+typedef struct sd_journal_ring sd_journal_ring;
+
+int sd_journal_ring_open(sd_journal_ring **ret, size_t size);
+sd_journal_ring* sd_journal_ring_close(sd_journal_ring *r);
+int sd_journal_ring_sendv(sd_journal_ring *r, const struct iovec *iov, int n);
+
 /* Browse journal stream */
 
 typedef struct sd_journal sd_journal;
@@ -78,6 +78,50 @@ static void test_copy_file_fd(void) {
         unlink(out_fn);
 }
 
+static void test_copy_bytes_sparse(void) {
+        char in_fn[] = "/tmp/test-copy-bytes-sparse-XXXXXX";
+        char out_fn[] = "/tmp/test-copy-bytes-sparse-XXXXXX";
+        _cleanup_close_ int in_fd = -1, out_fd = -1;
+        _cleanup_free_ char *buf = NULL, *buf2 = NULL;
+        size_t sz = page_size() * 64;
+        struct stat st;
+
+        buf = new0(char, sz);
+        assert_se(buf);
+        buf2 = new(char, sz);
+        assert_se(buf2);
+
+        /* Some data, followed by a large hole, some more data, and
+         * a trailing hole */
+        memcpy(buf, "foo", 3);
+        memcpy(buf + sz / 2, "bar", 3);
+
+        in_fd = mkostemp_safe(in_fn, O_RDWR);
+        assert_se(in_fd >= 0);
+        out_fd = mkostemp_safe(out_fn, O_RDWR);
+        assert_se(out_fd >= 0);
+
+        assert_se(loop_write(in_fd, buf, sz, false) >= 0);
+        assert_se(lseek(in_fd, 0, SEEK_SET) == 0);
+
+        assert_se(copy_bytes_sparse(in_fd, out_fd, (off_t) sz - 1) == -EFBIG);
+
+        assert_se(lseek(in_fd, 0, SEEK_SET) == 0);
+        assert_se(ftruncate(out_fd, 0) == 0);
+        assert_se(lseek(out_fd, 0, SEEK_SET) == 0);
+        assert_se(copy_bytes_sparse(in_fd, out_fd, (off_t) -1) == 0);
+
+        assert_se(fstat(out_fd, &st) >= 0);
+        assert_se(st.st_size == (off_t) sz);
+
+        assert_se(lseek(out_fd, 0, SEEK_SET) == 0);
+        assert_se(loop_read(out_fd, buf2, sz, false) == (ssize_t) sz);
+        assert_se(memcmp(buf, buf2, sz) == 0);
+
+        unlink(in_fn);
+        unlink(out_fn);
+}
+
 static void test_copy_tree(void) {
         char original_dir[] = "/tmp/test-copy_tree/";
         char copy_dir[] = "/tmp/test-copy_tree-copy/";
@@ -135,6 +179,7 @@ static void test_copy_tree(void) {
 int main(int argc, char *argv[]) {
         test_copy_file();
         test_copy_file_fd();
+        test_copy_bytes_sparse();
         test_copy_tree();
 
         return 0;
@@ -0,0 +1,248 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+
+#include "util.h"
+#include "timer-wheel.h"
+
+#define N_NODES (1024*4)
+
+struct test {
+        uint64_t value;
+        TimerWheelNode node;
+};
+
+static int uint64_compare(const void *a, const void *b) {
+        const uint64_t *x = a, *y = b;
+
+        if (*x < *y)
+                return -1;
+
+        if (*x > *y)
+                return 1;
+
+        return 0;
+}
+
+static uint64_t random_key(void) {
+        uint64_t k;
+
+        /* Spread the keys over all levels of the wheel */
+        k = ((uint64_t) rand() << 32) | (uint64_t) rand();
+        return k >> (rand() % 64);
+}
+
+static void test_order(void) {
+        struct test t[N_NODES];
+        uint64_t buffer[N_NODES];
+        TimerWheelNode *n;
+        TimerWheel *w;
+        unsigned i;
+
+        srand(0);
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        for (i = 0; i < ELEMENTSOF(t); i++) {
+                timer_wheel_node_init(&t[i].node);
+                t[i].value = buffer[i] = random_key();
+                timer_wheel_put(w, &t[i].node, t[i].value);
+                assert_se(timer_wheel_node_linked(&t[i].node));
+        }
+
+        qsort(buffer, ELEMENTSOF(buffer), sizeof(buffer[0]), uint64_compare);
+
+        for (i = 0; i < ELEMENTSOF(buffer); i++) {
+                assert_se(timer_wheel_size(w) == ELEMENTSOF(buffer) - i);
+
+                n = timer_wheel_peek(w);
+                assert_se(n);
+                assert_se(n->key == buffer[i]);
+
+                /* Nothing is due before the smallest key */
+                if (buffer[i] > 0)
+                        assert_se(!timer_wheel_pop(w, buffer[i] - 1));
+
+                n = timer_wheel_pop(w, buffer[i]);
+                assert_se(n);
+                assert_se(n->key == buffer[i]);
+                assert_se(container_of(n, struct test, node)->value == buffer[i]);
+                assert_se(!timer_wheel_node_linked(n));
+        }
+
+        assert_se(timer_wheel_isempty(w));
+        assert_se(!timer_wheel_peek(w));
+        assert_se(!timer_wheel_pop(w, (uint64_t) -1));
+
+        timer_wheel_free(w);
+}
+
+static void test_update(void) {
+        struct test t[N_NODES];
+        TimerWheelNode *n;
+        TimerWheel *w;
+        uint64_t last = 0, now = 0;
+        unsigned i, count = 0;
+
+        srand(0);
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        for (i = 0; i < ELEMENTSOF(t); i++) {
+                timer_wheel_node_init(&t[i].node);
+                t[i].value = rand() % (USEC_PER_SEC * 60);
+                timer_wheel_put(w, &t[i].node, t[i].value);
+        }
+
+        /* Move the wheel forward while changing keys, like timeouts
+         * that get pushed out on activity */
+        while (!timer_wheel_isempty(w)) {
+                now += rand() % (USEC_PER_MSEC * 100);
+
+                for (i = 0; i < 16; i++) {
+                        struct test *x = t + rand() % ELEMENTSOF(t);
+
+                        if (!timer_wheel_node_linked(&x->node))
+                                continue;
+
+                        if (rand() % 4 == 0) {
+                                timer_wheel_remove(w, &x->node);
+                                count++;
+                                continue;
+                        }
+
+                        x->value = now + rand() % (USEC_PER_SEC * 10);
+                        timer_wheel_put(w, &x->node, x->value);
+                }
+
+                n = timer_wheel_peek(w);
+                assert_se(n);
+                for (i = 0; i < ELEMENTSOF(t); i++)
+                        if (timer_wheel_node_linked(&t[i].node))
+                                assert_se(t[i].value >= n->key);
+
+                while ((n = timer_wheel_pop(w, now))) {
+                        struct test *x = container_of(n, struct test, node);
+
+                        assert_se(x->value <= now);
+                        assert_se(x->value >= last);
+                        last = x->value;
+                        count++;
+                }
+
+                for (i = 0; i < ELEMENTSOF(t); i++)
+                        if (timer_wheel_node_linked(&t[i].node))
+                                assert_se(t[i].value > now);
+        }
+
+        assert_se(count == ELEMENTSOF(t));
+        timer_wheel_free(w);
+}
+
+static void test_remove_smallest(void) {
+        struct test t[N_NODES];
+        uint64_t buffer[N_NODES];
+        TimerWheelNode *n;
+        TimerWheel *w;
+        unsigned i;
+
+        srand(0);
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        /* All in the same coarse slot, like timeouts far out that
+         * keep getting cancelled in order */
+        for (i = 0; i < ELEMENTSOF(t); i++) {
+                timer_wheel_node_init(&t[i].node);
+                t[i].value = buffer[i] = USEC_PER_SEC * 3600 + rand() % USEC_PER_SEC;
+                timer_wheel_put(w, &t[i].node, t[i].value);
+        }
+
+        qsort(buffer, ELEMENTSOF(buffer), sizeof(buffer[0]), uint64_compare);
+
+        for (i = 0; i < ELEMENTSOF(buffer); i++) {
+                n = timer_wheel_peek(w);
+                assert_se(n);
+                assert_se(n->key == buffer[i]);
+
+                timer_wheel_remove(w, n);
+                assert_se(!timer_wheel_node_linked(n));
+        }
+
+        assert_se(timer_wheel_isempty(w));
+        assert_se(!timer_wheel_peek(w));
+
+        timer_wheel_free(w);
+}
+
+static void test_rewind(void) {
+        TimerWheelNode a, b, c;
+        TimerWheel *w;
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        timer_wheel_node_init(&a);
+        timer_wheel_node_init(&b);
+        timer_wheel_node_init(&c);
+
+        timer_wheel_advance(w, 100000);
+
+        /* Keys already passed are due right-away */
+        timer_wheel_put(w, &a, 10);
+        timer_wheel_put(w, &b, 200000);
+        assert_se(timer_wheel_peek(w) == &a);
+        assert_se(timer_wheel_pop(w, 100000) == &a);
+        assert_se(!timer_wheel_pop(w, 100000));
+
+        /* The clock jumps backwards */
+        timer_wheel_put(w, &c, 50);
+        assert_se(!timer_wheel_pop(w, 20));
+        assert_se(timer_wheel_peek(w) == &c);
+        assert_se(timer_wheel_pop(w, 60) == &c);
+        assert_se(!timer_wheel_pop(w, 199999));
+        assert_se(timer_wheel_pop(w, 200000) == &b);
+        assert_se(timer_wheel_isempty(w));
+
+        /* Removing the smallest key and then everything else */
+        timer_wheel_put(w, &a, 300000);
+        timer_wheel_put(w, &b, 400000);
+        timer_wheel_remove(w, &a);
+        timer_wheel_remove(w, &b);
+        assert_se(!timer_wheel_peek(w));
+        timer_wheel_put(w, &c, 500000);
+        assert_se(timer_wheel_peek(w) == &c);
+        timer_wheel_remove(w, &c);
+
+        timer_wheel_free(w);
+}
+
+int main(int argc, char* argv[]) {
+
+        test_order();
+        test_update();
+        test_remove_smallest();
+        test_rewind();
+
+        return 0;
+}